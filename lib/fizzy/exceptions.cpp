@@ -0,0 +1,249 @@
+#include "exceptions.hpp"
+
+namespace fizzy
+{
+std::string error_message(const Error& error)
+{
+    const auto value = std::to_string(error.value);
+    const auto value2 = std::to_string(error.value2);
+
+    switch (error.code)
+    {
+    case ErrorCode::none:
+        return "no error";
+
+    case ErrorCode::unexpected_eof:
+        return "Unexpected EOF";
+    case ErrorCode::invalid_leb128:
+        return "Invalid LEB128 encoding: too many bytes.";
+    case ErrorCode::invalid_prefix:
+        return "invalid wasm module prefix";
+    case ErrorCode::unknown_section:
+        return "unknown section encountered " + value;
+    case ErrorCode::invalid_section_size:
+        return "incorrect section " + value + " size, difference: " + value2;
+    case ErrorCode::floating_point_valtype:
+        return "unsupported valtype (floating point)";
+    case ErrorCode::invalid_valtype:
+        return "invalid valtype " + value;
+    case ErrorCode::invalid_limits:
+        return "invalid limits " + value;
+    case ErrorCode::malformed_limits:
+        return "malformed limits (minimum is larger than maximum)";
+    case ErrorCode::invalid_functype_form:
+        return "unexpected byte value " + value + ", expected 0x60 for functype";
+    case ErrorCode::invalid_global_mutability:
+        return "unexpected byte value " + value + ", expected 0x00 or 0x01 for global mutability";
+    case ErrorCode::invalid_table_elemtype:
+        return "unexpected table elemtype: " + value;
+    case ErrorCode::invalid_import_kind:
+        return "unexpected import kind value " + value;
+    case ErrorCode::invalid_export_kind:
+        return "unexpected export kind value " + value;
+    case ErrorCode::invalid_table_index:
+        return "unexpected tableidx value " + value;
+    case ErrorCode::invalid_memory_index:
+        return "unexpected memidx value " + value;
+    case ErrorCode::too_many_locals:
+        return "too many local variables";
+    case ErrorCode::malformed_function_size:
+        return "malformed size field for function";
+    case ErrorCode::invalid_instruction:
+        return "invalid instruction " + value;
+    case ErrorCode::floating_point_instruction:
+        return "unsupported floating point instruction " + value;
+    case ErrorCode::invalid_constant_instruction:
+        return "unexpected instruction in the global initializer expression: " + value;
+
+    case ErrorCode::too_many_tables:
+        return "too many table sections (at most one is allowed)";
+    case ErrorCode::too_many_memories:
+        return "too many memory sections (at most one is allowed)";
+    case ErrorCode::too_many_imported_tables:
+        return "too many imported tables (at most one is allowed)";
+    case ErrorCode::too_many_imported_memories:
+        return "too many imported memories (at most one is allowed)";
+    case ErrorCode::imported_and_defined_table:
+        return "both module table and imported table are defined (at most one of them is allowed)";
+    case ErrorCode::imported_and_defined_memory:
+        return "both module memory and imported memory are defined (at most one of them is "
+               "allowed)";
+    case ErrorCode::element_section_without_table:
+        return "element section encountered without a table section";
+    case ErrorCode::data_section_without_memory:
+        return "data section encountered without a memory section";
+    case ErrorCode::function_type_with_many_results:
+        return "function type has more than one result";
+    case ErrorCode::invalid_function_type_index:
+        return "invalid function type index " + value;
+    case ErrorCode::code_count_mismatch:
+        return "malformed code section: the number of bodies differs from functions";
+    case ErrorCode::empty_constant_expression:
+        return "constant expression is empty";
+    case ErrorCode::constant_expression_type_mismatch:
+        return "constant expression type mismatch";
+    case ErrorCode::constant_expression_too_long:
+        return "constant expression has more than one instruction";
+    case ErrorCode::invalid_constant_global_index:
+        return "invalid global index in constant expression";
+    case ErrorCode::mutable_constant_global:
+        return "constant expression can use global.get only for const globals";
+    case ErrorCode::invalid_element_function_index:
+        return "invalid function index in element section";
+    case ErrorCode::invalid_export_index:
+        return "invalid index of export " + std::string{error.name};
+    case ErrorCode::duplicate_export_name:
+        return "duplicate export name";
+    case ErrorCode::invalid_start_function_index:
+        return "invalid start function index";
+    case ErrorCode::invalid_start_function_type:
+        return "invalid start function type";
+
+    case ErrorCode::stack_underflow:
+        return "stack underflow";
+    case ErrorCode::type_mismatch:
+        return "type mismatch";
+    case ErrorCode::too_many_results:
+        return "too many results";
+    case ErrorCode::function_with_many_results:
+        return "function has more than one result";
+    case ErrorCode::missing_if_result:
+        return "missing result in if without else";
+    case ErrorCode::unexpected_else:
+        return "unexpected else instruction";
+    case ErrorCode::unexpected_else_without_if:
+        return "unexpected else instruction (if instruction missing)";
+    case ErrorCode::invalid_label_index:
+        return "invalid label index " + value;
+    case ErrorCode::inconsistent_br_table:
+        return "br_table labels have inconsistent types";
+    case ErrorCode::invalid_function_index:
+        return "invalid function index " + value;
+    case ErrorCode::invalid_global_index:
+        return "invalid global index " + value;
+    case ErrorCode::immutable_global_set:
+        return "trying to mutate immutable global " + value;
+    case ErrorCode::invalid_local_index:
+        return "invalid local index " + value;
+    case ErrorCode::invalid_call_indirect_table:
+        return "invalid tableidx encountered with call_indirect";
+    case ErrorCode::invalid_call_indirect_type:
+        return "invalid typeidx encountered with call_indirect";
+    case ErrorCode::call_indirect_without_table:
+        return "call_indirect instruction without defined table";
+    case ErrorCode::invalid_alignment:
+        return "alignment cannot exceed operand size";
+    case ErrorCode::invalid_memory_instruction_index:
+        return "invalid memory index encountered";
+    case ErrorCode::missing_memory:
+        return "memory instructions require imported or defined memory";
+
+    case ErrorCode::invalid_serialized_prefix:
+        return "invalid serialized module prefix";
+    case ErrorCode::unsupported_serialized_version:
+        return "unsupported serialized module version";
+    case ErrorCode::serialized_module_eof:
+        return "unexpected end of the serialized module";
+    case ErrorCode::invalid_serialized_import_kind:
+        return "invalid serialized import kind";
+    case ErrorCode::invalid_serialized_value:
+        return "invalid serialized value " + value;
+    case ErrorCode::invalid_serialized_instruction:
+        return "invalid serialized instruction " + value;
+    case ErrorCode::serialized_module_trailing_data:
+        return "unexpected data after the serialized module";
+
+    case ErrorCode::imported_function_count_mismatch:
+        return "Module requires " + value + " imported functions, " + value2 + " provided";
+    case ErrorCode::imported_function_type_mismatch:
+        return "Function " + value + " type doesn't match module's imported function type";
+    case ErrorCode::imported_limits_min_below:
+        return "Provided import's min is below import's min defined in module.";
+    case ErrorCode::imported_limits_max_above:
+        return "Provided import's max is above import's max defined in module.";
+    case ErrorCode::too_many_provided_tables:
+        return "Only 1 imported table is allowed.";
+    case ErrorCode::unexpected_imported_table:
+        return "Trying to provide imported table to a module that doesn't define one.";
+    case ErrorCode::missing_imported_table:
+        return "Module defines an imported table but none was provided.";
+    case ErrorCode::null_imported_table:
+        return "Provided imported table has a null pointer to data.";
+    case ErrorCode::imported_table_size_mismatch:
+        return "Provided imported table doesn't fit provided limits";
+    case ErrorCode::too_many_provided_memories:
+        return "Only 1 imported memory is allowed.";
+    case ErrorCode::unexpected_imported_memory:
+        return "Trying to provide imported memory to a module that doesn't define one.";
+    case ErrorCode::missing_imported_memory:
+        return "Module defines an imported memory but none was provided.";
+    case ErrorCode::null_imported_memory:
+        return "Provided imported memory has a null pointer to data.";
+    case ErrorCode::imported_memory_size_mismatch:
+        return "Provided imported memory doesn't fit provided limits";
+    case ErrorCode::imported_global_count_mismatch:
+        return "Module requires " + value + " imported globals, " + value2 + " provided";
+    case ErrorCode::imported_global_mutability_mismatch:
+        return "Global " + value + " mutability doesn't match module's global mutability";
+    case ErrorCode::null_imported_global:
+        return "Global " + value + " has a null pointer to value";
+    case ErrorCode::unsupported_table_count:
+        return "Cannot support more than 1 table section.";
+    case ErrorCode::unsupported_memory_count:
+        return "Cannot support more than 1 memory section.";
+    case ErrorCode::memory_limit_exceeded:
+        return "Cannot exceed hard memory limit of " + value + " bytes.";
+    case ErrorCode::imported_memory_limit_exceeded:
+        return "Imported memory limits cannot exceed hard memory limit of " + value + " bytes.";
+    case ErrorCode::mutable_global_initializer:
+        return "Constant expression can use global_get only for const globals.";
+    case ErrorCode::non_imported_global_initializer:
+        return "Global can be initialized by another const global only if it's imported.";
+    case ErrorCode::element_out_of_bounds:
+        return "Element segment is out of table bounds";
+    case ErrorCode::data_out_of_bounds:
+        return "Data segment is out of memory bounds";
+    case ErrorCode::start_function_trapped:
+        return "Start function failed to execute";
+
+    case ErrorCode::out_of_memory:
+        return "out of memory";
+    case ErrorCode::unexpected_exception:
+        return "unexpected exception";
+    }
+    return "unknown error";
+}
+
+error_base::error_base(const Error& error) : runtime_error{""}, m_error{error}
+{
+    if (!m_error.name.empty())
+    {
+        message();
+        m_error.name = {};
+    }
+}
+
+error_base::error_base(const error_base& other)
+  : runtime_error{other}, m_error{other.m_error}, m_message{other.message()}
+{
+    std::call_once(m_message_built, [] {});
+}
+
+const std::string& error_base::message() const
+{
+    std::call_once(m_message_built, [this] { m_message = error_message(m_error); });
+    return m_message;
+}
+
+const char* error_base::what() const noexcept
+{
+    try
+    {
+        return message().c_str();
+    }
+    catch (...)
+    {
+        return "fizzy error (the message cannot be allocated)";
+    }
+}
+}  // namespace fizzy
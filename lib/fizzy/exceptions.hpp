@@ -1,17 +1,213 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 
 namespace fizzy
 {
-struct parser_error : public std::runtime_error
+/// The reason of the failure to parse or to instantiate the module.
+enum class ErrorCode : uint8_t
 {
-    using runtime_error::runtime_error;
+    none,
+
+    // The errors of the binary format.
+    unexpected_eof,
+    invalid_leb128,
+    invalid_prefix,
+    unknown_section,
+    invalid_section_size,
+    floating_point_valtype,
+    invalid_valtype,
+    invalid_limits,
+    malformed_limits,
+    invalid_functype_form,
+    invalid_global_mutability,
+    invalid_table_elemtype,
+    invalid_import_kind,
+    invalid_export_kind,
+    invalid_table_index,
+    invalid_memory_index,
+    too_many_locals,
+    malformed_function_size,
+    invalid_instruction,
+    floating_point_instruction,
+    invalid_constant_instruction,
+
+    // The errors of the module validation.
+    too_many_tables,
+    too_many_memories,
+    too_many_imported_tables,
+    too_many_imported_memories,
+    imported_and_defined_table,
+    imported_and_defined_memory,
+    element_section_without_table,
+    data_section_without_memory,
+    function_type_with_many_results,
+    invalid_function_type_index,
+    code_count_mismatch,
+    empty_constant_expression,
+    constant_expression_type_mismatch,
+    constant_expression_too_long,
+    invalid_constant_global_index,
+    mutable_constant_global,
+    invalid_element_function_index,
+    invalid_export_index,
+    duplicate_export_name,
+    invalid_start_function_index,
+    invalid_start_function_type,
+
+    // The errors of the function body validation.
+    stack_underflow,
+    type_mismatch,
+    too_many_results,
+    function_with_many_results,
+    missing_if_result,
+    unexpected_else,
+    unexpected_else_without_if,
+    invalid_label_index,
+    inconsistent_br_table,
+    invalid_function_index,
+    invalid_global_index,
+    immutable_global_set,
+    invalid_local_index,
+    invalid_call_indirect_table,
+    invalid_call_indirect_type,
+    call_indirect_without_table,
+    invalid_alignment,
+    invalid_memory_instruction_index,
+    missing_memory,
+
+    // The errors of loading the serialized module.
+    invalid_serialized_prefix,
+    unsupported_serialized_version,
+    serialized_module_eof,
+    invalid_serialized_import_kind,
+    invalid_serialized_value,
+    invalid_serialized_instruction,
+    serialized_module_trailing_data,
+
+    // The errors of the instantiation.
+    imported_function_count_mismatch,
+    imported_function_type_mismatch,
+    imported_limits_min_below,
+    imported_limits_max_above,
+    too_many_provided_tables,
+    unexpected_imported_table,
+    missing_imported_table,
+    null_imported_table,
+    imported_table_size_mismatch,
+    too_many_provided_memories,
+    unexpected_imported_memory,
+    missing_imported_memory,
+    null_imported_memory,
+    imported_memory_size_mismatch,
+    imported_global_count_mismatch,
+    imported_global_mutability_mismatch,
+    null_imported_global,
+    unsupported_table_count,
+    unsupported_memory_count,
+    memory_limit_exceeded,
+    imported_memory_limit_exceeded,
+    mutable_global_initializer,
+    non_imported_global_initializer,
+    element_out_of_bounds,
+    data_out_of_bounds,
+    start_function_trapped,
+
+    // The errors reported only by the non-throwing API.
+    out_of_memory,
+    unexpected_exception,
+};
+
+/// The failure to parse or to instantiate the module.
+///
+/// It owns no strings, the message is built by error_message() only when it is needed.
+struct Error
+{
+    ErrorCode code = ErrorCode::none;
+
+    /// The offset of the input byte the parser error was found at: the invalid byte or the start
+    /// of the invalid item (e.g. the instruction). The size of the input for the errors found
+    /// by the validation of the whole module. Always 0 for the instantiation errors.
+    size_t offset = 0;
+
+    /// The values the message is built from, depending on the code: e.g. the invalid byte,
+    /// the invalid index, the numbers of the required and the provided imports.
+    int64_t value = 0;
+    int64_t value2 = 0;
+
+    /// The name the message refers to (the export name). It points into the parsed input.
+    std::string_view name;
+
+    Error() noexcept = default;
+
+    Error(ErrorCode error_code, int64_t error_value = 0, int64_t error_value2 = 0) noexcept
+      : code{error_code}, value{error_value}, value2{error_value2}
+    {}
+
+    explicit operator bool() const noexcept { return code != ErrorCode::none; }
+};
+
+/// Builds the message describing the error. The offset is not included.
+std::string error_message(const Error& error);
+
+/// The base of the exceptions reporting the Error.
+///
+/// The exception is thrown without allocating the message, the message is built by the first
+/// call of what(), once even if what() is called by many threads (e.g. of the exception_ptr
+/// shared by them). Only the message including the name is built at construction, because
+/// the name is not owned by the error.
+class error_base : public std::runtime_error
+{
+    Error m_error;
+    mutable std::string m_message;
+    mutable std::once_flag m_message_built;
+
+    /// Returns the message, built by the first call.
+    const std::string& message() const;
+
+public:
+    explicit error_base(const Error& error);
+
+    explicit error_base(ErrorCode code, int64_t value = 0, int64_t value2 = 0)
+      : error_base{Error{code, value, value2}}
+    {}
+
+    /// Copies the error with its message, the message is built if it is not yet.
+    error_base(const error_base& other);
+
+    error_base& operator=(const error_base&) = delete;
+
+    const Error& error() const noexcept { return m_error; }
+
+    const char* what() const noexcept override;
+};
+
+struct parser_error : public error_base
+{
+    using error_base::error_base;
+
+    /// The error found at the given position of the input.
+    parser_error(const uint8_t* position, ErrorCode code, int64_t value = 0, int64_t value2 = 0)
+      : error_base{code, value, value2}, m_position{position}
+    {}
+
+    /// The position of the input the error was found at, null if not known.
+    const uint8_t* position() const noexcept { return m_position; }
+
+    void set_position(const uint8_t* position) noexcept { m_position = position; }
+
+private:
+    const uint8_t* m_position = nullptr;
 };
 
-struct instantiate_error : public std::runtime_error
+struct instantiate_error : public error_base
 {
-    using runtime_error::runtime_error;
+    using error_base::error_base;
 };
 
 }  // namespace fizzy
@@ -1,146 +1,157 @@
 #include "execute.hpp"
 #include "limits.hpp"
+#include "parser.hpp"
 #include "stack.hpp"
 #include "types.hpp"
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <exception>
+#include <limits>
+#include <map>
+#include <new>
+#include <tuple>
+#include <utility>
 
 namespace fizzy
 {
 namespace
 {
-struct LabelContext
-{
-    const Instr* pc = nullptr;           ///< The jump target instruction.
-    const uint8_t* immediate = nullptr;  ///< The jump target immediate pointer.
-    size_t arity = 0;                    ///< The type arity of the label instruction.
-    size_t stack_height = 0;             ///< The stack height at the label instruction.
-};
-
-void match_imported_functions(const std::vector<TypeIdx>& module_imported_types,
+Error match_imported_functions(const std::vector<FuncType>& module_types,
+    const std::vector<TypeIdx>& module_imported_types,
     const std::vector<ExternalFunction>& imported_functions)
 {
     if (module_imported_types.size() != imported_functions.size())
     {
-        throw instantiate_error("Module requires " + std::to_string(module_imported_types.size()) +
-                                " imported functions, " +
-                                std::to_string(imported_functions.size()) + " provided");
+        return {ErrorCode::imported_function_count_mismatch,
+            static_cast<int64_t>(module_imported_types.size()),
+            static_cast<int64_t>(imported_functions.size())};
+    }
+
+    for (size_t i = 0; i < imported_functions.size(); ++i)
+    {
+        // Only the types of the HostFunctions are known.
+        const auto* host_type = imported_functions[i].host_function.type;
+        if (host_type == nullptr)
+            continue;
+
+        const auto type_idx = module_imported_types[i];
+        if (type_idx >= module_types.size() || host_type->inputs != module_types[type_idx].inputs ||
+            host_type->outputs != module_types[type_idx].outputs)
+            return {ErrorCode::imported_function_type_mismatch, static_cast<int64_t>(i)};
     }
+    return {};
 }
 
-void match_limits(const Limits& external_limits, const Limits& module_limits)
+Error match_limits(const Limits& external_limits, const Limits& module_limits)
 {
     if (external_limits.min < module_limits.min)
-        throw instantiate_error("Provided import's min is below import's min defined in module.");
+        return {ErrorCode::imported_limits_min_below};
 
     if (!module_limits.max.has_value())
-        return;
+        return {};
 
     if (external_limits.max.has_value() && *external_limits.max <= *module_limits.max)
-        return;
+        return {};
 
-    throw instantiate_error("Provided import's max is above import's max defined in module.");
+    return {ErrorCode::imported_limits_max_above};
 }
 
-void match_imported_tables(const std::vector<Table>& module_imported_tables,
+Error match_imported_tables(const std::vector<Table>& module_imported_tables,
     const std::vector<ExternalTable>& imported_tables)
 {
     assert(module_imported_tables.size() <= 1);
 
     if (imported_tables.size() > 1)
-        throw instantiate_error("Only 1 imported table is allowed.");
+        return {ErrorCode::too_many_provided_tables};
 
     if (module_imported_tables.empty())
     {
         if (!imported_tables.empty())
-        {
-            throw instantiate_error(
-                "Trying to provide imported table to a module that doesn't define one.");
-        }
+            return {ErrorCode::unexpected_imported_table};
     }
     else
     {
         if (imported_tables.empty())
-            throw instantiate_error("Module defines an imported table but none was provided.");
+            return {ErrorCode::missing_imported_table};
 
-        match_limits(imported_tables[0].limits, module_imported_tables[0].limits);
+        if (auto error = match_limits(imported_tables[0].limits, module_imported_tables[0].limits))
+            return error;
 
         if (imported_tables[0].table == nullptr)
-            throw instantiate_error("Provided imported table has a null pointer to data.");
+            return {ErrorCode::null_imported_table};
 
         const auto size = imported_tables[0].table->size();
         const auto min = imported_tables[0].limits.min;
         const auto& max = imported_tables[0].limits.max;
         if (size < min || (max.has_value() && size > *max))
-            throw instantiate_error("Provided imported table doesn't fit provided limits");
+            return {ErrorCode::imported_table_size_mismatch};
     }
+    return {};
 }
 
-void match_imported_memories(const std::vector<Memory>& module_imported_memories,
+Error match_imported_memories(const std::vector<Memory>& module_imported_memories,
     const std::vector<ExternalMemory>& imported_memories)
 {
     assert(module_imported_memories.size() <= 1);
 
     if (imported_memories.size() > 1)
-        throw instantiate_error("Only 1 imported memory is allowed.");
+        return {ErrorCode::too_many_provided_memories};
 
     if (module_imported_memories.empty())
     {
         if (!imported_memories.empty())
-        {
-            throw instantiate_error(
-                "Trying to provide imported memory to a module that doesn't define one.");
-        }
+            return {ErrorCode::unexpected_imported_memory};
     }
     else
     {
         if (imported_memories.empty())
-            throw instantiate_error("Module defines an imported memory but none was provided.");
+            return {ErrorCode::missing_imported_memory};
 
-        match_limits(imported_memories[0].limits, module_imported_memories[0].limits);
+        if (auto error =
+                match_limits(imported_memories[0].limits, module_imported_memories[0].limits))
+            return error;
 
         if (imported_memories[0].data == nullptr)
-            throw instantiate_error("Provided imported memory has a null pointer to data.");
+            return {ErrorCode::null_imported_memory};
 
         const auto size = imported_memories[0].data->size();
         const auto min = imported_memories[0].limits.min;
         const auto& max = imported_memories[0].limits.max;
         if (size < min * PageSize || (max.has_value() && size > *max * PageSize))
-            throw instantiate_error("Provided imported memory doesn't fit provided limits");
+            return {ErrorCode::imported_memory_size_mismatch};
     }
+    return {};
 }
 
-void match_imported_globals(const std::vector<bool>& module_imports_mutability,
+Error match_imported_globals(const std::vector<bool>& module_imports_mutability,
     const std::vector<ExternalGlobal>& imported_globals)
 {
     if (module_imports_mutability.size() != imported_globals.size())
     {
-        throw instantiate_error(
-            "Module requires " + std::to_string(module_imports_mutability.size()) +
-            " imported globals, " + std::to_string(imported_globals.size()) + " provided");
+        return {ErrorCode::imported_global_count_mismatch,
+            static_cast<int64_t>(module_imports_mutability.size()),
+            static_cast<int64_t>(imported_globals.size())};
     }
 
     for (size_t i = 0; i < imported_globals.size(); ++i)
     {
         if (imported_globals[i].is_mutable != module_imports_mutability[i])
-        {
-            throw instantiate_error("Global " + std::to_string(i) +
-                                    " mutability doesn't match module's global mutability");
-        }
+            return {ErrorCode::imported_global_mutability_mismatch, static_cast<int64_t>(i)};
         if (imported_globals[i].value == nullptr)
-        {
-            throw instantiate_error("Global " + std::to_string(i) + " has a null pointer to value");
-        }
+            return {ErrorCode::null_imported_global, static_cast<int64_t>(i)};
     }
+    return {};
 }
 
-std::vector<TypeIdx> match_imports(const Module& module,
-    const std::vector<ExternalFunction>& imported_functions,
+/// Matches the provided imports to the module's imports and collects the types of the imported
+/// functions into @a imported_function_types.
+Error match_imports(const Module& module, const std::vector<ExternalFunction>& imported_functions,
     const std::vector<ExternalTable>& imported_tables,
     const std::vector<ExternalMemory>& imported_memories,
-    const std::vector<ExternalGlobal>& imported_globals)
+    const std::vector<ExternalGlobal>& imported_globals,
+    std::vector<TypeIdx>& imported_function_types)
 {
-    std::vector<TypeIdx> imported_function_types;
     std::vector<Table> imported_table_types;
     std::vector<Memory> imported_memory_types;
     std::vector<bool> imported_globals_mutability;
@@ -158,34 +169,155 @@ std::vector<TypeIdx> match_imports(const Module& module,
             imported_memory_types.emplace_back(import.desc.memory);
             break;
         case ExternalKind::Global:
-            imported_globals_mutability.emplace_back(import.desc.global_mutable);
+            imported_globals_mutability.emplace_back(import.desc.global.is_mutable);
             break;
         default:
             assert(false);
         }
     }
 
-    match_imported_functions(imported_function_types, imported_functions);
-    match_imported_tables(imported_table_types, imported_tables);
-    match_imported_memories(imported_memory_types, imported_memories);
-    match_imported_globals(imported_globals_mutability, imported_globals);
+    if (auto error =
+            match_imported_functions(module.typesec, imported_function_types, imported_functions))
+        return error;
+    if (auto error = match_imported_tables(imported_table_types, imported_tables))
+        return error;
+    if (auto error = match_imported_memories(imported_memory_types, imported_memories))
+        return error;
+    return match_imported_globals(imported_globals_mutability, imported_globals);
+}
+
+/// Returns the canonical IDs of the types: the index of the first type equal to each type.
+std::vector<uint32_t> get_type_ids(const std::vector<FuncType>& types)
+{
+    const auto type_less = [](const FuncType* a, const FuncType* b) {
+        return std::tie(a->inputs, a->outputs) < std::tie(b->inputs, b->outputs);
+    };
+    std::map<const FuncType*, uint32_t, decltype(type_less)> first_equal_types{type_less};
+
+    std::vector<uint32_t> type_ids;
+    type_ids.reserve(types.size());
+    for (const auto& type : types)
+    {
+        const auto next_id = static_cast<uint32_t>(type_ids.size());
+        type_ids.push_back(first_equal_types.try_emplace(&type, next_id).first->second);
+    }
+    return type_ids;
+}
+
+/// Calls the imported std::function as the HostFunction, the context is the function's descriptor.
+ExecutionStatus call_external_function(
+    void* context, Instance& instance, const uint64_t* args, uint64_t* result)
+{
+    const auto& func = *static_cast<const FunctionDescriptor*>(context);
+
+    const auto ret =
+        (*func.external_function)(instance, std::vector<uint64_t>(args, args + func.num_inputs));
+    // Bubble up traps
+    if (ret.trapped)
+        return ExecutionStatus::trapped;
+
+    // NOTE: we can assume these two from validation
+    assert(ret.stack.size() == func.num_outputs);
+    assert(func.num_outputs <= 1);
+    if (func.num_outputs != 0)
+        *result = ret.stack[0];
+
+    return ExecutionStatus::success;
+}
+
+/// Builds the descriptors of all the functions of the instance, the imported ones first.
+std::vector<FunctionDescriptor> resolve_functions(const Instance& instance)
+{
+    const auto& module = *instance.module;
+    const auto num_imported_functions = instance.imported_function_types.size();
+
+    // The module not validated may have the function bodies without the function types.
+    std::vector<FunctionDescriptor> functions(
+        num_imported_functions + std::max(module.funcsec.size(), get_code_count(module)));
+    for (size_t func_idx = 0; func_idx < functions.size(); ++func_idx)
+    {
+        auto& func = functions[func_idx];
+        if (func_idx < num_imported_functions)
+        {
+            func.type_idx = instance.imported_function_types[func_idx];
+            const auto& imported_function = instance.imported_functions[func_idx];
+            if (imported_function.host_function.function != nullptr)
+            {
+                func.host_function = imported_function.host_function.function;
+                func.host_context = imported_function.host_function.context;
+            }
+            else
+            {
+                func.host_function = call_external_function;
+                func.host_context = &func;
+                func.external_function = &imported_function;
+            }
+        }
+        else
+        {
+            func.code_idx = static_cast<uint32_t>(func_idx - num_imported_functions);
+            func.type_idx = func.code_idx < module.funcsec.size() ?
+                                module.funcsec[func.code_idx] :
+                                std::numeric_limits<TypeIdx>::max();
+        }
+
+        // The module not validated may have invalid type indexes, the ID of such a function
+        // type matches no type, so the function traps if called indirectly.
+        if (func.type_idx >= module.typesec.size())
+        {
+            func.type_id = std::numeric_limits<uint32_t>::max();
+            continue;
+        }
+        const auto& type = module.typesec[func.type_idx];
+        func.type_id = instance.type_ids[func.type_idx];
+        func.num_inputs = static_cast<uint32_t>(type.inputs.size());
+        func.num_outputs = static_cast<uint32_t>(type.outputs.size());
+    }
+    return functions;
+}
+
+/// Returns the descriptor of the function defined in the module of the given code index.
+inline const FunctionDescriptor& get_code_function(const Instance& instance, size_t code_idx)
+{
+    assert(instance.imported_function_types.size() + code_idx < instance.functions.size());
+    return instance.functions[instance.imported_function_types.size() + code_idx];
+}
+
+/// Checks the table and the memory of the module can be allocated.
+Error check_table_and_memory(const Module& module,
+    const std::vector<ExternalTable>& imported_tables,
+    const std::vector<ExternalMemory>& imported_memories) noexcept
+{
+    // FIXME: turn these into asserts if instantiate is not exposed externally and it only
+    // takes validated modules
+    if (module.tablesec.size() + imported_tables.size() > 1)
+        return {ErrorCode::unsupported_table_count};
+    if (module.memorysec.size() + imported_memories.size() > 1)
+        return {ErrorCode::unsupported_memory_count};
+
+    // FIXME: better error handling
+    const auto exceeds_pages_limit = [](const Limits& limits) noexcept {
+        return limits.min > MemoryPagesLimit ||
+               (limits.max.has_value() && *limits.max > MemoryPagesLimit);
+    };
+    if (module.memorysec.size() == 1 && exceeds_pages_limit(module.memorysec[0].limits))
+        return {ErrorCode::memory_limit_exceeded, MemoryPagesLimit * PageSize};
+    if (imported_memories.size() == 1 && exceeds_pages_limit(imported_memories[0].limits))
+        return {ErrorCode::imported_memory_limit_exceeded, MemoryPagesLimit * PageSize};
 
-    return imported_function_types;
+    return {};
 }
 
+/// Allocates the table, checked by check_table_and_memory().
 table_ptr allocate_table(
     const std::vector<Table>& module_tables, const std::vector<ExternalTable>& imported_tables)
 {
     static const auto table_delete = [](std::vector<FuncIdx>* t) noexcept { delete t; };
     static const auto null_delete = [](std::vector<FuncIdx>*) noexcept {};
 
-    if (module_tables.size() + imported_tables.size() > 1)
-    {
-        // FIXME: turn this into an assert if instantiate is not exposed externally and it only
-        // takes validated modules
-        throw instantiate_error("Cannot support more than 1 table section.");
-    }
-    else if (module_tables.size() == 1)
+    assert(module_tables.size() + imported_tables.size() <= 1);
+
+    if (module_tables.size() == 1)
         return {new std::vector<FuncIdx>(module_tables[0].limits.min), table_delete};
     else if (imported_tables.size() == 1)
         return {imported_tables[0].table, null_delete};
@@ -193,62 +325,172 @@ table_ptr allocate_table(
         return {nullptr, null_delete};
 }
 
-std::tuple<bytes_ptr, size_t> allocate_memory(const std::vector<Memory>& module_memories,
+/// Allocates the memory, checked by check_table_and_memory().
+std::tuple<memory_ptr, size_t> allocate_memory(const std::vector<Memory>& module_memories,
     const std::vector<ExternalMemory>& imported_memories)
 {
-    static const auto bytes_delete = [](bytes* b) noexcept { delete b; };
-    static const auto null_delete = [](bytes*) noexcept {};
+    static const auto memory_delete = [](LinearMemory* m) noexcept { delete m; };
+    static const auto null_delete = [](LinearMemory*) noexcept {};
 
-    if (module_memories.size() + imported_memories.size() > 1)
-    {
-        // FIXME: turn this into an assert if instantiate is not exposed externally and it only
-        // takes validated modules
-        throw instantiate_error("Cannot support more than 1 memory section.");
-    }
-    else if (module_memories.size() == 1)
+    assert(module_memories.size() + imported_memories.size() <= 1);
+
+    if (module_memories.size() == 1)
     {
         const size_t memory_min = module_memories[0].limits.min;
         const size_t memory_max =
             (module_memories[0].limits.max.has_value() ? *module_memories[0].limits.max :
                                                          MemoryPagesLimit);
-        // FIXME: better error handling
-        if ((memory_min > MemoryPagesLimit) || (memory_max > MemoryPagesLimit))
-        {
-            throw instantiate_error("Cannot exceed hard memory limit of " +
-                                    std::to_string(MemoryPagesLimit * PageSize) + " bytes.");
-        }
-
-        // NOTE: fill it with zeroes
-        bytes_ptr memory{new bytes(memory_min * PageSize, 0), bytes_delete};
+        assert(memory_min <= MemoryPagesLimit && memory_max <= MemoryPagesLimit);
+
+        // The reserved memory grows in place and its pages are zero-filled lazily. The heap memory
+        // is the fallback where the address space cannot be reserved.
+        auto reserved = LinearMemory::create_reserved(memory_min * PageSize, memory_max * PageSize);
+        memory_ptr memory{reserved ? new LinearMemory(std::move(*reserved)) :
+                                     new LinearMemory(memory_min * PageSize),
+            memory_delete};
         return {std::move(memory), memory_max};
     }
     else if (imported_memories.size() == 1)
     {
-        const size_t memory_min = imported_memories[0].limits.min;
         const size_t memory_max =
             (imported_memories[0].limits.max.has_value() ? *imported_memories[0].limits.max :
                                                            MemoryPagesLimit);
+        assert(memory_max <= MemoryPagesLimit);
 
-        // FIXME: better error handling
-        if ((memory_min > MemoryPagesLimit) || (memory_max > MemoryPagesLimit))
-        {
-            throw instantiate_error("Imported memory limits cannot exceed hard memory limit of " +
-                                    std::to_string(MemoryPagesLimit * PageSize) + " bytes.");
-        }
-
-        bytes_ptr memory{imported_memories[0].data, null_delete};
+        memory_ptr memory{imported_memories[0].data, null_delete};
         return {std::move(memory), memory_max};
     }
     else
     {
-        bytes_ptr memory{nullptr, null_delete};
+        memory_ptr memory{nullptr, null_delete};
         return {std::move(memory), MemoryPagesLimit};
     }
 }
 
+/// Starts the frame of the top-level execution on top of the value stack and drops it at the exit
+/// of the scope, also when an exception (e.g. thrown by an imported function) leaves
+/// the execution with the frames of the unfinished calls on the stack.
+class ScopedFrame
+{
+    ValueStack& m_stack;
+    size_t m_base;
+
+public:
+    explicit ScopedFrame(ValueStack& stack) noexcept : m_stack{stack}, m_base{stack.size()}
+    {}
+    ~ScopedFrame() { m_stack.resize(m_base); }
+
+    ScopedFrame(const ScopedFrame&) = delete;
+    ScopedFrame& operator=(const ScopedFrame&) = delete;
+
+    size_t base() const noexcept { return m_base; }
+};
+
+/// The operand stack of the validated function, placed in the function's frame reserved
+/// up front in the value stack. The validation ensures the operand stack never exceeds
+/// Code::max_stack_height, so the items are pushed through the pointer to the top without
+/// the capacity checks of Stack::push().
+///
+/// The value stack covers the whole frame during the execution. It ends at the top
+/// of the operand stack only for the calls, see release() and reclaim().
+class FrameStack
+{
+    ValueStack& m_storage;
+    uint64_t* m_top;
+    size_t m_frame_end;
+
+public:
+    FrameStack(ValueStack& storage, size_t size, size_t frame_end) noexcept
+      : m_storage{storage}, m_top{storage.data() + size}, m_frame_end{frame_end}
+    {
+        assert(storage.size() == frame_end);
+    }
+
+    void push(uint64_t value) noexcept
+    {
+        assert(m_top < m_storage.data() + m_frame_end);
+        *m_top++ = value;
+    }
+
+    uint64_t pop() noexcept { return *--m_top; }
+
+    uint64_t peek(size_t depth = 0) const noexcept { return *(m_top - depth - 1); }
+
+    uint64_t& back() noexcept { return *(m_top - 1); }
+
+    /// Drops @a num_elements elements from the top of the stack.
+    void drop(size_t num_elements = 1) noexcept { m_top -= num_elements; }
+
+    /// Shrinks the stack to the given size, counted from the beginning of the value stack.
+    void resize(size_t new_size) noexcept
+    {
+        assert(new_size <= size());
+        m_top = m_storage.data() + new_size;
+    }
+
+    size_t size() const noexcept { return static_cast<size_t>(m_top - m_storage.data()); }
+
+    uint64_t* begin() noexcept { return m_storage.data(); }
+    uint64_t* end() noexcept { return m_top; }
+
+    uint64_t& operator[](size_t index) noexcept { return m_storage[index]; }
+
+    /// Ends the value stack at the top of the operand stack.
+    void release() noexcept { m_storage.resize(size()); }
+
+    /// Extends the value stack to the whole frame again after the call, which leaves its result
+    /// on top of the value stack and may reallocate it. The value stack does not initialize
+    /// the elements it grows by, so this costs no zeroing of the rest of the frame.
+    void reclaim() noexcept
+    {
+        const auto new_size = m_storage.size();
+        assert(new_size <= m_frame_end && m_frame_end <= m_storage.capacity());
+        m_storage.resize(m_frame_end);
+        m_top = m_storage.data() + new_size;
+    }
+};
+
+/// Checks the constant expressions of the module not validated by the parser: they can read
+/// only the immutable globals and the globals can be initialized only by the imported globals.
+Error check_constant_expressions(
+    const Module& module, const std::vector<ExternalGlobal>& imported_globals) noexcept
+{
+    const auto reads_mutable_global = [&](ConstantExpression expr) noexcept {
+        if (expr.kind != ConstantExpression::Kind::GlobalGet)
+            return false;
+        const auto global_idx = expr.value.global_index;
+        return global_idx < imported_globals.size() ?
+                   imported_globals[global_idx].is_mutable :
+                   module.globalsec[global_idx - imported_globals.size()].is_mutable;
+    };
+
+    for (const auto& global : module.globalsec)
+    {
+        // Wasm spec section 3.3.7 constrains initialization by another global to const imports
+        // only https://webassembly.github.io/spec/core/valid/instructions.html#expressions
+        if (global.expression.kind == ConstantExpression::Kind::GlobalGet &&
+            global.expression.value.global_index >= imported_globals.size())
+            return {ErrorCode::non_imported_global_initializer};
+
+        if (reads_mutable_global(global.expression))
+            return {ErrorCode::mutable_global_initializer};
+    }
+    for (const auto& element : module.elementsec)
+    {
+        if (reads_mutable_global(element.offset))
+            return {ErrorCode::mutable_global_initializer};
+    }
+    for (const auto& data : module.datasec)
+    {
+        if (reads_mutable_global(data.offset))
+            return {ErrorCode::mutable_global_initializer};
+    }
+    return {};
+}
+
+/// Evaluates the constant expression, checked by the parser or check_constant_expressions().
 uint64_t eval_constant_expression(ConstantExpression expr,
-    const std::vector<ExternalGlobal>& imported_globals, const std::vector<Global>& global_types,
-    const std::vector<uint64_t>& globals)
+    const std::vector<ExternalGlobal>& imported_globals, const std::vector<uint64_t>& globals)
 {
     if (expr.kind == ConstantExpression::Kind::Constant)
         return expr.value.constant;
@@ -256,79 +498,183 @@ uint64_t eval_constant_expression(ConstantExpression expr,
     assert(expr.kind == ConstantExpression::Kind::GlobalGet);
 
     const auto global_idx = expr.value.global_index;
-    const bool is_mutable = (global_idx < imported_globals.size() ?
-                                 imported_globals[global_idx].is_mutable :
-                                 global_types[global_idx - imported_globals.size()].is_mutable);
-    if (is_mutable)
-        throw instantiate_error("Constant expression can use global_get only for const globals.");
-
     if (global_idx < imported_globals.size())
         return *imported_globals[global_idx].value;
     else
         return globals[global_idx - imported_globals.size()];
 }
 
-void branch(uint32_t label_idx, Stack<LabelContext>& labels, Stack<uint64_t>& stack,
-    const Instr*& pc, const uint8_t*& immediates) noexcept
-{
-    assert(labels.size() > label_idx);
-    labels.drop(label_idx);  // Drop skipped labels (does nothing for labelidx == 0).
-    const auto label = labels.pop();
+template <bool Guarded>
+bool execute_code(Instance& instance, size_t code_idx, size_t frame_base);
+
+template <bool Guarded>
+bool execute_register_code(Instance& instance, size_t code_idx, size_t frame_base);
+
+bool execute_jit_code(
+    Instance& instance, size_t code_idx, size_t frame_base, JitCode::Function function);
 
-    pc = label.pc;
-    immediates = label.immediate;
+template <bool Guarded>
+bool execute_tiered_code(Instance& instance, size_t code_idx, size_t frame_base);
 
-    // When branch is taken, additional stack items must be dropped.
-    assert(stack.size() >= label.stack_height + label.arity);
-    if (label.arity != 0)
+/// Executes the wasm function of the given code index with the instance's interpreter.
+/// The memory accesses of the guarded memory are not bounds-checked.
+template <bool Guarded>
+inline bool execute_with_interpreter(Instance& instance, size_t code_idx, size_t frame_base)
+{
+    switch (instance.interpreter)
     {
-        assert(label.arity == 1);
-        const auto result = stack.peek();
-        stack.resize(label.stack_height);
-        stack.push(result);
+    case Interpreter::registers:
+        return execute_register_code<Guarded>(instance, code_idx, frame_base);
+    case Interpreter::jit:
+        return execute_jit_code(
+            instance, code_idx, frame_base, instance.jit_code.function(code_idx));
+    case Interpreter::tiered:
+        return execute_tiered_code<Guarded>(instance, code_idx, frame_base);
+    default:
+        return execute_code<Guarded>(instance, code_idx, frame_base);
     }
-    else
-        stack.resize(label.stack_height);
 }
 
-bool invoke_function(
-    uint32_t type_idx, uint32_t func_idx, Instance& instance, Stack<uint64_t>& stack)
+/// Executes the wasm function of the given code index with the instance's interpreter.
+inline bool execute_function_code(Instance& instance, size_t code_idx, size_t frame_base)
 {
-    const auto num_args = instance.module.typesec[type_idx].inputs.size();
-    assert(stack.size() >= num_args);
-    std::vector<uint64_t> call_args(stack.end() - static_cast<ptrdiff_t>(num_args), stack.end());
-    stack.resize(stack.size() - num_args);
+    assert(code_idx < instance.function_profiles.size());
+    ++instance.function_profiles[code_idx].calls;
+
+#if FIZZY_GUARDED_MEMORY
+    // The out-of-bounds access faults and returns as a trap to the recovery point set
+    // by invoke_top_level_function().
+    if (instance.memory != nullptr && instance.memory->is_guarded())
+        return execute_with_interpreter<true>(instance, code_idx, frame_base);
+#endif
+    return execute_with_interpreter<false>(instance, code_idx, frame_base);
+}
 
-    const auto ret = execute(instance, func_idx, std::move(call_args));
-    // Bubble up traps
-    if (ret.trapped)
+/// Calls the function with the arguments on top of the value stack, replacing them with
+/// the function result.
+///
+/// @return false if the execution trapped.
+bool invoke_function(const FunctionDescriptor& func, Instance& instance)
+{
+    auto& stack = instance.value_stack;
+    assert(stack.size() >= func.num_inputs);
+
+    // The arguments on top of the caller's operand stack become the beginning of
+    // the callee's frame, so they are passed without copying.
+    const auto frame_base = stack.size() - func.num_inputs;
+    if (func.host_function == nullptr)
+        return execute_function_code(instance, func.code_idx, frame_base);
+
+#if FIZZY_GUARDED_MEMORY
+    // The faults in the host code are not recoverable.
+    const ScopedGuardFaultRecovery no_recovery{nullptr};
+#endif
+    // The result is not written to the value stack by the host function, which may reallocate it
+    // by executing functions of the instance.
+    uint64_t result = 0;
+    if (func.host_function(func.host_context, instance, stack.data() + frame_base, &result) !=
+        ExecutionStatus::success)
         return false;
 
-    const auto num_outputs = instance.module.typesec[type_idx].outputs.size();
-    // NOTE: we can assume these two from validation
-    assert(ret.stack.size() == num_outputs);
-    assert(num_outputs <= 1);
-    // Push back the result
-    if (num_outputs != 0)
-        stack.push(ret.stack[0]);
+    stack.resize(frame_base + func.num_outputs);
+    if (func.num_outputs != 0)
+        stack[frame_base] = result;
+    return true;
+}
+
+/// Calls the function from the stack interpreter with the arguments on top of its operand stack.
+inline bool invoke_function(const FunctionDescriptor& func, Instance& instance, ValueStack&)
+{
+    return invoke_function(func, instance);
+}
 
+/// Calls the function with the arguments on top of the operand stack of the validated
+/// function. The rest of the caller's frame is given back to the value stack for the call.
+inline bool invoke_function(const FunctionDescriptor& func, Instance& instance, FrameStack& stack)
+{
+    stack.release();
+    if (!invoke_function(func, instance))
+        return false;
+    stack.reclaim();
     return true;
 }
 
+/// Calls the function started by execute() with the arguments in the frame starting at
+/// @a frame_base. The HostFunction is called as from the wasm code.
+inline bool call_top_level_function(
+    const FunctionDescriptor& func, Instance& instance, size_t frame_base)
+{
+    return func.host_function != nullptr ?
+               invoke_function(func, instance) :
+               execute_function_code(instance, func.code_idx, frame_base);
+}
+
+/// Calls the function like call_top_level_function(), setting the single guard fault recovery
+/// point for the whole execution started by execute().
+///
+/// The out-of-bounds access of the guarded memory in any of the wasm functions called returns
+/// here as a trap, jumping over their frames, which therefore must not hold objects with
+/// non-trivial destructors. The value stack is left to be unwound by the caller.
+bool invoke_top_level_function(
+    const FunctionDescriptor& func, Instance& instance, size_t frame_base)
+{
+#if FIZZY_GUARDED_MEMORY
+    if (instance.memory != nullptr && instance.memory->is_guarded())
+    {
+        GuardFaultRecovery recovery;
+        recovery.region = instance.memory->region();
+        const ScopedGuardFaultRecovery scope{&recovery};
+        if (sigsetjmp(recovery.env, 0) != 0)
+            return false;
+        return call_top_level_function(func, instance, frame_base);
+    }
+#endif
+    return call_top_level_function(func, instance, frame_base);
+}
+
 template <typename T>
-inline void store(bytes& input, size_t offset, T value) noexcept
+inline void store(uint8_t* input, size_t offset, T value) noexcept
 {
-    __builtin_memcpy(input.data() + offset, &value, sizeof(value));
+    __builtin_memcpy(input + offset, &value, sizeof(value));
 }
 
 template <typename T>
-inline T load(bytes_view input, size_t offset) noexcept
+inline T load(const uint8_t* input, size_t offset) noexcept
 {
     T ret;
-    __builtin_memcpy(&ret, input.data() + offset, sizeof(ret));
+    __builtin_memcpy(&ret, input + offset, sizeof(ret));
     return ret;
 }
 
+/// The reference to the instance memory used by the interpreters.
+/// The accesses of the guarded memory are not bounds-checked: they fault on the guard pages.
+template <bool Guarded>
+struct MemoryRef
+{
+    /// The instance's memory, null if the instance has none: then the code has no memory
+    /// instructions.
+    LinearMemory* memory;
+
+    uint8_t* data() const noexcept { return memory->data(); }
+    size_t size() const noexcept { return memory->size(); }
+
+    /// Marks the store of the given size as written, if the writes are tracked.
+    /// The store must be already done: the guarded memory is not checked before.
+    void mark_dirty(uint64_t address, size_t size) const noexcept
+    {
+        static_assert(sizeof(uint64_t) <= LinearMemory::MaxStoreSize);
+        if (auto* const dirty = memory->dirty_pages(); dirty != nullptr)
+            dirty[(address + size - 1) / LinearMemory::DirtyPageSize] = 1;
+    }
+
+    /// Returns true if the access of the given size at the address and offset is in bounds.
+    bool check(uint32_t address, uint32_t offset, size_t size) const noexcept
+    {
+        // Addressing is 32-bit, but we keep the value as 64-bit to detect overflows.
+        return Guarded || (uint64_t{address} + offset + size) <= memory->size();
+    }
+};
+
 template <typename T>
 inline T read(const uint8_t*& input) noexcept
 {
@@ -350,46 +696,91 @@ inline DstT extend(SrcT in) noexcept
         return DstT{in};
 }
 
-template <typename DstT, typename SrcT = DstT>
-inline bool load_from_memory(bytes_view memory, Stack<uint64_t>& stack, const uint8_t*& immediates)
+/// The size of the branch immediates: the target instruction and immediates offsets,
+/// the number of operand stack items to drop and the branch arity.
+constexpr auto BranchImmediateSize = 4 * sizeof(uint32_t);
+
+/// Jumps to the target instruction and immediates offsets read from the immediates.
+inline void jump(const Code& code, const Instr*& pc, const uint8_t*& immediates) noexcept
+{
+    const auto target_pc = read<uint32_t>(immediates);
+    const auto target_imm = read<uint32_t>(immediates);
+    pc = code.instructions.data() + target_pc;
+    immediates = code.immediates.data() + target_imm;
+}
+
+/// Takes the branch resolved by the parser. Drops the operand stack items between the branch
+/// result and the operand stack height at the branch target. Counts the backward branches
+/// (to the loop beginnings) in @a back_edges.
+template <typename OperandStack>
+inline void branch(const Code& code, OperandStack& stack, const Instr*& pc,
+    const uint8_t*& immediates, uint64_t& back_edges) noexcept
+{
+    const auto target_pc = read<uint32_t>(immediates);
+    const auto target_imm = read<uint32_t>(immediates);
+    const auto stack_drop = read<uint32_t>(immediates);
+    const auto arity = read<uint32_t>(immediates);
+
+    const auto* const target = code.instructions.data() + target_pc;
+    if (target < pc)
+        ++back_edges;
+    pc = target;
+    immediates = code.immediates.data() + target_imm;
+
+    assert(stack.size() >= stack_drop + arity);
+    if (arity != 0)
+    {
+        assert(arity == 1);
+        const auto result = stack.peek();
+        stack.drop(stack_drop);
+        stack.back() = result;
+    }
+    else
+        stack.drop(stack_drop);
+}
+
+template <typename DstT, typename SrcT = DstT, bool Guarded, typename OperandStack>
+inline bool load_from_memory(
+    MemoryRef<Guarded> memory, OperandStack& stack, const uint8_t*& immediates)
 {
     const auto address = static_cast<uint32_t>(stack.pop());
     // NOTE: alignment is dropped by the parser
     const auto offset = read<uint32_t>(immediates);
-    // Addressing is 32-bit, but we keep the value as 64-bit to detect overflows.
-    if ((uint64_t{address} + offset + sizeof(SrcT)) > memory.size())
+    if (!memory.check(address, offset, sizeof(SrcT)))
         return false;
 
-    const auto ret = load<SrcT>(memory, address + offset);
+    const auto ret = load<SrcT>(memory.data(), uint64_t{address} + offset);
     stack.push(extend<DstT>(ret));
     return true;
 }
 
-template <typename DstT>
-inline bool store_into_memory(bytes& memory, Stack<uint64_t>& stack, const uint8_t*& immediates)
+template <typename DstT, bool Guarded, typename OperandStack>
+inline bool store_into_memory(
+    MemoryRef<Guarded> memory, OperandStack& stack, const uint8_t*& immediates)
 {
     const auto value = static_cast<DstT>(stack.pop());
     const auto address = static_cast<uint32_t>(stack.pop());
     // NOTE: alignment is dropped by the parser
     const auto offset = read<uint32_t>(immediates);
-    // Addressing is 32-bit, but we keep the value as 64-bit to detect overflows.
-    if ((uint64_t{address} + offset + sizeof(DstT)) > memory.size())
+    if (!memory.check(address, offset, sizeof(DstT)))
         return false;
 
-    store<DstT>(memory, address + offset, value);
+    const auto effective_address = uint64_t{address} + offset;
+    store<DstT>(memory.data(), effective_address, value);
+    memory.mark_dirty(effective_address, sizeof(DstT));
     return true;
 }
 
-template <typename Op>
-inline void unary_op(Stack<uint64_t>& stack, Op op) noexcept
+template <typename OperandStack, typename Op>
+inline void unary_op(OperandStack& stack, Op op) noexcept
 {
     using T = decltype(op(stack.pop()));
     const auto a = static_cast<T>(stack.pop());
     stack.push(static_cast<uint64_t>(op(a)));
 }
 
-template <typename Op>
-inline void binary_op(Stack<uint64_t>& stack, Op op) noexcept
+template <typename OperandStack, typename Op>
+inline void binary_op(OperandStack& stack, Op op) noexcept
 {
     using T = decltype(op(stack.pop(), stack.pop()));
     const auto val2 = static_cast<T>(stack.pop());
@@ -397,14 +788,64 @@ inline void binary_op(Stack<uint64_t>& stack, Op op) noexcept
     stack.push(static_cast<uint64_t>(op(val1, val2)));
 }
 
-template <typename T, template <typename> class Op>
-inline void comparison_op(Stack<uint64_t>& stack, Op<T> op) noexcept
+template <typename T, template <typename> class Op, typename OperandStack>
+inline void comparison_op(OperandStack& stack, Op<T> op) noexcept
 {
     const auto val2 = static_cast<T>(stack.pop());
     const auto val1 = static_cast<T>(stack.pop());
     stack.push(uint32_t{op(val1, val2)});
 }
 
+template <typename DstT, typename SrcT = DstT, bool Guarded>
+inline bool load_from_memory(
+    MemoryRef<Guarded> memory, uint64_t* regs, const RegisterInstr& instr) noexcept
+{
+    const auto address = static_cast<uint32_t>(regs[instr.a]);
+    const auto offset = instr.b;
+    if (!memory.check(address, offset, sizeof(SrcT)))
+        return false;
+
+    regs[instr.dst] = extend<DstT>(load<SrcT>(memory.data(), uint64_t{address} + offset));
+    return true;
+}
+
+template <typename DstT, bool Guarded>
+inline bool store_into_memory(
+    MemoryRef<Guarded> memory, uint64_t* regs, const RegisterInstr& instr) noexcept
+{
+    const auto value = static_cast<DstT>(regs[instr.b]);
+    const auto address = static_cast<uint32_t>(regs[instr.a]);
+    const auto offset = instr.c;
+    if (!memory.check(address, offset, sizeof(DstT)))
+        return false;
+
+    const auto effective_address = uint64_t{address} + offset;
+    store<DstT>(memory.data(), effective_address, value);
+    memory.mark_dirty(effective_address, sizeof(DstT));
+    return true;
+}
+
+template <typename Op>
+inline void unary_op(uint64_t* regs, const RegisterInstr& instr, Op op) noexcept
+{
+    using T = decltype(op(regs[instr.a]));
+    regs[instr.dst] = static_cast<uint64_t>(op(static_cast<T>(regs[instr.a])));
+}
+
+template <typename Op>
+inline void binary_op(uint64_t* regs, const RegisterInstr& instr, Op op) noexcept
+{
+    using T = decltype(op(regs[instr.a], regs[instr.b]));
+    regs[instr.dst] =
+        static_cast<uint64_t>(op(static_cast<T>(regs[instr.a]), static_cast<T>(regs[instr.b])));
+}
+
+template <typename T, template <typename> class Op>
+inline void comparison_op(uint64_t* regs, const RegisterInstr& instr, Op<T> op) noexcept
+{
+    regs[instr.dst] = uint32_t{op(static_cast<T>(regs[instr.a]), static_cast<T>(regs[instr.b]))};
+}
+
 template <typename T>
 inline T shift_left(T lhs, T rhs) noexcept
 {
@@ -437,6 +878,20 @@ inline T rotr(T lhs, T rhs) noexcept
     return (lhs >> k) | (lhs << (num_bits - k));
 }
 
+/// Grows the memory by the given number of pages.
+///
+/// @return The previous number of pages or -1 if the memory cannot be grown.
+inline uint32_t grow_memory(LinearMemory& memory, uint32_t delta, size_t memory_max_pages)
+{
+    const auto cur_pages = memory.size() / PageSize;
+    assert(cur_pages <= size_t(std::numeric_limits<int32_t>::max()));
+    const auto new_pages = cur_pages + delta;
+    assert(new_pages >= cur_pages);
+    if (new_pages > memory_max_pages || !memory.grow(new_pages * PageSize))
+        return static_cast<uint32_t>(-1);
+    return static_cast<uint32_t>(cur_pages);
+}
+
 inline uint32_t clz32(uint32_t value) noexcept
 {
     // NOTE: Wasm specifies this case, but C/C++ intrinsic leaves it as undefined.
@@ -480,29 +935,43 @@ inline uint64_t popcnt64(uint64_t value) noexcept
 }
 }  // namespace
 
-Instance instantiate(Module module, std::vector<ExternalFunction> imported_functions,
-    std::vector<ExternalTable> imported_tables, std::vector<ExternalMemory> imported_memories,
-    std::vector<ExternalGlobal> imported_globals)
+namespace
 {
-    std::vector<TypeIdx> imported_function_types = match_imports(
-        module, imported_functions, imported_tables, imported_memories, imported_globals);
+/// Instantiates the module like instantiate(), placing the instance in @a result.
+/// The failures of the instantiation are reported by the returned error, the @a result is not
+/// complete then. The exceptions of the start function propagate, e.g. the exception of
+/// the imported function or the parser_error of the lazily parsed body.
+Error instantiate_into(std::optional<Instance>& result, std::shared_ptr<const Module> module_ptr,
+    std::vector<ExternalFunction> imported_functions, std::vector<ExternalTable> imported_tables,
+    std::vector<ExternalMemory> imported_memories, std::vector<ExternalGlobal> imported_globals)
+{
+    assert(module_ptr != nullptr);
+    const Module& module = *module_ptr;
+    // The module built by hand must own the buffers its views point into, see
+    // copy_referenced_data().
+    assert(module.validated || references_owned_data(module));
+
+    std::vector<TypeIdx> imported_function_types;
+    if (auto error = match_imports(module, imported_functions, imported_tables, imported_memories,
+            imported_globals, imported_function_types))
+        return error;
+
+    // The constant expressions of the validated module are checked by the parser.
+    if (!module.validated)
+    {
+        if (auto error = check_constant_expressions(module, imported_globals))
+            return error;
+    }
+
+    if (auto error = check_table_and_memory(module, imported_tables, imported_memories))
+        return error;
 
     // Init globals
     std::vector<uint64_t> globals;
     globals.reserve(module.globalsec.size());
     for (auto const& global : module.globalsec)
     {
-        // Wasm spec section 3.3.7 constrains initialization by another global to const imports only
-        // https://webassembly.github.io/spec/core/valid/instructions.html#expressions
-        if (global.expression.kind == ConstantExpression::Kind::GlobalGet &&
-            global.expression.value.global_index >= imported_globals.size())
-        {
-            throw instantiate_error(
-                "Global can be initialized by another const global only if it's imported.");
-        }
-
-        const auto value = eval_constant_expression(
-            global.expression, imported_globals, module.globalsec, globals);
+        const auto value = eval_constant_expression(global.expression, imported_globals, globals);
         globals.emplace_back(value);
     }
 
@@ -515,11 +984,10 @@ Instance instantiate(Module module, std::vector<ExternalFunction> imported_funct
     assert(module.elementsec.empty() || table != nullptr);
     for (const auto& element : module.elementsec)
     {
-        const uint64_t offset =
-            eval_constant_expression(element.offset, imported_globals, module.globalsec, globals);
+        const uint64_t offset = eval_constant_expression(element.offset, imported_globals, globals);
 
         if (offset + element.init.size() > table->size())
-            throw instantiate_error("Element segment is out of table bounds");
+            return {ErrorCode::element_out_of_bounds};
 
         // Overwrite table[offset..] with element.init
         std::copy(element.init.begin(), element.init.end(), table->data() + offset);
@@ -528,198 +996,313 @@ Instance instantiate(Module module, std::vector<ExternalFunction> imported_funct
     // Fill out memory based on data segments
     for (const auto& data : module.datasec)
     {
-        const uint64_t offset =
-            eval_constant_expression(data.offset, imported_globals, module.globalsec, globals);
+        const uint64_t offset = eval_constant_expression(data.offset, imported_globals, globals);
 
         if (offset + data.init.size() > memory->size())
-            throw instantiate_error("Data segment is out of memory bounds");
+            return {ErrorCode::data_out_of_bounds};
 
         // NOTE: these instructions can overlap
         std::memcpy(memory->data() + offset, data.init.data(), data.init.size());
     }
 
+    auto type_ids = get_type_ids(module.typesec);
+
+    std::vector<FunctionProfile> function_profiles(get_code_count(module));
+
     // FIXME: clang-tidy warns about potential memory leak for moving memory (which is in fact
     // safe), but also erroneously points this warning to std::move(table)
     // NOLINTNEXTLINE(clang-analyzer-cplusplus.NewDeleteLeaks)
-    Instance instance = {std::move(module), std::move(memory), memory_max, std::move(table),
-        std::move(globals), std::move(imported_functions), std::move(imported_function_types),
-        std::move(imported_globals)};
+    auto& instance = result.emplace(Instance{std::move(module_ptr), std::move(memory), memory_max,
+        std::move(table), std::move(globals), std::move(imported_functions),
+        std::move(imported_function_types), std::move(imported_globals), std::move(type_ids), {},
+        {}, Interpreter::stack, {}, {}, {}, std::move(function_profiles), {}, {}, {}});
+    // The descriptors point to the imported functions already owned by the instance.
+    instance.functions = resolve_functions(instance);
 
     // Run start function if present
-    if (instance.module.startfunc)
+    if (instance.module->startfunc)
     {
-        const auto funcidx = *instance.module.startfunc;
-        assert(funcidx < instance.imported_functions.size() + instance.module.funcsec.size());
+        const auto funcidx = *instance.module->startfunc;
+        assert(funcidx < instance.imported_functions.size() + instance.module->funcsec.size());
         if (execute(instance, funcidx, {}).trapped)
-            throw instantiate_error("Start function failed to execute");
+            return {ErrorCode::start_function_trapped};
     }
 
-    return instance;
+    return {};
 }
+}  // namespace
 
-execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint64_t> args)
+Instance instantiate(std::shared_ptr<const Module> module,
+    std::vector<ExternalFunction> imported_functions, std::vector<ExternalTable> imported_tables,
+    std::vector<ExternalMemory> imported_memories, std::vector<ExternalGlobal> imported_globals)
 {
-    if (func_idx < instance.imported_functions.size())
-        return instance.imported_functions[func_idx](instance, std::move(args));
+    std::optional<Instance> instance;
+    if (const auto error = instantiate_into(instance, std::move(module),
+            std::move(imported_functions), std::move(imported_tables),
+            std::move(imported_memories), std::move(imported_globals)))
+        throw instantiate_error{error};
+    return std::move(*instance);
+}
+
+Instance instantiate(Module module, std::vector<ExternalFunction> imported_functions,
+    std::vector<ExternalTable> imported_tables, std::vector<ExternalMemory> imported_memories,
+    std::vector<ExternalGlobal> imported_globals)
+{
+    if (!module.validated && !references_owned_data(module))
+        copy_referenced_data(module);
+    return instantiate(std::make_shared<const Module>(std::move(module)),
+        std::move(imported_functions), std::move(imported_tables), std::move(imported_memories),
+        std::move(imported_globals));
+}
 
-    const auto code_idx = func_idx - instance.imported_functions.size();
-    assert(code_idx < instance.module.codesec.size());
+std::optional<Instance> try_instantiate(std::shared_ptr<const Module> module, Error& error,
+    std::vector<ExternalFunction> imported_functions, std::vector<ExternalTable> imported_tables,
+    std::vector<ExternalMemory> imported_memories,
+    std::vector<ExternalGlobal> imported_globals) noexcept
+{
+    std::optional<Instance> instance;
+    try
+    {
+        error = instantiate_into(instance, std::move(module), std::move(imported_functions),
+            std::move(imported_tables), std::move(imported_memories), std::move(imported_globals));
+    }
+    catch (const parser_error& e)
+    {
+        // The lazily parsed body of the start function.
+        error = e.error();
+    }
+    catch (const std::bad_alloc&)
+    {
+        error = {ErrorCode::out_of_memory};
+    }
+    catch (...)
+    {
+        // E.g. the exception of the host function called by the start function.
+        error = {ErrorCode::unexpected_exception};
+    }
 
-    const auto& code = instance.module.codesec[code_idx];
-    auto& memory = *instance.memory;
+    if (error)
+        return std::nullopt;
+    return instance;
+}
 
-    std::vector<uint64_t> locals = std::move(args);
-    locals.resize(locals.size() + code.local_count);
+std::optional<Instance> try_instantiate(Module module, Error& error,
+    std::vector<ExternalFunction> imported_functions, std::vector<ExternalTable> imported_tables,
+    std::vector<ExternalMemory> imported_memories,
+    std::vector<ExternalGlobal> imported_globals) noexcept
+{
+    std::shared_ptr<const Module> module_ptr;
+    try
+    {
+        if (!module.validated && !references_owned_data(module))
+            copy_referenced_data(module);
+        module_ptr = std::make_shared<const Module>(std::move(module));
+    }
+    catch (const std::bad_alloc&)
+    {
+        error = {ErrorCode::out_of_memory};
+        return std::nullopt;
+    }
+    return try_instantiate(std::move(module_ptr), error, std::move(imported_functions),
+        std::move(imported_tables), std::move(imported_memories), std::move(imported_globals));
+}
 
-    // TODO: preallocate fixed stack depth properly
-    Stack<uint64_t> stack;
+#if FIZZY_THREADED_DISPATCH
+// Threaded-code dispatch: every instruction handler ends with its own indirect jump through
+// the dispatch table, so the branch predictor gets a separate history for each handler.
+// This uses the "labels as values" GNU extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define DISPATCH_CASE(name) \
+    op_##name:              \
+    case Instr::name
+#define DISPATCH_DEFAULT \
+    op_default:          \
+    default
+#define DISPATCH_NEXT()                                          \
+    do                                                           \
+    {                                                            \
+        instruction = *pc++;                                     \
+        goto* dispatch_table[static_cast<uint8_t>(instruction)]; \
+    } while (false)
+#else
+#define DISPATCH_CASE(name) case Instr::name
+#define DISPATCH_DEFAULT default
+#define DISPATCH_NEXT() break
+#endif
 
-    Stack<LabelContext> labels;
+namespace
+{
+/// Executes the code of the wasm function of the given code index with the operand stack
+/// starting at @a operands_base, after the function's arguments and locals.
+/// When the execution finishes successfully the frame is replaced with the function result.
+///
+/// @return false if the execution trapped.
+template <bool Guarded, typename OperandStack>
+bool execute_instructions(Instance& instance, const Code& code, size_t code_idx,
+    size_t frame_base, size_t operands_base, OperandStack& stack)
+{
+    const MemoryRef<Guarded> memory{instance.memory.get()};
+    auto& back_edges = instance.function_profiles[code_idx].back_edges;
 
     bool trap = false;
 
     const Instr* pc = code.instructions.data();
+    const Instr* const pc_end = pc + code.instructions.size();
     const uint8_t* immediates = code.immediates.data();
 
+#if FIZZY_THREADED_DISPATCH
+    // The handler address for every possible opcode byte.
+    // The first instruction is dispatched by the switch, all following ones by this table.
+    static const void* const dispatch_table[256] = {
+        /* 0x00 */
+        &&op_unreachable, &&op_nop, &&op_block, &&op_loop, &&op_if_, &&op_else_, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_end, &&op_br, &&op_br_if,
+        &&op_br_table, &&op_return_,
+        /* 0x10 */
+        &&op_call, &&op_call_indirect, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_drop, &&op_select,
+        &&op_default, &&op_default, &&op_default, &&op_default,
+        /* 0x20 */
+        &&op_local_get, &&op_local_set, &&op_local_tee, &&op_global_get, &&op_global_set,
+        &&op_default, &&op_default, &&op_default, &&op_i32_load, &&op_i64_load, &&op_default,
+        &&op_default, &&op_i32_load8_s, &&op_i32_load8_u, &&op_i32_load16_s, &&op_i32_load16_u,
+        /* 0x30 */
+        &&op_i64_load8_s, &&op_i64_load8_u, &&op_i64_load16_s, &&op_i64_load16_u, &&op_i64_load32_s,
+        &&op_i64_load32_u, &&op_i32_store, &&op_i64_store, &&op_default, &&op_default,
+        &&op_i32_store8, &&op_i32_store16, &&op_i64_store8, &&op_i64_store16, &&op_i64_store32,
+        &&op_memory_size,
+        /* 0x40 */
+        &&op_memory_grow, &&op_i32_const, &&op_i64_const, &&op_default, &&op_default, &&op_i32_eqz,
+        &&op_i32_eq, &&op_i32_ne, &&op_i32_lt_s, &&op_i32_lt_u, &&op_i32_gt_s, &&op_i32_gt_u,
+        &&op_i32_le_s, &&op_i32_le_u, &&op_i32_ge_s, &&op_i32_ge_u,
+        /* 0x50 */
+        &&op_i64_eqz, &&op_i64_eq, &&op_i64_ne, &&op_i64_lt_s, &&op_i64_lt_u, &&op_i64_gt_s,
+        &&op_i64_gt_u, &&op_i64_le_s, &&op_i64_le_u, &&op_i64_ge_s, &&op_i64_ge_u, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default,
+        /* 0x60 */
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_i32_clz, &&op_i32_ctz, &&op_i32_popcnt, &&op_i32_add, &&op_i32_sub,
+        &&op_i32_mul, &&op_i32_div_s, &&op_i32_div_u, &&op_i32_rem_s,
+        /* 0x70 */
+        &&op_i32_rem_u, &&op_i32_and, &&op_i32_or, &&op_i32_xor, &&op_i32_shl, &&op_i32_shr_s,
+        &&op_i32_shr_u, &&op_i32_rotl, &&op_i32_rotr, &&op_i64_clz, &&op_i64_ctz, &&op_i64_popcnt,
+        &&op_i64_add, &&op_i64_sub, &&op_i64_mul, &&op_i64_div_s,
+        /* 0x80 */
+        &&op_i64_div_u, &&op_i64_rem_s, &&op_i64_rem_u, &&op_i64_and, &&op_i64_or, &&op_i64_xor,
+        &&op_i64_shl, &&op_i64_shr_s, &&op_i64_shr_u, &&op_i64_rotl, &&op_i64_rotr, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default,
+        /* 0x90 */
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default,
+        /* 0xa0 */
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_i32_wrap_i64, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_i64_extend_i32_s, &&op_i64_extend_i32_u, &&op_default, &&op_default,
+        /* 0xb0 */
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default,
+        /* 0xc0 */
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default,
+        /* 0xd0 */
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default,
+        /* 0xe0 */
+        &&op_local_get_local_get, &&op_local_get_i32_const, &&op_local_get_i32_const_i32_add,
+        &&op_local_get_i32_load, &&op_local_set_local_get, &&op_local_tee_br_if,
+        &&op_i32_const_i32_add, &&op_i32_add_local_set, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        /* 0xf0 */
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default,
+    };
+#endif
+
     while (true)
     {
-        const auto instruction = *pc++;
+        auto instruction = *pc++;
         switch (instruction)
         {
-        case Instr::unreachable:
+        DISPATCH_CASE(unreachable):
             trap = true;
             goto end;
-        case Instr::nop:
-            break;
-        case Instr::block:
+        DISPATCH_CASE(nop):
+            DISPATCH_NEXT();
+        DISPATCH_CASE(block):
+        DISPATCH_CASE(loop):
+            DISPATCH_NEXT();
+        DISPATCH_CASE(if_):
         {
-            const auto arity = read<uint8_t>(immediates);
-            const auto target_pc = read<uint32_t>(immediates);
-            const auto target_imm = read<uint32_t>(immediates);
-            LabelContext label{code.instructions.data() + target_pc,
-                code.immediates.data() + target_imm, arity, stack.size()};
-            labels.emplace_back(label);
-            break;
+            if (static_cast<uint32_t>(stack.pop()) != 0)
+                immediates += 2 * sizeof(uint32_t);  // Skip the else/end jump target.
+            else
+                jump(code, pc, immediates);
+            DISPATCH_NEXT();
         }
-        case Instr::loop:
+        DISPATCH_CASE(else_):
         {
-            LabelContext label{pc - 1, immediates, 0, stack.size()};  // Target this instruction.
-            labels.push_back(label);
-            break;
+            // We reach else only at the end of if block.
+            jump(code, pc, immediates);
+            DISPATCH_NEXT();
         }
-        case Instr::if_:
+        DISPATCH_CASE(end):
         {
-            const auto arity = read<uint8_t>(immediates);
-            const auto target_pc = read<uint32_t>(immediates);
-            const auto target_imm = read<uint32_t>(immediates);
-
-            if (static_cast<uint32_t>(stack.pop()) != 0)
-            {
-                immediates += 2 * sizeof(uint32_t);  // Skip the immediates for else instruction.
-
-                LabelContext label{code.instructions.data() + target_pc,
-                    code.immediates.data() + target_imm, arity, stack.size()};
-                labels.emplace_back(label);
-            }
-            else
-            {
-                const auto target_else_pc = read<uint32_t>(immediates);
-                const auto target_else_imm = read<uint32_t>(immediates);
-
-                if (target_else_pc != 0)  // If else block defined.
-                {
-                    LabelContext label{code.instructions.data() + target_pc,
-                        code.immediates.data() + target_imm, arity, stack.size()};
-                    labels.emplace_back(label);
-                    pc = code.instructions.data() + target_else_pc;
-                    immediates = code.immediates.data() + target_else_imm;
-                }
-                else  // If else block not defined go to end of if.
-                {
-                    assert(arity == 0);  // if without else cannot have type signature.
-                    pc = code.instructions.data() + target_pc;
-                    immediates = code.immediates.data() + target_imm;
-                }
-            }
-            break;
+            // The end of a block is no-op, the end of the function body is the last instruction.
+            if (pc == pc_end)
+                goto end;
+            DISPATCH_NEXT();
         }
-        case Instr::else_:
+        DISPATCH_CASE(br):
         {
-            // We reach else only at the end of if block.
-            assert(!labels.empty());
-            const auto label = labels.pop();
-
-            pc = label.pc;
-            immediates = label.immediate;
-
-            break;
+            branch(code, stack, pc, immediates, back_edges);
+            DISPATCH_NEXT();
         }
-        case Instr::end:
+        DISPATCH_CASE(br_if):
         {
-            if (!labels.empty())
-                labels.pop_back();
+            if (static_cast<uint32_t>(stack.pop()) != 0)
+                branch(code, stack, pc, immediates, back_edges);
             else
-                goto end;
-            break;
-        }
-        case Instr::br:
-        case Instr::br_if:
-        {
-            const auto label_idx = read<uint32_t>(immediates);
-
-            // Check condition for br_if.
-            if (instruction == Instr::br_if && static_cast<uint32_t>(stack.pop()) == 0)
-                break;
-
-            if (label_idx == labels.size())
-                goto case_return;
-
-            branch(label_idx, labels, stack, pc, immediates);
-            break;
+                immediates += BranchImmediateSize;
+            DISPATCH_NEXT();
         }
-        case Instr::br_table:
+        DISPATCH_CASE(br_table):
         {
-            // immediates are: size of label vector, labels, default label
+            // immediates are: size of the jump table, the targets, the default target
             const auto br_table_size = read<uint32_t>(immediates);
             const auto br_table_idx = stack.pop();
 
-            const auto label_idx_offset = br_table_idx < br_table_size ?
-                                              br_table_idx * sizeof(uint32_t) :
-                                              br_table_size * sizeof(uint32_t);
-            immediates += label_idx_offset;
-
-            const auto label_idx = read<uint32_t>(immediates);
-
-            if (label_idx == labels.size())
-                goto case_return;
+            const auto target_offset = br_table_idx < br_table_size ?
+                                           br_table_idx * BranchImmediateSize :
+                                           br_table_size * BranchImmediateSize;
+            immediates += target_offset;
 
-            branch(label_idx, labels, stack, pc, immediates);
-            break;
+            branch(code, stack, pc, immediates, back_edges);
+            DISPATCH_NEXT();
         }
-        case Instr::call:
+        DISPATCH_CASE(call):
         {
             const auto called_func_idx = read<uint32_t>(immediates);
-            assert(called_func_idx <
-                   instance.imported_functions.size() + instance.module.funcsec.size());
-            const auto type_idx =
-                called_func_idx < instance.imported_functions.size() ?
-                    instance.imported_function_types[called_func_idx] :
-                    instance.module.funcsec[called_func_idx - instance.imported_functions.size()];
-            assert(type_idx < instance.module.typesec.size());
-
-            if (!invoke_function(type_idx, called_func_idx, instance, stack))
+            assert(called_func_idx < instance.functions.size());
+
+            if (!invoke_function(instance.functions[called_func_idx], instance, stack))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::call_indirect:
+        DISPATCH_CASE(call_indirect):
         {
             assert(instance.table != nullptr);
 
             const auto expected_type_idx = read<uint32_t>(immediates);
-            assert(expected_type_idx < instance.module.typesec.size());
+            assert(expected_type_idx < instance.module->typesec.size());
 
             const auto elem_idx = stack.pop();
             if (elem_idx >= instance.table->size())
@@ -729,59 +1312,44 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
             }
 
             const auto called_func_idx = (*instance.table)[elem_idx];
-            assert(called_func_idx <
-                   instance.imported_functions.size() + instance.module.funcsec.size());
+            assert(called_func_idx < instance.functions.size());
+            const auto& called_func = instance.functions[called_func_idx];
 
             // check actual type against expected type
-            const auto actual_type_idx =
-                called_func_idx < instance.imported_functions.size() ?
-                    instance.imported_function_types[called_func_idx] :
-                    instance.module.funcsec[called_func_idx - instance.imported_functions.size()];
-            assert(actual_type_idx < instance.module.typesec.size());
-            const auto& expected_type = instance.module.typesec[expected_type_idx];
-            const auto& actual_type = instance.module.typesec[actual_type_idx];
-            if (expected_type.inputs != actual_type.inputs ||
-                expected_type.outputs != actual_type.outputs)
+            if (called_func.type_id != instance.type_ids[expected_type_idx])
             {
                 trap = true;
                 goto end;
             }
 
-            if (!invoke_function(actual_type_idx, called_func_idx, instance, stack))
+            if (!invoke_function(called_func, instance, stack))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::return_:
-        case_return:
+        DISPATCH_CASE(return_):
         {
-            // TODO: Not needed, but satisfies the assert in the end of the main loop.
-            labels.clear();
-
-            assert(code_idx < instance.module.funcsec.size());
-            const auto type_idx = instance.module.funcsec[code_idx];
-            assert(type_idx < instance.module.typesec.size());
-            const bool have_result = !instance.module.typesec[type_idx].outputs.empty();
+            const bool have_result = get_code_function(instance, code_idx).num_outputs != 0;
 
             if (have_result)
             {
                 const auto result = stack.peek();
-                stack.clear();
+                stack.resize(operands_base);
                 stack.push(result);
             }
             else
-                stack.clear();
+                stack.resize(operands_base);
 
             goto end;
         }
-        case Instr::drop:
+        DISPATCH_CASE(drop):
         {
             stack.pop();
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::select:
+        DISPATCH_CASE(select):
         {
             const auto condition = static_cast<uint32_t>(stack.pop());
             // NOTE: these two are the same type (ensured by validation)
@@ -791,30 +1359,30 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
                 stack.push(val2);
             else
                 stack.push(val1);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::local_get:
+        DISPATCH_CASE(local_get):
         {
             const auto idx = read<uint32_t>(immediates);
-            assert(idx <= locals.size());
-            stack.push(locals[idx]);
-            break;
+            assert(frame_base + idx < operands_base);
+            stack.push(stack[frame_base + idx]);
+            DISPATCH_NEXT();
         }
-        case Instr::local_set:
+        DISPATCH_CASE(local_set):
         {
             const auto idx = read<uint32_t>(immediates);
-            assert(idx <= locals.size());
-            locals[idx] = stack.pop();
-            break;
+            assert(frame_base + idx < operands_base);
+            stack[frame_base + idx] = stack.pop();
+            DISPATCH_NEXT();
         }
-        case Instr::local_tee:
+        DISPATCH_CASE(local_tee):
         {
             const auto idx = read<uint32_t>(immediates);
-            assert(idx <= locals.size());
-            locals[idx] = stack.peek();
-            break;
+            assert(frame_base + idx < operands_base);
+            stack[frame_base + idx] = stack.peek();
+            DISPATCH_NEXT();
         }
-        case Instr::global_get:
+        DISPATCH_CASE(global_get):
         {
             const auto idx = read<uint32_t>(immediates);
             assert(idx < instance.imported_globals.size() + instance.globals.size());
@@ -825,12 +1393,12 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
             else
             {
                 const auto module_global_idx = idx - instance.imported_globals.size();
-                assert(module_global_idx < instance.module.globalsec.size());
+                assert(module_global_idx < instance.module->globalsec.size());
                 stack.push(instance.globals[module_global_idx]);
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::global_set:
+        DISPATCH_CASE(global_set):
         {
             const auto idx = read<uint32_t>(immediates);
             if (idx < instance.imported_globals.size())
@@ -841,347 +1409,332 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
             else
             {
                 const auto module_global_idx = idx - instance.imported_globals.size();
-                assert(module_global_idx < instance.module.globalsec.size());
-                assert(instance.module.globalsec[module_global_idx].is_mutable);
+                assert(module_global_idx < instance.module->globalsec.size());
+                assert(instance.module->globalsec[module_global_idx].is_mutable);
                 instance.globals[module_global_idx] = stack.pop();
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_load:
+        DISPATCH_CASE(i32_load):
         {
             if (!load_from_memory<uint32_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_load:
+        DISPATCH_CASE(i64_load):
         {
             if (!load_from_memory<uint64_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_load8_s:
+        DISPATCH_CASE(i32_load8_s):
         {
             if (!load_from_memory<uint32_t, int8_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_load8_u:
+        DISPATCH_CASE(i32_load8_u):
         {
             if (!load_from_memory<uint32_t, uint8_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_load16_s:
+        DISPATCH_CASE(i32_load16_s):
         {
             if (!load_from_memory<uint32_t, int16_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_load16_u:
+        DISPATCH_CASE(i32_load16_u):
         {
             if (!load_from_memory<uint32_t, uint16_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_load8_s:
+        DISPATCH_CASE(i64_load8_s):
         {
             if (!load_from_memory<uint64_t, int8_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_load8_u:
+        DISPATCH_CASE(i64_load8_u):
         {
             if (!load_from_memory<uint64_t, uint8_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_load16_s:
+        DISPATCH_CASE(i64_load16_s):
         {
             if (!load_from_memory<uint64_t, int16_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_load16_u:
+        DISPATCH_CASE(i64_load16_u):
         {
             if (!load_from_memory<uint64_t, uint16_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_load32_s:
+        DISPATCH_CASE(i64_load32_s):
         {
             if (!load_from_memory<uint64_t, int32_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_load32_u:
+        DISPATCH_CASE(i64_load32_u):
         {
             if (!load_from_memory<uint64_t, uint32_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_store:
+        DISPATCH_CASE(i32_store):
         {
             if (!store_into_memory<uint32_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_store:
+        DISPATCH_CASE(i64_store):
         {
             if (!store_into_memory<uint64_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_store8:
-        case Instr::i64_store8:
+        DISPATCH_CASE(i32_store8):
+        DISPATCH_CASE(i64_store8):
         {
             if (!store_into_memory<uint8_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_store16:
-        case Instr::i64_store16:
+        DISPATCH_CASE(i32_store16):
+        DISPATCH_CASE(i64_store16):
         {
             if (!store_into_memory<uint16_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_store32:
+        DISPATCH_CASE(i64_store32):
         {
             if (!store_into_memory<uint32_t>(memory, stack, immediates))
             {
                 trap = true;
                 goto end;
             }
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::memory_size:
+        DISPATCH_CASE(memory_size):
         {
             stack.push(static_cast<uint32_t>(memory.size() / PageSize));
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::memory_grow:
+        DISPATCH_CASE(memory_grow):
         {
             const auto delta = static_cast<uint32_t>(stack.pop());
-            const auto cur_pages = memory.size() / PageSize;
-            assert(cur_pages <= size_t(std::numeric_limits<int32_t>::max()));
-            const auto new_pages = cur_pages + delta;
-            assert(new_pages >= cur_pages);
-            uint32_t ret = static_cast<uint32_t>(cur_pages);
-            try
-            {
-                if (new_pages > instance.memory_max_pages)
-                    throw std::bad_alloc();
-                memory.resize(new_pages * PageSize);
-            }
-            catch (std::bad_alloc const&)
-            {
-                ret = static_cast<uint32_t>(-1);
-            }
-            stack.push(ret);
-            break;
+            stack.push(grow_memory(*memory.memory, delta, instance.memory_max_pages));
+            DISPATCH_NEXT();
         }
-        case Instr::i32_const:
+        DISPATCH_CASE(i32_const):
         {
             const auto value = read<uint32_t>(immediates);
             stack.push(value);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_const:
+        DISPATCH_CASE(i64_const):
         {
             const auto value = read<uint64_t>(immediates);
             stack.push(value);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_eqz:
+        DISPATCH_CASE(i32_eqz):
         {
             const auto value = static_cast<uint32_t>(stack.pop());
             stack.push(value == 0);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_eq:
+        DISPATCH_CASE(i32_eq):
         {
             comparison_op(stack, std::equal_to<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_ne:
+        DISPATCH_CASE(i32_ne):
         {
             comparison_op(stack, std::not_equal_to<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_lt_s:
+        DISPATCH_CASE(i32_lt_s):
         {
             comparison_op(stack, std::less<int32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_lt_u:
+        DISPATCH_CASE(i32_lt_u):
         {
             comparison_op(stack, std::less<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_gt_s:
+        DISPATCH_CASE(i32_gt_s):
         {
             comparison_op(stack, std::greater<int32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_gt_u:
+        DISPATCH_CASE(i32_gt_u):
         {
             comparison_op(stack, std::greater<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_le_s:
+        DISPATCH_CASE(i32_le_s):
         {
             comparison_op(stack, std::less_equal<int32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_le_u:
+        DISPATCH_CASE(i32_le_u):
         {
             comparison_op(stack, std::less_equal<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_ge_s:
+        DISPATCH_CASE(i32_ge_s):
         {
             comparison_op(stack, std::greater_equal<int32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_ge_u:
+        DISPATCH_CASE(i32_ge_u):
         {
             comparison_op(stack, std::greater_equal<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_eqz:
+        DISPATCH_CASE(i64_eqz):
         {
             stack.push(stack.pop() == 0);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_eq:
+        DISPATCH_CASE(i64_eq):
         {
             comparison_op(stack, std::equal_to<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_ne:
+        DISPATCH_CASE(i64_ne):
         {
             comparison_op(stack, std::not_equal_to<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_lt_s:
+        DISPATCH_CASE(i64_lt_s):
         {
             comparison_op(stack, std::less<int64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_lt_u:
+        DISPATCH_CASE(i64_lt_u):
         {
             comparison_op(stack, std::less<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_gt_s:
+        DISPATCH_CASE(i64_gt_s):
         {
             comparison_op(stack, std::greater<int64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_gt_u:
+        DISPATCH_CASE(i64_gt_u):
         {
             comparison_op(stack, std::greater<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_le_s:
+        DISPATCH_CASE(i64_le_s):
         {
             comparison_op(stack, std::less_equal<int64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_le_u:
+        DISPATCH_CASE(i64_le_u):
         {
             comparison_op(stack, std::less_equal<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_ge_s:
+        DISPATCH_CASE(i64_ge_s):
         {
             comparison_op(stack, std::greater_equal<int64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_ge_u:
+        DISPATCH_CASE(i64_ge_u):
         {
             comparison_op(stack, std::greater_equal<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_clz:
+        DISPATCH_CASE(i32_clz):
         {
             unary_op(stack, clz32);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_ctz:
+        DISPATCH_CASE(i32_ctz):
         {
             unary_op(stack, ctz32);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_popcnt:
+        DISPATCH_CASE(i32_popcnt):
         {
             unary_op(stack, popcnt32);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_add:
+        DISPATCH_CASE(i32_add):
         {
             binary_op(stack, std::plus<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_sub:
+        DISPATCH_CASE(i32_sub):
         {
             binary_op(stack, std::minus<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_mul:
+        DISPATCH_CASE(i32_mul):
         {
             binary_op(stack, std::multiplies<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_div_s:
+        DISPATCH_CASE(i32_div_s):
         {
             auto const rhs = static_cast<int32_t>(stack.peek(0));
             auto const lhs = static_cast<int32_t>(stack.peek(1));
@@ -1191,9 +1744,9 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
                 goto end;
             }
             binary_op(stack, std::divides<int32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_div_u:
+        DISPATCH_CASE(i32_div_u):
         {
             auto const rhs = static_cast<uint32_t>(stack.peek());
             if (rhs == 0)
@@ -1202,9 +1755,9 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
                 goto end;
             }
             binary_op(stack, std::divides<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_rem_s:
+        DISPATCH_CASE(i32_rem_s):
         {
             auto const rhs = static_cast<int32_t>(stack.peek());
             if (rhs == 0)
@@ -1220,9 +1773,9 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
             }
             else
                 binary_op(stack, std::modulus<int32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_rem_u:
+        DISPATCH_CASE(i32_rem_u):
         {
             auto const rhs = static_cast<uint32_t>(stack.peek());
             if (rhs == 0)
@@ -1231,79 +1784,79 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
                 goto end;
             }
             binary_op(stack, std::modulus<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_and:
+        DISPATCH_CASE(i32_and):
         {
             binary_op(stack, std::bit_and<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_or:
+        DISPATCH_CASE(i32_or):
         {
             binary_op(stack, std::bit_or<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_xor:
+        DISPATCH_CASE(i32_xor):
         {
             binary_op(stack, std::bit_xor<uint32_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_shl:
+        DISPATCH_CASE(i32_shl):
         {
             binary_op(stack, shift_left<uint32_t>);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_shr_s:
+        DISPATCH_CASE(i32_shr_s):
         {
             binary_op(stack, shift_right<int32_t>);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_shr_u:
+        DISPATCH_CASE(i32_shr_u):
         {
             binary_op(stack, shift_right<uint32_t>);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_rotl:
+        DISPATCH_CASE(i32_rotl):
         {
             binary_op(stack, rotl<uint32_t>);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_rotr:
+        DISPATCH_CASE(i32_rotr):
         {
             binary_op(stack, rotr<uint32_t>);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_clz:
+        DISPATCH_CASE(i64_clz):
         {
             unary_op(stack, clz64);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_ctz:
+        DISPATCH_CASE(i64_ctz):
         {
             unary_op(stack, ctz64);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_popcnt:
+        DISPATCH_CASE(i64_popcnt):
         {
             unary_op(stack, popcnt64);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_add:
+        DISPATCH_CASE(i64_add):
         {
             binary_op(stack, std::plus<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_sub:
+        DISPATCH_CASE(i64_sub):
         {
             binary_op(stack, std::minus<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_mul:
+        DISPATCH_CASE(i64_mul):
         {
             binary_op(stack, std::multiplies<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_div_s:
+        DISPATCH_CASE(i64_div_s):
         {
             auto const rhs = static_cast<int64_t>(stack.peek(0));
             auto const lhs = static_cast<int64_t>(stack.peek(1));
@@ -1313,9 +1866,9 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
                 goto end;
             }
             binary_op(stack, std::divides<int64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_div_u:
+        DISPATCH_CASE(i64_div_u):
         {
             auto const rhs = static_cast<uint64_t>(stack.peek());
             if (rhs == 0)
@@ -1324,9 +1877,9 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
                 goto end;
             }
             binary_op(stack, std::divides<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_rem_s:
+        DISPATCH_CASE(i64_rem_s):
         {
             auto const rhs = static_cast<int64_t>(stack.peek());
             if (rhs == 0)
@@ -1342,9 +1895,9 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
             }
             else
                 binary_op(stack, std::modulus<int64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_rem_u:
+        DISPATCH_CASE(i64_rem_u):
         {
             auto const rhs = static_cast<uint64_t>(stack.peek());
             if (rhs == 0)
@@ -1353,80 +1906,1100 @@ execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint6
                 goto end;
             }
             binary_op(stack, std::modulus<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_and:
+        DISPATCH_CASE(i64_and):
         {
             binary_op(stack, std::bit_and<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_or:
+        DISPATCH_CASE(i64_or):
         {
             binary_op(stack, std::bit_or<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_xor:
+        DISPATCH_CASE(i64_xor):
         {
             binary_op(stack, std::bit_xor<uint64_t>());
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_shl:
+        DISPATCH_CASE(i64_shl):
         {
             binary_op(stack, shift_left<uint64_t>);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_shr_s:
+        DISPATCH_CASE(i64_shr_s):
         {
             binary_op(stack, shift_right<int64_t>);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_shr_u:
+        DISPATCH_CASE(i64_shr_u):
         {
             binary_op(stack, shift_right<uint64_t>);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_rotl:
+        DISPATCH_CASE(i64_rotl):
         {
             binary_op(stack, rotl<uint64_t>);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_rotr:
+        DISPATCH_CASE(i64_rotr):
         {
             binary_op(stack, rotr<uint64_t>);
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i32_wrap_i64:
+        DISPATCH_CASE(i32_wrap_i64):
         {
             stack.push(static_cast<uint32_t>(stack.pop()));
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_extend_i32_s:
+        DISPATCH_CASE(i64_extend_i32_s):
         {
             const auto value = static_cast<int32_t>(stack.pop());
             stack.push(static_cast<uint64_t>(int64_t{value}));
-            break;
+            DISPATCH_NEXT();
         }
-        case Instr::i64_extend_i32_u:
+        DISPATCH_CASE(i64_extend_i32_u):
         {
             // effectively no-op
-            break;
+            DISPATCH_NEXT();
         }
-        default:
+
+        // The superinstructions skip the remaining instructions of their fused sequences.
+        DISPATCH_CASE(local_get_local_get):
+        {
+            const auto idx1 = read<uint32_t>(immediates);
+            const auto idx2 = read<uint32_t>(immediates);
+            assert(frame_base + idx1 < operands_base && frame_base + idx2 < operands_base);
+            stack.push(stack[frame_base + idx1]);
+            stack.push(stack[frame_base + idx2]);
+            pc += 1;
+            DISPATCH_NEXT();
+        }
+        DISPATCH_CASE(local_get_i32_const):
+        {
+            const auto idx = read<uint32_t>(immediates);
+            assert(frame_base + idx < operands_base);
+            stack.push(stack[frame_base + idx]);
+            stack.push(read<uint32_t>(immediates));
+            pc += 1;
+            DISPATCH_NEXT();
+        }
+        DISPATCH_CASE(local_get_i32_const_i32_add):
+        {
+            const auto idx = read<uint32_t>(immediates);
+            assert(frame_base + idx < operands_base);
+            const auto value = static_cast<uint32_t>(stack[frame_base + idx]);
+            stack.push(value + read<uint32_t>(immediates));
+            pc += 2;
+            DISPATCH_NEXT();
+        }
+        DISPATCH_CASE(local_get_i32_load):
+        {
+            const auto idx = read<uint32_t>(immediates);
+            assert(frame_base + idx < operands_base);
+            stack.push(stack[frame_base + idx]);
+            if (!load_from_memory<uint32_t>(memory, stack, immediates))
+            {
+                trap = true;
+                goto end;
+            }
+            pc += 1;
+            DISPATCH_NEXT();
+        }
+        DISPATCH_CASE(local_set_local_get):
+        {
+            const auto set_idx = read<uint32_t>(immediates);
+            const auto get_idx = read<uint32_t>(immediates);
+            assert(frame_base + set_idx < operands_base && frame_base + get_idx < operands_base);
+            stack[frame_base + set_idx] = stack.back();
+            stack.back() = stack[frame_base + get_idx];
+            pc += 1;
+            DISPATCH_NEXT();
+        }
+        DISPATCH_CASE(local_tee_br_if):
+        {
+            const auto idx = read<uint32_t>(immediates);
+            assert(frame_base + idx < operands_base);
+            const auto condition = stack.pop();
+            stack[frame_base + idx] = condition;
+            if (static_cast<uint32_t>(condition) != 0)
+                branch(code, stack, pc, immediates, back_edges);
+            else
+            {
+                immediates += BranchImmediateSize;
+                pc += 1;
+            }
+            DISPATCH_NEXT();
+        }
+        DISPATCH_CASE(i32_const_i32_add):
+        {
+            const auto value = static_cast<uint32_t>(stack.back());
+            stack.back() = value + read<uint32_t>(immediates);
+            pc += 1;
+            DISPATCH_NEXT();
+        }
+        DISPATCH_CASE(i32_add_local_set):
+        {
+            const auto idx = read<uint32_t>(immediates);
+            assert(frame_base + idx < operands_base);
+            const auto b = static_cast<uint32_t>(stack.pop());
+            const auto a = static_cast<uint32_t>(stack.pop());
+            stack[frame_base + idx] = a + b;
+            pc += 1;
+            DISPATCH_NEXT();
+        }
+        DISPATCH_DEFAULT:
             assert(false);
-            break;
+            DISPATCH_NEXT();
         }
     }
 
 end:
-    assert(labels.empty() || trap);
-    // move allows to return derived Stack<uint64_t> instance into base vector<uint64_t> value
-    return {trap, std::move(stack)};
+    if (trap)
+        return false;
+
+    // Replace the frame with the function result left on the operand stack.
+    const auto num_results = stack.size() - operands_base;
+    std::copy(stack.end() - static_cast<ptrdiff_t>(num_results), stack.end(),
+        stack.begin() + static_cast<ptrdiff_t>(frame_base));
+    stack.resize(frame_base + num_results);
+    return true;
 }
 
-execution_result execute(const Module& module, FuncIdx func_idx, std::vector<uint64_t> args)
+/// Executes the wasm function of the given code index in the frame starting at @a frame_base
+/// of the instance's value stack.
+///
+/// The function arguments must already be at the top of the value stack. They are followed by
+/// the function's locals and its operand stack. When the execution finishes successfully
+/// the frame is replaced with the function result.
+///
+/// @return false if the execution trapped.
+template <bool Guarded>
+bool execute_code(Instance& instance, size_t code_idx, size_t frame_base)
 {
-    auto instance = instantiate(module);
-    return execute(instance, func_idx, std::move(args));
+    assert(code_idx < get_code_count(*instance.module));
+
+    const auto& code = get_code(*instance.module, code_idx);
+    auto& stack = instance.value_stack;
+
+    // Make room for the whole frame up front, so the operand stack is not reallocated
+    // during the execution of the function's code.
+    const auto locals_base = stack.size();
+    const auto operands_base = locals_base + code.local_count;
+    const auto frame_end = operands_base + code.max_stack_height;
+    if (frame_end > stack.capacity())
+        stack.reserve(std::max(frame_end, 2 * stack.capacity()));
+
+    // The value stack does not initialize the elements it grows by, the locals are zeroed here.
+    stack.resize(operands_base);
+    std::fill_n(stack.data() + locals_base, code.local_count, uint64_t{0});
+
+    if (instance.module->validated)
+    {
+        stack.resize(frame_end);
+        FrameStack operand_stack{stack, operands_base, frame_end};
+        if (!execute_instructions<Guarded>(
+                instance, code, code_idx, frame_base, operands_base, operand_stack))
+            return false;
+        operand_stack.release();
+        return true;
+    }
+
+    // The hand-built code may exceed its max_stack_height, so the operand stack pushes
+    // are checked.
+    return execute_instructions<Guarded>(
+        instance, code, code_idx, frame_base, operands_base, stack);
+}
+
+/// Executes the register code of the wasm function of the given code index in the frame starting
+/// at @a frame_base of the instance's value stack.
+///
+/// The function arguments must already be at the top of the value stack. The frame is extended
+/// to all the registers of the function. When the execution finishes successfully the frame
+/// is replaced with the function result.
+///
+/// @return false if the execution trapped.
+template <bool Guarded>
+bool execute_register_code(Instance& instance, size_t code_idx, size_t frame_base)
+{
+    assert(code_idx < instance.register_code.size());
+
+    const auto& code = instance.register_code[code_idx];
+    const MemoryRef<Guarded> memory{instance.memory.get()};
+    auto& stack = instance.value_stack;
+    auto& back_edges = instance.function_profiles[code_idx].back_edges;
+
+    // The registers not being arguments are zero-initialized: this initializes the locals.
+    const auto frame_end = frame_base + code.num_registers;
+    if (frame_end > stack.capacity())
+        stack.reserve(std::max(frame_end, 2 * stack.capacity()));
+    const auto args_end = stack.size();
+    stack.resize(frame_end);
+    std::fill(stack.data() + args_end, stack.data() + frame_end, uint64_t{0});
+
+    auto* regs = stack.data() + frame_base;
+    std::copy(code.constants.begin(), code.constants.end(), regs + code.constants_base);
+
+    const auto* const instructions = code.instructions.data();
+    const RegisterInstr* pc = instructions;
+
+    while (true)
+    {
+        const auto& instr = *pc++;
+        switch (instr.opcode)
+        {
+        case Instr::unreachable:
+            return false;
+        case Instr::if_:
+        {
+            if (static_cast<uint32_t>(regs[instr.c]) == 0)
+                pc = instructions + instr.a;
+            break;
+        }
+        case Instr::br:
+        {
+            regs[instr.dst] = regs[instr.b];
+            if (instructions + instr.a < pc)
+                ++back_edges;
+            pc = instructions + instr.a;
+            break;
+        }
+        case Instr::br_if:
+        {
+            if (static_cast<uint32_t>(regs[instr.c]) != 0)
+            {
+                regs[instr.dst] = regs[instr.b];
+                if (instructions + instr.a < pc)
+                    ++back_edges;
+                pc = instructions + instr.a;
+            }
+            break;
+        }
+        case Instr::br_table:
+        {
+            // The br_table has instr.dst targets followed by the default one.
+            const auto idx = regs[instr.c];
+            const auto& target = code.br_tables[instr.a + (idx < instr.dst ? idx : instr.dst)];
+            regs[target.dst] = regs[instr.b];
+            if (instructions + target.pc < pc)
+                ++back_edges;
+            pc = instructions + target.pc;
+            break;
+        }
+        case Instr::call:
+        case Instr::call_indirect:
+        {
+            auto called_func_idx = instr.a;
+            if (instr.opcode == Instr::call_indirect)
+            {
+                assert(instance.table != nullptr);
+                const auto elem_idx = regs[instr.c];
+                if (elem_idx >= instance.table->size())
+                    return false;
+                called_func_idx = (*instance.table)[elem_idx];
+                assert(called_func_idx < instance.functions.size());
+
+                // check actual type against expected type
+                assert(instr.a < instance.module->typesec.size());
+                if (instance.functions[called_func_idx].type_id != instance.type_ids[instr.a])
+                    return false;
+            }
+            assert(called_func_idx < instance.functions.size());
+            const auto& called_func = instance.functions[called_func_idx];
+
+            // The arguments in the registers starting at instr.b become the top of the stack.
+            stack.resize(frame_base + instr.b + called_func.num_inputs);
+            if (!invoke_function(called_func, instance))
+                return false;
+
+            // The result is left in the register instr.b. The callee may have reallocated
+            // the value stack.
+            stack.resize(frame_end);
+            regs = stack.data() + frame_base;
+            break;
+        }
+        case Instr::return_:
+        {
+            if (instr.c != 0)
+                regs[0] = regs[instr.a];
+            stack.resize(frame_base + instr.c);
+            return true;
+        }
+        case Instr::select:
+        {
+            regs[instr.dst] =
+                static_cast<uint32_t>(regs[instr.c]) != 0 ? regs[instr.a] : regs[instr.b];
+            break;
+        }
+        case Instr::local_set:
+        {
+            regs[instr.dst] = regs[instr.a];
+            break;
+        }
+        case Instr::global_get:
+        {
+            const auto idx = instr.a;
+            assert(idx < instance.imported_globals.size() + instance.globals.size());
+            if (idx < instance.imported_globals.size())
+                regs[instr.dst] = *instance.imported_globals[idx].value;
+            else
+                regs[instr.dst] = instance.globals[idx - instance.imported_globals.size()];
+            break;
+        }
+        case Instr::global_set:
+        {
+            const auto idx = instr.a;
+            if (idx < instance.imported_globals.size())
+            {
+                assert(instance.imported_globals[idx].is_mutable);
+                *instance.imported_globals[idx].value = regs[instr.b];
+            }
+            else
+            {
+                const auto module_global_idx = idx - instance.imported_globals.size();
+                assert(module_global_idx < instance.module->globalsec.size());
+                assert(instance.module->globalsec[module_global_idx].is_mutable);
+                instance.globals[module_global_idx] = regs[instr.b];
+            }
+            break;
+        }
+        case Instr::i32_load:
+        {
+            if (!load_from_memory<uint32_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i64_load:
+        {
+            if (!load_from_memory<uint64_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i32_load8_s:
+        {
+            if (!load_from_memory<uint32_t, int8_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i32_load8_u:
+        {
+            if (!load_from_memory<uint32_t, uint8_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i32_load16_s:
+        {
+            if (!load_from_memory<uint32_t, int16_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i32_load16_u:
+        {
+            if (!load_from_memory<uint32_t, uint16_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i64_load8_s:
+        {
+            if (!load_from_memory<uint64_t, int8_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i64_load8_u:
+        {
+            if (!load_from_memory<uint64_t, uint8_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i64_load16_s:
+        {
+            if (!load_from_memory<uint64_t, int16_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i64_load16_u:
+        {
+            if (!load_from_memory<uint64_t, uint16_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i64_load32_s:
+        {
+            if (!load_from_memory<uint64_t, int32_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i64_load32_u:
+        {
+            if (!load_from_memory<uint64_t, uint32_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i32_store:
+        {
+            if (!store_into_memory<uint32_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i64_store:
+        {
+            if (!store_into_memory<uint64_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i32_store8:
+        case Instr::i64_store8:
+        {
+            if (!store_into_memory<uint8_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i32_store16:
+        case Instr::i64_store16:
+        {
+            if (!store_into_memory<uint16_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::i64_store32:
+        {
+            if (!store_into_memory<uint32_t>(memory, regs, instr))
+                return false;
+            break;
+        }
+        case Instr::memory_size:
+        {
+            regs[instr.dst] = static_cast<uint32_t>(memory.size() / PageSize);
+            break;
+        }
+        case Instr::memory_grow:
+        {
+            const auto delta = static_cast<uint32_t>(regs[instr.a]);
+            regs[instr.dst] = grow_memory(*memory.memory, delta, instance.memory_max_pages);
+            break;
+        }
+        case Instr::i32_eqz:
+        {
+            regs[instr.dst] = static_cast<uint32_t>(regs[instr.a]) == 0;
+            break;
+        }
+        case Instr::i32_eq:
+        {
+            comparison_op(regs, instr, std::equal_to<uint32_t>());
+            break;
+        }
+        case Instr::i32_ne:
+        {
+            comparison_op(regs, instr, std::not_equal_to<uint32_t>());
+            break;
+        }
+        case Instr::i32_lt_s:
+        {
+            comparison_op(regs, instr, std::less<int32_t>());
+            break;
+        }
+        case Instr::i32_lt_u:
+        {
+            comparison_op(regs, instr, std::less<uint32_t>());
+            break;
+        }
+        case Instr::i32_gt_s:
+        {
+            comparison_op(regs, instr, std::greater<int32_t>());
+            break;
+        }
+        case Instr::i32_gt_u:
+        {
+            comparison_op(regs, instr, std::greater<uint32_t>());
+            break;
+        }
+        case Instr::i32_le_s:
+        {
+            comparison_op(regs, instr, std::less_equal<int32_t>());
+            break;
+        }
+        case Instr::i32_le_u:
+        {
+            comparison_op(regs, instr, std::less_equal<uint32_t>());
+            break;
+        }
+        case Instr::i32_ge_s:
+        {
+            comparison_op(regs, instr, std::greater_equal<int32_t>());
+            break;
+        }
+        case Instr::i32_ge_u:
+        {
+            comparison_op(regs, instr, std::greater_equal<uint32_t>());
+            break;
+        }
+        case Instr::i64_eqz:
+        {
+            regs[instr.dst] = regs[instr.a] == 0;
+            break;
+        }
+        case Instr::i64_eq:
+        {
+            comparison_op(regs, instr, std::equal_to<uint64_t>());
+            break;
+        }
+        case Instr::i64_ne:
+        {
+            comparison_op(regs, instr, std::not_equal_to<uint64_t>());
+            break;
+        }
+        case Instr::i64_lt_s:
+        {
+            comparison_op(regs, instr, std::less<int64_t>());
+            break;
+        }
+        case Instr::i64_lt_u:
+        {
+            comparison_op(regs, instr, std::less<uint64_t>());
+            break;
+        }
+        case Instr::i64_gt_s:
+        {
+            comparison_op(regs, instr, std::greater<int64_t>());
+            break;
+        }
+        case Instr::i64_gt_u:
+        {
+            comparison_op(regs, instr, std::greater<uint64_t>());
+            break;
+        }
+        case Instr::i64_le_s:
+        {
+            comparison_op(regs, instr, std::less_equal<int64_t>());
+            break;
+        }
+        case Instr::i64_le_u:
+        {
+            comparison_op(regs, instr, std::less_equal<uint64_t>());
+            break;
+        }
+        case Instr::i64_ge_s:
+        {
+            comparison_op(regs, instr, std::greater_equal<int64_t>());
+            break;
+        }
+        case Instr::i64_ge_u:
+        {
+            comparison_op(regs, instr, std::greater_equal<uint64_t>());
+            break;
+        }
+        case Instr::i32_clz:
+        {
+            unary_op(regs, instr, clz32);
+            break;
+        }
+        case Instr::i32_ctz:
+        {
+            unary_op(regs, instr, ctz32);
+            break;
+        }
+        case Instr::i32_popcnt:
+        {
+            unary_op(regs, instr, popcnt32);
+            break;
+        }
+        case Instr::i32_add:
+        {
+            binary_op(regs, instr, std::plus<uint32_t>());
+            break;
+        }
+        case Instr::i32_sub:
+        {
+            binary_op(regs, instr, std::minus<uint32_t>());
+            break;
+        }
+        case Instr::i32_mul:
+        {
+            binary_op(regs, instr, std::multiplies<uint32_t>());
+            break;
+        }
+        case Instr::i32_div_s:
+        {
+            const auto rhs = static_cast<int32_t>(regs[instr.b]);
+            const auto lhs = static_cast<int32_t>(regs[instr.a]);
+            if (rhs == 0 || (lhs == std::numeric_limits<int32_t>::min() && rhs == -1))
+                return false;
+            binary_op(regs, instr, std::divides<int32_t>());
+            break;
+        }
+        case Instr::i32_div_u:
+        {
+            if (static_cast<uint32_t>(regs[instr.b]) == 0)
+                return false;
+            binary_op(regs, instr, std::divides<uint32_t>());
+            break;
+        }
+        case Instr::i32_rem_s:
+        {
+            const auto rhs = static_cast<int32_t>(regs[instr.b]);
+            if (rhs == 0)
+                return false;
+            const auto lhs = static_cast<int32_t>(regs[instr.a]);
+            if (lhs == std::numeric_limits<int32_t>::min() && rhs == -1)
+                regs[instr.dst] = 0;
+            else
+                binary_op(regs, instr, std::modulus<int32_t>());
+            break;
+        }
+        case Instr::i32_rem_u:
+        {
+            if (static_cast<uint32_t>(regs[instr.b]) == 0)
+                return false;
+            binary_op(regs, instr, std::modulus<uint32_t>());
+            break;
+        }
+        case Instr::i32_and:
+        {
+            binary_op(regs, instr, std::bit_and<uint32_t>());
+            break;
+        }
+        case Instr::i32_or:
+        {
+            binary_op(regs, instr, std::bit_or<uint32_t>());
+            break;
+        }
+        case Instr::i32_xor:
+        {
+            binary_op(regs, instr, std::bit_xor<uint32_t>());
+            break;
+        }
+        case Instr::i32_shl:
+        {
+            binary_op(regs, instr, shift_left<uint32_t>);
+            break;
+        }
+        case Instr::i32_shr_s:
+        {
+            binary_op(regs, instr, shift_right<int32_t>);
+            break;
+        }
+        case Instr::i32_shr_u:
+        {
+            binary_op(regs, instr, shift_right<uint32_t>);
+            break;
+        }
+        case Instr::i32_rotl:
+        {
+            binary_op(regs, instr, rotl<uint32_t>);
+            break;
+        }
+        case Instr::i32_rotr:
+        {
+            binary_op(regs, instr, rotr<uint32_t>);
+            break;
+        }
+        case Instr::i64_clz:
+        {
+            unary_op(regs, instr, clz64);
+            break;
+        }
+        case Instr::i64_ctz:
+        {
+            unary_op(regs, instr, ctz64);
+            break;
+        }
+        case Instr::i64_popcnt:
+        {
+            unary_op(regs, instr, popcnt64);
+            break;
+        }
+        case Instr::i64_add:
+        {
+            binary_op(regs, instr, std::plus<uint64_t>());
+            break;
+        }
+        case Instr::i64_sub:
+        {
+            binary_op(regs, instr, std::minus<uint64_t>());
+            break;
+        }
+        case Instr::i64_mul:
+        {
+            binary_op(regs, instr, std::multiplies<uint64_t>());
+            break;
+        }
+        case Instr::i64_div_s:
+        {
+            const auto rhs = static_cast<int64_t>(regs[instr.b]);
+            const auto lhs = static_cast<int64_t>(regs[instr.a]);
+            if (rhs == 0 || (lhs == std::numeric_limits<int64_t>::min() && rhs == -1))
+                return false;
+            binary_op(regs, instr, std::divides<int64_t>());
+            break;
+        }
+        case Instr::i64_div_u:
+        {
+            if (regs[instr.b] == 0)
+                return false;
+            binary_op(regs, instr, std::divides<uint64_t>());
+            break;
+        }
+        case Instr::i64_rem_s:
+        {
+            const auto rhs = static_cast<int64_t>(regs[instr.b]);
+            if (rhs == 0)
+                return false;
+            const auto lhs = static_cast<int64_t>(regs[instr.a]);
+            if (lhs == std::numeric_limits<int64_t>::min() && rhs == -1)
+                regs[instr.dst] = 0;
+            else
+                binary_op(regs, instr, std::modulus<int64_t>());
+            break;
+        }
+        case Instr::i64_rem_u:
+        {
+            if (regs[instr.b] == 0)
+                return false;
+            binary_op(regs, instr, std::modulus<uint64_t>());
+            break;
+        }
+        case Instr::i64_and:
+        {
+            binary_op(regs, instr, std::bit_and<uint64_t>());
+            break;
+        }
+        case Instr::i64_or:
+        {
+            binary_op(regs, instr, std::bit_or<uint64_t>());
+            break;
+        }
+        case Instr::i64_xor:
+        {
+            binary_op(regs, instr, std::bit_xor<uint64_t>());
+            break;
+        }
+        case Instr::i64_shl:
+        {
+            binary_op(regs, instr, shift_left<uint64_t>);
+            break;
+        }
+        case Instr::i64_shr_s:
+        {
+            binary_op(regs, instr, shift_right<int64_t>);
+            break;
+        }
+        case Instr::i64_shr_u:
+        {
+            binary_op(regs, instr, shift_right<uint64_t>);
+            break;
+        }
+        case Instr::i64_rotl:
+        {
+            binary_op(regs, instr, rotl<uint64_t>);
+            break;
+        }
+        case Instr::i64_rotr:
+        {
+            binary_op(regs, instr, rotr<uint64_t>);
+            break;
+        }
+        case Instr::i32_wrap_i64:
+        {
+            regs[instr.dst] = static_cast<uint32_t>(regs[instr.a]);
+            break;
+        }
+        case Instr::i64_extend_i32_s:
+        {
+            const auto value = static_cast<int32_t>(regs[instr.a]);
+            regs[instr.dst] = static_cast<uint64_t>(int64_t{value});
+            break;
+        }
+        default:
+            assert(false);
+            break;
+        }
+    }
+}
+
+/// Updates the memory of the JIT context after it may have been grown or replaced.
+void update_jit_memory(JitContext& context) noexcept
+{
+    const auto& memory = context.instance->memory;
+    context.memory_data = memory ? memory->data() : nullptr;
+    context.memory_size = memory ? memory->size() : 0;
+    context.memory_dirty_pages = memory ? memory->dirty_pages() : nullptr;
+}
+
+/// Calls the function from the compiled code in the same way as the register interpreter does.
+uint64_t* jit_invoke_function(JitContext* context, uint64_t* regs, const FunctionDescriptor& func,
+    uint32_t args_reg, uint32_t num_registers) noexcept
+{
+    auto& instance = *context->instance;
+    auto& stack = instance.value_stack;
+    const auto frame_base = static_cast<size_t>(regs - stack.data());
+    const auto frame_end = frame_base + num_registers;
+
+    // The arguments in the registers starting at args_reg become the top of the stack.
+    stack.resize(frame_base + args_reg + func.num_inputs);
+    try
+    {
+        if (!invoke_function(func, instance))
+            return nullptr;
+    }
+    catch (...)
+    {
+        // The exception cannot be propagated through the compiled code.
+        instance.jit_exception = std::current_exception();
+        return nullptr;
+    }
+
+    // The result is left in the register args_reg. The callee may have reallocated
+    // the value stack or grown the memory.
+    stack.resize(frame_end);
+    update_jit_memory(*context);
+    return stack.data() + frame_base;
+}
+
+uint64_t* jit_call(JitContext* context, uint64_t* regs, uint32_t func_idx, uint32_t args_reg,
+    uint32_t num_registers) noexcept
+{
+    const auto& instance = *context->instance;
+    assert(func_idx < instance.functions.size());
+    return jit_invoke_function(
+        context, regs, instance.functions[func_idx], args_reg, num_registers);
+}
+
+uint64_t* jit_call_indirect(JitContext* context, uint64_t* regs, uint32_t type_idx,
+    uint32_t args_reg, uint32_t num_registers, uint64_t elem_idx) noexcept
+{
+    const auto& instance = *context->instance;
+    assert(instance.table != nullptr);
+    if (elem_idx >= instance.table->size())
+        return nullptr;
+    const auto called_func_idx = (*instance.table)[elem_idx];
+    assert(called_func_idx < instance.functions.size());
+    const auto& called_func = instance.functions[called_func_idx];
+
+    // check actual type against expected type
+    assert(type_idx < instance.module->typesec.size());
+    if (called_func.type_id != instance.type_ids[type_idx])
+        return nullptr;
+
+    return jit_invoke_function(context, regs, called_func, args_reg, num_registers);
+}
+
+uint64_t jit_memory_grow(JitContext* context, uint32_t delta) noexcept
+{
+    auto& instance = *context->instance;
+    assert(instance.memory != nullptr);
+    const auto ret = grow_memory(*instance.memory, delta, instance.memory_max_pages);
+    update_jit_memory(*context);
+    return ret;
+}
+
+constexpr JitRuntime jit_runtime{jit_call, jit_call_indirect, jit_memory_grow};
+
+/// Executes the machine code @a function of the wasm function of the given code index
+/// in the frame starting at @a frame_base of the instance's value stack.
+///
+/// The frame is laid out and replaced with the function result as in execute_register_code().
+/// The exceptions thrown by the called imported functions are rethrown.
+///
+/// @return false if the execution trapped.
+bool execute_jit_code(
+    Instance& instance, size_t code_idx, size_t frame_base, JitCode::Function function)
+{
+    assert(code_idx < instance.register_code.size());
+
+    const auto& code = instance.register_code[code_idx];
+    auto& stack = instance.value_stack;
+
+    // The registers not being arguments are zero-initialized: this initializes the locals.
+    const auto frame_end = frame_base + code.num_registers;
+    if (frame_end > stack.capacity())
+        stack.reserve(std::max(frame_end, 2 * stack.capacity()));
+    const auto args_end = stack.size();
+    stack.resize(frame_end);
+    std::fill(stack.data() + args_end, stack.data() + frame_end, uint64_t{0});
+
+    auto* const regs = stack.data() + frame_base;
+    std::copy(code.constants.begin(), code.constants.end(), regs + code.constants_base);
+
+    JitContext context;
+    context.instance = &instance;
+    update_jit_memory(context);
+
+    if (!function(&context, regs))
+    {
+        if (instance.jit_exception)
+            std::rethrow_exception(std::exchange(instance.jit_exception, nullptr));
+        return false;
+    }
+
+    stack.resize(frame_base + get_code_function(instance, code_idx).num_outputs);
+    return true;
+}
+
+/// Translates the function of the given code index to the register code,
+/// unless it is already translated.
+void prepare_register_code(Instance& instance, size_t code_idx)
+{
+    if (instance.register_code.size() != get_code_count(*instance.module))
+        instance.register_code.resize(get_code_count(*instance.module));
+    // The translated code always ends with the return instruction.
+    if (instance.register_code[code_idx].instructions.empty())
+        instance.register_code[code_idx] = translate_to_register_code(*instance.module, code_idx);
+}
+
+/// Executes the wasm function of the given code index in its current tier, after promoting it
+/// if its hotness has reached the instance's thresholds.
+template <bool Guarded>
+bool execute_tiered_code(Instance& instance, size_t code_idx, size_t frame_base)
+{
+    auto& profile = instance.function_profiles[code_idx];
+    const auto hotness = profile.calls + profile.back_edges;
+    const auto& thresholds = instance.tiering_thresholds;
+
+    if (profile.tier == Interpreter::stack && hotness >= thresholds.registers)
+    {
+        prepare_register_code(instance, code_idx);
+        profile.tier = Interpreter::registers;
+        ++instance.tiering_stats.promoted_to_registers;
+    }
+    if (profile.tier == Interpreter::registers && hotness >= thresholds.jit && is_jit_available())
+    {
+        if (instance.tiered_jit_code.size() != get_code_count(*instance.module))
+            instance.tiered_jit_code.resize(get_code_count(*instance.module));
+        instance.tiered_jit_code[code_idx] =
+            compile_function_to_machine_code(instance, code_idx, jit_runtime);
+        profile.tier = Interpreter::jit;
+        ++instance.tiering_stats.promoted_to_jit;
+    }
+
+    switch (profile.tier)
+    {
+    case Interpreter::registers:
+        return execute_register_code<Guarded>(instance, code_idx, frame_base);
+    case Interpreter::jit:
+        return execute_jit_code(
+            instance, code_idx, frame_base, instance.tiered_jit_code[code_idx].function(0));
+    default:
+        return execute_code<Guarded>(instance, code_idx, frame_base);
+    }
+}
+}  // namespace
+
+#undef DISPATCH_CASE
+#undef DISPATCH_DEFAULT
+#undef DISPATCH_NEXT
+#if FIZZY_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint64_t> args)
+{
+    assert(func_idx < instance.functions.size());
+    const auto& func = instance.functions[func_idx];
+    if (func.external_function != nullptr)
+        return (*func.external_function)(instance, std::move(args));
+
+    // Start a new frame on top of the value stack. It may be already in use in case
+    // this is a nested execution started by an imported function.
+    auto& stack = instance.value_stack;
+    const ScopedFrame frame{stack};
+    stack.insert(stack.end(), args.begin(), args.end());
+
+    const bool trapped = !invoke_top_level_function(func, instance, frame.base());
+
+    std::vector<uint64_t> result;
+    if (!trapped)
+        result.assign(stack.begin() + static_cast<ptrdiff_t>(frame.base()), stack.end());
+    return {trapped, std::move(result)};
+}
+
+ExecutionStatus execute(
+    Instance& instance, FuncIdx func_idx, span<const uint64_t> args, span<uint64_t> results)
+{
+    if (func_idx >= instance.functions.size())
+        return ExecutionStatus::invalid_arguments;
+    const auto& func = instance.functions[func_idx];
+    if (args.size() != func.num_inputs || results.size() < func.num_outputs)
+        return ExecutionStatus::invalid_arguments;
+
+    // Start a new frame on top of the value stack, as execute() does.
+    auto& stack = instance.value_stack;
+    const ScopedFrame frame{stack};
+    stack.insert(stack.end(), args.begin(), args.end());
+
+    const bool trapped = !invoke_top_level_function(func, instance, frame.base());
+
+    if (!trapped)
+        std::copy_n(stack.begin() + static_cast<ptrdiff_t>(frame.base()), func.num_outputs,
+            results.begin());
+    return trapped ? ExecutionStatus::trapped : ExecutionStatus::success;
+}
+
+execution_result execute(const Module& module, FuncIdx func_idx, std::vector<uint64_t> args)
+{
+    // The instance does not outlive the module, so it references the module without owning it.
+    auto instance = instantiate(std::shared_ptr<const Module>{std::shared_ptr<void>{}, &module});
+    return execute(instance, func_idx, std::move(args));
+}
+
+void set_interpreter(Instance& instance, Interpreter interpreter)
+{
+    if (interpreter == Interpreter::registers || interpreter == Interpreter::jit)
+    {
+        for (size_t code_idx = 0; code_idx < get_code_count(*instance.module); ++code_idx)
+            prepare_register_code(instance, code_idx);
+    }
+    if (interpreter == Interpreter::jit && instance.jit_code.empty())
+    {
+        instance.jit_code = compile_to_machine_code(instance, jit_runtime);
+        if (instance.jit_code.empty())
+            interpreter = Interpreter::registers;
+    }
+    instance.interpreter = interpreter;
+}
+
+bool enable_guarded_memory(Instance& instance)
+{
+    if (instance.memory == nullptr)
+        return false;
+    if (instance.memory->is_guarded())
+        return true;
+
+    // The imported memory is owned by the host.
+    const auto& imports = instance.module->importsec;
+    if (std::any_of(imports.begin(), imports.end(),
+            [](const Import& import) { return import.kind == ExternalKind::Memory; }))
+        return false;
+
+    auto guarded = LinearMemory::create_guarded(instance.memory->size());
+    if (!guarded)
+        return false;
+
+    std::memcpy(guarded->data(), instance.memory->data(), instance.memory->size());
+    *instance.memory = std::move(*guarded);
+    return true;
+}
+
+InstanceSnapshot take_snapshot(Instance& instance)
+{
+    InstanceSnapshot snapshot;
+    if (instance.memory != nullptr)
+        snapshot.memory = instance.memory->snapshot();
+    snapshot.globals = instance.globals;
+    return snapshot;
+}
+
+bool restore_snapshot(Instance& instance, const InstanceSnapshot& snapshot)
+{
+    // The snapshot of another instance may not fit.
+    if (snapshot.globals.size() != instance.globals.size() ||
+        snapshot.memory.has_value() != (instance.memory != nullptr))
+        return false;
+
+    if (snapshot.memory.has_value() && !instance.memory->restore(*snapshot.memory))
+        return false;
+    std::copy(snapshot.globals.begin(), snapshot.globals.end(), instance.globals.begin());
+    return true;
 }
 
 std::optional<FuncIdx> find_exported_function(const Module& module, std::string_view name)
@@ -1,8 +1,14 @@
 #pragma once
 
 #include "exceptions.hpp"
+#include "jit.hpp"
+#include "linear_memory.hpp"
+#include "register_code.hpp"
+#include "span.hpp"
+#include "stack.hpp"
 #include "types.hpp"
 #include <cstdint>
+#include <exception>
 #include <functional>
 #include <memory>
 
@@ -18,9 +24,52 @@ struct execution_result
     std::vector<uint64_t> stack;
 };
 
+// The status of an execution reported without allocating the result.
+enum class ExecutionStatus : uint8_t
+{
+    success,
+    trapped,
+    // The function was not executed: the function index, the number of the arguments or
+    // the size of the results buffer does not match the function.
+    invalid_arguments,
+};
+
 struct Instance;
 
-using ExternalFunction = std::function<execution_result(Instance&, std::vector<uint64_t>)>;
+// The host function called with the arguments in place on the value stack of the instance.
+// The arguments are valid only until the host function executes any function of the instance,
+// the value stack may be reallocated. The result, if the function type has one, is written to
+// @a result, which remains valid for the whole call; the caller places it on the value stack
+// after the host function returns.
+using HostFunctionPtr = ExecutionStatus (*)(
+    void* context, Instance& instance, const uint64_t* args, uint64_t* result);
+
+// The imported function called with no allocations and no type erasure.
+struct HostFunction
+{
+    HostFunctionPtr function = nullptr;
+    // Passed to the function, e.g. the host's state.
+    void* context = nullptr;
+    // The type of the function, if known. Checked against the type of the import
+    // by instantiate().
+    const FuncType* type = nullptr;
+};
+
+// The imported function: either the std::function taking the arguments in the vector or,
+// if constructed from the HostFunction, the HostFunction.
+class ExternalFunction : public std::function<execution_result(Instance&, std::vector<uint64_t>)>
+{
+    using function_type = std::function<execution_result(Instance&, std::vector<uint64_t>)>;
+
+public:
+    using function_type::function_type;
+
+    ExternalFunction(HostFunction host) noexcept  // NOLINT(google-explicit-constructor)
+      : host_function{host}
+    {}
+
+    HostFunction host_function;
+};
 
 using table_ptr = std::unique_ptr<std::vector<FuncIdx>, void (*)(std::vector<FuncIdx>*)>;
 
@@ -32,7 +81,7 @@ struct ExternalTable
 
 struct ExternalMemory
 {
-    bytes* data = nullptr;
+    LinearMemory* data = nullptr;
     Limits limits;
 };
 
@@ -42,16 +91,76 @@ struct ExternalGlobal
     bool is_mutable = false;
 };
 
-using bytes_ptr = std::unique_ptr<bytes, void (*)(bytes*)>;
+using memory_ptr = std::unique_ptr<LinearMemory, void (*)(LinearMemory*)>;
+
+// The interpreter executing the functions of an instance.
+enum class Interpreter
+{
+    // Interprets the parsed stack machine code.
+    stack,
+    // Interprets the code translated to the register-based form.
+    registers,
+    // Executes the register code compiled to x86-64 machine code by the baseline JIT compiler.
+    jit,
+    // Starts every function in the stack interpreter and promotes the frequently executed ones
+    // to the register interpreter and then to machine code, see TieringThresholds.
+    tiered,
+};
+
+// The function hotness (the number of calls plus the number of taken loop back-edges)
+// at which Interpreter::tiered promotes a function to the next tier. The promotion takes effect
+// on the next call of the function.
+struct TieringThresholds
+{
+    uint64_t registers = 16;
+    uint64_t jit = 1024;
+};
+
+// The execution profile of a function, collected by the stack and the register interpreters.
+struct FunctionProfile
+{
+    uint64_t calls = 0;
+    uint64_t back_edges = 0;
+    // The interpreter currently executing the function under Interpreter::tiered.
+    Interpreter tier = Interpreter::stack;
+};
+
+// The statistics of the tiered execution.
+struct TieringStats
+{
+    size_t promoted_to_registers = 0;
+    size_t promoted_to_jit = 0;
+};
+
+// The function of an instance, resolved at the instantiation so that the calls need no lookups
+// of the function's kind and type in the module.
+struct FunctionDescriptor
+{
+    TypeIdx type_idx = 0;
+    // The canonical ID of the function's type, see Instance::type_ids.
+    uint32_t type_id = 0;
+    uint32_t num_inputs = 0;
+    uint32_t num_outputs = 0;
+    // The code index of the function defined in the module.
+    uint32_t code_idx = 0;
+    // The host function of the imported function and its context, null for the function defined
+    // in the module. The std::function imports are called by the adapter taking their descriptor
+    // as the context.
+    HostFunctionPtr host_function = nullptr;
+    void* host_context = nullptr;
+    // The imported std::function, null for the HostFunction imports and the defined functions.
+    const ExternalFunction* external_function = nullptr;
+};
 
 // The module instance.
 struct Instance
 {
-    Module module;
-    // Memory is either allocated and owned by the instance or imported as already allocated bytes
+    // The module is immutable and shared by all its instances.
+    std::shared_ptr<const Module> module;
+    // Memory is either allocated and owned by the instance or imported as already allocated memory
     // and owned externally.
     // For these cases unique_ptr would either have a normal deleter or noop deleter respectively
-    bytes_ptr memory = {nullptr, [](bytes*) {}};
+    memory_ptr memory = {nullptr, [](LinearMemory*) {}};
     size_t memory_max_pages = 0;
     // Table is either allocated and owned by the instance or imported and owned externally.
     // For these cases unique_ptr would either have a normal deleter or noop deleter respectively.
@@ -60,18 +169,127 @@ struct Instance
     std::vector<ExternalFunction> imported_functions;
     std::vector<TypeIdx> imported_function_types;
     std::vector<ExternalGlobal> imported_globals;
+    // The canonical IDs of the module's types, by type index: the index of the first type equal
+    // to the type. The types are equal if and only if their IDs are, so the signature check
+    // of call_indirect is a single integer comparison.
+    std::vector<uint32_t> type_ids;
+    // The descriptors of all the functions, the imported ones first, by function index.
+    // Built once by instantiate(), the descriptors are referenced by their addresses.
+    std::vector<FunctionDescriptor> functions;
+    // The value stack shared by all nested function calls executed in this instance.
+    // Each call frame occupies a continuous part of it: the arguments, the locals and
+    // the operand stack of the function. It may be reserved up front to avoid reallocations.
+    ValueStack value_stack;
+    // The interpreter executing the module's functions. Selected with set_interpreter().
+    Interpreter interpreter = Interpreter::stack;
+    // The register code of the module's functions, translated when the register interpreter
+    // is selected.
+    std::vector<RegisterCode> register_code;
+    // The machine code of the module's functions, compiled when the JIT is selected.
+    JitCode jit_code;
+    // The exception thrown by a function called from the compiled code. The compiled code
+    // reports it as a trap and it is rethrown when the compiled code returns. It is kept here,
+    // not in the frames of the compiled code, which the guard fault recovery may jump over.
+    std::exception_ptr jit_exception;
+    // The execution profiles of the module's functions, by code index.
+    std::vector<FunctionProfile> function_profiles;
+    // The promotion thresholds of Interpreter::tiered. They can be changed at any time.
+    TieringThresholds tiering_thresholds;
+    TieringStats tiering_stats;
+    // The machine code of the functions promoted to the JIT tier, by code index.
+    std::vector<JitCode> tiered_jit_code;
+};
+
+// The state of an instance captured by take_snapshot().
+struct InstanceSnapshot
+{
+    std::optional<MemorySnapshot> memory;
+    // The values of the instance's own globals.
+    std::vector<uint64_t> globals;
 };
 
 // Instantiate a module.
+// The module is shared with the instance, so a module can be instantiated many times, also
+// concurrently from multiple threads, without copying it.
+// The module not validated by the parser (built by hand) must own the buffers its names,
+// data segments and custom sections point into, see copy_referenced_data().
+Instance instantiate(std::shared_ptr<const Module> module,
+    std::vector<ExternalFunction> imported_functions = {},
+    std::vector<ExternalTable> imported_tables = {},
+    std::vector<ExternalMemory> imported_memories = {},
+    std::vector<ExternalGlobal> imported_globals = {});
+
+// Instantiate a module, taking the ownership of it.
+// The module built by hand referencing the buffers it does not own gets the copy of them,
+// so they only need to be alive during the call (e.g. the string literals of the names).
 Instance instantiate(Module module, std::vector<ExternalFunction> imported_functions = {},
     std::vector<ExternalTable> imported_tables = {},
     std::vector<ExternalMemory> imported_memories = {},
     std::vector<ExternalGlobal> imported_globals = {});
 
+// Instantiate a module like instantiate(), but report the failure by the error instead of
+// the exception. The error message is not built, error_message() builds it when needed.
+// Returns no instance if the module cannot be instantiated, also if the start function traps.
+std::optional<Instance> try_instantiate(std::shared_ptr<const Module> module, Error& error,
+    std::vector<ExternalFunction> imported_functions = {},
+    std::vector<ExternalTable> imported_tables = {},
+    std::vector<ExternalMemory> imported_memories = {},
+    std::vector<ExternalGlobal> imported_globals = {}) noexcept;
+
+// Instantiate a module like try_instantiate(), taking the ownership of it and copying
+// the buffers like instantiate().
+std::optional<Instance> try_instantiate(Module module, Error& error,
+    std::vector<ExternalFunction> imported_functions = {},
+    std::vector<ExternalTable> imported_tables = {},
+    std::vector<ExternalMemory> imported_memories = {},
+    std::vector<ExternalGlobal> imported_globals = {}) noexcept;
+
+// Select the interpreter executing the instance's functions.
+// Selecting Interpreter::registers translates the module's code on the first use.
+// Selecting Interpreter::jit also compiles it to machine code on the first use. Where the JIT
+// compiler is not available (other than x86-64 platforms) Interpreter::registers is selected.
+// Selecting Interpreter::tiered translates and compiles the functions only when promoted;
+// where the JIT compiler is not available they are not promoted further than the register code.
+// The translation parses all the function bodies of the lazily parsed module, so it throws
+// parser_error if any of them is not valid.
+void set_interpreter(Instance& instance, Interpreter interpreter);
+
+// Move the instance's own memory to the guarded memory, so the memory accesses need no bounds
+// checks: the out-of-bounds accesses fault on the guard pages and are turned into traps.
+// Must be called before selecting Interpreter::jit for the compiled code to benefit from it,
+// and not during the execution of the instance's functions.
+// Returns false and leaves the memory unchanged if the memory is imported or if the guarded memory
+// is not available (not supported on the platform or the address space is limited).
+bool enable_guarded_memory(Instance& instance);
+
+// Capture the memory and the own globals of the instance, so the instance can be reset to this
+// state with restore_snapshot(). The imported globals and the table are not captured.
+// The memory writes are tracked since, the host functions writing to the memory must mark
+// the writes with LinearMemory::mark_dirty().
+InstanceSnapshot take_snapshot(Instance& instance);
+
+// Restore the state of the instance captured by take_snapshot().
+// For the last snapshot taken only the memory pages written since the snapshot was taken or
+// restored are copied, so the cost does not depend on the memory size.
+// Returns false if the memory cannot be restored or the snapshot does not match the instance
+// (it has a different number of globals or no memory where the instance has one, or vice versa).
+bool restore_snapshot(Instance& instance, const InstanceSnapshot& snapshot);
+
 // Execute a function on an instance.
+// The function bodies of the lazily parsed module are parsed on their first call, so it throws
+// parser_error if the called body is not valid.
 execution_result execute(Instance& instance, FuncIdx func_idx, std::vector<uint64_t> args);
 
+// Execute a function on an instance like execute(), but without the heap allocations, unless
+// the function's frames do not fit the capacity of the value stack or a host function is called.
+// The results are written to the beginning of the results buffer. Returns
+// ExecutionStatus::invalid_arguments if the number of the arguments does not match the function
+// type or the buffer does not fit the results (a function has at most one result).
+ExecutionStatus execute(
+    Instance& instance, FuncIdx func_idx, span<const uint64_t> args, span<uint64_t> results);
+
 // TODO: remove this helper
+// The module is not copied, it only must not be modified during the execution.
 execution_result execute(const Module& module, FuncIdx func_idx, std::vector<uint64_t> args);
 
 // Find exported function index by name.
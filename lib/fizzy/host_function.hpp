@@ -0,0 +1,105 @@
+#pragma once
+
+#include "execute.hpp"
+#include "types.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace fizzy
+{
+namespace detail
+{
+/// The wasm value type of the C++ type of a host function's parameter or result.
+template <typename T>
+constexpr ValType valtype_of() noexcept
+{
+    static_assert(std::is_same_v<T, uint32_t> || std::is_same_v<T, int32_t> ||
+                      std::is_same_v<T, uint64_t> || std::is_same_v<T, int64_t>,
+        "the host function parameters and result must be 32-bit or 64-bit integers");
+    return sizeof(T) == sizeof(uint32_t) ? ValType::i32 : ValType::i64;
+}
+
+/// The wasm result types of the C++ result type R, none for void.
+template <typename R>
+std::vector<ValType> outputs_of()
+{
+    if constexpr (std::is_void_v<R>)
+        return {};
+    else
+        return {valtype_of<R>()};
+}
+
+/// Reads the argument of type T from the value stack item.
+template <typename T>
+inline T from_value(uint64_t value) noexcept
+{
+    // The i32 values are stored zero-extended.
+    if constexpr (sizeof(T) == sizeof(uint32_t))
+        return static_cast<T>(static_cast<uint32_t>(value));
+    else
+        return static_cast<T>(value);
+}
+
+/// Converts the result of type T to the value stack item.
+template <typename T>
+inline uint64_t to_value(T value) noexcept
+{
+    if constexpr (sizeof(T) == sizeof(uint32_t))
+        return static_cast<uint32_t>(value);
+    else
+        return static_cast<uint64_t>(value);
+}
+
+template <typename F>
+struct host_function_traits;
+
+template <typename R, typename... Args>
+struct host_function_traits<R (*)(Instance&, Args...)>
+{
+    /// The wasm type of the function, built once for all the bindings.
+    static inline const FuncType type{{valtype_of<Args>()...}, outputs_of<R>()};
+
+    template <auto Function, size_t... I>
+    static void call(Instance& instance, [[maybe_unused]] const uint64_t* args,
+        [[maybe_unused]] uint64_t* result, std::index_sequence<I...>)
+    {
+        if constexpr (std::is_void_v<R>)
+            Function(instance, from_value<Args>(args[I])...);
+        else
+            *result = to_value(Function(instance, from_value<Args>(args[I])...));
+    }
+
+    /// The HostFunction calling the Function, the context is not used.
+    template <auto Function>
+    static ExecutionStatus thunk(void*, Instance& instance, const uint64_t* args, uint64_t* result)
+    {
+        call<Function>(instance, args, result, std::index_sequence_for<Args...>{});
+        return ExecutionStatus::success;
+    }
+};
+
+template <typename R, typename... Args>
+struct host_function_traits<R (*)(Instance&, Args...) noexcept>
+  : host_function_traits<R (*)(Instance&, Args...)>
+{};
+}  // namespace detail
+
+/// Binds the C++ function as the imported function, e.g.
+///
+///     uint32_t f(Instance&, uint32_t, uint64_t);
+///     instantiate(module, {bind_host_function<f>()});
+///
+/// The parameters and the result must be 32-bit (i32) or 64-bit (i64) integers, the result may be
+/// void. The arguments are converted and the function is called by the thunk generated at
+/// compile time. The function type is checked against the type of the import by instantiate(),
+/// which throws instantiate_error if they differ.
+template <auto Function>
+HostFunction bind_host_function() noexcept
+{
+    using traits = detail::host_function_traits<decltype(Function)>;
+    return {traits::template thunk<Function>, nullptr, &traits::type};
+}
+}  // namespace fizzy
@@ -0,0 +1,996 @@
+#include "jit.hpp"
+#include "execute.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <utility>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#define FIZZY_JIT_X86_64 1
+#endif
+
+namespace fizzy
+{
+JitCode::JitCode(uint8_t* memory, size_t size, std::vector<size_t> function_offsets) noexcept
+  : m_memory{memory}, m_size{size}, m_function_offsets{std::move(function_offsets)}
+{}
+
+JitCode::JitCode(JitCode&& other) noexcept
+  : m_memory{std::exchange(other.m_memory, nullptr)},
+    m_size{std::exchange(other.m_size, 0)},
+    m_function_offsets{std::move(other.m_function_offsets)}
+{}
+
+JitCode& JitCode::operator=(JitCode&& other) noexcept
+{
+    JitCode tmp{std::move(other)};
+    std::swap(m_memory, tmp.m_memory);
+    std::swap(m_size, tmp.m_size);
+    std::swap(m_function_offsets, tmp.m_function_offsets);
+    return *this;
+}
+
+JitCode::~JitCode()
+{
+#if FIZZY_JIT_X86_64
+    if (m_memory != nullptr)
+        munmap(m_memory, m_size);
+#endif
+}
+
+JitCode::Function JitCode::function(size_t code_idx) const noexcept
+{
+    assert(code_idx < m_function_offsets.size());
+    const auto address = reinterpret_cast<uintptr_t>(m_memory + m_function_offsets[code_idx]);
+    return reinterpret_cast<Function>(address);
+}
+
+#if FIZZY_JIT_X86_64
+namespace
+{
+enum Reg : uint8_t
+{
+    rax,
+    rcx,
+    rdx,
+    rbx,
+    rsp,
+    rbp,
+    rsi,
+    rdi,
+    r8,
+    r9,
+    r10,
+    r11,
+    r12,
+    r13,
+    r14,
+    r15,
+};
+
+/// The condition codes of the jcc and setcc instructions.
+enum Cond : uint8_t
+{
+    below = 0x2,
+    above_equal = 0x3,
+    equal = 0x4,
+    not_equal = 0x5,
+    below_equal = 0x6,
+    above = 0x7,
+    less = 0xc,
+    greater_equal = 0xd,
+    less_equal = 0xe,
+    greater = 0xf,
+};
+
+constexpr uint8_t dirty_page_shift = 12;
+static_assert(LinearMemory::DirtyPageSize == 1 << dirty_page_shift);
+
+// The registers of the fixed use in the compiled code. All are callee-saved.
+constexpr Reg regs_base = rbx;    // The frame registers.
+constexpr Reg memory_base = r13;  // JitContext::memory_data.
+constexpr Reg memory_end = r14;   // JitContext::memory_size.
+constexpr Reg context = r15;      // The JitContext.
+
+/// The x86-64 machine code emitter. Emits only the encodings used by the compiler.
+class Assembler
+{
+public:
+    std::vector<uint8_t> code;
+
+    size_t size() const noexcept { return code.size(); }
+
+    void emit(std::initializer_list<uint8_t> bytes) { code.insert(code.end(), bytes); }
+
+    void emit32(uint32_t value)
+    {
+        for (size_t i = 0; i < sizeof(value); ++i)
+            code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    void emit64(uint64_t value)
+    {
+        for (size_t i = 0; i < sizeof(value); ++i)
+            code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    /// Emits the REX prefix, if it is needed.
+    void rex(bool w, unsigned reg, unsigned index, unsigned base)
+    {
+        const auto prefix = static_cast<uint8_t>(
+            0x40 | (w ? 8 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3));
+        if (prefix != 0x40)
+            code.push_back(prefix);
+    }
+
+    /// Emits the instruction with the register operands: op reg, rm.
+    void rr(bool w, std::initializer_list<uint8_t> opcode, unsigned reg, unsigned rm)
+    {
+        rex(w, reg, 0, rm);
+        emit(opcode);
+        code.push_back(static_cast<uint8_t>(0xc0 | (reg & 7) << 3 | (rm & 7)));
+    }
+
+    /// Emits the instruction with the memory operand: op reg, [base + disp].
+    /// The base must not be rsp or r12.
+    void rm(
+        bool w, std::initializer_list<uint8_t> opcode, unsigned reg, unsigned base, uint32_t disp)
+    {
+        assert((base & 7) != rsp);
+        rex(w, reg, 0, base);
+        emit(opcode);
+        if (disp < 0x80)
+        {
+            code.push_back(static_cast<uint8_t>(0x40 | (reg & 7) << 3 | (base & 7)));
+            code.push_back(static_cast<uint8_t>(disp));
+        }
+        else
+        {
+            code.push_back(static_cast<uint8_t>(0x80 | (reg & 7) << 3 | (base & 7)));
+            emit32(disp);
+        }
+    }
+
+    /// Emits the instruction accessing the frame register: op reg, [regs_base + 8 * idx].
+    void frame(bool w, std::initializer_list<uint8_t> opcode, unsigned reg, uint32_t idx)
+    {
+        rm(w, opcode, reg, regs_base, idx * sizeof(uint64_t));
+    }
+
+    /// Emits the instruction accessing the wasm memory: op reg, [memory_base + rax].
+    void memory(bool w, std::initializer_list<uint8_t> opcode, unsigned reg)
+    {
+        rex(w, reg, rax, memory_base);
+        emit(opcode);
+        code.push_back(static_cast<uint8_t>(0x44 | (reg & 7) << 3));
+        code.push_back(static_cast<uint8_t>((rax << 3) | (memory_base & 7)));
+        code.push_back(0);
+    }
+
+    void load(bool w, unsigned reg, uint32_t idx) { frame(w, {0x8b}, reg, idx); }
+
+    void store(unsigned reg, uint32_t idx) { frame(true, {0x89}, reg, idx); }
+
+    void mov(unsigned dst, unsigned src) { rr(true, {0x89}, src, dst); }
+
+    /// Moves the 32-bit immediate zero-extended to the register.
+    void mov_imm(unsigned reg, uint32_t imm)
+    {
+        rex(false, 0, 0, reg);
+        code.push_back(static_cast<uint8_t>(0xb8 | (reg & 7)));
+        emit32(imm);
+    }
+
+    void mov_imm64(unsigned reg, uint64_t imm)
+    {
+        rex(true, 0, 0, reg);
+        code.push_back(static_cast<uint8_t>(0xb8 | (reg & 7)));
+        emit64(imm);
+    }
+
+    void test(bool w, unsigned reg) { rr(w, {0x85}, reg, reg); }
+
+    /// Sets rax to 1 if the condition is met, to 0 otherwise.
+    void set(Cond cond)
+    {
+        emit({0x0f, static_cast<uint8_t>(0x90 | cond), 0xc0});  // setcc al
+        emit({0x0f, 0xb6, 0xc0});                               // movzx eax, al
+    }
+
+    void push(unsigned reg)
+    {
+        rex(false, 0, 0, reg);
+        code.push_back(static_cast<uint8_t>(0x50 | (reg & 7)));
+    }
+
+    void pop(unsigned reg)
+    {
+        rex(false, 0, 0, reg);
+        code.push_back(static_cast<uint8_t>(0x58 | (reg & 7)));
+    }
+
+    template <typename Fn>
+    void call(Fn* fn)
+    {
+        mov_imm64(rax, reinterpret_cast<uintptr_t>(fn));
+        emit({0xff, 0xd0});  // call rax
+    }
+
+    /// Emits the jump with the 32-bit displacement to be patched.
+    /// @return The offset of the displacement.
+    size_t jmp()
+    {
+        emit({0xe9});
+        emit32(0);
+        return size() - sizeof(uint32_t);
+    }
+
+    /// Emits the conditional jump with the 32-bit displacement to be patched.
+    /// @return The offset of the displacement.
+    size_t jcc(Cond cond)
+    {
+        emit({0x0f, static_cast<uint8_t>(0x80 | cond)});
+        emit32(0);
+        return size() - sizeof(uint32_t);
+    }
+
+    /// Sets the displacement at the given offset to point to the target offset.
+    void patch(size_t displacement_offset, size_t target)
+    {
+        const auto rel = static_cast<uint32_t>(target - (displacement_offset + sizeof(uint32_t)));
+        std::memcpy(&code[displacement_offset], &rel, sizeof(rel));
+    }
+};
+
+uint64_t clz32(uint64_t value) noexcept
+{
+    const auto x = static_cast<uint32_t>(value);
+    return x == 0 ? 32 : static_cast<uint64_t>(__builtin_clz(x));
+}
+
+uint64_t ctz32(uint64_t value) noexcept
+{
+    const auto x = static_cast<uint32_t>(value);
+    return x == 0 ? 32 : static_cast<uint64_t>(__builtin_ctz(x));
+}
+
+uint64_t popcnt32(uint64_t value) noexcept
+{
+    return static_cast<uint64_t>(__builtin_popcount(static_cast<uint32_t>(value)));
+}
+
+uint64_t clz64(uint64_t value) noexcept
+{
+    return value == 0 ? 64 : static_cast<uint64_t>(__builtin_clzll(value));
+}
+
+uint64_t ctz64(uint64_t value) noexcept
+{
+    return value == 0 ? 64 : static_cast<uint64_t>(__builtin_ctzll(value));
+}
+
+uint64_t popcnt64(uint64_t value) noexcept
+{
+    return static_cast<uint64_t>(__builtin_popcountll(value));
+}
+
+/// Returns the address of the value of the given global.
+uint64_t* global_address(Instance& instance, uint32_t global_idx) noexcept
+{
+    assert(global_idx < instance.imported_globals.size() + instance.globals.size());
+    if (global_idx < instance.imported_globals.size())
+        return instance.imported_globals[global_idx].value;
+    return &instance.globals[global_idx - instance.imported_globals.size()];
+}
+
+/// Compiles a single function.
+///
+/// Every register code instruction is compiled to the sequence of machine instructions
+/// loading the operands from the frame registers and storing the result back.
+/// The traps, returns and branches to the end of the function leave through the epilogue
+/// restoring the callee-saved registers.
+class FunctionCompiler
+{
+    Assembler& m_as;
+    Instance& m_instance;
+    const RegisterCode& m_code;
+    const JitRuntime& m_runtime;
+
+    /// The offsets of the compiled instructions, the branch targets.
+    std::vector<size_t> m_instr_offsets;
+
+    /// The displacements of the branches to be patched: the offset and the target instruction.
+    std::vector<std::pair<size_t, uint32_t>> m_branch_fixups;
+
+    /// The displacements of the jumps to the trap exit.
+    std::vector<size_t> m_trap_fixups;
+
+public:
+    FunctionCompiler(
+        Assembler& as, Instance& instance, const RegisterCode& code, const JitRuntime& runtime)
+      : m_as{as}, m_instance{instance}, m_code{code}, m_runtime{runtime}
+    {}
+
+    void compile()
+    {
+        emit_prologue();
+
+        m_instr_offsets.resize(m_code.instructions.size() + 1);
+        for (size_t i = 0; i < m_code.instructions.size(); ++i)
+        {
+            m_instr_offsets[i] = m_as.size();
+            compile_instruction(m_code.instructions[i]);
+        }
+        m_instr_offsets.back() = m_as.size();
+
+        // The trap exit.
+        for (const auto offset : m_trap_fixups)
+            m_as.patch(offset, m_as.size());
+        m_as.rr(false, {0x31}, rax, rax);  // xor eax, eax
+        emit_epilogue();
+
+        for (const auto& [offset, target] : m_branch_fixups)
+            m_as.patch(offset, m_instr_offsets[target]);
+    }
+
+private:
+    void emit_prologue()
+    {
+        m_as.push(rbx);
+        m_as.push(r13);
+        m_as.push(r14);
+        m_as.push(r15);
+        // sub rsp, 8: aligns the stack to 16 bytes for the calls.
+        m_as.rr(true, {0x83}, 5, rsp);
+        m_as.emit({8});
+
+        m_as.mov(context, rdi);
+        m_as.mov(regs_base, rsi);
+        reload_memory();
+    }
+
+    void emit_epilogue()
+    {
+        // add rsp, 8
+        m_as.rr(true, {0x83}, 0, rsp);
+        m_as.emit({8});
+        m_as.pop(r15);
+        m_as.pop(r14);
+        m_as.pop(r13);
+        m_as.pop(rbx);
+        m_as.emit({0xc3});  // ret
+    }
+
+    void reload_memory()
+    {
+        m_as.rm(true, {0x8b}, memory_base, context,
+            static_cast<uint32_t>(offsetof(JitContext, memory_data)));
+        m_as.rm(true, {0x8b}, memory_end, context,
+            static_cast<uint32_t>(offsetof(JitContext, memory_size)));
+    }
+
+    void trap_if(Cond cond) { m_trap_fixups.push_back(m_as.jcc(cond)); }
+
+    void jump_to(uint32_t target) { m_branch_fixups.emplace_back(m_as.jmp(), target); }
+
+    /// Copies the branch result, if the branch has it in a different register.
+    void copy(uint32_t dst, uint32_t src)
+    {
+        if (dst == src)
+            return;
+        m_as.load(true, rax, src);
+        m_as.store(rax, dst);
+    }
+
+    /// dst = a op b for the ALU instructions of the "op reg, r/m" form.
+    void binary(bool w, std::initializer_list<uint8_t> opcode, const RegisterInstr& instr)
+    {
+        m_as.load(w, rax, instr.a);
+        m_as.frame(w, opcode, rax, instr.b);
+        m_as.store(rax, instr.dst);
+    }
+
+    /// dst = a shift b, the shift operation selected by the opcode extension.
+    /// The signed 32-bit result is sign-extended to match the interpreter.
+    void shift(bool w, uint8_t extension, const RegisterInstr& instr, bool sign_extend = false)
+    {
+        m_as.load(w, rcx, instr.b);
+        m_as.load(w, rax, instr.a);
+        m_as.rr(w, {0xd3}, extension, rax);  // op rax, cl
+        if (sign_extend)
+            m_as.rr(true, {0x63}, rax, rax);  // movsxd rax, eax
+        m_as.store(rax, instr.dst);
+    }
+
+    void compare(bool w, Cond cond, const RegisterInstr& instr)
+    {
+        m_as.load(w, rax, instr.a);
+        m_as.frame(w, {0x3b}, rax, instr.b);  // cmp rax, b
+        m_as.set(cond);
+        m_as.store(rax, instr.dst);
+    }
+
+    void eqz(bool w, const RegisterInstr& instr)
+    {
+        m_as.load(w, rax, instr.a);
+        m_as.test(w, rax);
+        m_as.set(equal);
+        m_as.store(rax, instr.dst);
+    }
+
+    template <typename Fn>
+    void unary_call(Fn* fn, const RegisterInstr& instr)
+    {
+        m_as.load(true, rdi, instr.a);
+        m_as.call(fn);
+        m_as.store(rax, instr.dst);
+    }
+
+    /// Division and remainder trapping on the division by zero and on the signed overflow.
+    /// The signed 32-bit result is sign-extended to match the interpreter.
+    void divide(bool w, bool is_signed, bool is_remainder, const RegisterInstr& instr)
+    {
+        m_as.load(w, rcx, instr.b);
+        m_as.test(w, rcx);
+        trap_if(equal);
+        m_as.load(w, rax, instr.a);
+
+        if (!is_signed)
+        {
+            m_as.rr(false, {0x31}, rdx, rdx);  // xor edx, edx
+            m_as.rr(w, {0xf7}, 6, rcx);        // div rcx
+        }
+        else
+        {
+            // cmp rcx, -1
+            m_as.rr(w, {0x83}, 7, rcx);
+            m_as.emit({0xff});
+            const auto not_minus_one = m_as.jcc(not_equal);
+            size_t done = 0;
+            if (is_remainder)
+            {
+                // The remainder of the division by -1 is 0, also for the minimum value.
+                m_as.rr(false, {0x31}, rdx, rdx);  // xor edx, edx
+                done = m_as.jmp();
+            }
+            else
+            {
+                // The division of the minimum value by -1 overflows.
+                if (w)
+                {
+                    m_as.mov_imm64(rdx, uint64_t{1} << 63);
+                    m_as.rr(true, {0x3b}, rax, rdx);  // cmp rax, rdx
+                }
+                else
+                {
+                    m_as.rr(false, {0x81}, 7, rax);  // cmp eax, imm32
+                    m_as.emit32(uint32_t{1} << 31);
+                }
+                trap_if(equal);
+            }
+            m_as.patch(not_minus_one, m_as.size());
+            if (w)
+                m_as.emit({0x48, 0x99});  // cqo
+            else
+                m_as.emit({0x99});  // cdq
+            m_as.rr(w, {0xf7}, 7, rcx);  // idiv rcx
+            if (is_remainder)
+                m_as.patch(done, m_as.size());
+        }
+
+        const Reg result = is_remainder ? rdx : rax;
+        if (is_signed && !w)
+            m_as.rr(true, {0x63}, rax, result);  // movsxd rax, result
+        else if (result != rax)
+            m_as.rr(w, {0x89}, result, rax);  // mov rax, rdx
+        m_as.store(rax, instr.dst);
+    }
+
+    /// Computes the effective address of the memory access in rax and traps if the access
+    /// of the given size is out of the memory bounds.
+    /// The accesses of the guarded memory are not checked: they fault on the guard pages.
+    void effective_address(uint32_t address_reg, uint32_t offset, uint32_t size)
+    {
+        m_as.load(false, rax, address_reg);  // Zero-extends the 32-bit address.
+        if (offset != 0)
+        {
+            m_as.mov_imm(rcx, offset);
+            m_as.rr(true, {0x01}, rcx, rax);  // add rax, rcx
+        }
+        if (m_instance.memory != nullptr && m_instance.memory->is_guarded())
+            return;
+        m_as.rm(true, {0x8d}, rdx, rax, size);   // lea rdx, [rax + size]
+        m_as.rr(true, {0x3b}, rdx, memory_end);  // cmp rdx, memory_end
+        trap_if(above);
+    }
+
+    void load(bool w, std::initializer_list<uint8_t> opcode, uint32_t size,
+        const RegisterInstr& instr)
+    {
+        effective_address(instr.a, instr.b, size);
+        m_as.memory(w, opcode, rax);
+        m_as.store(rax, instr.dst);
+    }
+
+    void store(bool w, std::initializer_list<uint8_t> opcode, uint32_t size,
+        const RegisterInstr& instr, bool operand_size_prefix = false)
+    {
+        effective_address(instr.a, instr.c, size);
+        m_as.load(true, rcx, instr.b);
+        if (operand_size_prefix)
+            m_as.emit({0x66});
+        m_as.memory(w, opcode, rcx);
+        mark_dirty(size);
+    }
+
+    /// Marks the store at the effective address in rax as written, if the memory writes are
+    /// tracked. Only the page of the last byte is marked, as LinearMemory::mark_dirty() allows.
+    void mark_dirty(uint32_t size)
+    {
+        assert(size <= LinearMemory::MaxStoreSize);
+        m_as.rm(true, {0x8b}, rcx, context,
+            static_cast<uint32_t>(offsetof(JitContext, memory_dirty_pages)));
+        m_as.test(true, rcx);
+        const auto not_tracked = m_as.jcc(equal);
+        m_as.rm(true, {0x8d}, rdx, rax, size - 1);  // lea rdx, [rax + size - 1]
+        m_as.rr(true, {0xc1}, 5, rdx);              // shr rdx, log2(DirtyPageSize)
+        m_as.emit({dirty_page_shift});
+        m_as.emit({0xc6, 0x04, 0x11, 0x01});  // mov byte [rcx + rdx], 1
+        m_as.patch(not_tracked, m_as.size());
+    }
+
+    /// Calls the runtime call function with the arguments already in rdx, rcx and r9.
+    template <typename Fn>
+    void call(Fn* fn, const RegisterInstr& instr)
+    {
+        m_as.mov(rdi, context);
+        m_as.mov(rsi, regs_base);
+        m_as.mov_imm(rcx, instr.b);
+        m_as.mov_imm(r8, m_code.num_registers);
+        m_as.call(fn);
+        m_as.test(true, rax);
+        trap_if(equal);
+        m_as.mov(regs_base, rax);
+        reload_memory();
+    }
+
+    void compile_instruction(const RegisterInstr& instr)
+    {
+        switch (instr.opcode)
+        {
+        case Instr::unreachable:
+            m_trap_fixups.push_back(m_as.jmp());
+            break;
+        case Instr::if_:
+            m_as.load(false, rax, instr.c);
+            m_as.test(false, rax);
+            m_branch_fixups.emplace_back(m_as.jcc(equal), instr.a);
+            break;
+        case Instr::br:
+            copy(instr.dst, instr.b);
+            jump_to(instr.a);
+            break;
+        case Instr::br_if:
+        {
+            m_as.load(false, rax, instr.c);
+            m_as.test(false, rax);
+            if (instr.dst == instr.b)
+                m_branch_fixups.emplace_back(m_as.jcc(not_equal), instr.a);
+            else
+            {
+                const auto not_taken = m_as.jcc(equal);
+                copy(instr.dst, instr.b);
+                jump_to(instr.a);
+                m_as.patch(not_taken, m_as.size());
+            }
+            break;
+        }
+        case Instr::br_table:
+        {
+            // The index out of the table selects the default target, the last one.
+            const auto table_size = instr.dst;
+            m_as.load(true, rax, instr.c);
+            m_as.rr(true, {0x81}, 7, rax);  // cmp rax, table_size
+            m_as.emit32(table_size);
+            const auto in_table = m_as.jcc(below);
+            m_as.mov_imm(rax, table_size);
+            m_as.patch(in_table, m_as.size());
+
+            // Jump through the table of the offsets of the target stubs.
+            m_as.emit({0x48, 0x8d, 0x0d});  // lea rcx, [rip + table]
+            const auto table_displacement = m_as.size();
+            m_as.emit32(0);
+            m_as.emit({0x48, 0x63, 0x04, 0x81});  // movsxd rax, [rcx + 4 * rax]
+            m_as.rr(true, {0x01}, rcx, rax);      // add rax, rcx
+            m_as.emit({0xff, 0xe0});              // jmp rax
+
+            const auto table = m_as.size();
+            m_as.patch(table_displacement, table);
+            m_as.code.resize(table + (table_size + 1) * sizeof(uint32_t));
+            for (uint32_t i = 0; i <= table_size; ++i)
+            {
+                const auto stub_offset = static_cast<uint32_t>(m_as.size() - table);
+                std::memcpy(&m_as.code[table + i * sizeof(uint32_t)], &stub_offset,
+                    sizeof(stub_offset));
+
+                const auto& target = m_code.br_tables[instr.a + i];
+                copy(target.dst, instr.b);
+                jump_to(target.pc);
+            }
+            break;
+        }
+        case Instr::call:
+            m_as.mov_imm(rdx, instr.a);
+            call(m_runtime.call, instr);
+            break;
+        case Instr::call_indirect:
+            m_as.load(true, r9, instr.c);
+            m_as.mov_imm(rdx, instr.a);
+            call(m_runtime.call_indirect, instr);
+            break;
+        case Instr::return_:
+            if (instr.c != 0)
+                copy(0, instr.a);
+            m_as.mov_imm(rax, 1);
+            emit_epilogue();
+            break;
+        case Instr::select:
+            m_as.load(true, rcx, instr.a);
+            m_as.load(true, rdx, instr.b);
+            m_as.load(false, rax, instr.c);
+            m_as.test(false, rax);
+            m_as.rr(true, {0x0f, 0x44}, rcx, rdx);  // cmove rcx, rdx
+            m_as.store(rcx, instr.dst);
+            break;
+        case Instr::local_set:
+            copy(instr.dst, instr.a);
+            break;
+        case Instr::global_get:
+            m_as.mov_imm64(rcx, reinterpret_cast<uintptr_t>(global_address(m_instance, instr.a)));
+            m_as.rm(true, {0x8b}, rax, rcx, 0);  // mov rax, [rcx]
+            m_as.store(rax, instr.dst);
+            break;
+        case Instr::global_set:
+            m_as.load(true, rax, instr.b);
+            m_as.mov_imm64(rcx, reinterpret_cast<uintptr_t>(global_address(m_instance, instr.a)));
+            m_as.rm(true, {0x89}, rax, rcx, 0);  // mov [rcx], rax
+            break;
+
+        case Instr::i32_load:
+            load(false, {0x8b}, 4, instr);
+            break;
+        case Instr::i64_load:
+            load(true, {0x8b}, 8, instr);
+            break;
+        case Instr::i32_load8_s:
+            load(false, {0x0f, 0xbe}, 1, instr);
+            break;
+        case Instr::i32_load8_u:
+        case Instr::i64_load8_u:
+            load(false, {0x0f, 0xb6}, 1, instr);
+            break;
+        case Instr::i32_load16_s:
+            load(false, {0x0f, 0xbf}, 2, instr);
+            break;
+        case Instr::i32_load16_u:
+        case Instr::i64_load16_u:
+            load(false, {0x0f, 0xb7}, 2, instr);
+            break;
+        case Instr::i64_load8_s:
+            load(true, {0x0f, 0xbe}, 1, instr);
+            break;
+        case Instr::i64_load16_s:
+            load(true, {0x0f, 0xbf}, 2, instr);
+            break;
+        case Instr::i64_load32_s:
+            load(true, {0x63}, 4, instr);
+            break;
+        case Instr::i64_load32_u:
+            load(false, {0x8b}, 4, instr);
+            break;
+        case Instr::i32_store:
+        case Instr::i64_store32:
+            store(false, {0x89}, 4, instr);
+            break;
+        case Instr::i64_store:
+            store(true, {0x89}, 8, instr);
+            break;
+        case Instr::i32_store8:
+        case Instr::i64_store8:
+            store(false, {0x88}, 1, instr);
+            break;
+        case Instr::i32_store16:
+        case Instr::i64_store16:
+            store(false, {0x89}, 2, instr, true);
+            break;
+        case Instr::memory_size:
+            m_as.mov(rax, memory_end);
+            m_as.rr(true, {0xc1}, 5, rax);  // shr rax, 16
+            m_as.emit({16});
+            m_as.store(rax, instr.dst);
+            break;
+        case Instr::memory_grow:
+            m_as.mov(rdi, context);
+            m_as.load(false, rsi, instr.a);
+            m_as.call(m_runtime.memory_grow);
+            m_as.store(rax, instr.dst);
+            reload_memory();
+            break;
+
+        case Instr::i32_eqz:
+            eqz(false, instr);
+            break;
+        case Instr::i32_eq:
+            compare(false, equal, instr);
+            break;
+        case Instr::i32_ne:
+            compare(false, not_equal, instr);
+            break;
+        case Instr::i32_lt_s:
+            compare(false, less, instr);
+            break;
+        case Instr::i32_lt_u:
+            compare(false, below, instr);
+            break;
+        case Instr::i32_gt_s:
+            compare(false, greater, instr);
+            break;
+        case Instr::i32_gt_u:
+            compare(false, above, instr);
+            break;
+        case Instr::i32_le_s:
+            compare(false, less_equal, instr);
+            break;
+        case Instr::i32_le_u:
+            compare(false, below_equal, instr);
+            break;
+        case Instr::i32_ge_s:
+            compare(false, greater_equal, instr);
+            break;
+        case Instr::i32_ge_u:
+            compare(false, above_equal, instr);
+            break;
+        case Instr::i64_eqz:
+            eqz(true, instr);
+            break;
+        case Instr::i64_eq:
+            compare(true, equal, instr);
+            break;
+        case Instr::i64_ne:
+            compare(true, not_equal, instr);
+            break;
+        case Instr::i64_lt_s:
+            compare(true, less, instr);
+            break;
+        case Instr::i64_lt_u:
+            compare(true, below, instr);
+            break;
+        case Instr::i64_gt_s:
+            compare(true, greater, instr);
+            break;
+        case Instr::i64_gt_u:
+            compare(true, above, instr);
+            break;
+        case Instr::i64_le_s:
+            compare(true, less_equal, instr);
+            break;
+        case Instr::i64_le_u:
+            compare(true, below_equal, instr);
+            break;
+        case Instr::i64_ge_s:
+            compare(true, greater_equal, instr);
+            break;
+        case Instr::i64_ge_u:
+            compare(true, above_equal, instr);
+            break;
+
+        case Instr::i32_clz:
+            unary_call(clz32, instr);
+            break;
+        case Instr::i32_ctz:
+            unary_call(ctz32, instr);
+            break;
+        case Instr::i32_popcnt:
+            unary_call(popcnt32, instr);
+            break;
+        case Instr::i64_clz:
+            unary_call(clz64, instr);
+            break;
+        case Instr::i64_ctz:
+            unary_call(ctz64, instr);
+            break;
+        case Instr::i64_popcnt:
+            unary_call(popcnt64, instr);
+            break;
+
+        case Instr::i32_add:
+            binary(false, {0x03}, instr);
+            break;
+        case Instr::i32_sub:
+            binary(false, {0x2b}, instr);
+            break;
+        case Instr::i32_mul:
+            binary(false, {0x0f, 0xaf}, instr);
+            break;
+        case Instr::i32_div_s:
+            divide(false, true, false, instr);
+            break;
+        case Instr::i32_div_u:
+            divide(false, false, false, instr);
+            break;
+        case Instr::i32_rem_s:
+            divide(false, true, true, instr);
+            break;
+        case Instr::i32_rem_u:
+            divide(false, false, true, instr);
+            break;
+        case Instr::i32_and:
+            binary(false, {0x23}, instr);
+            break;
+        case Instr::i32_or:
+            binary(false, {0x0b}, instr);
+            break;
+        case Instr::i32_xor:
+            binary(false, {0x33}, instr);
+            break;
+        case Instr::i32_shl:
+            shift(false, 4, instr);
+            break;
+        case Instr::i32_shr_s:
+            shift(false, 7, instr, true);
+            break;
+        case Instr::i32_shr_u:
+            shift(false, 5, instr);
+            break;
+        case Instr::i32_rotl:
+            shift(false, 0, instr);
+            break;
+        case Instr::i32_rotr:
+            shift(false, 1, instr);
+            break;
+
+        case Instr::i64_add:
+            binary(true, {0x03}, instr);
+            break;
+        case Instr::i64_sub:
+            binary(true, {0x2b}, instr);
+            break;
+        case Instr::i64_mul:
+            binary(true, {0x0f, 0xaf}, instr);
+            break;
+        case Instr::i64_div_s:
+            divide(true, true, false, instr);
+            break;
+        case Instr::i64_div_u:
+            divide(true, false, false, instr);
+            break;
+        case Instr::i64_rem_s:
+            divide(true, true, true, instr);
+            break;
+        case Instr::i64_rem_u:
+            divide(true, false, true, instr);
+            break;
+        case Instr::i64_and:
+            binary(true, {0x23}, instr);
+            break;
+        case Instr::i64_or:
+            binary(true, {0x0b}, instr);
+            break;
+        case Instr::i64_xor:
+            binary(true, {0x33}, instr);
+            break;
+        case Instr::i64_shl:
+            shift(true, 4, instr);
+            break;
+        case Instr::i64_shr_s:
+            shift(true, 7, instr);
+            break;
+        case Instr::i64_shr_u:
+            shift(true, 5, instr);
+            break;
+        case Instr::i64_rotl:
+            shift(true, 0, instr);
+            break;
+        case Instr::i64_rotr:
+            shift(true, 1, instr);
+            break;
+
+        case Instr::i32_wrap_i64:
+            m_as.load(false, rax, instr.a);
+            m_as.store(rax, instr.dst);
+            break;
+        case Instr::i64_extend_i32_s:
+            m_as.frame(true, {0x63}, rax, instr.a);  // movsxd rax, a
+            m_as.store(rax, instr.dst);
+            break;
+
+        default:
+            assert(false);
+            break;
+        }
+    }
+};
+}  // namespace
+#endif
+
+bool is_jit_available() noexcept
+{
+#if FIZZY_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if FIZZY_JIT_X86_64
+namespace
+{
+/// Compiles the functions of the given code indices, in this order.
+JitCode compile_functions(
+    Instance& instance, const std::vector<size_t>& code_indices, const JitRuntime& runtime)
+{
+    Assembler as;
+    std::vector<size_t> function_offsets;
+    function_offsets.reserve(code_indices.size());
+    for (const auto code_idx : code_indices)
+    {
+        assert(code_idx < instance.register_code.size());
+        function_offsets.push_back(as.size());
+        FunctionCompiler{as, instance, instance.register_code[code_idx], runtime}.compile();
+    }
+
+    // The code is written to the writable memory, which is then made executable.
+    const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const auto size = std::max((as.size() + page_size - 1) / page_size * page_size, page_size);
+    auto* const memory =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        throw std::bad_alloc{};
+
+    std::memcpy(memory, as.code.data(), as.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, size);
+        throw std::bad_alloc{};
+    }
+
+    return {static_cast<uint8_t*>(memory), size, std::move(function_offsets)};
+}
+}  // namespace
+#endif
+
+JitCode compile_to_machine_code(Instance& instance, const JitRuntime& runtime)
+{
+#if FIZZY_JIT_X86_64
+    assert(instance.register_code.size() == get_code_count(*instance.module));
+
+    std::vector<size_t> code_indices(instance.register_code.size());
+    for (size_t code_idx = 0; code_idx < code_indices.size(); ++code_idx)
+        code_indices[code_idx] = code_idx;
+    return compile_functions(instance, code_indices, runtime);
+#else
+    (void)instance;
+    (void)runtime;
+    return {};
+#endif
+}
+
+JitCode compile_function_to_machine_code(
+    Instance& instance, size_t code_idx, const JitRuntime& runtime)
+{
+#if FIZZY_JIT_X86_64
+    return compile_functions(instance, {code_idx}, runtime);
+#else
+    (void)instance;
+    (void)code_idx;
+    (void)runtime;
+    return {};
+#endif
+}
+}  // namespace fizzy
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fizzy
+{
+struct Instance;
+
+/// The state shared by the compiled function and the runtime functions it calls.
+struct JitContext
+{
+    Instance* instance = nullptr;
+
+    /// The instance's memory, reloaded after every call and memory growth.
+    uint8_t* memory_data = nullptr;
+    uint64_t memory_size = 0;
+    /// The map of the memory pages written since the last snapshot, null if not tracked.
+    uint8_t* memory_dirty_pages = nullptr;
+};
+
+/// The runtime functions called by the compiled code.
+struct JitRuntime
+{
+    /// Calls the function @a func_idx with the arguments in the registers starting at @a args_reg
+    /// of the frame of @a num_registers registers @a regs.
+    /// @return The (possibly relocated) frame registers or null if the call trapped.
+    uint64_t* (*call)(JitContext* context, uint64_t* regs, uint32_t func_idx, uint32_t args_reg,
+        uint32_t num_registers) noexcept;
+
+    /// Calls the function at the table element @a elem_idx, expected to be of type @a type_idx.
+    /// Otherwise the same as JitRuntime::call.
+    uint64_t* (*call_indirect)(JitContext* context, uint64_t* regs, uint32_t type_idx,
+        uint32_t args_reg, uint32_t num_registers, uint64_t elem_idx) noexcept;
+
+    /// Grows the memory by @a delta pages.
+    /// @return The previous number of pages or -1 (as uint32_t) if the memory cannot grow.
+    uint64_t (*memory_grow)(JitContext* context, uint32_t delta) noexcept;
+};
+
+/// The machine code of the module's functions compiled by the baseline JIT compiler.
+/// Owns the executable memory the code is placed in.
+class JitCode
+{
+public:
+    /// The compiled function. Executes the function in the frame of registers @a regs
+    /// laid out as described by RegisterCode and leaves the result in the register 0.
+    /// @return false if the execution trapped.
+    using Function = bool (*)(JitContext* context, uint64_t* regs);
+
+    JitCode() noexcept = default;
+    JitCode(uint8_t* memory, size_t size, std::vector<size_t> function_offsets) noexcept;
+    JitCode(JitCode&& other) noexcept;
+    JitCode& operator=(JitCode&& other) noexcept;
+    ~JitCode();
+
+    JitCode(const JitCode&) = delete;
+    JitCode& operator=(const JitCode&) = delete;
+
+    bool empty() const noexcept { return m_memory == nullptr; }
+
+    /// Returns the compiled function of the given code index.
+    Function function(size_t code_idx) const noexcept;
+
+private:
+    uint8_t* m_memory = nullptr;
+    size_t m_size = 0;
+    std::vector<size_t> m_function_offsets;
+};
+
+/// Returns true if the JIT compiler is available: on x86-64 with the System V calling convention.
+bool is_jit_available() noexcept;
+
+/// Compiles the register code of all the instance's functions to x86-64 machine code.
+///
+/// The code is specific to the instance: it embeds the addresses of the instance's globals.
+/// Returns empty JitCode if the JIT compiler is not available.
+JitCode compile_to_machine_code(Instance& instance, const JitRuntime& runtime);
+
+/// Compiles the register code of the single function of the given code index.
+/// The returned JitCode holds the function at index 0. Otherwise the same
+/// as compile_to_machine_code().
+JitCode compile_function_to_machine_code(
+    Instance& instance, size_t code_idx, const JitRuntime& runtime);
+}  // namespace fizzy
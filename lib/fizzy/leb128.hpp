@@ -2,12 +2,29 @@
 
 #include "exceptions.hpp"
 #include "types.hpp"
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
 
 namespace fizzy
 {
+/// The result of the LEB128 decoding reporting the error without throwing it: the value and
+/// the position following the encoding, or the error and the position it was found at.
 template <typename T>
-std::pair<T, const uint8_t*> leb128u_decode(const uint8_t* input, const uint8_t* end)
+struct Leb128Result
+{
+    T value = 0;
+    const uint8_t* pos = nullptr;
+    ErrorCode error = ErrorCode::none;
+};
+
+/// The decoding of the LEB128 encoding byte by byte, used near the end of the input and for
+/// the encodings longer than leb128_decode_word() handles.
+template <typename T>
+Leb128Result<T> leb128u_try_decode_bytewise(const uint8_t* input, const uint8_t* end) noexcept
 {
     static_assert(!std::numeric_limits<T>::is_signed);
 
@@ -17,20 +34,29 @@ std::pair<T, const uint8_t*> leb128u_decode(const uint8_t* input, const uint8_t*
     for (; result_shift < std::numeric_limits<T>::digits; ++input, result_shift += 7)
     {
         if (input == end)
-            throw parser_error("Unexpected EOF");
+            return {0, input, ErrorCode::unexpected_eof};
 
         // TODO this ignores the bits in the last byte other than the least significant one
         // So would not reject some invalid encoding with those bits set.
         result |= static_cast<T>((static_cast<T>(*input) & 0x7F) << result_shift);
         if ((*input & 0x80) == 0)
-            return {result, input + 1};
+            return {result, input + 1, ErrorCode::none};
     }
 
-    throw parser_error("Invalid LEB128 encoding: too many bytes.");
+    return {0, input, ErrorCode::invalid_leb128};
+}
+
+template <typename T>
+std::pair<T, const uint8_t*> leb128u_decode_bytewise(const uint8_t* input, const uint8_t* end)
+{
+    const auto [value, pos, error] = leb128u_try_decode_bytewise<T>(input, end);
+    if (error != ErrorCode::none)
+        throw parser_error{pos, error};
+    return {value, pos};
 }
 
 template <typename T>
-std::pair<T, const uint8_t*> leb128s_decode(const uint8_t* input, const uint8_t* end)
+std::pair<T, const uint8_t*> leb128s_decode_bytewise(const uint8_t* input, const uint8_t* end)
 {
     static_assert(std::numeric_limits<T>::is_signed);
 
@@ -41,7 +67,7 @@ std::pair<T, const uint8_t*> leb128s_decode(const uint8_t* input, const uint8_t*
     for (; result_shift < std::numeric_limits<T_unsigned>::digits; ++input, result_shift += 7)
     {
         if (input == end)
-            throw parser_error("Unexpected EOF");
+            throw parser_error{input, ErrorCode::unexpected_eof};
 
         result |= static_cast<T_unsigned>((static_cast<T_unsigned>(*input) & 0x7F) << result_shift);
         if ((*input & 0x80) == 0)
@@ -57,7 +83,117 @@ std::pair<T, const uint8_t*> leb128s_decode(const uint8_t* input, const uint8_t*
         }
     }
 
-    throw parser_error("Invalid LEB128 encoding: too many bytes.");
+    throw parser_error{input, ErrorCode::invalid_leb128};
+}
+
+/// Decodes the LEB128 encoding of up to 8 bytes from the single 64-bit load, if at least 8 bytes
+/// of the input remain. Every encoding size is decoded by the same branchless sequence.
+/// Returns the concatenated 7-bit groups and the size of the encoding, or the size 0 if
+/// the input is too short or the encoding is longer.
+/// Requires the little-endian host, like the memory instructions.
+inline std::pair<uint64_t, int> leb128_decode_word(
+    const uint8_t* input, const uint8_t* end) noexcept
+{
+    if (end - input < static_cast<ptrdiff_t>(sizeof(uint64_t)))
+        return {0, 0};
+
+    uint64_t word;
+    std::memcpy(&word, input, sizeof(word));
+    // The continuation bit of the last byte of the encoding is the lowest one not set.
+    const auto last_bytes = ~word & 0x8080808080808080;
+    if (last_bytes == 0)
+        return {0, 0};
+    const auto num_bits = __builtin_ctzll(last_bytes) + 1;
+
+    // Drop the bytes following the encoding and the continuation bits, then join the groups
+    // pairwise: 7-bit groups into 14-bit ones, those into 28-bit ones and those into 56 bits.
+    auto v = word & (~uint64_t{0} >> (64 - num_bits)) & 0x7f7f7f7f7f7f7f7f;
+    v = (v & 0x007f007f007f007f) | ((v & 0x7f007f007f007f00) >> 1);
+    v = (v & 0x00003fff00003fff) | ((v & 0x3fff00003fff0000) >> 2);
+    v = (v & 0x000000000fffffff) | ((v & 0x0fffffff00000000) >> 4);
+    return {v, num_bits / 8};
+}
+
+/// The max size of the LEB128 encoding of the value of the type T.
+template <typename T>
+constexpr int leb128_max_size = (std::numeric_limits<std::make_unsigned_t<T>>::digits + 6) / 7;
+
+/// Decodes the unsigned LEB128 encoding, reporting the invalid encoding without throwing.
+/// Used by the parsing of the wasm binary reporting the errors by the status (see try_parse()).
+template <typename T>
+inline Leb128Result<T> leb128u_try_decode(const uint8_t* input, const uint8_t* end) noexcept
+{
+    static_assert(!std::numeric_limits<T>::is_signed);
+
+    // The most frequent single byte encoding.
+    if (input != end && (*input & 0x80) == 0)
+        return {static_cast<T>(*input), input + 1, ErrorCode::none};
+
+    // The two to four byte encodings (not longer than the max size for the type) are decoded
+    // byte by byte: their sizes are predicted by the branches, while leb128_decode_word()
+    // computes the size from the loaded word, which delays the decoding following it.
+    if (end - input >= 4)
+    {
+        uint32_t v = input[0] & 0x7f;
+        for (int i = 1; i < std::min(4, leb128_max_size<T>); ++i)
+        {
+            v |= uint32_t{input[i] & 0x7fu} << (7 * i);
+            if ((input[i] & 0x80) == 0)
+                return {static_cast<T>(v), input + i + 1, ErrorCode::none};
+        }
+    }
+
+    const auto [value, size] = leb128_decode_word(input, end);
+    // The bits of the last group exceeding the type are ignored like by the bytewise decoding.
+    if (static_cast<unsigned>(size - 1) < leb128_max_size<T>)
+        return {static_cast<T>(value), input + size, ErrorCode::none};
+    return leb128u_try_decode_bytewise<T>(input, end);
+}
+
+template <typename T>
+inline std::pair<T, const uint8_t*> leb128u_decode(const uint8_t* input, const uint8_t* end)
+{
+    const auto [value, pos, error] = leb128u_try_decode<T>(input, end);
+    if (error != ErrorCode::none)
+        throw parser_error{pos, error};
+    return {value, pos};
+}
+
+template <typename T>
+inline std::pair<T, const uint8_t*> leb128s_decode(const uint8_t* input, const uint8_t* end)
+{
+    static_assert(std::numeric_limits<T>::is_signed);
+
+    // The most frequent single byte encoding, sign extended from the bit 6.
+    if (input != end && (*input & 0x80) == 0)
+        return {static_cast<T>((*input ^ 0x40) - 0x40), input + 1};
+
+    // The two to four byte encodings, like in leb128u_try_decode().
+    if (end - input >= 4)
+    {
+        uint32_t v = input[0] & 0x7f;
+        for (int i = 1; i < std::min(4, leb128_max_size<T>); ++i)
+        {
+            v |= uint32_t{input[i] & 0x7fu} << (7 * i);
+            if ((input[i] & 0x80) == 0)
+            {
+                // Sign extend from the highest bit of the last group.
+                const auto sign_bit = uint32_t{1} << (7 * i + 6);
+                const auto extended = static_cast<int32_t>((v ^ sign_bit) - sign_bit);
+                return {static_cast<T>(extended), input + i + 1};
+            }
+        }
+    }
+
+    const auto [value, size] = leb128_decode_word(input, end);
+    if (static_cast<unsigned>(size - 1) < leb128_max_size<T>)
+    {
+        // Sign extend from the highest bit of the last group.
+        const auto sign_bit = uint64_t{1} << (size * 7 - 1);
+        const auto extended = (value ^ sign_bit) - sign_bit;
+        return {static_cast<T>(static_cast<std::make_unsigned_t<T>>(extended)), input + size};
+    }
+    return leb128s_decode_bytewise<T>(input, end);
 }
 
-}  // namespace fizzy
\ No newline at end of file
+}  // namespace fizzy
@@ -0,0 +1,323 @@
+#include "linear_memory.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#if FIZZY_RESERVED_MEMORY
+#include <sys/mman.h>
+#endif
+#if FIZZY_GUARDED_MEMORY
+#include <signal.h>
+#endif
+
+namespace fizzy
+{
+namespace
+{
+/// Rounds the size up to the whole wasm pages, the granularity of the reserved memory pages
+/// being accessible.
+constexpr size_t round_up_to_pages(size_t size) noexcept
+{
+    return (size + PageSize - 1) / PageSize * PageSize;
+}
+
+/// Returns the number of the dirty pages covering the memory of the given size.
+constexpr size_t num_dirty_pages(size_t size) noexcept
+{
+    return (size + LinearMemory::DirtyPageSize - 1) / LinearMemory::DirtyPageSize;
+}
+
+#if FIZZY_GUARDED_MEMORY
+thread_local GuardFaultRecovery* current_recovery = nullptr;
+
+struct sigaction previous_segv_action;
+struct sigaction previous_bus_action;
+
+/// Returns to the current recovery point if the fault is an access to its guarded memory.
+/// Otherwise passes the signal to the previously installed handler.
+void handle_guard_fault(int signum, siginfo_t* info, void* context)
+{
+    const auto* const recovery = current_recovery;
+    const auto* const address = static_cast<const uint8_t*>(info->si_addr);
+    if (recovery != nullptr && address >= recovery->region &&
+        address < recovery->region + LinearMemory::GuardedRegionSize)
+        siglongjmp(const_cast<GuardFaultRecovery*>(recovery)->env, 1);
+
+    const auto& previous = signum == SIGSEGV ? previous_segv_action : previous_bus_action;
+    if ((previous.sa_flags & SA_SIGINFO) != 0)
+        previous.sa_sigaction(signum, info, context);
+    else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+        previous.sa_handler(signum);
+    else
+    {
+        // Restore the default action and return to fault again at the same instruction.
+        sigaction(signum, &previous, nullptr);
+    }
+}
+
+void install_guard_fault_handler()
+{
+    static std::once_flag once;
+    std::call_once(once, [] {
+        struct sigaction action = {};
+        action.sa_sigaction = handle_guard_fault;
+        // The handler leaves with siglongjmp() not restoring the signal mask, so the signal
+        // must not be blocked during the handler execution.
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previous_segv_action);
+        sigaction(SIGBUS, &action, &previous_bus_action);
+    });
+}
+#endif
+}  // namespace
+
+#if FIZZY_GUARDED_MEMORY
+
+ScopedGuardFaultRecovery::ScopedGuardFaultRecovery(GuardFaultRecovery* recovery) noexcept
+  : m_previous{std::exchange(current_recovery, recovery)}
+{}
+
+ScopedGuardFaultRecovery::~ScopedGuardFaultRecovery()
+{
+    current_recovery = m_previous;
+}
+#endif
+
+LinearMemory::LinearMemory(LinearMemory&& other) noexcept
+  : m_heap{std::move(other.m_heap)},
+    m_region{std::exchange(other.m_region, nullptr)},
+    m_region_size{std::exchange(other.m_region_size, 0)},
+    m_size{std::exchange(other.m_size, 0)},
+    m_dirty_pages{std::move(other.m_dirty_pages)},
+    m_dirty{std::exchange(other.m_dirty, nullptr)},
+    m_snapshot_id{std::exchange(other.m_snapshot_id, 0)}
+{
+    // The heap data may be stored inside the bytes object.
+    m_data = m_region != nullptr ? m_region : m_heap.data();
+    other.m_heap.clear();
+    other.m_data = nullptr;
+}
+
+LinearMemory& LinearMemory::operator=(LinearMemory&& other) noexcept
+{
+    LinearMemory tmp{std::move(other)};
+    std::swap(m_heap, tmp.m_heap);
+    std::swap(m_region, tmp.m_region);
+    std::swap(m_region_size, tmp.m_region_size);
+    std::swap(m_size, tmp.m_size);
+    std::swap(m_dirty_pages, tmp.m_dirty_pages);
+    std::swap(m_dirty, tmp.m_dirty);
+    std::swap(m_snapshot_id, tmp.m_snapshot_id);
+    m_data = m_region != nullptr ? m_region : m_heap.data();
+    tmp.m_data = tmp.m_region != nullptr ? tmp.m_region : tmp.m_heap.data();
+    return *this;
+}
+
+LinearMemory::~LinearMemory()
+{
+#if FIZZY_RESERVED_MEMORY
+    if (m_region != nullptr)
+        munmap(m_region, m_region_size);
+#endif
+}
+
+std::optional<LinearMemory> LinearMemory::reserve(size_t size, size_t region_size) noexcept
+{
+#if FIZZY_RESERVED_MEMORY
+    // The reservation fails if the address space is limited (e.g. by ulimit -v).
+    auto* const region =
+        mmap(nullptr, region_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED)
+        return std::nullopt;
+
+    LinearMemory memory;
+    memory.m_region = static_cast<uint8_t*>(region);
+    memory.m_region_size = region_size;
+    memory.m_data = memory.m_region;
+    if (!memory.grow(size))
+        return std::nullopt;
+    return memory;
+#else
+    (void)size;
+    (void)region_size;
+    return std::nullopt;
+#endif
+}
+
+std::optional<LinearMemory> LinearMemory::create_reserved(size_t size, size_t max_size) noexcept
+{
+    // The memory larger than the wasm address space is not needed.
+    if (max_size == 0 || uint64_t{max_size} > (uint64_t{1} << 32))
+        return std::nullopt;
+    return reserve(size, round_up_to_pages(max_size));
+}
+
+std::optional<LinearMemory> LinearMemory::create_guarded(size_t size) noexcept
+{
+#if FIZZY_GUARDED_MEMORY
+    try
+    {
+        install_guard_fault_handler();
+    }
+    catch (...)
+    {
+        return std::nullopt;
+    }
+    return reserve(size, GuardedRegionSize);
+#else
+    (void)size;
+    return std::nullopt;
+#endif
+}
+
+bool LinearMemory::grow(size_t new_size) noexcept
+{
+    assert(new_size >= m_size);
+    return resize(new_size);
+}
+
+bool LinearMemory::assign(bytes_view content) noexcept
+{
+    if (!resize(content.size()))
+        return false;
+    std::memcpy(m_data, content.data(), content.size());
+    mark_dirty(0, content.size());
+    return true;
+}
+
+void LinearMemory::track_writes(uint64_t snapshot_id)
+{
+    // The map has at least one element, so its data pointer is not null.
+    m_dirty_pages.assign(std::max(num_dirty_pages(m_size), size_t{1}), 0);
+    m_dirty = m_dirty_pages.data();
+    m_snapshot_id = snapshot_id;
+}
+
+MemorySnapshot LinearMemory::snapshot()
+{
+    static std::atomic<uint64_t> last_snapshot_id{0};
+
+    MemorySnapshot snapshot;
+    snapshot.m_content = bytes{*this};
+    snapshot.m_id = ++last_snapshot_id;
+    track_writes(snapshot.m_id);
+    return snapshot;
+}
+
+bool LinearMemory::restore(const MemorySnapshot& snapshot) noexcept
+{
+    const auto& content = snapshot.m_content;
+    if (m_dirty == nullptr || m_snapshot_id != snapshot.m_id)
+    {
+        if (!assign(content))
+            return false;
+        try
+        {
+            track_writes(snapshot.m_id);
+        }
+        catch (const std::bad_alloc&)
+        {
+            // The memory is restored, but the next restore will copy it whole again.
+            m_dirty = nullptr;
+            m_snapshot_id = 0;
+        }
+        return true;
+    }
+
+    // The pages the memory shrinks out of are marked as written, so the memory growing back
+    // to the snapshot size has them restored.
+    if (!resize(content.size()))
+        return false;
+
+    // The write marking only the page of its last byte may start in the previous page,
+    // so the page past the memory end is also checked.
+    const auto num_pages =
+        std::min(num_dirty_pages(m_size + MaxStoreSize - 1), m_dirty_pages.size());
+    for (size_t page = 0; page < num_pages; ++page)
+    {
+        if (m_dirty[page] == 0)
+            continue;
+        const auto begin = page * DirtyPageSize;
+        const auto offset = page == 0 ? 0 : begin - (MaxStoreSize - 1);
+        const auto end = std::min(begin + DirtyPageSize, m_size);
+        std::memcpy(m_data + offset, content.data() + offset, end - offset);
+    }
+    std::fill(m_dirty_pages.begin(), m_dirty_pages.end(), uint8_t{0});
+    return true;
+}
+
+bool LinearMemory::resize(size_t new_size) noexcept
+{
+    if (m_dirty != nullptr)
+    {
+        if (num_dirty_pages(new_size) > m_dirty_pages.size())
+        {
+            try
+            {
+                m_dirty_pages.resize(num_dirty_pages(new_size));
+            }
+            catch (const std::bad_alloc&)
+            {
+                return false;
+            }
+            m_dirty = m_dirty_pages.data();
+        }
+        if (new_size < m_size)
+            mark_dirty(new_size, m_size - new_size);
+    }
+
+    if (m_region == nullptr)
+    {
+        try
+        {
+            m_heap.resize(new_size);
+        }
+        catch (const std::bad_alloc&)
+        {
+            return false;
+        }
+        m_data = m_heap.data();
+        m_size = new_size;
+        return true;
+    }
+
+#if FIZZY_RESERVED_MEMORY
+    // The guarded memory is resized by whole wasm pages, so the guard pages follow
+    // the memory directly.
+    if (is_guarded() ? (new_size % PageSize != 0 || new_size > (uint64_t{1} << 32)) :
+                       new_size > m_region_size)
+        return false;
+
+    // The pages are accessible up to the end of the wasm page containing the memory end.
+    const auto committed = round_up_to_pages(m_size);
+    const auto new_committed = round_up_to_pages(new_size);
+    if (new_committed > committed)
+    {
+        // The new pages are zero-filled by the system on the first access.
+        if (mprotect(m_region + committed, new_committed - committed, PROT_READ | PROT_WRITE) != 0)
+            return false;
+    }
+    else if (new_committed < committed)
+    {
+        // Replace the released pages with the new inaccessible ones, so they are zero-filled
+        // when the memory grows again.
+        if (mmap(m_region + new_committed, committed - new_committed, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED)
+            return false;
+    }
+    // The part of the last page the memory shrinks out of must be zero-filled explicitly.
+    if (new_size < m_size)
+        std::memset(m_data + new_size, 0, std::min(m_size, new_committed) - new_size);
+
+    m_size = new_size;
+    return true;
+#else
+    return false;
+#endif
+}
+}  // namespace fizzy
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "bytes.hpp"
+#include "limits.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define FIZZY_RESERVED_MEMORY 1
+#if defined(__LP64__)
+#include <setjmp.h>
+#define FIZZY_GUARDED_MEMORY 1
+#endif
+#endif
+
+namespace fizzy
+{
+/// The content of the linear memory captured by LinearMemory::snapshot().
+class MemorySnapshot
+{
+    friend class LinearMemory;
+
+    bytes m_content;
+    /// The unique identifier of the snapshot, the memory tracks the writes since.
+    uint64_t m_id = 0;
+
+public:
+    /// The size of the captured memory.
+    size_t size() const noexcept { return m_content.size(); }
+};
+
+/// The linear memory of a wasm instance.
+///
+/// The memory is either allocated on the heap or placed at the beginning of a reserved region
+/// of the address space. The reserved memory grows in place without copying and its pages are
+/// zero-filled lazily by the system on the first access.
+/// The guarded memory is the reserved memory whose region covers all the addresses a wasm memory
+/// access can compute. The pages of the region past the memory size are inaccessible
+/// (the guard pages), so the out-of-bounds accesses of the guarded memory fault instead of being
+/// checked.
+class LinearMemory
+{
+public:
+    /// The size of the region reserved for the guarded memory: the 32-bit address plus
+    /// the 32-bit offset plus the size of the access.
+    static constexpr uint64_t GuardedRegionSize = (uint64_t{1} << 33) + PageSize;
+
+    /// The granularity of tracking the memory writes since the last snapshot.
+    static constexpr size_t DirtyPageSize = 4096;
+
+    LinearMemory() noexcept = default;
+
+    /// Allocates the zero-filled memory of the given size on the heap.
+    explicit LinearMemory(size_t size) : m_heap(size, 0), m_data{m_heap.data()}, m_size{size} {}
+
+    LinearMemory(LinearMemory&& other) noexcept;
+    LinearMemory& operator=(LinearMemory&& other) noexcept;
+    ~LinearMemory();
+
+    LinearMemory(const LinearMemory&) = delete;
+    LinearMemory& operator=(const LinearMemory&) = delete;
+
+    /// Creates the zero-filled reserved memory of the given size able to grow up to
+    /// the max size.
+    /// Returns empty optional if the reserved memory is not supported on this platform
+    /// or the region of the address space cannot be reserved.
+    static std::optional<LinearMemory> create_reserved(size_t size, size_t max_size) noexcept;
+
+    /// Creates the zero-filled guarded memory of the given size.
+    /// Returns empty optional if the guarded memory is not supported on this platform
+    /// or the region of the address space cannot be reserved.
+    static std::optional<LinearMemory> create_guarded(size_t size) noexcept;
+
+    bool is_reserved() const noexcept { return m_region != nullptr; }
+    bool is_guarded() const noexcept { return m_region_size == GuardedRegionSize; }
+
+    /// Returns the region of the reserved memory, null otherwise.
+    const uint8_t* region() const noexcept { return m_region; }
+
+    uint8_t* data() noexcept { return m_data; }
+    const uint8_t* data() const noexcept { return m_data; }
+    size_t size() const noexcept { return m_size; }
+    bool empty() const noexcept { return m_size == 0; }
+
+    uint8_t* begin() noexcept { return m_data; }
+    uint8_t* end() noexcept { return m_data + m_size; }
+    const uint8_t* begin() const noexcept { return m_data; }
+    const uint8_t* end() const noexcept { return m_data + m_size; }
+
+    uint8_t& operator[](size_t pos) noexcept { return m_data[pos]; }
+    uint8_t operator[](size_t pos) const noexcept { return m_data[pos]; }
+
+    operator bytes_view() const noexcept { return {m_data, m_size}; }
+
+    bytes substr(size_t pos, size_t count = bytes::npos) const
+    {
+        return bytes{bytes_view{*this}.substr(pos, count)};
+    }
+
+    /// Grows the memory to the new size, the added part is zero-filled.
+    /// @return false if the memory cannot be grown.
+    bool grow(size_t new_size) noexcept;
+
+    /// Replaces the memory content and size with the given one.
+    /// @return false if the memory cannot be resized.
+    bool assign(bytes_view content) noexcept;
+
+    /// Captures the memory content and size, and starts tracking the memory writes,
+    /// so restore() copies back only the pages written since.
+    MemorySnapshot snapshot();
+
+    /// Restores the memory content and size captured by the snapshot.
+    /// The cost is proportional to the number of the pages written since the snapshot
+    /// was taken or restored, if it is the last snapshot taken of this memory.
+    /// @return false if the memory cannot be resized.
+    bool restore(const MemorySnapshot& snapshot) noexcept;
+
+    /// The max size of the write that may be tracked by marking only the page of its last byte.
+    /// restore() copies this many bytes preceding every written page too.
+    static constexpr size_t MaxStoreSize = 8;
+
+    /// Returns the map of the pages written since the last snapshot, one byte per
+    /// DirtyPageSize bytes of memory. Null if the writes are not tracked.
+    uint8_t* dirty_pages() noexcept { return m_dirty; }
+
+    /// Marks the memory range as written. Every write to the memory not done by the wasm code
+    /// (e.g. by the host functions) must be marked for restore() to revert it.
+    void mark_dirty(size_t offset, size_t size) noexcept
+    {
+        if (m_dirty == nullptr || size == 0)
+            return;
+        for (auto page = offset / DirtyPageSize; page <= (offset + size - 1) / DirtyPageSize;
+             ++page)
+            m_dirty[page] = 1;
+    }
+
+private:
+    /// Reserves the region of the given size and grows the memory in it to the given size.
+    static std::optional<LinearMemory> reserve(size_t size, size_t region_size) noexcept;
+
+    bool resize(size_t new_size) noexcept;
+
+    /// Starts tracking the memory writes since the snapshot of the given identifier.
+    void track_writes(uint64_t snapshot_id);
+
+    bytes m_heap;
+    uint8_t* m_region = nullptr;
+    size_t m_region_size = 0;
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+
+    /// The map of the written pages and the snapshot the writes are tracked since.
+    /// The map never shrinks: it covers all the pages the memory has had since the snapshot.
+    std::vector<uint8_t> m_dirty_pages;
+    uint8_t* m_dirty = nullptr;
+    uint64_t m_snapshot_id = 0;
+};
+
+#if FIZZY_GUARDED_MEMORY
+/// The point the execution returns to when an access of the guarded memory faults.
+struct GuardFaultRecovery
+{
+    sigjmp_buf env;
+    /// The reserved region of the accessed guarded memory.
+    const uint8_t* region = nullptr;
+};
+
+/// Sets the innermost guard fault recovery point of the current thread for the lifetime of
+/// the object. The null recovery point makes the faults not recoverable, e.g. during the
+/// execution of the host code.
+class ScopedGuardFaultRecovery
+{
+    GuardFaultRecovery* m_previous;
+
+public:
+    explicit ScopedGuardFaultRecovery(GuardFaultRecovery* recovery) noexcept;
+    ~ScopedGuardFaultRecovery();
+
+    ScopedGuardFaultRecovery(const ScopedGuardFaultRecovery&) = delete;
+    ScopedGuardFaultRecovery& operator=(const ScopedGuardFaultRecovery&) = delete;
+};
+#endif
+}  // namespace fizzy
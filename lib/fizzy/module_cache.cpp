@@ -0,0 +1,655 @@
+#include "module_cache.hpp"
+#include "exceptions.hpp"
+#include "parser.hpp"
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <type_traits>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define FIZZY_MAPPED_FILES 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fizzy
+{
+namespace
+{
+constexpr uint8_t serialized_module_magic[] = {'f', 'z', 'm', 'c'};
+
+/// Appends the values to the serialized module.
+/// The values are stored in the byte order of the host, which is little-endian on all
+/// the supported platforms, as the interpreter stores the immediates in it too.
+class Writer
+{
+    bytes& m_output;
+
+public:
+    explicit Writer(bytes& output) noexcept : m_output{output} {}
+
+    template <typename T>
+    void put(T value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        m_output.append(reinterpret_cast<const uint8_t*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    void put_array(const T* data, size_t size)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        put(static_cast<uint32_t>(size));
+        m_output.append(reinterpret_cast<const uint8_t*>(data), size * sizeof(T));
+    }
+
+    template <typename T>
+    void put_vec(const std::vector<T>& values)
+    {
+        put_array(values.data(), values.size());
+    }
+
+    void put_string(std::string_view value) { put_array(value.data(), value.size()); }
+
+    void put_bytes(bytes_view value) { put_array(value.data(), value.size()); }
+
+    void put_limits(const Limits& limits)
+    {
+        put(limits.min);
+        put(uint8_t{limits.max.has_value()});
+        put(limits.max.value_or(0));
+    }
+
+    void put_expression(const ConstantExpression& expression)
+    {
+        put(expression.kind);
+        if (expression.kind == ConstantExpression::Kind::Constant)
+            put(expression.value.constant);
+        else
+            put(uint64_t{expression.value.global_index});
+    }
+};
+
+/// Checks if the instruction is one of those the parser puts into the code: the wasm
+/// instructions without the floating-point ones, and the superinstructions.
+constexpr bool is_code_instruction(Instr instr) noexcept
+{
+    const auto in = [instr](Instr first, Instr last) noexcept {
+        return instr >= first && instr <= last;
+    };
+    return in(Instr::unreachable, Instr::else_) || in(Instr::end, Instr::call_indirect) ||
+           in(Instr::drop, Instr::select) || in(Instr::local_get, Instr::global_set) ||
+           in(Instr::i32_load, Instr::i64_load) || in(Instr::i32_load8_s, Instr::i64_store) ||
+           in(Instr::i32_store8, Instr::memory_grow) || in(Instr::i32_const, Instr::i64_const) ||
+           in(Instr::i32_eqz, Instr::i64_ge_u) || in(Instr::i32_clz, Instr::i64_rotr) ||
+           in(Instr::i32_wrap_i64, Instr::i32_wrap_i64) ||
+           in(Instr::i64_extend_i32_s, Instr::i64_extend_i32_u) ||
+           in(Instr::local_get_local_get, Instr::i32_add_local_set);
+}
+
+/// Reads the values of the serialized module.
+/// The enum values and the instructions are checked, so the damaged module cannot hold
+/// the values the interpreter does not handle.
+class Reader
+{
+    const uint8_t* m_pos;
+    const uint8_t* m_end;
+
+    const uint8_t* take(size_t size)
+    {
+        if (size > static_cast<size_t>(m_end - m_pos))
+            throw parser_error{m_pos, ErrorCode::serialized_module_eof};
+        const auto* const data = m_pos;
+        m_pos += size;
+        return data;
+    }
+
+    /// Throws if the value of the byte just read is not valid.
+    void check_value(bool valid, uint8_t value) const
+    {
+        if (!valid)
+            throw parser_error{m_pos - 1, ErrorCode::invalid_serialized_value, value};
+    }
+
+public:
+    explicit Reader(bytes_view input) noexcept
+      : m_pos{input.data()}, m_end{input.data() + input.size()}
+    {}
+
+    bool at_end() const noexcept { return m_pos == m_end; }
+
+    template <typename T>
+    T get()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        std::memcpy(&value, take(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    bool get_bool()
+    {
+        const auto value = get<uint8_t>();
+        check_value(value <= 1, value);
+        return value != 0;
+    }
+
+    ValType get_valtype()
+    {
+        const auto type = get<ValType>();
+        check_value(type == ValType::i32 || type == ValType::i64, static_cast<uint8_t>(type));
+        return type;
+    }
+
+    ExternalKind get_external_kind()
+    {
+        const auto kind = get<ExternalKind>();
+        check_value(kind <= ExternalKind::Global, static_cast<uint8_t>(kind));
+        return kind;
+    }
+
+    /// Reads the number of the elements of the section.
+    /// Every element takes at least one byte, so the damaged count is detected before
+    /// the elements are allocated.
+    uint32_t get_count()
+    {
+        const auto count = get<uint32_t>();
+        if (count > static_cast<size_t>(m_end - m_pos))
+            throw parser_error{m_pos, ErrorCode::serialized_module_eof};
+        return count;
+    }
+
+    template <typename T>
+    std::vector<T> get_vec()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto size = get<uint32_t>();
+        const auto* const data = take(size_t{size} * sizeof(T));
+        std::vector<T> values(size);
+        if (size != 0)
+            std::memcpy(values.data(), data, size * sizeof(T));
+        return values;
+    }
+
+    std::vector<ValType> get_valtypes()
+    {
+        std::vector<ValType> types(get_count());
+        for (auto& type : types)
+            type = get_valtype();
+        return types;
+    }
+
+    std::vector<Instr> get_instructions()
+    {
+        auto instructions = get_vec<Instr>();
+        for (const auto instr : instructions)
+        {
+            if (!is_code_instruction(instr))
+                throw parser_error{
+                    ErrorCode::invalid_serialized_instruction, static_cast<uint8_t>(instr)};
+        }
+        return instructions;
+    }
+
+    std::string_view get_string()
+    {
+        const auto size = get<uint32_t>();
+        return {reinterpret_cast<const char*>(take(size)), size};
+    }
+
+    bytes_view get_bytes()
+    {
+        const auto size = get<uint32_t>();
+        return {take(size), size};
+    }
+
+    Limits get_limits()
+    {
+        Limits limits;
+        limits.min = get<uint32_t>();
+        const auto has_max = get_bool();
+        const auto max = get<uint32_t>();
+        if (has_max)
+            limits.max = max;
+        return limits;
+    }
+
+    ConstantExpression get_expression()
+    {
+        ConstantExpression expression;
+        expression.kind = get<ConstantExpression::Kind>();
+        check_value(expression.kind <= ConstantExpression::Kind::GlobalGet,
+            static_cast<uint8_t>(expression.kind));
+        const auto value = get<uint64_t>();
+        if (expression.kind == ConstantExpression::Kind::Constant)
+            expression.value.constant = value;
+        else
+            expression.value.global_index = static_cast<uint32_t>(value);
+        return expression;
+    }
+};
+
+void serialize_module_into(bytes& output, const Module& module)
+{
+    Writer w{output};
+    output.append(serialized_module_magic, sizeof(serialized_module_magic));
+    w.put(SerializedModuleVersion);
+
+    w.put(static_cast<uint32_t>(module.typesec.size()));
+    for (const auto& type : module.typesec)
+    {
+        w.put_vec(type.inputs);
+        w.put_vec(type.outputs);
+    }
+
+    w.put(static_cast<uint32_t>(module.importsec.size()));
+    for (const auto& import : module.importsec)
+    {
+        w.put_string(import.module);
+        w.put_string(import.name);
+        w.put(import.kind);
+        switch (import.kind)
+        {
+        case ExternalKind::Function:
+            w.put(import.desc.function_type_index);
+            break;
+        case ExternalKind::Table:
+            w.put_limits(import.desc.table.limits);
+            break;
+        case ExternalKind::Memory:
+            w.put_limits(import.desc.memory.limits);
+            break;
+        case ExternalKind::Global:
+            w.put(uint8_t{import.desc.global.is_mutable});
+            w.put(import.desc.global.value_type);
+            break;
+        }
+    }
+
+    w.put_vec(module.funcsec);
+
+    w.put(static_cast<uint32_t>(module.tablesec.size()));
+    for (const auto& table : module.tablesec)
+        w.put_limits(table.limits);
+
+    w.put(static_cast<uint32_t>(module.memorysec.size()));
+    for (const auto& memory : module.memorysec)
+        w.put_limits(memory.limits);
+
+    w.put(static_cast<uint32_t>(module.globalsec.size()));
+    for (const auto& global : module.globalsec)
+    {
+        w.put(uint8_t{global.is_mutable});
+        w.put(global.value_type);
+        w.put_expression(global.expression);
+    }
+
+    w.put(static_cast<uint32_t>(module.exportsec.size()));
+    for (const auto& export_ : module.exportsec)
+    {
+        w.put_string(export_.name);
+        w.put(export_.kind);
+        w.put(export_.index);
+    }
+
+    w.put(uint8_t{module.startfunc.has_value()});
+    w.put(module.startfunc.value_or(0));
+
+    w.put(static_cast<uint32_t>(module.elementsec.size()));
+    for (const auto& element : module.elementsec)
+    {
+        w.put_expression(element.offset);
+        w.put_vec(element.init);
+    }
+
+    // The bodies of the lazily parsed module are all parsed to be serialized.
+    w.put(static_cast<uint32_t>(get_code_count(module)));
+    for (size_t code_idx = 0; code_idx < get_code_count(module); ++code_idx)
+    {
+        const auto& code = get_code(module, code_idx);
+        w.put(code.local_count);
+        w.put(code.max_stack_height);
+        w.put_vec(code.instructions);
+        w.put_bytes(code.immediates);
+    }
+
+    w.put(static_cast<uint32_t>(module.datasec.size()));
+    for (const auto& data : module.datasec)
+    {
+        w.put_expression(data.offset);
+        w.put_bytes(data.init);
+    }
+
+    w.put(static_cast<uint32_t>(module.customsec.size()));
+    for (const auto& custom : module.customsec)
+    {
+        w.put_string(custom.name);
+        w.put_bytes(custom.content);
+    }
+
+    w.put_vec(module.imported_function_types);
+    w.put(static_cast<uint32_t>(module.imported_global_types.size()));
+    for (const auto& type : module.imported_global_types)
+    {
+        w.put(uint8_t{type.is_mutable});
+        w.put(type.value_type);
+    }
+}
+
+/// The 64-bit FNV-1a hash.
+uint64_t hash(bytes_view data) noexcept
+{
+    uint64_t h = 0xcbf29ce484222325;
+    for (const auto byte : data)
+        h = (h ^ byte) * 0x100000001b3;
+    return h;
+}
+
+/// The read-only view of the whole content of the file.
+/// The large files are mapped into the memory, the small ones are read as mapping them costs
+/// more than copying. The view is empty if the file cannot be read.
+class FileContent
+{
+    /// The min size of the file mapped into the memory.
+    static constexpr size_t MappedFileMinSize = 128 * 1024;
+
+#if FIZZY_MAPPED_FILES
+    void* m_map = nullptr;
+#endif
+    bytes m_buffer;
+    bytes_view m_content;
+
+public:
+    explicit FileContent(const std::string& path)
+    {
+#if FIZZY_MAPPED_FILES
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            const auto size = static_cast<size_t>(st.st_size);
+            if (size >= MappedFileMinSize)
+            {
+                auto* const map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map != MAP_FAILED)
+                {
+                    m_map = map;
+                    m_content = {static_cast<const uint8_t*>(map), size};
+                }
+            }
+            else
+            {
+                m_buffer.resize(size);
+                if (read(fd, m_buffer.data(), size) == static_cast<ssize_t>(size))
+                    m_content = m_buffer;
+            }
+        }
+        close(fd);
+#else
+        auto* const file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr)
+            return;
+        uint8_t buffer[4096];
+        for (size_t n; (n = std::fread(buffer, 1, sizeof(buffer), file)) != 0;)
+            m_buffer.append(buffer, n);
+        if (std::ferror(file) == 0)
+            m_content = m_buffer;
+        std::fclose(file);
+#endif
+    }
+
+    ~FileContent()
+    {
+#if FIZZY_MAPPED_FILES
+        if (m_map != nullptr)
+            munmap(m_map, m_content.size());
+#endif
+    }
+
+    FileContent(const FileContent&) = delete;
+    FileContent& operator=(const FileContent&) = delete;
+
+    bytes_view view() const noexcept { return m_content; }
+};
+
+// The cache file stores the size of the wasm binary, the binary itself, the hash of
+// the serialized module and the serialized module. The whole binary is compared, so the modules
+// of the binaries of the same hash are not mistaken for each other. The hash of the serialized
+// module detects the damaged files.
+
+std::optional<Module> load_cached(const std::string& path, bytes_view wasm)
+{
+    const FileContent file{path};
+    auto content = file.view();
+
+    uint64_t wasm_size = 0;
+    if (content.size() < sizeof(wasm_size))
+        return std::nullopt;
+    std::memcpy(&wasm_size, content.data(), sizeof(wasm_size));
+    content.remove_prefix(sizeof(wasm_size));
+
+    if (wasm_size != wasm.size() || content.size() < wasm.size() ||
+        (!wasm.empty() && std::memcmp(content.data(), wasm.data(), wasm.size()) != 0))
+        return std::nullopt;
+    content.remove_prefix(wasm.size());
+
+    uint64_t module_hash = 0;
+    if (content.size() < sizeof(module_hash))
+        return std::nullopt;
+    std::memcpy(&module_hash, content.data(), sizeof(module_hash));
+    content.remove_prefix(sizeof(module_hash));
+    if (module_hash != hash(content))
+        return std::nullopt;
+
+    try
+    {
+        return deserialize_module(content);
+    }
+    catch (const parser_error&)
+    {
+        // The file of another format version or damaged one is replaced.
+        return std::nullopt;
+    }
+}
+
+void store_cached(const std::string& path, bytes_view wasm, const Module& module)
+{
+    bytes content;
+    Writer{content}.put(uint64_t{wasm.size()});
+    content.append(wasm);
+    const auto module_offset = content.size() + sizeof(uint64_t);
+    Writer{content}.put(uint64_t{0});
+    serialize_module_into(content, module);
+    const auto module_hash = hash(bytes_view{content}.substr(module_offset));
+    std::memcpy(&content[module_offset - sizeof(module_hash)], &module_hash, sizeof(module_hash));
+
+    // The content is written to the temporary file renamed to the cache file afterwards,
+    // so the concurrent readers never see the partially written file.
+#if FIZZY_MAPPED_FILES
+    std::string temp_path = path + ".XXXXXX";
+    const int fd = mkstemp(temp_path.data());
+    if (fd < 0)
+        return;
+    const auto* data = content.data();
+    auto remaining = content.size();
+    while (remaining != 0)
+    {
+        const auto n = write(fd, data, remaining);
+        if (n <= 0)
+            break;
+        data += n;
+        remaining -= static_cast<size_t>(n);
+    }
+    const bool written = close(fd) == 0 && remaining == 0;
+#else
+    const auto temp_path = path + ".tmp";
+    auto* const file = std::fopen(temp_path.c_str(), "wb");
+    if (file == nullptr)
+        return;
+    const bool written = std::fwrite(content.data(), 1, content.size(), file) == content.size() &&
+                         std::fclose(file) == 0;
+#endif
+    if (!written || std::rename(temp_path.c_str(), path.c_str()) != 0)
+        std::remove(temp_path.c_str());
+}
+}  // namespace
+
+bytes serialize_module(const Module& module)
+{
+    bytes output;
+    serialize_module_into(output, module);
+    return output;
+}
+
+Module deserialize_module(bytes_view input)
+{
+    if (input.substr(0, sizeof(serialized_module_magic)) !=
+        bytes_view{serialized_module_magic, sizeof(serialized_module_magic)})
+        throw parser_error{ErrorCode::invalid_serialized_prefix};
+    input.remove_prefix(sizeof(serialized_module_magic));
+
+    Reader r{input};
+    if (r.get<uint32_t>() != SerializedModuleVersion)
+        throw parser_error{ErrorCode::unsupported_serialized_version};
+
+    Module module;
+
+    module.typesec.resize(r.get_count());
+    for (auto& type : module.typesec)
+    {
+        type.inputs = r.get_valtypes();
+        type.outputs = r.get_valtypes();
+    }
+
+    // Import is not default-constructible because of the union of the descriptions.
+    const auto num_imports = r.get_count();
+    module.importsec.reserve(num_imports);
+    for (uint32_t i = 0; i < num_imports; ++i)
+    {
+        Import import{};
+        import.module = r.get_string();
+        import.name = r.get_string();
+        import.kind = r.get<ExternalKind>();
+        switch (import.kind)
+        {
+        case ExternalKind::Function:
+            import.desc.function_type_index = r.get<TypeIdx>();
+            break;
+        case ExternalKind::Table:
+            import.desc.table.limits = r.get_limits();
+            break;
+        case ExternalKind::Memory:
+            import.desc.memory.limits = r.get_limits();
+            break;
+        case ExternalKind::Global:
+            import.desc.global.is_mutable = r.get_bool();
+            import.desc.global.value_type = r.get_valtype();
+            break;
+        default:
+            throw parser_error{ErrorCode::invalid_serialized_import_kind};
+        }
+        module.importsec.emplace_back(std::move(import));
+    }
+
+    module.funcsec = r.get_vec<TypeIdx>();
+
+    module.tablesec.resize(r.get_count());
+    for (auto& table : module.tablesec)
+        table.limits = r.get_limits();
+
+    module.memorysec.resize(r.get_count());
+    for (auto& memory : module.memorysec)
+        memory.limits = r.get_limits();
+
+    module.globalsec.resize(r.get_count());
+    for (auto& global : module.globalsec)
+    {
+        global.is_mutable = r.get_bool();
+        global.value_type = r.get_valtype();
+        global.expression = r.get_expression();
+    }
+
+    module.exportsec.resize(r.get_count());
+    for (auto& export_ : module.exportsec)
+    {
+        export_.name = r.get_string();
+        export_.kind = r.get_external_kind();
+        export_.index = r.get<uint32_t>();
+    }
+
+    const auto has_startfunc = r.get_bool();
+    const auto startfunc = r.get<FuncIdx>();
+    if (has_startfunc)
+        module.startfunc = startfunc;
+
+    module.elementsec.resize(r.get_count());
+    for (auto& element : module.elementsec)
+    {
+        element.offset = r.get_expression();
+        element.init = r.get_vec<FuncIdx>();
+    }
+
+    module.codesec.resize(r.get_count());
+    for (auto& code : module.codesec)
+    {
+        code.local_count = r.get<uint32_t>();
+        code.max_stack_height = r.get<uint32_t>();
+        code.instructions = r.get_instructions();
+        code.immediates = bytes{r.get_bytes()};
+    }
+
+    module.datasec.resize(r.get_count());
+    for (auto& data : module.datasec)
+    {
+        data.offset = r.get_expression();
+        data.init = r.get_bytes();
+    }
+
+    module.customsec.resize(r.get_count());
+    for (auto& custom : module.customsec)
+    {
+        custom.name = r.get_string();
+        custom.content = r.get_bytes();
+    }
+
+    module.imported_function_types = r.get_vec<TypeIdx>();
+    module.imported_global_types.resize(r.get_count());
+    for (auto& type : module.imported_global_types)
+    {
+        type.is_mutable = r.get_bool();
+        type.value_type = r.get_valtype();
+    }
+
+    if (!r.at_end())
+        throw parser_error{ErrorCode::serialized_module_trailing_data};
+
+    // The input is not owned by the module.
+    copy_referenced_data(module);
+    return module;
+}
+
+std::string module_cache_path(bytes_view wasm, const std::string& cache_dir)
+{
+    static constexpr char hex_digits[] = "0123456789abcdef";
+    auto h = hash(wasm);
+    std::string name(16, '0');
+    for (auto it = name.rbegin(); it != name.rend(); ++it, h >>= 4)
+        *it = hex_digits[h & 0xf];
+    return cache_dir + '/' + name + ".fzm";
+}
+
+Module parse_cached(bytes_view wasm, const std::string& cache_dir)
+{
+    const auto path = module_cache_path(wasm, cache_dir);
+    if (auto module = load_cached(path, wasm))
+        return std::move(*module);
+
+    auto module = parse(wasm);
+    store_cached(path, wasm, module);
+    return module;
+}
+}  // namespace fizzy
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "bytes.hpp"
+#include "types.hpp"
+#include <cstdint>
+#include <string>
+
+namespace fizzy
+{
+/// The version of the serialized module format. Must be bumped on every change of the Module
+/// structure or of the code produced by the parser (e.g. new superinstructions).
+constexpr uint32_t SerializedModuleVersion = 4;
+
+/// Serializes the parsed module.
+///
+/// The format stores all the values in the fixed-width little-endian form and the instructions
+/// and the immediates of the code as they are, so loading it requires neither the LEB128
+/// decoding nor the patching of the branch targets.
+/// The function bodies of the lazily parsed module are parsed first, the loaded module is
+/// parsed eagerly.
+/// @throws parser_error if a lazily parsed body is not valid.
+bytes serialize_module(const Module& module);
+
+/// Loads the module serialized by serialize_module().
+///
+/// The enum values and the instructions are checked, but the module is not validated again,
+/// so it is not marked as validated: it is executed with the checks of the modules not
+/// validated by the parser. The input must still come from a trusted source, as the immediates
+/// of the instructions are not checked.
+/// @throws parser_error if the input is not the module serialized in the current version.
+Module deserialize_module(bytes_view input);
+
+/// Returns the path of the file caching the module parsed from the wasm binary:
+/// the file named after the hash of the binary in the cache directory.
+std::string module_cache_path(bytes_view wasm, const std::string& cache_dir);
+
+/// Parses the wasm binary using the cache of the parsed modules in the given directory.
+///
+/// The module is loaded from the cache file if the file holds the module parsed from the same
+/// binary in the current format version. Otherwise the binary is parsed with parse() and
+/// the module is stored in the cache. The failures to access the cache are ignored.
+/// The cache file holding the damaged module is replaced. The cache directory must be trusted,
+/// the cached modules are not validated.
+/// @throws parser_error if the binary is parsed and it is not a valid wasm module.
+Module parse_cached(bytes_view wasm, const std::string& cache_dir);
+}  // namespace fizzy
@@ -2,6 +2,14 @@
 #include "leb128.hpp"
 #include "types.hpp"
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <type_traits>
 
 namespace fizzy
 {
@@ -10,7 +18,7 @@ template <>
 inline parser_result<uint8_t> parse(const uint8_t* pos, const uint8_t* end)
 {
     if (pos == end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
     return {*pos, pos + 1};
 }
@@ -20,87 +28,95 @@ template <>
 inline parser_result<FuncType> parse(const uint8_t* pos, const uint8_t* end)
 {
     if (pos == end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
     const uint8_t kind = *pos++;
     if (kind != 0x60)
     {
-        throw parser_error{
-            "unexpected byte value " + std::to_string(kind) + ", expected 0x60 for functype"};
+        throw parser_error{pos - 1, ErrorCode::invalid_functype_form, kind};
     }
 
     FuncType result;
     std::tie(result.inputs, pos) = parse_vec<ValType>(pos, end);
     std::tie(result.outputs, pos) = parse_vec<ValType>(pos, end);
+    if (result.outputs.size() > 1)
+        throw parser_error{pos, ErrorCode::function_type_with_many_results};
     return {result, pos};
 }
 
-inline std::tuple<bool, const uint8_t*> parse_global_type(const uint8_t* pos, const uint8_t* end)
+inline parser_result<GlobalType> parse_global_type(const uint8_t* pos, const uint8_t* end)
 {
+    GlobalType result;
     // will throw if invalid type
-    std::tie(std::ignore, pos) = parse<ValType>(pos, end);
+    std::tie(result.value_type, pos) = parse<ValType>(pos, end);
 
     if (pos == end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
     const uint8_t mutability = *pos++;
     if (mutability != 0x00 && mutability != 0x01)
     {
-        throw parser_error{"unexpected byte value " + std::to_string(mutability) +
-                           ", expected 0x00 or 0x01 for global mutability"};
+        throw parser_error{pos - 1, ErrorCode::invalid_global_mutability, mutability};
     }
 
-    const bool is_mutable = (mutability == 0x01);
-    return {is_mutable, pos};
+    result.is_mutable = (mutability == 0x01);
+    return {result, pos};
 }
 
+/// Parses the constant expression: the single constant or global.get instruction followed by
+/// the end instruction. The constant must have the expected type. The type of the global
+/// is checked by validate_module(), as the globals may not be parsed yet.
 inline parser_result<ConstantExpression> parse_constant_expression(
-    const uint8_t* pos, const uint8_t* end)
+    const uint8_t* pos, const uint8_t* end, ValType expected_type)
 {
     ConstantExpression result;
 
-    Instr instr;
-    do
+    if (pos == end)
+        throw parser_error{pos, ErrorCode::unexpected_eof};
+
+    const auto instr = static_cast<Instr>(*pos++);
+    switch (instr)
     {
-        if (pos == end)
-            throw parser_error{"Unexpected EOF"};
+    default:
+        throw parser_error{pos - 1, ErrorCode::invalid_constant_instruction, *(pos - 1)};
 
-        instr = static_cast<Instr>(*pos++);
-        switch (instr)
-        {
-        default:
-            throw parser_error{"unexpected instruction in the global initializer expression: " +
-                               std::to_string(*(pos - 1))};
+    case Instr::end:
+        throw parser_error{pos - 1, ErrorCode::empty_constant_expression};
 
-        case Instr::end:
-            break;
+    case Instr::global_get:
+    {
+        result.kind = ConstantExpression::Kind::GlobalGet;
+        std::tie(result.value.global_index, pos) = leb128u_decode<uint32_t>(pos, end);
+        break;
+    }
 
-        case Instr::global_get:
-        {
-            result.kind = ConstantExpression::Kind::GlobalGet;
-            std::tie(result.value.global_index, pos) = leb128u_decode<uint32_t>(pos, end);
-            break;
-        }
+    case Instr::i32_const:
+    {
+        if (expected_type != ValType::i32)
+            throw parser_error{pos - 1, ErrorCode::constant_expression_type_mismatch};
+        result.kind = ConstantExpression::Kind::Constant;
+        int32_t value;
+        std::tie(value, pos) = leb128s_decode<int32_t>(pos, end);
+        result.value.constant = static_cast<uint32_t>(value);
+        break;
+    }
 
-        case Instr::i32_const:
-        {
-            result.kind = ConstantExpression::Kind::Constant;
-            int32_t value;
-            std::tie(value, pos) = leb128s_decode<int32_t>(pos, end);
-            result.value.constant = static_cast<uint32_t>(value);
-            break;
-        }
+    case Instr::i64_const:
+    {
+        if (expected_type != ValType::i64)
+            throw parser_error{pos - 1, ErrorCode::constant_expression_type_mismatch};
+        result.kind = ConstantExpression::Kind::Constant;
+        int64_t value;
+        std::tie(value, pos) = leb128s_decode<int64_t>(pos, end);
+        result.value.constant = static_cast<uint64_t>(value);
+        break;
+    }
+    }
 
-        case Instr::i64_const:
-        {
-            result.kind = ConstantExpression::Kind::Constant;
-            int64_t value;
-            std::tie(value, pos) = leb128s_decode<int64_t>(pos, end);
-            result.value.constant = static_cast<uint64_t>(value);
-            break;
-        }
-        }
-    } while (instr != Instr::end);
+    if (pos == end)
+        throw parser_error{pos, ErrorCode::unexpected_eof};
+    if (static_cast<Instr>(*pos++) != Instr::end)
+        throw parser_error{pos - 1, ErrorCode::constant_expression_too_long};
 
     return {result, pos};
 }
@@ -109,8 +125,11 @@ template <>
 inline parser_result<Global> parse(const uint8_t* pos, const uint8_t* end)
 {
     Global result;
-    std::tie(result.is_mutable, pos) = parse_global_type(pos, end);
-    std::tie(result.expression, pos) = parse_constant_expression(pos, end);
+    GlobalType type;
+    std::tie(type, pos) = parse_global_type(pos, end);
+    result.is_mutable = type.is_mutable;
+    result.value_type = type.value_type;
+    std::tie(result.expression, pos) = parse_constant_expression(pos, end, type.value_type);
 
     return {result, pos};
 }
@@ -119,11 +138,11 @@ template <>
 inline parser_result<Table> parse(const uint8_t* pos, const uint8_t* end)
 {
     if (pos == end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
     const uint8_t elemtype = *pos++;
     if (elemtype != FuncRef)
-        throw parser_error{"unexpected table elemtype: " + std::to_string(elemtype)};
+        throw parser_error{pos - 1, ErrorCode::invalid_table_elemtype, elemtype};
 
     Limits limits;
     std::tie(limits, pos) = parse_limits(pos, end);
@@ -139,20 +158,20 @@ inline parser_result<Memory> parse(const uint8_t* pos, const uint8_t* end)
     return {{limits}, pos};
 }
 
-parser_result<std::string> parse_string(const uint8_t* pos, const uint8_t* end)
+parser_result<std::string_view> parse_string(const uint8_t* pos, const uint8_t* end)
 {
     // NOTE: this is an optimised version of parse_vec<uint8_t>
     uint32_t size;
     std::tie(size, pos) = leb128u_decode<uint32_t>(pos, end);
 
     if ((pos + size) > end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
     // FIXME: need to validate that string is a valid UTF-8
-    auto ret = std::string(pos, pos + size);
+    const auto ret = std::string_view(reinterpret_cast<const char*>(pos), size);
     pos += size;
 
-    return {std::move(ret), pos};
+    return {ret, pos};
 }
 
 template <>
@@ -163,7 +182,7 @@ inline parser_result<Import> parse(const uint8_t* pos, const uint8_t* end)
     std::tie(result.name, pos) = parse_string(pos, end);
 
     if (pos == end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
     const uint8_t kind = *pos++;
     switch (kind)
@@ -182,10 +201,10 @@ inline parser_result<Import> parse(const uint8_t* pos, const uint8_t* end)
         break;
     case 0x03:
         result.kind = ExternalKind::Global;
-        std::tie(result.desc.global_mutable, pos) = parse_global_type(pos, end);
+        std::tie(result.desc.global, pos) = parse_global_type(pos, end);
         break;
     default:
-        throw parser_error{"unexpected import kind value " + std::to_string(kind)};
+        throw parser_error{pos - 1, ErrorCode::invalid_import_kind, kind};
     }
 
     return {result, pos};
@@ -198,7 +217,7 @@ inline parser_result<Export> parse(const uint8_t* pos, const uint8_t* end)
     std::tie(result.name, pos) = parse_string(pos, end);
 
     if (pos == end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
     const uint8_t kind = *pos++;
     switch (kind)
@@ -216,7 +235,7 @@ inline parser_result<Export> parse(const uint8_t* pos, const uint8_t* end)
         result.kind = ExternalKind::Global;
         break;
     default:
-        throw parser_error{"unexpected export kind value " + std::to_string(kind)};
+        throw parser_error{pos - 1, ErrorCode::invalid_export_kind, kind};
     }
 
     std::tie(result.index, pos) = leb128u_decode<uint32_t>(pos, end);
@@ -230,10 +249,10 @@ inline parser_result<Element> parse(const uint8_t* pos, const uint8_t* end)
     TableIdx table_index;
     std::tie(table_index, pos) = leb128u_decode<uint32_t>(pos, end);
     if (table_index != 0)
-        throw parser_error{"unexpected tableidx value " + std::to_string(table_index)};
+        throw parser_error{pos, ErrorCode::invalid_table_index, table_index};
 
     ConstantExpression offset;
-    std::tie(offset, pos) = parse_constant_expression(pos, end);
+    std::tie(offset, pos) = parse_constant_expression(pos, end, ValType::i32);
 
     std::vector<FuncIdx> init;
     std::tie(init, pos) = parse_vec<FuncIdx>(pos, end);
@@ -250,167 +269,805 @@ inline parser_result<Locals> parse(const uint8_t* pos, const uint8_t* end)
     return {result, pos};
 }
 
-template <>
-inline parser_result<Code> parse(const uint8_t* pos, const uint8_t* end)
+/// Parses the function body, reporting the malformed size and the invalid instruction opcode
+/// by the status.
+inline parser_result<Code> parse_code(const uint8_t* pos, const uint8_t* end, FuncIdx func_idx,
+    const Module& module, ParseStatus& status)
 {
-    const auto [size, pos1] = leb128u_decode<uint32_t>(pos, end);
+    const auto [size, pos1, size_error] = leb128u_try_decode<uint32_t>(pos, end);
+    if (size_error != ErrorCode::none)
+    {
+        status = {{size_error}, pos1};
+        return {Code{}, pos1};
+    }
 
     const auto [locals_vec, pos2] = parse_vec<Locals>(pos1, end);
 
-    auto [code, pos3] = parse_expr(pos2, end);
-
-    // Size is the total bytes of locals and expressions
-    if (size != (pos3 - pos1))
-        throw parser_error{"malformed size field for function"};
-
     uint64_t local_count = 0;
     for (const auto& l : locals_vec)
     {
         local_count += l.count;
         if (local_count > std::numeric_limits<uint32_t>::max())
-            throw parser_error{"too many local variables"};
+            throw parser_error{pos2, ErrorCode::too_many_locals};
+    }
+
+    auto [code, pos3] = parse_expr(pos2, end, func_idx, locals_vec, module, status);
+    if (status.error)
+        return {std::move(code), pos3};
+
+    // Size is the total bytes of locals and expressions
+    if (size != (pos3 - pos1))
+    {
+        status = {{ErrorCode::malformed_function_size}, pos3};
+        return {std::move(code), pos3};
     }
+
     code.local_count = static_cast<uint32_t>(local_count);
 
+    fuse_instructions(code);
+
     return {std::move(code), pos3};
 }
 
+inline parser_result<Code> parse_code(
+    const uint8_t* pos, const uint8_t* end, FuncIdx func_idx, const Module& module)
+{
+    ParseStatus status;
+    auto result = parse_code(pos, end, func_idx, module, status);
+    if (status.error)
+        throw_parser_error(status);
+    return result;
+}
+
+/// Parses the function bodies following the ones already in the module's code section,
+/// up to the given number of the bodies. Stops at the body the status is set by.
+inline const uint8_t* parse_codes(const uint8_t* pos, const uint8_t* end, uint32_t num_codes,
+    Module& module, ParseStatus& status)
+{
+    module.codesec.reserve(num_codes);
+    const auto num_imported_functions =
+        static_cast<FuncIdx>(module.imported_function_types.size());
+    for (auto i = static_cast<uint32_t>(module.codesec.size()); i < num_codes; ++i)
+    {
+        Code code;
+        std::tie(code, pos) = parse_code(pos, end, num_imported_functions + i, module, status);
+        if (status.error)
+            return pos;
+        module.codesec.emplace_back(std::move(code));
+    }
+    return pos;
+}
+
+/// Parses the function bodies on the given number of threads.
+///
+/// The bodies are located by their size prefixes first. The scan stops at the first prefix
+/// being malformed or exceeding the input, the bodies from there on are parsed sequentially.
+/// Every located body starts where the sequential parsing would start it, provided all
+/// the preceding bodies are valid, so reporting the error of the first invalid body gives
+/// the same error as the sequential parsing.
+inline const uint8_t* parse_codes_in_parallel(const uint8_t* pos, const uint8_t* end,
+    uint32_t num_codes, unsigned num_threads, Module& module, ParseStatus& status)
+{
+    std::vector<const uint8_t*> bodies;
+    // Every body takes at least one byte.
+    bodies.reserve(std::min(size_t{num_codes}, static_cast<size_t>(end - pos)));
+    try
+    {
+        while (bodies.size() < num_codes)
+        {
+            const auto [size, body_end] = leb128u_decode<uint32_t>(pos, end);
+            if (size > end - body_end)
+                break;
+            bodies.push_back(pos);
+            pos = body_end + size;
+        }
+    }
+    catch (const parser_error&)
+    {
+        // The malformed prefix is reported by the sequential parsing.
+    }
+
+    const auto num_imported_functions =
+        static_cast<FuncIdx>(module.imported_function_types.size());
+    module.codesec.resize(bodies.size());
+    std::vector<std::exception_ptr> errors(bodies.size());
+    std::atomic<size_t> next_body{0};
+    std::atomic<size_t> first_invalid_body{bodies.size()};
+
+    const auto worker = [&]() noexcept {
+        for (size_t i; (i = next_body.fetch_add(1, std::memory_order_relaxed)) < bodies.size();)
+        {
+            // The bodies following an invalid one are not needed.
+            if (i > first_invalid_body.load(std::memory_order_relaxed))
+                break;
+            try
+            {
+                std::tie(module.codesec[i], std::ignore) = parse_code(bodies[i], end,
+                    num_imported_functions + static_cast<FuncIdx>(i), module);
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+                auto first = first_invalid_body.load(std::memory_order_relaxed);
+                while (i < first && !first_invalid_body.compare_exchange_weak(first, i))
+                {
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    try
+    {
+        for (unsigned i = 1; i < num_threads && i < bodies.size(); ++i)
+            threads.emplace_back(worker);
+    }
+    catch (const std::system_error&)
+    {
+        // Continue with the threads created so far.
+    }
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    const auto first_invalid = first_invalid_body.load();
+    if (first_invalid != bodies.size())
+        std::rethrow_exception(errors[first_invalid]);
+
+    return parse_codes(pos, end, num_codes, module, status);
+}
+
+/// Splits the code section content into the function bodies to be parsed lazily.
+/// Only the sizes of the bodies are checked.
+inline const uint8_t* split_code_section(
+    const uint8_t* pos, const uint8_t* end, uint32_t num_codes, Module& module)
+{
+    // Every body takes at least one byte.
+    if (num_codes > end - pos)
+        throw parser_error{pos, ErrorCode::unexpected_eof};
+
+    auto lazy = std::make_shared<LazyCodeSection>();
+    const auto* const begin = pos;
+    lazy->content.assign(begin, end);
+    lazy->body_offsets.reserve(num_codes);
+    for (uint32_t i = 0; i < num_codes; ++i)
+    {
+        lazy->body_offsets.push_back(static_cast<size_t>(pos - begin));
+        uint32_t size;
+        std::tie(size, pos) = leb128u_decode<uint32_t>(pos, end);
+        if (size > end - pos)
+            throw parser_error{pos, ErrorCode::unexpected_eof};
+        pos += size;
+    }
+    lazy->codes.resize(num_codes);
+    lazy->parsed = std::make_unique<std::atomic<bool>[]>(num_codes);
+    module.lazy_codesec = std::move(lazy);
+    return pos;
+}
+
 template <>
 inline parser_result<Data> parse(const uint8_t* pos, const uint8_t* end)
 {
     MemIdx memory_index;
     std::tie(memory_index, pos) = leb128u_decode<uint32_t>(pos, end);
     if (memory_index != 0)
-        throw parser_error{"unexpected memidx value " + std::to_string(memory_index)};
+        throw parser_error{pos, ErrorCode::invalid_memory_index, memory_index};
 
     ConstantExpression offset;
-    std::tie(offset, pos) = parse_constant_expression(pos, end);
+    std::tie(offset, pos) = parse_constant_expression(pos, end, ValType::i32);
 
     // NOTE: this is an optimised version of parse_vec<uint8_t>
     uint32_t size;
     std::tie(size, pos) = leb128u_decode<uint32_t>(pos, end);
 
     if ((pos + size) > end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
-    auto init = bytes(pos, pos + size);
+    const auto init = bytes_view(pos, size);
     pos += size;
 
-    return {{offset, std::move(init)}, pos};
+    return {{offset, init}, pos};
+}
+
+const Code& parse_lazy_code(const Module& module, size_t code_idx)
+{
+    auto& lazy = *module.lazy_codesec;
+    const std::lock_guard lock{lazy.mutex};
+    if (!lazy.parsed[code_idx].load(std::memory_order_relaxed))
+    {
+        const auto* const content = lazy.content.data();
+        const auto func_idx =
+            static_cast<FuncIdx>(module.imported_function_types.size() + code_idx);
+        std::tie(lazy.codes[code_idx], std::ignore) =
+            parse_code(content + lazy.body_offsets[code_idx], content + lazy.content.size(),
+                func_idx, module);
+        lazy.parsed[code_idx].store(true, std::memory_order_release);
+    }
+    return lazy.codes[code_idx];
+}
+
+/// Parses the content of the section other than the code section.
+/// The section ends at @a section_end, but its content is parsed up to @a end, so the content
+/// exceeding the section size is reported by check_section_size().
+inline const uint8_t* parse_section(SectionId id, const uint8_t* pos, const uint8_t* end,
+    const uint8_t* section_end, Module& module)
+{
+    switch (id)
+    {
+    case SectionId::type:
+        std::tie(module.typesec, pos) = parse_vec<FuncType>(pos, end);
+        break;
+    case SectionId::import:
+        std::tie(module.importsec, pos) = parse_vec<Import>(pos, end);
+        for (const auto& import : module.importsec)
+        {
+            if (import.kind == ExternalKind::Function)
+                module.imported_function_types.emplace_back(import.desc.function_type_index);
+            else if (import.kind == ExternalKind::Global)
+                module.imported_global_types.emplace_back(import.desc.global);
+        }
+        break;
+    case SectionId::function:
+        std::tie(module.funcsec, pos) = parse_vec<TypeIdx>(pos, end);
+        break;
+    case SectionId::table:
+        std::tie(module.tablesec, pos) = parse_vec<Table>(pos, end);
+        break;
+    case SectionId::memory:
+        std::tie(module.memorysec, pos) = parse_vec<Memory>(pos, end);
+        break;
+    case SectionId::global:
+        std::tie(module.globalsec, pos) = parse_vec<Global>(pos, end);
+        break;
+    case SectionId::export_:
+        std::tie(module.exportsec, pos) = parse_vec<Export>(pos, end);
+        break;
+    case SectionId::start:
+        std::tie(module.startfunc, pos) = leb128u_decode<uint32_t>(pos, end);
+        break;
+    case SectionId::element:
+        std::tie(module.elementsec, pos) = parse_vec<Element>(pos, end);
+        break;
+    case SectionId::data:
+        std::tie(module.datasec, pos) = parse_vec<Data>(pos, end);
+        break;
+    case SectionId::custom:
+    {
+        // NOTE: the name must be parseable (and valid UTF-8)
+        CustomSection custom;
+        std::tie(custom.name, pos) = parse_string(pos, section_end);
+        custom.content = bytes_view(pos, static_cast<size_t>(section_end - pos));
+        module.customsec.emplace_back(custom);
+        pos = section_end;
+        break;
+    }
+    default:
+        throw parser_error{pos, ErrorCode::unknown_section, static_cast<int>(id)};
+    }
+    return pos;
+}
+
+/// Checks if the section content is referenced by the parsed module.
+inline bool is_referenced(SectionId id) noexcept
+{
+    return id == SectionId::import || id == SectionId::export_ || id == SectionId::data ||
+           id == SectionId::custom;
+}
+
+/// Checks the section content parsed ends where the section size says.
+/// @param pos         The position the parsing ended.
+/// @param difference  The position the parsing ended minus the expected section end.
+inline void check_section_size(SectionId id, const uint8_t* pos, ptrdiff_t difference)
+{
+    if (difference != 0)
+        throw parser_error{pos, ErrorCode::invalid_section_size, static_cast<int>(id), difference};
+}
+
+/// Validates the relations of the sections of the completely parsed module.
+/// The function bodies are validated when parsed.
+/// @return  The error found, none if the module is valid.
+inline Error validate_module(const Module& module)
+{
+    if (module.tablesec.size() > 1)
+        return {ErrorCode::too_many_tables};
+
+    if (module.memorysec.size() > 1)
+        return {ErrorCode::too_many_memories};
+
+    const auto imported_mem_count = std::count_if(module.importsec.begin(), module.importsec.end(),
+        [](const auto& import) noexcept { return import.kind == ExternalKind::Memory; });
+
+    if (imported_mem_count > 1)
+        return {ErrorCode::too_many_imported_memories};
+
+    if (!module.memorysec.empty() && imported_mem_count > 0)
+        return {ErrorCode::imported_and_defined_memory};
+
+    const auto imported_tbl_count = std::count_if(module.importsec.begin(), module.importsec.end(),
+        [](const auto& import) noexcept { return import.kind == ExternalKind::Table; });
+
+    if (imported_tbl_count > 1)
+        return {ErrorCode::too_many_imported_tables};
+
+    if (!module.tablesec.empty() && imported_tbl_count > 0)
+        return {ErrorCode::imported_and_defined_table};
+
+    if (!module.elementsec.empty() && module.tablesec.empty() && imported_tbl_count == 0)
+        return {ErrorCode::element_section_without_table};
+
+    if (!module.datasec.empty() && module.memorysec.empty() && imported_mem_count == 0)
+        return {ErrorCode::data_section_without_memory};
+
+    const auto total_func_count = module.imported_function_types.size() + module.funcsec.size();
+    const auto total_global_count = module.imported_global_types.size() + module.globalsec.size();
+
+    for (const auto type_idx : module.imported_function_types)
+    {
+        if (type_idx >= module.typesec.size())
+            return {ErrorCode::invalid_function_type_index, type_idx};
+    }
+    for (const auto type_idx : module.funcsec)
+    {
+        if (type_idx >= module.typesec.size())
+            return {ErrorCode::invalid_function_type_index, type_idx};
+    }
+
+    if (get_code_count(module) != module.funcsec.size())
+        return {ErrorCode::code_count_mismatch};
+
+    // The constant expressions can only read the imported immutable globals.
+    const auto check_constant_expression = [&module](const ConstantExpression& expr,
+                                               ValType type) noexcept -> Error {
+        if (expr.kind != ConstantExpression::Kind::GlobalGet)
+            return {};
+        const auto global_idx = expr.value.global_index;
+        if (global_idx >= module.imported_global_types.size())
+            return {ErrorCode::invalid_constant_global_index};
+        const auto& global_type = module.imported_global_types[global_idx];
+        if (global_type.is_mutable)
+            return {ErrorCode::mutable_constant_global};
+        if (global_type.value_type != type)
+            return {ErrorCode::constant_expression_type_mismatch};
+        return {};
+    };
+    for (const auto& global : module.globalsec)
+    {
+        if (auto error = check_constant_expression(global.expression, global.value_type))
+            return error;
+    }
+    for (const auto& element : module.elementsec)
+    {
+        if (auto error = check_constant_expression(element.offset, ValType::i32))
+            return error;
+        for (const auto func_idx : element.init)
+        {
+            if (func_idx >= total_func_count)
+                return {ErrorCode::invalid_element_function_index};
+        }
+    }
+    for (const auto& data : module.datasec)
+    {
+        if (auto error = check_constant_expression(data.offset, ValType::i32))
+            return error;
+    }
+
+    std::vector<std::string_view> export_names;
+    export_names.reserve(module.exportsec.size());
+    for (const auto& export_ : module.exportsec)
+    {
+        size_t count = total_global_count;
+        if (export_.kind == ExternalKind::Function)
+            count = total_func_count;
+        else if (export_.kind == ExternalKind::Table)
+            count = module.tablesec.size() + static_cast<size_t>(imported_tbl_count);
+        else if (export_.kind == ExternalKind::Memory)
+            count = module.memorysec.size() + static_cast<size_t>(imported_mem_count);
+        if (export_.index >= count)
+        {
+            Error error{ErrorCode::invalid_export_index};
+            error.name = export_.name;
+            return error;
+        }
+        export_names.push_back(export_.name);
+    }
+    std::sort(export_names.begin(), export_names.end());
+    if (std::adjacent_find(export_names.begin(), export_names.end()) != export_names.end())
+        return {ErrorCode::duplicate_export_name};
+
+    if (module.startfunc)
+    {
+        if (*module.startfunc >= total_func_count)
+            return {ErrorCode::invalid_start_function_index};
+
+        const auto func_idx = *module.startfunc;
+        const auto type_idx = func_idx < module.imported_function_types.size() ?
+                                  module.imported_function_types[func_idx] :
+                                  module.funcsec[func_idx - module.imported_function_types.size()];
+        const auto& type = module.typesec[type_idx];
+        if (!type.inputs.empty() || !type.outputs.empty())
+            return {ErrorCode::invalid_start_function_type};
+    }
+    return {};
+}
+
+/// Checks if the input holds the complete LEB128 encoding of a 32-bit value or at least
+/// enough bytes for decoding it to fail.
+inline bool is_leb128u32_complete(const uint8_t* pos, const uint8_t* end) noexcept
+{
+    constexpr ptrdiff_t max_size = (32 + 6) / 7;
+    for (ptrdiff_t i = 0; i < std::min(end - pos, max_size); ++i)
+    {
+        if ((pos[i] & 0x80) == 0)
+            return true;
+    }
+    return end - pos >= max_size;
 }
 
-Module parse(bytes_view input)
+/// Parses the sections of the wasm binary, without the validation of the whole module.
+///
+/// The errors of the prefix, the section headers, the section sizes and of the function bodies
+/// reported by parse_code() are reported by the status, the parsing stops there. The other errors
+/// of the section contents are thrown.
+inline Module parse_sections(
+    bytes_view input, ParseMode mode, unsigned num_threads, ParseStatus& status)
 {
+    if (num_threads == 0)
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    Module module;
     if (input.substr(0, wasm_prefix.size()) != wasm_prefix)
-        throw parser_error{"invalid wasm module prefix"};
+    {
+        status = {{ErrorCode::invalid_prefix}, input.data()};
+        return module;
+    }
 
     input.remove_prefix(wasm_prefix.size());
 
-    Module module;
     for (auto it = input.begin(); it != input.end();)
     {
         const auto id = static_cast<SectionId>(*it++);
-        uint32_t size;
-        std::tie(size, it) = leb128u_decode<uint32_t>(it, input.end());
+        const auto [size, content, size_error] = leb128u_try_decode<uint32_t>(it, input.end());
+        it = content;
+        if (size_error != ErrorCode::none)
+        {
+            status = {{size_error}, it};
+            return module;
+        }
 
         const auto expected_section_end = it + size;
         if (expected_section_end > input.end())
-            throw parser_error("Unexpected EOF");
+        {
+            status = {{ErrorCode::unexpected_eof}, it};
+            return module;
+        }
 
-        switch (id)
+        if (id > SectionId::data)
         {
-        case SectionId::type:
-            std::tie(module.typesec, it) = parse_vec<FuncType>(it, input.end());
-            break;
-        case SectionId::import:
-            std::tie(module.importsec, it) = parse_vec<Import>(it, input.end());
-            break;
-        case SectionId::function:
-            std::tie(module.funcsec, it) = parse_vec<TypeIdx>(it, input.end());
-            break;
-        case SectionId::table:
-            std::tie(module.tablesec, it) = parse_vec<Table>(it, input.end());
-            break;
-        case SectionId::memory:
-            std::tie(module.memorysec, it) = parse_vec<Memory>(it, input.end());
-            break;
-        case SectionId::global:
-            std::tie(module.globalsec, it) = parse_vec<Global>(it, input.end());
-            break;
-        case SectionId::export_:
-            std::tie(module.exportsec, it) = parse_vec<Export>(it, input.end());
-            break;
-        case SectionId::start:
-            std::tie(module.startfunc, it) = leb128u_decode<uint32_t>(it, input.end());
-            break;
-        case SectionId::element:
-            std::tie(module.elementsec, it) = parse_vec<Element>(it, input.end());
-            break;
-        case SectionId::code:
-            std::tie(module.codesec, it) = parse_vec<Code>(it, input.end());
-            break;
-        case SectionId::data:
-            std::tie(module.datasec, it) = parse_vec<Data>(it, input.end());
-            break;
-        case SectionId::custom:
-            // NOTE: this section can be ignored, but the name must be parseable (and valid UTF-8)
-            parse_string(it, expected_section_end);
-            // These sections are ignored for now.
-            it += size;
-            break;
-        default:
-            throw parser_error{
-                "unknown section encountered " + std::to_string(static_cast<int>(id))};
+            status = {{ErrorCode::unknown_section, static_cast<int>(id)}, it};
+            return module;
         }
 
+        if (id == SectionId::code)
+        {
+            // NOTE: this is a version of parse_vec<Code> providing the module context
+            const auto [num_codes, codes, count_error] =
+                leb128u_try_decode<uint32_t>(it, input.end());
+            it = codes;
+            if (count_error != ErrorCode::none)
+            {
+                status = {{count_error}, it};
+                return module;
+            }
+            if (mode == ParseMode::lazy)
+                it = split_code_section(it, expected_section_end, num_codes, module);
+            else if (num_threads > 1)
+            {
+                it = parse_codes_in_parallel(
+                    it, input.end(), num_codes, num_threads, module, status);
+            }
+            else
+                it = parse_codes(it, input.end(), num_codes, module, status);
+            if (status.error)
+                return module;
+        }
+        else
+            it = parse_section(id, it, input.end(), expected_section_end, module);
+
         if (it != expected_section_end)
         {
-            throw parser_error{"incorrect section " + std::to_string(static_cast<int>(id)) +
-                               " size, difference: " + std::to_string(it - expected_section_end)};
+            status = {{ErrorCode::invalid_section_size, static_cast<int>(id),
+                          it - expected_section_end},
+                it};
+            return module;
         }
     }
 
-    // Validation checks
-    if (module.tablesec.size() > 1)
-        throw parser_error{"too many table sections (at most one is allowed)"};
+    return module;
+}
 
-    if (module.memorysec.size() > 1)
-        throw parser_error{"too many memory sections (at most one is allowed)"};
+void copy_referenced_data(Module& module)
+{
+    size_t size = 0;
+    for (const auto& import : module.importsec)
+        size += import.module.size() + import.name.size();
+    for (const auto& export_ : module.exportsec)
+        size += export_.name.size();
+    for (const auto& data : module.datasec)
+        size += data.init.size();
+    for (const auto& custom : module.customsec)
+        size += custom.name.size() + custom.content.size();
+
+    // The buffer is not reallocated while appended, so the views remain valid.
+    auto buffer = std::make_shared<bytes>();
+    buffer->reserve(size);
+    const auto copy = [&buffer](auto& view) {
+        using View = std::decay_t<decltype(view)>;
+        const auto offset = buffer->size();
+        buffer->append(reinterpret_cast<const uint8_t*>(view.data()), view.size());
+        view = View{
+            reinterpret_cast<const typename View::value_type*>(buffer->data() + offset),
+            view.size()};
+    };
+    for (auto& import : module.importsec)
+    {
+        copy(import.module);
+        copy(import.name);
+    }
+    for (auto& export_ : module.exportsec)
+        copy(export_.name);
+    for (auto& data : module.datasec)
+        copy(data.init);
+    for (auto& custom : module.customsec)
+    {
+        copy(custom.name);
+        copy(custom.content);
+    }
 
-    const auto imported_mem_count = std::count_if(module.importsec.begin(), module.importsec.end(),
-        [](const auto& import) noexcept { return import.kind == ExternalKind::Memory; });
+    module.buffers.clear();
+    module.buffers.emplace_back(std::move(buffer));
+}
 
-    if (imported_mem_count > 1)
-        throw parser_error{"too many imported memories (at most one is allowed)"};
+bytes_view copy_to_module(Module& module, bytes_view data)
+{
+    const auto& buffer = module.buffers.emplace_back(std::make_shared<const bytes>(data));
+    return *buffer;
+}
 
-    if (!module.memorysec.empty() && imported_mem_count > 0)
+std::string_view copy_to_module(Module& module, std::string_view data)
+{
+    const auto copy = copy_to_module(
+        module, bytes_view{reinterpret_cast<const uint8_t*>(data.data()), data.size()});
+    return {reinterpret_cast<const char*>(copy.data()), copy.size()};
+}
+
+bool references_owned_data(const Module& module) noexcept
+{
+    // The pointers into the different buffers are compared by std::less_equal giving the total
+    // order of the pointers.
+    const auto is_owned = [&module](const auto& view) noexcept {
+        if (view.empty())
+            return true;
+        const auto* const data = reinterpret_cast<const uint8_t*>(view.data());
+        for (const auto& buffer : module.buffers)
+        {
+            if (std::less_equal<>{}(buffer->data(), data) &&
+                std::less_equal<>{}(data + view.size(), buffer->data() + buffer->size()))
+                return true;
+        }
+        return false;
+    };
+
+    for (const auto& import : module.importsec)
+    {
+        if (!is_owned(import.module) || !is_owned(import.name))
+            return false;
+    }
+    for (const auto& export_ : module.exportsec)
+    {
+        if (!is_owned(export_.name))
+            return false;
+    }
+    for (const auto& data : module.datasec)
+    {
+        if (!is_owned(data.init))
+            return false;
+    }
+    for (const auto& custom : module.customsec)
     {
-        throw parser_error{
-            "both module memory and imported memory are defined (at most one of them is allowed)"};
+        if (!is_owned(custom.name) || !is_owned(custom.content))
+            return false;
     }
+    return true;
+}
 
-    const auto imported_tbl_count = std::count_if(module.importsec.begin(), module.importsec.end(),
-        [](const auto& import) noexcept { return import.kind == ExternalKind::Table; });
+Module parse(bytes_view input, ParseMode mode, unsigned num_threads)
+{
+    auto module = parse_referencing(input, mode, num_threads);
+    copy_referenced_data(module);
+    return module;
+}
 
-    if (imported_tbl_count > 1)
-        throw parser_error{"too many imported tables (at most one is allowed)"};
+/// Returns the offset of the error position in the input, the input size if the position is
+/// not known or it is outside of the input.
+inline size_t get_error_offset(const uint8_t* error_position, bytes_view input) noexcept
+{
+    const auto position = reinterpret_cast<uintptr_t>(error_position);
+    const auto begin = reinterpret_cast<uintptr_t>(input.data());
+    if (position < begin || position - begin > input.size())
+        return input.size();
+    return position - begin;
+}
 
-    if (!module.tablesec.empty() && imported_tbl_count > 0)
+std::optional<Module> try_parse(
+    bytes_view input, Error& error, ParseMode mode, unsigned num_threads) noexcept
+{
+    error = {};
+    try
     {
-        throw parser_error{
-            "both module table and imported table are defined (at most one of them is allowed)"};
+        ParseStatus status;
+        auto module = parse_sections(input, mode, num_threads, status);
+        if (status.error)
+        {
+            error = status.error;
+            error.offset = get_error_offset(status.position, input);
+            return std::nullopt;
+        }
+        error = validate_module(module);
+        if (error)
+        {
+            error.offset = input.size();
+            return std::nullopt;
+        }
+        module.validated = true;
+        copy_referenced_data(module);
+        return module;
     }
+    catch (const parser_error& e)
+    {
+        error = e.error();
+        error.offset = get_error_offset(e.position(), input);
+    }
+    catch (const std::bad_alloc&)
+    {
+        error.code = ErrorCode::out_of_memory;
+    }
+    catch (...)
+    {
+        error.code = ErrorCode::unexpected_exception;
+    }
+    return std::nullopt;
+}
 
-    if (!module.elementsec.empty() && module.tablesec.empty() && imported_tbl_count == 0)
-        throw parser_error("element section encountered without a table section");
+Module parse_referencing(bytes_view input, ParseMode mode, unsigned num_threads)
+{
+    ParseStatus status;
+    auto module = parse_sections(input, mode, num_threads, status);
+    if (status.error)
+        throw_parser_error(status);
+    if (const auto error = validate_module(module))
+        throw parser_error{error};
+    module.validated = true;
+    return module;
+}
 
-    const auto imported_func_count = std::count_if(module.importsec.begin(), module.importsec.end(),
-        [](const auto& import) noexcept { return import.kind == ExternalKind::Function; });
-    const auto total_func_count = static_cast<size_t>(imported_func_count) + module.funcsec.size();
+void StreamingParser::push(bytes_view chunk)
+{
+    m_buffer.append(chunk);
+    const auto* const begin = m_buffer.data();
+    const auto* const end = parse_complete(begin, begin + m_buffer.size());
+    m_buffer.erase(0, static_cast<size_t>(end - begin));
+}
 
-    if (module.startfunc && *module.startfunc >= total_func_count)
-        throw parser_error{"invalid start function index"};
+const uint8_t* StreamingParser::parse_complete(const uint8_t* pos, const uint8_t* end)
+{
+    if (!m_prefix_parsed)
+    {
+        const auto size = std::min(static_cast<size_t>(end - pos), wasm_prefix.size());
+        if (bytes_view{pos, size} != wasm_prefix.substr(0, size))
+            throw parser_error{pos, ErrorCode::invalid_prefix};
+        if (size != wasm_prefix.size())
+            return pos;
+        pos += size;
+        m_prefix_parsed = true;
+    }
 
-    return module;
+    while (true)
+    {
+        if (m_code_section)
+        {
+            // The code section is parsed body by body.
+            auto& section = *m_code_section;
+            const auto* const section_end =
+                pos + std::min(static_cast<size_t>(end - pos), section.remaining_size);
+            const auto* const section_pos = pos;
+            if (!section.num_codes)
+            {
+                if (!is_leb128u32_complete(pos, section_end))
+                {
+                    if (section_end - pos == static_cast<ptrdiff_t>(section.remaining_size))
+                        throw parser_error{pos, ErrorCode::unexpected_eof};
+                    return pos;
+                }
+                std::tie(section.num_codes, pos) = leb128u_decode<uint32_t>(pos, section_end);
+                m_module.codesec.reserve(
+                    std::min(size_t{*section.num_codes}, section.remaining_size));
+            }
+            else if (m_module.codesec.size() < *section.num_codes)
+            {
+                if (!is_leb128u32_complete(pos, section_end))
+                {
+                    if (section_end - pos == static_cast<ptrdiff_t>(section.remaining_size))
+                        throw parser_error{pos, ErrorCode::unexpected_eof};
+                    return pos;
+                }
+                const auto [size, body] = leb128u_decode<uint32_t>(pos, section_end);
+                if (size > section.remaining_size - static_cast<size_t>(body - pos))
+                    throw parser_error{pos, ErrorCode::unexpected_eof};
+                if (size > end - body)
+                    return pos;
+
+                const auto func_idx = static_cast<FuncIdx>(
+                    m_module.imported_function_types.size() + m_module.codesec.size());
+                Code code;
+                std::tie(code, pos) = parse_code(pos, body + size, func_idx, m_module);
+                m_module.codesec.emplace_back(std::move(code));
+            }
+            else
+            {
+                check_section_size(
+                    SectionId::code, pos, -static_cast<ptrdiff_t>(section.remaining_size));
+                m_code_section.reset();
+                continue;
+            }
+            section.remaining_size -= static_cast<size_t>(pos - section_pos);
+            continue;
+        }
+
+        if (pos == end || !is_leb128u32_complete(pos + 1, end))
+            return pos;
+
+        const auto id = static_cast<SectionId>(*pos);
+        const auto [size, content] = leb128u_decode<uint32_t>(pos + 1, end);
+        if (id == SectionId::code && m_mode == ParseMode::eager)
+        {
+            m_code_section = CodeSectionState{size, std::nullopt};
+            pos = content;
+            continue;
+        }
+
+        if (size > end - content)
+            return pos;
+        const auto* const section_end = content + size;
+        if (id == SectionId::code)
+        {
+            uint32_t num_codes;
+            std::tie(num_codes, pos) = leb128u_decode<uint32_t>(content, section_end);
+            pos = split_code_section(pos, section_end, num_codes, m_module);
+        }
+        else if (is_referenced(id))
+        {
+            // The input buffer is reused, so the module references the copy of the section.
+            auto buffer = std::make_shared<const bytes>(content, size);
+            const auto* const copy = buffer->data();
+            m_module.buffers.emplace_back(std::move(buffer));
+            pos = content + (parse_section(id, copy, copy + size, copy + size, m_module) - copy);
+        }
+        else
+            pos = parse_section(id, content, section_end, section_end, m_module);
+        check_section_size(id, pos, pos - section_end);
+    }
+}
+
+Module StreamingParser::finish()
+{
+    if (!m_prefix_parsed)
+        throw parser_error{ErrorCode::invalid_prefix};
+    if (!m_buffer.empty() || m_code_section)
+        throw parser_error{ErrorCode::unexpected_eof};
+
+    if (const auto error = validate_module(m_module))
+        throw parser_error{error};
+    m_module.validated = true;
+    return std::move(m_module);
 }
 }  // namespace fizzy
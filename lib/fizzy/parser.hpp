@@ -3,6 +3,9 @@
 #include "exceptions.hpp"
 #include "leb128.hpp"
 #include "types.hpp"
+#include <atomic>
+#include <mutex>
+#include <optional>
 #include <tuple>
 
 namespace fizzy
@@ -13,9 +16,189 @@ constexpr bytes_view wasm_prefix{wasm_prefix_data, sizeof(wasm_prefix_data)};
 template <typename T>
 using parser_result = std::tuple<T, const uint8_t*>;
 
-Module parse(bytes_view input);
+/// The parser error reported without throwing it: the error and the position of the input
+/// it was found at. Used for the errors of the malformed binaries found most often
+/// (e.g. the prefix, the section headers, the instruction opcodes), so try_parse() rejects
+/// such binaries without the exceptions.
+struct ParseStatus
+{
+    Error error;
+    const uint8_t* position = nullptr;
+};
+
+/// Throws the parser_error of the status.
+[[noreturn]] inline void throw_parser_error(const ParseStatus& status)
+{
+    throw parser_error{
+        status.position, status.error.code, status.error.value, status.error.value2};
+}
+
+/// The mode of parsing the function bodies of the code section.
+enum class ParseMode : uint8_t
+{
+    /// All the bodies are parsed and validated by parse().
+    eager,
+    /// The bodies are only split by parse() and each is parsed on the first use.
+    /// The invalid body is reported when the function is executed the first time.
+    lazy,
+};
+
+/// The function bodies of the lazily parsed module.
+struct LazyCodeSection
+{
+    /// The copy of the code section content the bodies are parsed from.
+    bytes content;
+
+    /// The offsets of the bodies in the content.
+    std::vector<size_t> body_offsets;
+
+    /// The parsed bodies. The code is written only once, before its flag is set.
+    std::vector<Code> codes;
+    std::unique_ptr<std::atomic<bool>[]> parsed;
+
+    /// Serializes the parsing of the bodies.
+    std::mutex mutex;
+};
+
+/// Parses the wasm binary.
+///
+/// In the eager mode the function bodies are parsed on the given number of threads,
+/// all the hardware threads if 0. The errors reported are the same as in the sequential parsing.
+/// The names, the data segments and the custom sections of the module are copied into
+/// the buffer owned by the module.
+Module parse(bytes_view input, ParseMode mode = ParseMode::eager, unsigned num_threads = 1);
+
+/// Parses the wasm binary like parse(), but the names, the data segments and the custom
+/// sections of the module point into the input instead of being copied.
+///
+/// The input (e.g. the mapped file) must outlive the module and all the instances of it.
+/// The data segments are copied to the memory of the instance directly from the input.
+Module parse_referencing(
+    bytes_view input, ParseMode mode = ParseMode::eager, unsigned num_threads = 1);
+
+/// Parses the wasm binary like parse(), but reports the failure by the error instead of
+/// the exception.
+///
+/// The error offset is relative to the beginning of the input. The error message is not built,
+/// error_message() builds it when needed.
+/// @return  The module, none if the binary is not valid or the memory cannot be allocated.
+std::optional<Module> try_parse(bytes_view input, Error& error,
+    ParseMode mode = ParseMode::eager, unsigned num_threads = 1) noexcept;
+
+/// Copies the names, the data segments and the custom sections of the module into the single
+/// buffer owned by the module, so the module no longer references the buffers it was built from.
+///
+/// The module built by hand must call it (or build the views with copy_to_module()) while
+/// the buffers it references are alive: instantiate() requires the module not validated by
+/// the parser to reference only the buffers it owns.
+void copy_referenced_data(Module& module);
+
+/// Copies the bytes into a new buffer owned by the module and returns the view of the copy.
+/// This builds the name, the data segment or the custom section of the module built by hand,
+/// e.g. `module.datasec.push_back({offset, copy_to_module(module, bytes{0xaa, 0xff})})`.
+bytes_view copy_to_module(Module& module, bytes_view data);
+
+/// Copies the string into a new buffer owned by the module, see above.
+std::string_view copy_to_module(Module& module, std::string_view data);
+
+/// Checks if the names, the data segments and the custom sections of the module are empty
+/// or point into the buffers owned by the module.
+bool references_owned_data(const Module& module) noexcept;
+
+/// Parses the wasm binary arriving in chunks.
+///
+/// Every section is parsed as soon as it is complete, and in the eager mode every function
+/// body of the code section too, so the parsing overlaps with receiving the binary and
+/// the errors are reported before the binary is complete. The section or body exceeding its
+/// declared size may be reported with a different error than by parse().
+/// The parser must not be used after it reports an error.
+class StreamingParser
+{
+public:
+    explicit StreamingParser(ParseMode mode = ParseMode::eager) noexcept : m_mode{mode} {}
+
+    /// Appends the chunk of the binary and parses the sections and bodies it completes.
+    /// @throws parser_error if the binary received so far is not valid.
+    void push(bytes_view chunk);
+
+    /// Returns the module after the whole binary is pushed.
+    /// @throws parser_error if the binary is incomplete or the module is not valid.
+    Module finish();
+
+private:
+    /// Parses the complete sections and bodies of the input.
+    /// Returns the position of the first byte not parsed.
+    const uint8_t* parse_complete(const uint8_t* pos, const uint8_t* end);
+
+    /// The state of the code section being parsed body by body.
+    struct CodeSectionState
+    {
+        size_t remaining_size = 0;
+        std::optional<uint32_t> num_codes;
+    };
+
+    ParseMode m_mode;
+    /// The input received but not parsed yet.
+    bytes m_buffer;
+    bool m_prefix_parsed = false;
+    std::optional<CodeSectionState> m_code_section;
+    Module m_module;
+};
+
+/// Returns the number of the function bodies of the module.
+inline size_t get_code_count(const Module& module) noexcept
+{
+    return module.lazy_codesec == nullptr ? module.codesec.size() :
+                                            module.lazy_codesec->codes.size();
+}
+
+/// Parses the function body of the lazily parsed module, unless it is already parsed.
+/// Thread-safe.
+/// @throws parser_error if the body is not valid.
+const Code& parse_lazy_code(const Module& module, size_t code_idx);
+
+/// Returns the code of the function body of the given code index.
+/// If the module is parsed lazily, the body is parsed on the first call.
+/// @throws parser_error if the lazily parsed body is not valid.
+inline const Code& get_code(const Module& module, size_t code_idx)
+{
+    if (module.lazy_codesec == nullptr)
+        return module.codesec[code_idx];
+
+    const auto& lazy = *module.lazy_codesec;
+    if (lazy.parsed[code_idx].load(std::memory_order_acquire))
+        return lazy.codes[code_idx];
+    return parse_lazy_code(module, code_idx);
+}
+
+/// Parses and validates the function body expression.
+///
+/// Requires the module's sections preceding the code section to be already parsed.
+/// The operand types of the instructions are checked against the types of the function,
+/// its locals, the globals and the called functions. Branch targets and the operand stack
+/// heights at them are resolved using the module's types.
+/// @throws parser_error if the expression is not valid.
+parser_result<Code> parse_expr(const uint8_t* input, const uint8_t* end, FuncIdx func_idx,
+    const std::vector<Locals>& locals, const Module& module);
+
+/// Parses and validates the function body expression like the above, but reports the invalid
+/// instruction opcode by the status instead of throwing it.
+/// @throws parser_error if the expression is not valid otherwise.
+parser_result<Code> parse_expr(const uint8_t* input, const uint8_t* end, FuncIdx func_idx,
+    const std::vector<Locals>& locals, const Module& module, ParseStatus& status);
+
+/// Replaces the frequent instruction sequences in the code with the superinstructions.
+///
+/// The superinstruction replaces the first instruction of the sequence and the following ones
+/// are left in place, so the instruction offsets of the branch targets remain valid.
+/// The immediates are not changed: the superinstruction consumes the immediates of all
+/// the instructions of the sequence. When executed, the superinstruction also skips
+/// the remaining instructions of the sequence.
+void fuse_instructions(Code& code) noexcept;
 
-parser_result<Code> parse_expr(const uint8_t* input, const uint8_t* end);
+/// Returns the first instruction of the sequence fused into the superinstruction,
+/// or the instruction itself if it is not a superinstruction.
+Instr unfused_instruction(Instr instr) noexcept;
 
 template <typename T>
 parser_result<T> parse(const uint8_t* pos, const uint8_t* end);
@@ -26,13 +209,13 @@ inline parser_result<uint32_t> parse(const uint8_t* pos, const uint8_t* end)
     return leb128u_decode<uint32_t>(pos, end);
 }
 
-parser_result<std::string> parse_string(const uint8_t* pos, const uint8_t* end);
+parser_result<std::string_view> parse_string(const uint8_t* pos, const uint8_t* end);
 
 template <>
 inline parser_result<ValType> parse(const uint8_t* pos, const uint8_t* end)
 {
     if (pos == end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
     const auto b = *pos++;
     switch (b)
@@ -43,16 +226,16 @@ inline parser_result<ValType> parse(const uint8_t* pos, const uint8_t* end)
         return {ValType::i64, pos};
     case 0x7D:  // f32
     case 0x7C:  // f64
-        throw parser_error{"unsupported valtype (floating point)"};
+        throw parser_error{pos - 1, ErrorCode::floating_point_valtype};
     default:
-        throw parser_error{"invalid valtype " + std::to_string(b)};
+        throw parser_error{pos - 1, ErrorCode::invalid_valtype, b};
     }
 }
 
 inline parser_result<Limits> parse_limits(const uint8_t* pos, const uint8_t* end)
 {
     if (pos == end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
     Limits result;
     const auto b = *pos++;
@@ -65,10 +248,10 @@ inline parser_result<Limits> parse_limits(const uint8_t* pos, const uint8_t* end
         std::tie(result.min, pos) = leb128u_decode<uint32_t>(pos, end);
         std::tie(result.max, pos) = leb128u_decode<uint32_t>(pos, end);
         if (result.min > *result.max)
-            throw parser_error("malformed limits (minimum is larger than maximum)");
+            throw parser_error{pos, ErrorCode::malformed_limits};
         return {result, pos};
     default:
-        throw parser_error{"invalid limits " + std::to_string(b)};
+        throw parser_error{pos - 1, ErrorCode::invalid_limits, b};
     }
 }
 
@@ -1,6 +1,8 @@
 #include "parser.hpp"
 #include "stack.hpp"
+#include <algorithm>
 #include <cassert>
+#include <optional>
 
 namespace fizzy
 {
@@ -20,55 +22,374 @@ inline void push(bytes& b, T value)
     b.append(storage, sizeof(storage));
 }
 
-struct LabelPosition
+/// The type of the operand stack item.
+/// The unknown type is the type of the items popped from the polymorphic operand stack
+/// of the unreachable code, matching any type.
+enum class OperandType : uint8_t
 {
-    Instr instruction = Instr::unreachable;  ///< The instruction that created the label.
-    size_t immediates_offset{0};             ///< The immediates offset for block instructions.
+    unknown = 0,
+    i32 = static_cast<uint8_t>(ValType::i32),
+    i64 = static_cast<uint8_t>(ValType::i64),
+};
+
+inline OperandType to_operand_type(ValType type) noexcept
+{
+    return static_cast<OperandType>(type);
+}
+
+using OperandStack = Stack<OperandType>;
+
+struct ControlFrame
+{
+    /// The instruction that created the frame: block/loop/if/else.
+    /// The function body is represented as a block frame.
+    Instr instruction = Instr::unreachable;
+
+    /// The result type of the frame, none if the frame has no result.
+    std::optional<ValType> type;
+
+    /// The operand stack height at the start of the frame.
+    size_t stack_height = 0;
+
+    /// The instruction offset of the frame start (used as loop branch target).
+    size_t code_offset = 0;
+
+    /// For loop: the immediates offset of the loop branch target.
+    /// For if/else: the immediates offset of the jump target to be filled at else/end.
+    size_t immediates_offset = 0;
+
+    /// Whether the rest of the frame is unreachable, making the operand stack polymorphic.
+    bool unreachable = false;
+
+    /// The immediates offsets of the branches to this frame,
+    /// to be filled with the branch target at the matching end instruction.
+    std::vector<size_t> br_immediate_offsets;
+};
+
+/// Pops the operand from the operand stack and checks it has the expected type.
+///
+/// In the unreachable code the operand stack is polymorphic: popping from the height at
+/// the start of the current frame gives the operand of the unknown type.
+inline OperandType pop_operand(
+    const ControlFrame& frame, OperandStack& operand_stack, OperandType expected_type)
+{
+    if (operand_stack.size() == frame.stack_height)
+    {
+        if (frame.unreachable)
+            return OperandType::unknown;
+        throw parser_error{ErrorCode::stack_underflow};
+    }
+
+    const auto actual_type = operand_stack.pop();
+    if (expected_type != OperandType::unknown && actual_type != OperandType::unknown &&
+        actual_type != expected_type)
+        throw parser_error{ErrorCode::type_mismatch};
+    return actual_type;
+}
+
+inline void pop_operand(const ControlFrame& frame, OperandStack& operand_stack, ValType type)
+{
+    pop_operand(frame, operand_stack, to_operand_type(type));
+}
+
+/// Pops the operands of the given types, the last type being on the top of the stack.
+inline void pop_operands(
+    const ControlFrame& frame, OperandStack& operand_stack, const std::vector<ValType>& types)
+{
+    for (auto it = types.rbegin(); it != types.rend(); ++it)
+        pop_operand(frame, operand_stack, *it);
+}
+
+inline void push_operand(OperandStack& operand_stack, ValType type)
+{
+    operand_stack.push(to_operand_type(type));
+}
+
+/// Pops the operands of the instruction taking the inputs of the given type
+/// and pushes its result.
+inline void update_operand_stack(const ControlFrame& frame, OperandStack& operand_stack,
+    int num_inputs, ValType input_type, ValType result_type)
+{
+    for (int i = 0; i < num_inputs; ++i)
+        pop_operand(frame, operand_stack, input_type);
+    push_operand(operand_stack, result_type);
+}
+
+/// Pops the result of the frame, checking no other operands are left in the frame.
+inline void check_frame_result(const ControlFrame& frame, OperandStack& operand_stack)
+{
+    if (frame.type.has_value())
+        pop_operand(frame, operand_stack, *frame.type);
+    if (operand_stack.size() != frame.stack_height)
+        throw parser_error{ErrorCode::too_many_results};
+}
+
+/// Marks the rest of the current frame as unreachable. The operand stack becomes polymorphic.
+inline void mark_frame_unreachable(ControlFrame& frame, OperandStack& operand_stack) noexcept
+{
+    operand_stack.resize(frame.stack_height);
+    frame.unreachable = true;
+}
+
+/// Pushes the jump target (instruction and immediates offsets) to the immediates.
+inline void push_jump_target(bytes& immediates, size_t target_pc, size_t target_imm)
+{
+    push(immediates, static_cast<uint32_t>(target_pc));
+    push(immediates, static_cast<uint32_t>(target_imm));
+}
+
+/// Stores the jump target (instruction and immediates offsets) at the given immediates offset.
+inline void store_jump_target(bytes& immediates, size_t offset, size_t target_pc, size_t target_imm)
+{
+    auto* imm = immediates.data() + offset;
+    store(imm, static_cast<uint32_t>(target_pc));
+    store(imm + sizeof(uint32_t), static_cast<uint32_t>(target_imm));
+}
+
+/// Pushes the resolved branch immediates: the target instruction offset, the target immediates
+/// offset, the number of operand stack items to drop and the arity of the branch.
+/// The forward branch targets are filled later at the end of the target frame.
+/// @return The type of the operand passed by the branch, none if the branch passes no operand.
+std::optional<ValType> push_branch_immediates(Code& code, Stack<ControlFrame>& control_stack,
+    size_t operand_stack_height, uint32_t label_idx)
+{
+    if (label_idx >= control_stack.size())
+        throw parser_error{ErrorCode::invalid_label_index, label_idx};
+
+    auto& frame = control_stack[control_stack.size() - 1 - label_idx];
+
+    // The loop label has the type of the loop inputs, i.e. none in wasm 1.0.
+    const auto type = (frame.instruction == Instr::loop) ? std::nullopt : frame.type;
+    const auto arity = type.has_value() ? size_t{1} : size_t{0};
+
+    if (frame.instruction == Instr::loop)
+        push_jump_target(code.immediates, frame.code_offset, frame.immediates_offset);
+    else
+    {
+        frame.br_immediate_offsets.push_back(code.immediates.size());
+        push_jump_target(code.immediates, 0, 0);  // Placeholder filled at the frame's end.
+    }
+
+    // In the unreachable code the operand stack may be lower than the branch operands need.
+    const auto stack_drop = operand_stack_height >= frame.stack_height + arity ?
+                                operand_stack_height - frame.stack_height - arity :
+                                0;
+    push(code.immediates, static_cast<uint32_t>(stack_drop));
+    push(code.immediates, static_cast<uint32_t>(arity));
+    return type;
+}
+
+/// Returns the type of the function of the given index.
+const FuncType& get_function_type(const Module& module, FuncIdx func_idx)
+{
+    const auto num_imported_functions = module.imported_function_types.size();
+    if (func_idx >= num_imported_functions + module.funcsec.size())
+        throw parser_error{ErrorCode::invalid_function_index, func_idx};
+
+    const auto type_idx = func_idx < num_imported_functions ?
+                              module.imported_function_types[func_idx] :
+                              module.funcsec[func_idx - num_imported_functions];
+    if (type_idx >= module.typesec.size())
+        throw parser_error{ErrorCode::invalid_function_type_index, type_idx};
+
+    return module.typesec[type_idx];
+}
+
+/// Returns the type of the global of the given index.
+GlobalType get_global_type(const Module& module, uint32_t global_idx)
+{
+    const auto num_imported_globals = module.imported_global_types.size();
+    if (global_idx < num_imported_globals)
+        return module.imported_global_types[global_idx];
+    if (global_idx - num_imported_globals >= module.globalsec.size())
+        throw parser_error{ErrorCode::invalid_global_index, global_idx};
+
+    const auto& global = module.globalsec[global_idx - num_imported_globals];
+    return {global.is_mutable, global.value_type};
+}
+
+/// Checks if the module has the imported or the defined external of the given kind.
+bool has_external(const Module& module, ExternalKind kind) noexcept
+{
+    if (kind == ExternalKind::Table && !module.tablesec.empty())
+        return true;
+    if (kind == ExternalKind::Memory && !module.memorysec.empty())
+        return true;
+    return std::any_of(module.importsec.begin(), module.importsec.end(),
+        [kind](const Import& import) noexcept { return import.kind == kind; });
+}
+
+/// The types of the function's locals (including the parameters), by the runs of the locals
+/// of the same type.
+class LocalTypes
+{
+    /// The index following the last local of the run, and the type of the run.
+    std::vector<std::pair<uint64_t, ValType>> m_runs;
+
+public:
+    LocalTypes(const std::vector<ValType>& params, const std::vector<Locals>& locals)
+    {
+        m_runs.reserve(params.size() + locals.size());
+        uint64_t count = 0;
+        for (const auto type : params)
+            m_runs.emplace_back(++count, type);
+        for (const auto& run : locals)
+        {
+            count += run.count;
+            m_runs.emplace_back(count, run.type);
+        }
+    }
+
+    ValType operator[](uint32_t local_idx) const
+    {
+        const auto it = std::upper_bound(m_runs.begin(), m_runs.end(), uint64_t{local_idx},
+            [](uint64_t idx, const auto& run) noexcept { return idx < run.first; });
+        if (it == m_runs.end())
+            throw parser_error{ErrorCode::invalid_local_index, local_idx};
+        return it->second;
+    }
 };
 
 /// Parses blocktype.
 ///
 /// Spec: https://webassembly.github.io/spec/core/binary/types.html#binary-blocktype.
-/// @return The type arity (can be 0 or 1).
-parser_result<uint8_t> parse_blocktype(const uint8_t* pos, const uint8_t* end)
+/// @return The result type, none for the empty type.
+parser_result<std::optional<ValType>> parse_blocktype(const uint8_t* pos, const uint8_t* end)
 {
     // The byte meaning an empty wasm result type.
     // https://webassembly.github.io/spec/core/binary/types.html#result-types
     constexpr uint8_t BlockTypeEmpty = 0x40;
 
     if (pos == end)
-        throw parser_error{"Unexpected EOF"};
+        throw parser_error{pos, ErrorCode::unexpected_eof};
 
     const uint8_t type{*pos};
 
     if (type == BlockTypeEmpty)
-        return {0, pos + 1};
+        return {std::nullopt, pos + 1};
 
-    // Validate type.
-    std::tie(std::ignore, pos) = parse<ValType>(pos, end);
-    return {1, pos};
+    return parse<ValType>(pos, end);
 }
-}  // namespace
 
-parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
+/// The type of the value accessed by the memory instruction and the log2 of its size.
+struct MemoryAccess
+{
+    ValType type;
+    uint32_t natural_alignment;
+};
+
+constexpr MemoryAccess memory_access(Instr instr) noexcept
+{
+    switch (instr)
+    {
+    case Instr::i32_load8_s:
+    case Instr::i32_load8_u:
+    case Instr::i32_store8:
+        return {ValType::i32, 0};
+    case Instr::i32_load16_s:
+    case Instr::i32_load16_u:
+    case Instr::i32_store16:
+        return {ValType::i32, 1};
+    case Instr::i64_load8_s:
+    case Instr::i64_load8_u:
+    case Instr::i64_store8:
+        return {ValType::i64, 0};
+    case Instr::i64_load16_s:
+    case Instr::i64_load16_u:
+    case Instr::i64_store16:
+        return {ValType::i64, 1};
+    case Instr::i64_load32_s:
+    case Instr::i64_load32_u:
+    case Instr::i64_store32:
+        return {ValType::i64, 2};
+    case Instr::i64_load:
+    case Instr::i64_store:
+        return {ValType::i64, 3};
+    default:
+        return {ValType::i32, 2};
+    }
+}
+
+/// Parses the memory instruction's alignment and offset, pushing the offset to the immediates.
+/// @param natural_alignment  The log2 of the size of the memory accessed.
+const uint8_t* parse_memarg(
+    const uint8_t* pos, const uint8_t* end, uint32_t natural_alignment, bytes& immediates)
+{
+    uint32_t alignment;
+    std::tie(alignment, pos) = leb128u_decode<uint32_t>(pos, end);
+    if (alignment > natural_alignment)
+        throw parser_error{pos, ErrorCode::invalid_alignment};
+
+    uint32_t offset;
+    std::tie(offset, pos) = leb128u_decode<uint32_t>(pos, end);
+    push(immediates, offset);
+    return pos;
+}
+
+/// The instruction sequence replaced with the superinstruction.
+struct Fusion
+{
+    Instr superinstruction;
+    size_t length;
+    Instr sequence[3];
+};
+
+/// The fused sequences, chosen by the instruction pair frequencies measured on the benchmarks
+/// in test/benchmarks. The longer sequences come first, so they take priority.
+constexpr Fusion fusions[] = {
+    {Instr::local_get_i32_const_i32_add, 3, {Instr::local_get, Instr::i32_const, Instr::i32_add}},
+    {Instr::local_get_local_get, 2, {Instr::local_get, Instr::local_get}},
+    {Instr::local_get_i32_const, 2, {Instr::local_get, Instr::i32_const}},
+    {Instr::local_get_i32_load, 2, {Instr::local_get, Instr::i32_load}},
+    {Instr::local_set_local_get, 2, {Instr::local_set, Instr::local_get}},
+    {Instr::local_tee_br_if, 2, {Instr::local_tee, Instr::br_if}},
+    {Instr::i32_const_i32_add, 2, {Instr::i32_const, Instr::i32_add}},
+    {Instr::i32_add_local_set, 2, {Instr::i32_add, Instr::local_set}},
+};
+
+/// Parses the instructions of the function body, see parse_expr().
+/// @param instr_pos  Set to the position of each instruction before it is parsed.
+/// @param status     Set to the error of the invalid instruction opcode, the parsing stops there.
+parser_result<Code> parse_instructions(const uint8_t* pos, const uint8_t* end, FuncIdx func_idx,
+    const std::vector<Locals>& locals, const Module& module, const uint8_t*& instr_pos,
+    ParseStatus& status)
 {
     Code code;
 
-    // The stack of labels allowing to distinguish between block/if/else and label instructions.
-    // For a block/if/else instruction the value is the block/if/else's immediate offset.
-    Stack<LabelPosition> label_positions;
+    const auto& func_type = get_function_type(module, func_idx);
+    if (func_type.outputs.size() > 1)
+        throw parser_error{pos, ErrorCode::function_with_many_results};
+
+    const LocalTypes local_types{func_type.inputs, locals};
+    const bool has_memory = has_external(module, ExternalKind::Memory);
+    const bool has_table = has_external(module, ExternalKind::Table);
+
+    // The stack of control frames allowing to distinguish between block/if/else and label
+    // instructions and to resolve branch targets. The function body is the bottom frame.
+    Stack<ControlFrame> control_stack;
+    std::optional<ValType> func_result_type;
+    if (!func_type.outputs.empty())
+        func_result_type = func_type.outputs[0];
+    control_stack.push_back({Instr::block, func_result_type, 0, 0, 0, false, {}});
+
+    // The types of the operand stack items of the function.
+    OperandStack operand_stack;
 
     bool continue_parsing = true;
     while (continue_parsing)
     {
         if (pos == end)
-            throw parser_error{"Unexpected EOF"};
+            throw parser_error{pos, ErrorCode::unexpected_eof};
 
+        auto& frame = control_stack.back();
+
+        instr_pos = pos;
         const auto instr = static_cast<Instr>(*pos++);
         switch (instr)
         {
         default:
-            throw parser_error{"invalid instruction " + std::to_string(*(pos - 1))};
+            status = {{ErrorCode::invalid_instruction, *instr_pos}, instr_pos};
+            return {std::move(code), instr_pos};
 
         // Floating point instructions are unsupported
         case Instr::f32_load:
@@ -139,16 +460,59 @@ parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
         case Instr::i64_reinterpret_f64:
         case Instr::f32_reinterpret_i32:
         case Instr::f64_reinterpret_i64:
-            throw parser_error{
-                "unsupported floating point instruction " + std::to_string(*(pos - 1))};
+            status = {{ErrorCode::floating_point_instruction, *instr_pos}, instr_pos};
+            return {std::move(code), instr_pos};
 
         case Instr::unreachable:
-        case Instr::nop:
+            mark_frame_unreachable(frame, operand_stack);
+            break;
+
         case Instr::return_:
+            if (func_result_type.has_value())
+                pop_operand(frame, operand_stack, *func_result_type);
+            mark_frame_unreachable(frame, operand_stack);
+            break;
+
+        case Instr::nop:
+            break;
+
         case Instr::drop:
+            pop_operand(frame, operand_stack, OperandType::unknown);
+            break;
+
         case Instr::select:
-        case Instr::i32_eq:
+        {
+            pop_operand(frame, operand_stack, ValType::i32);  // The condition.
+            const auto type = pop_operand(frame, operand_stack, OperandType::unknown);
+            const auto other_type = pop_operand(frame, operand_stack, type);
+            operand_stack.push(type != OperandType::unknown ? type : other_type);
+            break;
+        }
+
         case Instr::i32_eqz:
+        case Instr::i32_clz:
+        case Instr::i32_ctz:
+        case Instr::i32_popcnt:
+            update_operand_stack(frame, operand_stack, 1, ValType::i32, ValType::i32);
+            break;
+
+        case Instr::i64_clz:
+        case Instr::i64_ctz:
+        case Instr::i64_popcnt:
+            update_operand_stack(frame, operand_stack, 1, ValType::i64, ValType::i64);
+            break;
+
+        case Instr::i64_eqz:
+        case Instr::i32_wrap_i64:
+            update_operand_stack(frame, operand_stack, 1, ValType::i64, ValType::i32);
+            break;
+
+        case Instr::i64_extend_i32_s:
+        case Instr::i64_extend_i32_u:
+            update_operand_stack(frame, operand_stack, 1, ValType::i32, ValType::i64);
+            break;
+
+        case Instr::i32_eq:
         case Instr::i32_ne:
         case Instr::i32_lt_s:
         case Instr::i32_lt_u:
@@ -158,20 +522,6 @@ parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
         case Instr::i32_le_u:
         case Instr::i32_ge_s:
         case Instr::i32_ge_u:
-        case Instr::i64_eq:
-        case Instr::i64_eqz:
-        case Instr::i64_ne:
-        case Instr::i64_lt_s:
-        case Instr::i64_lt_u:
-        case Instr::i64_gt_s:
-        case Instr::i64_gt_u:
-        case Instr::i64_le_s:
-        case Instr::i64_le_u:
-        case Instr::i64_ge_s:
-        case Instr::i64_ge_u:
-        case Instr::i32_clz:
-        case Instr::i32_ctz:
-        case Instr::i32_popcnt:
         case Instr::i32_add:
         case Instr::i32_sub:
         case Instr::i32_mul:
@@ -187,9 +537,22 @@ parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
         case Instr::i32_shr_u:
         case Instr::i32_rotl:
         case Instr::i32_rotr:
-        case Instr::i64_clz:
-        case Instr::i64_ctz:
-        case Instr::i64_popcnt:
+            update_operand_stack(frame, operand_stack, 2, ValType::i32, ValType::i32);
+            break;
+
+        case Instr::i64_eq:
+        case Instr::i64_ne:
+        case Instr::i64_lt_s:
+        case Instr::i64_lt_u:
+        case Instr::i64_gt_s:
+        case Instr::i64_gt_u:
+        case Instr::i64_le_s:
+        case Instr::i64_le_u:
+        case Instr::i64_ge_s:
+        case Instr::i64_ge_u:
+            update_operand_stack(frame, operand_stack, 2, ValType::i64, ValType::i32);
+            break;
+
         case Instr::i64_add:
         case Instr::i64_sub:
         case Instr::i64_mul:
@@ -205,105 +568,119 @@ parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
         case Instr::i64_shr_u:
         case Instr::i64_rotl:
         case Instr::i64_rotr:
-        case Instr::i32_wrap_i64:
-        case Instr::i64_extend_i32_s:
-        case Instr::i64_extend_i32_u:
+            update_operand_stack(frame, operand_stack, 2, ValType::i64, ValType::i64);
             break;
 
         case Instr::end:
         {
-            if (!label_positions.empty())
-            {
-                const auto label_pos = label_positions.pop();
-                if (label_pos.instruction != Instr::loop)  // If end of block/if/else instruction.
-                {
-                    const auto target_pc = static_cast<uint32_t>(code.instructions.size() + 1);
-                    const auto target_imm = static_cast<uint32_t>(code.immediates.size());
-
-                    // Set the imm values for block instruction.
-                    auto* block_imm = code.immediates.data() + label_pos.immediates_offset;
-                    store(block_imm, target_pc);
-                    block_imm += sizeof(target_pc);
-                    store(block_imm, target_imm);
-                }
-            }
-            else
+            check_frame_result(frame, operand_stack);
+            if (frame.instruction == Instr::if_ && frame.type.has_value())
+                throw parser_error{ErrorCode::missing_if_result};
+
+            // The end of the function body is the target of the branches to the function frame.
+            // Other frames' branches target the instruction following the end instruction.
+            const bool is_function_end = control_stack.size() == 1;
+            const auto target_pc = code.instructions.size() + (is_function_end ? 0 : 1);
+            const auto target_imm = code.immediates.size();
+
+            // Set the jump target of if without else or of else.
+            if (frame.instruction == Instr::if_ || frame.instruction == Instr::else_)
+                store_jump_target(code.immediates, frame.immediates_offset, target_pc, target_imm);
+
+            for (const auto br_imm_offset : frame.br_immediate_offsets)
+                store_jump_target(code.immediates, br_imm_offset, target_pc, target_imm);
+
+            const auto type = frame.type;
+            control_stack.pop_back();
+            if (type.has_value())
+                push_operand(operand_stack, *type);
+
+            if (is_function_end)
                 continue_parsing = false;
             break;
         }
 
         case Instr::block:
         {
-            uint8_t arity;
-            std::tie(arity, pos) = parse_blocktype(pos, end);
-            code.immediates.push_back(arity);
-
-            // Push label with immediates offset after arity.
-            label_positions.push_back({Instr::block, code.immediates.size()});
-
-            // Placeholders for immediate values, filled at the matching end instruction.
-            push(code.immediates, uint32_t{0});  // Diff to the end instruction.
-            push(code.immediates, uint32_t{0});  // Diff for the immediates.
+            std::optional<ValType> type;
+            std::tie(type, pos) = parse_blocktype(pos, end);
+            control_stack.push_back({Instr::block, type, operand_stack.size(),
+                code.instructions.size(), code.immediates.size(), false, {}});
             break;
         }
 
         case Instr::loop:
         {
-            std::tie(std::ignore, pos) = parse_blocktype(pos, end);
-            label_positions.push_back({Instr::loop, 0});  // Mark as not interested.
+            std::optional<ValType> type;
+            std::tie(type, pos) = parse_blocktype(pos, end);
+
+            // The loop branches target the instruction following the loop instruction.
+            control_stack.push_back({Instr::loop, type, operand_stack.size(),
+                code.instructions.size() + 1, code.immediates.size(), false, {}});
             break;
         }
 
         case Instr::if_:
         {
-            uint8_t arity;
-            std::tie(arity, pos) = parse_blocktype(pos, end);
-            code.immediates.push_back(arity);
-
-            label_positions.push_back({Instr::if_, code.immediates.size()});
-
-            // Placeholders for immediate values, filled at the matching end and else instructions.
-            push(code.immediates, uint32_t{0});  // Diff to the end instruction.
-            push(code.immediates, uint32_t{0});  // Diff for the immediates
+            std::optional<ValType> type;
+            std::tie(type, pos) = parse_blocktype(pos, end);
 
-            push(code.immediates, uint32_t{0});  // Diff to the else instruction
-            push(code.immediates, uint32_t{0});  // Diff for the immediates.
+            pop_operand(frame, operand_stack, ValType::i32);  // The condition.
+            control_stack.push_back({Instr::if_, type, operand_stack.size(),
+                code.instructions.size(), code.immediates.size(), false, {}});
 
+            // Placeholder for the jump target when the condition is false,
+            // filled at the matching else or end instruction.
+            push_jump_target(code.immediates, 0, 0);
             break;
         }
 
         case Instr::else_:
         {
-            if (label_positions.empty())
-                throw parser_error{"unexpected else instruction"};
-            const auto label_pos = label_positions.peek();
-            if (label_pos.instruction != Instr::if_)
-                throw parser_error{"unexpected else instruction (if instruction missing)"};
-            const auto target_pc = static_cast<uint32_t>(code.instructions.size() + 1);
-            const auto target_imm = static_cast<uint32_t>(code.immediates.size());
-
-            // Set the imm values for else instruction.
-            auto* block_imm = code.immediates.data() + label_pos.immediates_offset +
-                              sizeof(target_pc) + sizeof(target_imm);
-            store(block_imm, target_pc);
-            block_imm += sizeof(target_pc);
-            store(block_imm, target_imm);
+            if (frame.instruction != Instr::if_)
+            {
+                throw parser_error{control_stack.size() == 1 ?
+                                       ErrorCode::unexpected_else :
+                                       ErrorCode::unexpected_else_without_if};
+            }
+
+            check_frame_result(frame, operand_stack);
+
+            const auto else_imm_offset = code.immediates.size();
 
+            // Placeholder for the jump target at the end of the if body,
+            // filled at the matching end instruction.
+            push_jump_target(code.immediates, 0, 0);
+
+            // The if jumps to the instruction following the else instruction.
+            store_jump_target(code.immediates, frame.immediates_offset,
+                code.instructions.size() + 1, code.immediates.size());
+
+            frame.instruction = Instr::else_;
+            frame.immediates_offset = else_imm_offset;
+            frame.unreachable = false;
             break;
         }
 
-        case Instr::local_get:
-        case Instr::local_set:
-        case Instr::local_tee:
-        case Instr::global_get:
-        case Instr::global_set:
         case Instr::br:
         case Instr::br_if:
-        case Instr::call:
         {
-            uint32_t imm;
-            std::tie(imm, pos) = leb128u_decode<uint32_t>(pos, end);
-            push(code.immediates, imm);
+            uint32_t label_idx;
+            std::tie(label_idx, pos) = leb128u_decode<uint32_t>(pos, end);
+
+            if (instr == Instr::br_if)
+                pop_operand(frame, operand_stack, ValType::i32);  // The condition.
+
+            const auto type =
+                push_branch_immediates(code, control_stack, operand_stack.size(), label_idx);
+
+            if (type.has_value())
+                pop_operand(frame, operand_stack, *type);
+
+            if (instr == Instr::br)
+                mark_frame_unreachable(frame, operand_stack);
+            else if (type.has_value())
+                push_operand(operand_stack, *type);  // The operand remains if not branching.
             break;
         }
 
@@ -314,10 +691,89 @@ parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
             uint32_t default_label_idx;
             std::tie(default_label_idx, pos) = leb128u_decode<uint32_t>(pos, end);
 
+            pop_operand(frame, operand_stack, ValType::i32);  // The label index.
+
+            // The jump table with the resolved targets, the default target is the last one.
             push(code.immediates, static_cast<uint32_t>(label_indices.size()));
+            const auto height = operand_stack.size();
+            std::vector<std::optional<ValType>> types;
+            types.reserve(label_indices.size());
             for (const auto idx : label_indices)
-                push(code.immediates, idx);
-            push(code.immediates, default_label_idx);
+                types.emplace_back(push_branch_immediates(code, control_stack, height, idx));
+            const auto default_type =
+                push_branch_immediates(code, control_stack, height, default_label_idx);
+
+            if (std::any_of(types.begin(), types.end(),
+                    [&default_type](const auto& type) noexcept { return type != default_type; }))
+                throw parser_error{ErrorCode::inconsistent_br_table};
+
+            if (default_type.has_value())
+                pop_operand(frame, operand_stack, *default_type);
+
+            mark_frame_unreachable(frame, operand_stack);
+            break;
+        }
+
+        case Instr::local_get:
+        {
+            uint32_t imm;
+            std::tie(imm, pos) = leb128u_decode<uint32_t>(pos, end);
+            push(code.immediates, imm);
+            push_operand(operand_stack, local_types[imm]);
+            break;
+        }
+
+        case Instr::local_set:
+        {
+            uint32_t imm;
+            std::tie(imm, pos) = leb128u_decode<uint32_t>(pos, end);
+            push(code.immediates, imm);
+            pop_operand(frame, operand_stack, local_types[imm]);
+            break;
+        }
+
+        case Instr::local_tee:
+        {
+            uint32_t imm;
+            std::tie(imm, pos) = leb128u_decode<uint32_t>(pos, end);
+            push(code.immediates, imm);
+            const auto type = local_types[imm];
+            pop_operand(frame, operand_stack, type);
+            push_operand(operand_stack, type);
+            break;
+        }
+
+        case Instr::global_get:
+        {
+            uint32_t imm;
+            std::tie(imm, pos) = leb128u_decode<uint32_t>(pos, end);
+            push(code.immediates, imm);
+            push_operand(operand_stack, get_global_type(module, imm).value_type);
+            break;
+        }
+
+        case Instr::global_set:
+        {
+            uint32_t imm;
+            std::tie(imm, pos) = leb128u_decode<uint32_t>(pos, end);
+            push(code.immediates, imm);
+            const auto global_type = get_global_type(module, imm);
+            if (!global_type.is_mutable)
+                throw parser_error{ErrorCode::immutable_global_set, imm};
+            pop_operand(frame, operand_stack, global_type.value_type);
+            break;
+        }
+
+        case Instr::call:
+        {
+            uint32_t imm;
+            std::tie(imm, pos) = leb128u_decode<uint32_t>(pos, end);
+            push(code.immediates, imm);
+
+            const auto& callee_type = get_function_type(module, imm);
+            pop_operands(frame, operand_stack, callee_type.inputs);
+            for (const auto type : callee_type.outputs)
+                push_operand(operand_stack, type);
             break;
         }
 
@@ -328,11 +784,23 @@ parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
             push(code.immediates, imm);
 
             if (pos == end)
-                throw parser_error{"Unexpected EOF"};
+                throw parser_error{pos, ErrorCode::unexpected_eof};
 
             const uint8_t tableidx{*pos++};
             if (tableidx != 0)
-                throw parser_error{"invalid tableidx encountered with call_indirect"};
+                throw parser_error{pos - 1, ErrorCode::invalid_call_indirect_table};
+
+            if (imm >= module.typesec.size())
+                throw parser_error{ErrorCode::invalid_call_indirect_type};
+
+            if (!has_table)
+                throw parser_error{ErrorCode::call_indirect_without_table};
+
+            const auto& callee_type = module.typesec[imm];
+            pop_operand(frame, operand_stack, ValType::i32);  // The elem idx.
+            pop_operands(frame, operand_stack, callee_type.inputs);
+            for (const auto type : callee_type.outputs)
+                push_operand(operand_stack, type);
             break;
         }
 
@@ -341,6 +809,7 @@ parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
             int32_t imm;
             std::tie(imm, pos) = leb128s_decode<int32_t>(pos, end);
             push(code.immediates, static_cast<uint32_t>(imm));
+            push_operand(operand_stack, ValType::i32);
             break;
         }
 
@@ -349,6 +818,7 @@ parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
             int64_t imm;
             std::tie(imm, pos) = leb128s_decode<int64_t>(pos, end);
             push(code.immediates, static_cast<uint64_t>(imm));
+            push_operand(operand_stack, ValType::i64);
             break;
         }
 
@@ -364,6 +834,15 @@ parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
         case Instr::i64_load16_u:
         case Instr::i64_load32_s:
         case Instr::i64_load32_u:
+        {
+            const auto access = memory_access(instr);
+            pos = parse_memarg(pos, end, access.natural_alignment, code.immediates);
+            if (!has_memory)
+                throw parser_error{ErrorCode::missing_memory};
+            update_operand_stack(frame, operand_stack, 1, ValType::i32, access.type);
+            break;
+        }
+
         case Instr::i32_store:
         case Instr::i64_store:
         case Instr::i32_store8:
@@ -372,30 +851,100 @@ parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end)
         case Instr::i64_store16:
         case Instr::i64_store32:
         {
-            // alignment
-            std::tie(std::ignore, pos) = leb128u_decode<uint32_t>(pos, end);
-
-            // offset
-            uint32_t imm;
-            std::tie(imm, pos) = leb128u_decode<uint32_t>(pos, end);
-            push(code.immediates, imm);
+            const auto access = memory_access(instr);
+            pos = parse_memarg(pos, end, access.natural_alignment, code.immediates);
+            if (!has_memory)
+                throw parser_error{ErrorCode::missing_memory};
+            pop_operand(frame, operand_stack, access.type);  // The value.
+            pop_operand(frame, operand_stack, ValType::i32);  // The address.
             break;
         }
+
         case Instr::memory_size:
         case Instr::memory_grow:
         {
             if (pos == end)
-                throw parser_error{"Unexpected EOF"};
+                throw parser_error{pos, ErrorCode::unexpected_eof};
 
             const uint8_t memory_idx{*pos++};
             if (memory_idx != 0)
-                throw parser_error{"invalid memory index encountered"};
+                throw parser_error{pos - 1, ErrorCode::invalid_memory_instruction_index};
+
+            if (!has_memory)
+                throw parser_error{ErrorCode::missing_memory};
+
+            const int num_inputs = (instr == Instr::memory_size) ? 0 : 1;
+            update_operand_stack(frame, operand_stack, num_inputs, ValType::i32, ValType::i32);
             break;
         }
         }
         code.instructions.emplace_back(instr);
+        code.max_stack_height =
+            std::max(code.max_stack_height, static_cast<uint32_t>(operand_stack.size()));
     }
-    assert(label_positions.empty());
+    assert(control_stack.empty());
     return {code, pos};
 }
+}  // namespace
+
+parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end, FuncIdx func_idx,
+    const std::vector<Locals>& locals, const Module& module)
+{
+    ParseStatus status;
+    auto result = parse_expr(pos, end, func_idx, locals, module, status);
+    if (status.error)
+        throw_parser_error(status);
+    return result;
+}
+
+parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end, FuncIdx func_idx,
+    const std::vector<Locals>& locals, const Module& module, ParseStatus& status)
+{
+    const uint8_t* instr_pos = pos;
+    try
+    {
+        return parse_instructions(pos, end, func_idx, locals, module, instr_pos, status);
+    }
+    catch (parser_error& error)
+    {
+        // The errors found by the helpers not knowing the input (e.g. the operand type checks)
+        // are reported at the instruction being parsed.
+        if (error.position() == nullptr)
+            error.set_position(instr_pos);
+        throw;
+    }
+}
+
+void fuse_instructions(Code& code) noexcept
+{
+    // The branch targets are only the instructions following loop, else and end instructions
+    // and the final end, none of which is part of the fused sequences.
+    // Therefore, there is no branch into the middle of the fused sequence.
+    auto& instructions = code.instructions;
+    for (size_t pc = 0; pc < instructions.size();)
+    {
+        size_t length = 1;
+        for (const auto& fusion : fusions)
+        {
+            if (pc + fusion.length <= instructions.size() &&
+                std::equal(fusion.sequence, fusion.sequence + fusion.length, &instructions[pc]))
+            {
+                instructions[pc] = fusion.superinstruction;
+                length = fusion.length;
+                break;
+            }
+        }
+        pc += length;
+    }
+}
+
+Instr unfused_instruction(Instr instr) noexcept
+{
+    for (const auto& fusion : fusions)
+    {
+        if (fusion.superinstruction == instr)
+            return fusion.sequence[0];
+    }
+    return instr;
+}
 }  // namespace fizzy
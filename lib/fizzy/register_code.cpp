@@ -0,0 +1,703 @@
+#include "register_code.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <cassert>
+#include <tuple>
+#include <unordered_map>
+
+namespace fizzy
+{
+namespace
+{
+template <typename T>
+inline T read(const uint8_t*& input) noexcept
+{
+    T ret;
+    __builtin_memcpy(&ret, input, sizeof(ret));
+    input += sizeof(ret);
+    return ret;
+}
+
+/// The size of the branch immediates: the target instruction and immediates offsets,
+/// the number of operand stack items to drop and the branch arity.
+constexpr auto BranchImmediateSize = 4 * sizeof(uint32_t);
+
+/// Returns the size of the instruction's immediates in Code::immediates.
+size_t immediates_size(Instr instr, const uint8_t* immediates) noexcept
+{
+    switch (instr)
+    {
+    case Instr::if_:
+    case Instr::else_:
+        return 2 * sizeof(uint32_t);
+    case Instr::br:
+    case Instr::br_if:
+        return BranchImmediateSize;
+    case Instr::br_table:
+        return sizeof(uint32_t) + (read<uint32_t>(immediates) + 1) * BranchImmediateSize;
+    case Instr::i64_const:
+        return sizeof(uint64_t);
+    case Instr::call:
+    case Instr::call_indirect:
+    case Instr::local_get:
+    case Instr::local_set:
+    case Instr::local_tee:
+    case Instr::global_get:
+    case Instr::global_set:
+    case Instr::i32_load:
+    case Instr::i64_load:
+    case Instr::i32_load8_s:
+    case Instr::i32_load8_u:
+    case Instr::i32_load16_s:
+    case Instr::i32_load16_u:
+    case Instr::i64_load8_s:
+    case Instr::i64_load8_u:
+    case Instr::i64_load16_s:
+    case Instr::i64_load16_u:
+    case Instr::i64_load32_s:
+    case Instr::i64_load32_u:
+    case Instr::i32_store:
+    case Instr::i64_store:
+    case Instr::i32_store8:
+    case Instr::i32_store16:
+    case Instr::i64_store8:
+    case Instr::i64_store16:
+    case Instr::i64_store32:
+    case Instr::i32_const:
+        return sizeof(uint32_t);
+    default:
+        return 0;
+    }
+}
+
+const FuncType& function_type(const Module& module, FuncIdx func_idx) noexcept
+{
+    const auto num_imported_functions = module.imported_function_types.size();
+    const auto type_idx = func_idx < num_imported_functions ?
+                              module.imported_function_types[func_idx] :
+                              module.funcsec[func_idx - num_imported_functions];
+    assert(type_idx < module.typesec.size());
+    return module.typesec[type_idx];
+}
+
+struct ControlFrame
+{
+    /// The instruction that created the frame: block/loop/if/else.
+    /// The function body is represented as a block frame.
+    Instr instruction = Instr::block;
+
+    /// The operand stack height at the start of the frame.
+    size_t stack_height = 0;
+
+    /// The code instruction index the branches to this frame target.
+    size_t target_pc = 0;
+
+    /// For loop: the index of the loop's first register instruction.
+    /// For if: the index of the if_ instruction to be patched with the else/end target.
+    size_t instr_idx = 0;
+
+    /// The arity of the frame's result, known from the reachable end of its code or branches.
+    uint32_t arity = 0;
+
+    /// The indices of the branch instructions to this frame, to be patched at the frame's end.
+    std::vector<size_t> br_fixups;
+
+    /// The indices of the br_table targets to this frame, to be patched at the frame's end.
+    std::vector<size_t> br_table_fixups;
+};
+
+class RegisterCodeBuilder
+{
+    RegisterCode& m_code;
+
+    /// The registers holding the values of the operand stack. The item of the height h is
+    /// either in the stack slot register of the height h or in a local or constant register.
+    std::vector<uint32_t> m_stack;
+
+    size_t m_max_stack_height = 0;
+
+    /// The index of the instruction which has just written the top stack slot,
+    /// or npos if there is no such instruction.
+    size_t m_last_producer = npos;
+
+public:
+    static constexpr auto npos = static_cast<size_t>(-1);
+
+    uint32_t stack_base = 0;
+
+    explicit RegisterCodeBuilder(RegisterCode& code) noexcept : m_code{code} {}
+
+    size_t max_stack_height() const noexcept { return m_max_stack_height; }
+
+    size_t stack_height() const noexcept { return m_stack.size(); }
+
+    uint32_t slot(size_t height) const noexcept
+    {
+        return stack_base + static_cast<uint32_t>(height);
+    }
+
+    uint32_t top() const noexcept
+    {
+        assert(!m_stack.empty());
+        return m_stack.back();
+    }
+
+    void push(uint32_t reg)
+    {
+        m_stack.push_back(reg);
+        m_max_stack_height = std::max(m_max_stack_height, m_stack.size());
+    }
+
+    uint32_t pop() noexcept
+    {
+        assert(!m_stack.empty());
+        const auto reg = m_stack.back();
+        m_stack.pop_back();
+        return reg;
+    }
+
+    void resize_stack(size_t height) { m_stack.resize(height); }
+
+    /// Pushes the new stack slot to be written by the next instruction.
+    uint32_t push_slot()
+    {
+        const auto reg = slot(m_stack.size());
+        push(reg);
+        return reg;
+    }
+
+    size_t emit(const RegisterInstr& instr)
+    {
+        m_code.instructions.emplace_back(instr);
+        m_last_producer = npos;
+        return m_code.instructions.size() - 1;
+    }
+
+    /// Emits the instruction writing the top stack slot.
+    void emit_producer(const RegisterInstr& instr)
+    {
+        emit(instr);
+        m_last_producer = m_code.instructions.size() - 1;
+    }
+
+    /// Marks the position where the control flow joins.
+    void label() noexcept { m_last_producer = npos; }
+
+    /// Returns the instruction which wrote the given just popped stack slot if it can be
+    /// retargeted to write another register instead.
+    RegisterInstr* retargetable_producer(uint32_t popped_reg) noexcept
+    {
+        if (m_last_producer == npos || popped_reg != slot(m_stack.size()))
+            return nullptr;
+        auto& instr = m_code.instructions[m_last_producer];
+        return instr.dst == popped_reg ? &instr : nullptr;
+    }
+
+    /// Copies the stack item of the given height to its stack slot if it is kept elsewhere.
+    void materialize(size_t height)
+    {
+        if (m_stack[height] != slot(height))
+        {
+            emit({Instr::local_set, slot(height), m_stack[height], 0, 0});
+            m_stack[height] = slot(height);
+        }
+    }
+
+    void materialize_all()
+    {
+        for (size_t i = 0; i < m_stack.size(); ++i)
+            materialize(i);
+    }
+
+    /// Materializes the stack items referencing the local to be modified.
+    void materialize_local(uint32_t local_reg)
+    {
+        for (size_t i = 0; i < m_stack.size(); ++i)
+        {
+            if (m_stack[i] == local_reg)
+                materialize(i);
+        }
+    }
+};
+
+void patch_fixups(RegisterCode& code, const ControlFrame& frame, size_t target)
+{
+    for (const auto idx : frame.br_fixups)
+        code.instructions[idx].a = static_cast<uint32_t>(target);
+    for (const auto idx : frame.br_table_fixups)
+        code.br_tables[idx].pc = static_cast<uint32_t>(target);
+}
+}  // namespace
+
+RegisterCode translate_to_register_code(const Module& module, size_t code_idx)
+{
+    assert(code_idx < get_code_count(module));
+    const auto& code = get_code(module, code_idx);
+    const auto& func_type = function_type(
+        module, static_cast<FuncIdx>(module.imported_function_types.size() + code_idx));
+
+    RegisterCode result;
+    const auto num_locals = static_cast<uint32_t>(func_type.inputs.size()) + code.local_count;
+
+    // Pre-pass: collect the constants and find the matching ends of the blocks.
+    std::unordered_map<uint64_t, uint32_t> constant_registers;
+    std::vector<size_t> matching_end(code.instructions.size(), 0);
+    {
+        std::vector<size_t> open_blocks;
+        const uint8_t* immediates = code.immediates.data();
+        for (size_t pc = 0; pc < code.instructions.size(); ++pc)
+        {
+            const auto instr = unfused_instruction(code.instructions[pc]);
+            if (instr == Instr::i32_const || instr == Instr::i64_const)
+            {
+                auto imm = immediates;
+                const auto value = instr == Instr::i32_const ? uint64_t{read<uint32_t>(imm)} :
+                                                               read<uint64_t>(imm);
+                const auto reg = num_locals + static_cast<uint32_t>(result.constants.size());
+                if (constant_registers.emplace(value, reg).second)
+                    result.constants.emplace_back(value);
+            }
+            else if (instr == Instr::block || instr == Instr::loop || instr == Instr::if_)
+                open_blocks.push_back(pc);
+            else if (instr == Instr::end && !open_blocks.empty())
+            {
+                matching_end[open_blocks.back()] = pc;
+                open_blocks.pop_back();
+            }
+            immediates += immediates_size(instr, immediates);
+        }
+    }
+    result.constants_base = num_locals;
+
+    RegisterCodeBuilder builder{result};
+    builder.stack_base = num_locals + static_cast<uint32_t>(result.constants.size());
+
+    // The function body is the bottom frame. Its branches target the final end instruction.
+    std::vector<ControlFrame> control_stack;
+    control_stack.push_back({Instr::block, 0, code.instructions.size() - 1, 0,
+        static_cast<uint32_t>(func_type.outputs.size()), {}, {}});
+
+    // Whether the current instruction is unreachable, and the number of the frames
+    // started in the unreachable code (not tracked in the control stack).
+    bool unreachable = false;
+    size_t dead_depth = 0;
+
+    const auto find_frame = [&control_stack](size_t target_pc) -> ControlFrame& {
+        auto it = std::find_if(control_stack.rbegin(), control_stack.rend(),
+            [target_pc](const ControlFrame& frame) { return frame.target_pc == target_pc; });
+        assert(it != control_stack.rend());
+        return *it;
+    };
+
+    // Returns the branch target, and the destination and source registers of the branch result
+    // copy for the branch to the given frame. Without result, the copy is no-op.
+    // The forward branch targets are to be patched at the frame's end.
+    const auto branch_target = [&builder](ControlFrame& frame, uint32_t arity, uint32_t src) {
+        if (frame.instruction == Instr::loop)
+            return std::tuple{static_cast<uint32_t>(frame.instr_idx), uint32_t{0}, uint32_t{0}};
+        frame.arity = arity;
+        if (arity == 0)
+            return std::tuple{uint32_t{0}, uint32_t{0}, uint32_t{0}};
+        return std::tuple{uint32_t{0}, builder.slot(frame.stack_height), src};
+    };
+
+    const uint8_t* immediates = code.immediates.data();
+    for (size_t pc = 0; pc < code.instructions.size(); ++pc)
+    {
+        // The instructions fused into superinstructions are translated one by one.
+        const auto instr = unfused_instruction(code.instructions[pc]);
+        switch (instr)
+        {
+        case Instr::unreachable:
+            if (unreachable)
+                break;
+            builder.emit({Instr::unreachable, 0, 0, 0, 0});
+            unreachable = true;
+            break;
+
+        case Instr::nop:
+            break;
+
+        case Instr::block:
+        case Instr::loop:
+        {
+            if (unreachable)
+            {
+                ++dead_depth;
+                break;
+            }
+            builder.materialize_all();
+            builder.label();
+            const auto target_pc = instr == Instr::loop ? pc + 1 : matching_end[pc] + 1;
+            control_stack.push_back(
+                {instr, builder.stack_height(), target_pc, result.instructions.size(), 0, {}, {}});
+            break;
+        }
+
+        case Instr::if_:
+        {
+            immediates += 2 * sizeof(uint32_t);
+            if (unreachable)
+            {
+                ++dead_depth;
+                break;
+            }
+            const auto condition = builder.pop();
+            builder.materialize_all();
+            const auto if_idx = builder.emit({Instr::if_, 0, 0, 0, condition});
+            control_stack.push_back(
+                {Instr::if_, builder.stack_height(), matching_end[pc] + 1, if_idx, 0, {}, {}});
+            break;
+        }
+
+        case Instr::else_:
+        {
+            immediates += 2 * sizeof(uint32_t);
+            if (dead_depth > 0)
+                break;
+
+            auto& frame = control_stack.back();
+            assert(frame.instruction == Instr::if_);
+            if (!unreachable)
+            {
+                frame.arity = static_cast<uint32_t>(builder.stack_height() - frame.stack_height);
+                if (frame.arity != 0)
+                    builder.materialize(frame.stack_height);
+                frame.br_fixups.push_back(builder.emit({Instr::br, 0, 0, 0, 0}));
+            }
+            result.instructions[frame.instr_idx].a =
+                static_cast<uint32_t>(result.instructions.size());
+            frame.instruction = Instr::else_;
+            builder.resize_stack(frame.stack_height);
+            builder.label();
+            unreachable = false;
+            break;
+        }
+
+        case Instr::end:
+        {
+            if (dead_depth > 0)
+            {
+                --dead_depth;
+                break;
+            }
+
+            auto frame = std::move(control_stack.back());
+            control_stack.pop_back();
+            const bool is_function_end = control_stack.empty();
+
+            const bool has_branches = !frame.br_fixups.empty() || !frame.br_table_fixups.empty();
+            // The result must be in the frame's result slot if multiple paths reach the end.
+            const bool is_join = has_branches || frame.instruction == Instr::if_ ||
+                                 frame.instruction == Instr::else_;
+
+            if (!unreachable)
+            {
+                if (!is_function_end)
+                {
+                    frame.arity =
+                        static_cast<uint32_t>(builder.stack_height() - frame.stack_height);
+                }
+                if (is_join && frame.arity != 0)
+                    builder.materialize(frame.stack_height);
+            }
+
+            // The end of if without else is reached also when the condition is false.
+            const bool reachable = !unreachable || has_branches || frame.instruction == Instr::if_;
+
+            builder.label();
+            patch_fixups(result, frame, result.instructions.size());
+            if (frame.instruction == Instr::if_)
+            {
+                result.instructions[frame.instr_idx].a =
+                    static_cast<uint32_t>(result.instructions.size());
+            }
+
+            if (is_function_end)
+            {
+                if (reachable)
+                {
+                    const auto result_reg = frame.arity == 0 ? 0 :
+                                            is_join          ? builder.slot(0) :
+                                                               builder.top();
+                    builder.emit({Instr::return_, 0, result_reg, 0, frame.arity});
+                }
+                break;
+            }
+
+            if (unreachable)
+            {
+                builder.resize_stack(frame.stack_height);
+                if (reachable && frame.arity != 0)
+                    builder.push(builder.slot(frame.stack_height));
+            }
+            unreachable = !reachable;
+            break;
+        }
+
+        case Instr::br:
+        case Instr::br_if:
+        {
+            const auto target_pc = read<uint32_t>(immediates);
+            immediates += 2 * sizeof(uint32_t);  // The target immediates and the stack drop.
+            const auto arity = read<uint32_t>(immediates);
+            if (unreachable)
+                break;
+
+            const auto condition = instr == Instr::br_if ? builder.pop() : 0;
+            const auto src = arity != 0 ? builder.top() : 0;
+            auto& frame = find_frame(target_pc);
+
+            if (instr == Instr::br && &frame == &control_stack.front())
+                builder.emit({Instr::return_, 0, src, 0, arity});
+            else
+            {
+                const auto [target, dst, copy_src] = branch_target(frame, arity, src);
+                const auto idx = builder.emit({instr, dst, target, copy_src, condition});
+                if (frame.instruction != Instr::loop)
+                    frame.br_fixups.push_back(idx);
+            }
+
+            if (instr == Instr::br)
+                unreachable = true;
+            break;
+        }
+
+        case Instr::br_table:
+        {
+            const auto size = read<uint32_t>(immediates);
+            if (unreachable)
+            {
+                immediates += (size + 1) * BranchImmediateSize;
+                break;
+            }
+
+            const auto index = builder.pop();
+            const auto offset = static_cast<uint32_t>(result.br_tables.size());
+            uint32_t src = 0;
+            for (uint32_t i = 0; i <= size; ++i)
+            {
+                const auto target_pc = read<uint32_t>(immediates);
+                immediates += 2 * sizeof(uint32_t);  // The target immediates and the stack drop.
+                const auto arity = read<uint32_t>(immediates);
+                src = arity != 0 ? builder.top() : 0;
+
+                auto& frame = find_frame(target_pc);
+                const auto [target, dst, copy_src] = branch_target(frame, arity, src);
+                src = copy_src;
+                if (frame.instruction != Instr::loop)
+                    frame.br_table_fixups.push_back(result.br_tables.size());
+                result.br_tables.push_back({target, dst});
+            }
+            builder.emit({Instr::br_table, size, offset, src, index});
+            unreachable = true;
+            break;
+        }
+
+        case Instr::return_:
+        {
+            if (unreachable)
+                break;
+            const auto arity = static_cast<uint32_t>(func_type.outputs.size());
+            builder.emit({Instr::return_, 0, arity != 0 ? builder.top() : 0, 0, arity});
+            unreachable = true;
+            break;
+        }
+
+        case Instr::call:
+        case Instr::call_indirect:
+        {
+            const auto imm = read<uint32_t>(immediates);
+            if (unreachable)
+                break;
+
+            const auto elem_idx = instr == Instr::call_indirect ? builder.pop() : 0;
+            const auto& type =
+                instr == Instr::call ? function_type(module, imm) : module.typesec[imm];
+
+            // The arguments must be in the consecutive stack slots, which become
+            // the beginning of the callee's frame.
+            const auto args_height = builder.stack_height() - type.inputs.size();
+            for (auto i = args_height; i < builder.stack_height(); ++i)
+                builder.materialize(i);
+
+            builder.emit({instr, 0, imm, builder.slot(args_height), elem_idx});
+            builder.resize_stack(args_height);
+            if (!type.outputs.empty())
+                builder.push_slot();
+            break;
+        }
+
+        case Instr::drop:
+            if (!unreachable)
+                builder.pop();
+            break;
+
+        case Instr::select:
+        {
+            if (unreachable)
+                break;
+            const auto condition = builder.pop();
+            const auto val2 = builder.pop();
+            const auto val1 = builder.pop();
+            builder.emit_producer({Instr::select, builder.push_slot(), val1, val2, condition});
+            break;
+        }
+
+        case Instr::local_get:
+        {
+            const auto idx = read<uint32_t>(immediates);
+            if (!unreachable)
+                builder.push(idx);
+            break;
+        }
+
+        case Instr::local_set:
+        case Instr::local_tee:
+        {
+            const auto idx = read<uint32_t>(immediates);
+            if (unreachable)
+                break;
+
+            const auto value = instr == Instr::local_set ? builder.pop() : builder.top();
+            if (value == idx)
+                break;  // The local is set to its own value.
+
+            if (instr == Instr::local_tee)
+                builder.pop();
+            builder.materialize_local(idx);
+
+            if (auto* producer = builder.retargetable_producer(value); producer != nullptr)
+            {
+                // Write the result directly to the local instead of the stack slot.
+                producer->dst = idx;
+                builder.label();
+            }
+            else
+                builder.emit({Instr::local_set, idx, value, 0, 0});
+
+            if (instr == Instr::local_tee)
+                builder.push(idx);
+            break;
+        }
+
+        case Instr::global_get:
+        {
+            const auto idx = read<uint32_t>(immediates);
+            if (!unreachable)
+                builder.emit_producer({Instr::global_get, builder.push_slot(), idx, 0, 0});
+            break;
+        }
+
+        case Instr::global_set:
+        {
+            const auto idx = read<uint32_t>(immediates);
+            if (!unreachable)
+                builder.emit({Instr::global_set, 0, idx, builder.pop(), 0});
+            break;
+        }
+
+        case Instr::i32_load:
+        case Instr::i64_load:
+        case Instr::i32_load8_s:
+        case Instr::i32_load8_u:
+        case Instr::i32_load16_s:
+        case Instr::i32_load16_u:
+        case Instr::i64_load8_s:
+        case Instr::i64_load8_u:
+        case Instr::i64_load16_s:
+        case Instr::i64_load16_u:
+        case Instr::i64_load32_s:
+        case Instr::i64_load32_u:
+        {
+            const auto offset = read<uint32_t>(immediates);
+            if (unreachable)
+                break;
+            const auto address = builder.pop();
+            builder.emit_producer({instr, builder.push_slot(), address, offset, 0});
+            break;
+        }
+
+        case Instr::i32_store:
+        case Instr::i64_store:
+        case Instr::i32_store8:
+        case Instr::i32_store16:
+        case Instr::i64_store8:
+        case Instr::i64_store16:
+        case Instr::i64_store32:
+        {
+            const auto offset = read<uint32_t>(immediates);
+            if (unreachable)
+                break;
+            const auto value = builder.pop();
+            const auto address = builder.pop();
+            builder.emit({instr, 0, address, value, offset});
+            break;
+        }
+
+        case Instr::memory_size:
+            if (!unreachable)
+                builder.emit_producer({instr, builder.push_slot(), 0, 0, 0});
+            break;
+
+        case Instr::memory_grow:
+        {
+            if (unreachable)
+                break;
+            const auto delta = builder.pop();
+            builder.emit_producer({instr, builder.push_slot(), delta, 0, 0});
+            break;
+        }
+
+        case Instr::i32_const:
+        case Instr::i64_const:
+        {
+            const auto value = instr == Instr::i32_const ? uint64_t{read<uint32_t>(immediates)} :
+                                                           read<uint64_t>(immediates);
+            if (!unreachable)
+                builder.push(constant_registers[value]);
+            break;
+        }
+
+        case Instr::i64_extend_i32_u:
+            // The i32 values are kept zero-extended, so this is no-op.
+            break;
+
+        case Instr::i32_eqz:
+        case Instr::i64_eqz:
+        case Instr::i32_clz:
+        case Instr::i32_ctz:
+        case Instr::i32_popcnt:
+        case Instr::i64_clz:
+        case Instr::i64_ctz:
+        case Instr::i64_popcnt:
+        case Instr::i32_wrap_i64:
+        case Instr::i64_extend_i32_s:
+        {
+            if (unreachable)
+                break;
+            const auto value = builder.pop();
+            builder.emit_producer({instr, builder.push_slot(), value, 0, 0});
+            break;
+        }
+
+        default:
+        {
+            // The binary numeric instructions.
+            if (unreachable)
+                break;
+            const auto rhs = builder.pop();
+            const auto lhs = builder.pop();
+            builder.emit_producer({instr, builder.push_slot(), lhs, rhs, 0});
+            break;
+        }
+        }
+    }
+    assert(control_stack.empty());
+
+    // At least one register is needed as the target of the branches without result.
+    result.num_registers =
+        std::max(builder.stack_base + static_cast<uint32_t>(builder.max_stack_height()), 1u);
+    return result;
+}
+}  // namespace fizzy
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "types.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace fizzy
+{
+/// The three-address instruction of the register code.
+///
+/// The operands are indices of the registers of the function's frame, unless noted otherwise.
+/// The opcode reuses the wasm instruction of the same semantics:
+/// - numeric instructions: dst = op(a, b),
+/// - select: dst = c ? a : b,
+/// - local_set: dst = a (register copy),
+/// - global_get: dst = global[a], global_set: global[a] = b,
+/// - loads: dst = memory[a + offset b], stores: memory[a + offset c] = b,
+/// - memory_size: dst = size, memory_grow: dst = grow(a),
+/// - br: dst = b, jump to instruction a,
+/// - br_if: if c != 0 { dst = b, jump to instruction a },
+/// - if_: if c == 0 jump to instruction a,
+/// - br_table: jump to the entry c of the table starting at offset a of RegisterCode::br_tables
+///   with dst entries (the default target at the end), copying b to the entry's register,
+/// - call / call_indirect: call function a / the function at table element c of type a,
+///   with the arguments in the registers starting at b, the result is left in register b,
+/// - return_: copies register a to register 0 if c is not 0 and returns.
+struct RegisterInstr
+{
+    Instr opcode = Instr::unreachable;
+    uint32_t dst = 0;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = 0;
+};
+
+/// The resolved br_table target.
+struct BrTableTarget
+{
+    uint32_t pc = 0;   ///< The target instruction index.
+    uint32_t dst = 0;  ///< The register to receive the branch result.
+};
+
+/// The function code translated to the register-based form.
+///
+/// The function's frame consists of registers: the arguments and the locals,
+/// followed by the constants used by the code and the operand stack slots.
+/// The values taken by the stack instructions only to be consumed by the next ones
+/// (local_get, constants) are referenced in their registers directly instead of being copied.
+struct RegisterCode
+{
+    std::vector<RegisterInstr> instructions;
+
+    /// The values of the constant registers, loaded at the function entry.
+    std::vector<uint64_t> constants;
+
+    /// The targets of all br_table instructions.
+    std::vector<BrTableTarget> br_tables;
+
+    /// The index of the first constant register. The registers below are the arguments
+    /// and the locals.
+    uint32_t constants_base = 0;
+
+    /// The total number of the registers of the frame.
+    uint32_t num_registers = 0;
+};
+
+/// Translates the code of the given function to the register code.
+///
+/// Requires the function code to be valid.
+RegisterCode translate_to_register_code(const Module& module, size_t code_idx);
+}  // namespace fizzy
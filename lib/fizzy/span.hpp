@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace fizzy
+{
+/// The non-owning view of a contiguous sequence of objects.
+///
+/// The minimal subset of C++20's std::span: https://en.cppreference.com/w/cpp/container/span.
+template <typename T>
+class span
+{
+    T* m_data = nullptr;
+    size_t m_size = 0;
+
+public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+    using iterator = T*;
+
+    constexpr span() noexcept = default;
+
+    constexpr span(T* data, size_t size) noexcept : m_data{data}, m_size{size} {}
+
+    /// Views the vector. The span of const elements can view the vector of non-const ones.
+    template <typename U, typename = std::enable_if_t<std::is_same_v<std::remove_cv_t<T>, U>>>
+    constexpr span(std::vector<U>& v) noexcept  // NOLINT(google-explicit-constructor)
+      : m_data{v.data()}, m_size{v.size()}
+    {}
+
+    template <typename U, typename = std::enable_if_t<std::is_same_v<std::remove_cv_t<T>, U> &&
+                                                      std::is_const_v<T>>>
+    constexpr span(const std::vector<U>& v) noexcept  // NOLINT(google-explicit-constructor)
+      : m_data{v.data()}, m_size{v.size()}
+    {}
+
+    constexpr T* data() const noexcept { return m_data; }
+    constexpr size_t size() const noexcept { return m_size; }
+    constexpr bool empty() const noexcept { return m_size == 0; }
+
+    constexpr T* begin() const noexcept { return m_data; }
+    constexpr T* end() const noexcept { return m_data + m_size; }
+
+    constexpr T& operator[](size_t index) const noexcept
+    {
+        assert(index < m_size);
+        return m_data[index];
+    }
+};
+}  // namespace fizzy
@@ -1,23 +1,56 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace fizzy
 {
+/// The allocator default-initializing the elements constructed without a value, so growing
+/// the vector of a trivial type leaves the new elements uninitialized instead of zeroing them.
 template <typename T>
-class Stack : public std::vector<T>
+struct DefaultInitAllocator : std::allocator<T>
 {
+    template <typename U>
+    struct rebind
+    {
+        using other = DefaultInitAllocator<U>;
+    };
+
+    using std::allocator<T>::allocator;
+
+    template <typename U>
+    void construct(U* p) noexcept(std::is_nothrow_default_constructible_v<U>)
+    {
+        ::new (static_cast<void*>(p)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T, typename Allocator = std::allocator<T>>
+class Stack : public std::vector<T, Allocator>
+{
+    using base = std::vector<T, Allocator>;
+
 public:
-    using difference_type = typename std::vector<T>::difference_type;
+    using difference_type = typename base::difference_type;
 
-    using std::vector<T>::vector;
+    using base::vector;
 
-    using std::vector<T>::back;
-    using std::vector<T>::emplace_back;
-    using std::vector<T>::pop_back;
-    using std::vector<T>::resize;
-    using std::vector<T>::size;
+    using base::back;
+    using base::emplace_back;
+    using base::pop_back;
+    using base::resize;
+    using base::size;
 
     void push(T val) { emplace_back(val); }
 
@@ -33,4 +66,8 @@ public:
     /// Drops @a num_elements elements from the top of the stack.
     void drop(size_t num_elements = 1) noexcept { resize(size() - num_elements); }
 };
+
+/// The value stack of the instance holding the frames of the functions being executed.
+/// The elements it grows by are not initialized, the frames zero only their locals.
+using ValueStack = Stack<uint64_t, DefaultInitAllocator<uint64_t>>;
 }  // namespace fizzy
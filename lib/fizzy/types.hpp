@@ -2,8 +2,10 @@
 
 #include "bytes.hpp"
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 
@@ -246,6 +248,16 @@ enum class Instr : uint8_t
     f32_reinterpret_i32 = 0xbe,
     f64_reinterpret_i64 = 0xbf,
 
+    // Superinstructions: the frequent instruction sequences fused by fuse_instructions().
+    // These are internal to the interpreter and are not valid in the wasm binary.
+    local_get_local_get = 0xe0,
+    local_get_i32_const = 0xe1,
+    local_get_i32_const_i32_add = 0xe2,
+    local_get_i32_load = 0xe3,
+    local_set_local_get = 0xe4,
+    local_tee_br_if = 0xe5,
+    i32_const_i32_add = 0xe6,
+    i32_add_local_set = 0xe7,
 };
 
 // https://webassembly.github.io/spec/core/binary/modules.html#table-section
@@ -276,11 +288,19 @@ struct ConstantExpression
     } value;
 };
 
+// https://webassembly.github.io/spec/core/binary/types.html#global-types
+struct GlobalType
+{
+    bool is_mutable = false;
+    ValType value_type = ValType::i32;
+};
+
 // https://webassembly.github.io/spec/core/binary/modules.html#global-section
 struct Global
 {
     bool is_mutable = false;
     ConstantExpression expression;
+    ValType value_type = ValType::i32;
 };
 
 enum class ExternalKind : uint8_t
@@ -292,24 +312,26 @@ enum class ExternalKind : uint8_t
 };
 
 // https://webassembly.github.io/spec/core/binary/modules.html#import-section
+// The names point into the buffer the module is parsed from, see Module::buffers.
 struct Import
 {
-    std::string module;
-    std::string name;
+    std::string_view module;
+    std::string_view name;
     ExternalKind kind = ExternalKind::Function;
     union
     {
         TypeIdx function_type_index = 0;
         Memory memory;
-        bool global_mutable;
+        GlobalType global;
         Table table;
     } desc;
 };
 
 // https://webassembly.github.io/spec/core/binary/modules.html#export-section
+// The name points into the buffer the module is parsed from, see Module::buffers.
 struct Export
 {
-    std::string name;
+    std::string_view name;
     ExternalKind kind = ExternalKind::Function;
     uint32_t index = 0;
 };
@@ -334,14 +356,28 @@ struct Code
     // The decoded instructions' immediate values.
     // These are instruction-type dependent fixed size value in the order of instructions.
     bytes immediates;
+
+    // The maximum height of the operand stack reached by the function's code.
+    // Computed by the parser. It does not include the function arguments and locals.
+    uint32_t max_stack_height = 0;
 };
 
 // https://webassembly.github.io/spec/core/binary/modules.html#data-section
 // The memory index is omitted from the structure as the parser ensures it to be 0
+// The content points into the buffer the module is parsed from, see Module::buffers.
 struct Data
 {
     ConstantExpression offset;
-    bytes init;
+    bytes_view init;
+};
+
+// https://webassembly.github.io/spec/core/binary/modules.html#custom-section
+// The name and the content point into the buffer the module is parsed from,
+// see Module::buffers.
+struct CustomSection
+{
+    std::string_view name;
+    bytes_view content;
 };
 
 enum class SectionId : uint8_t
@@ -360,6 +396,8 @@ enum class SectionId : uint8_t
     data = 11
 };
 
+struct LazyCodeSection;
+
 struct Module
 {
     // https://webassembly.github.io/spec/core/binary/modules.html#type-section
@@ -381,9 +419,38 @@ struct Module
     // https://webassembly.github.io/spec/core/binary/modules.html#element-section
     std::vector<Element> elementsec;
     // https://webassembly.github.io/spec/core/binary/modules.html#code-section
+    // Empty if the module is parsed lazily, the code is accessed with get_code() then.
     std::vector<Code> codesec;
     // https://webassembly.github.io/spec/core/binary/modules.html#data-section
     std::vector<Data> datasec;
+    // https://webassembly.github.io/spec/core/binary/modules.html#custom-section
+    // In the order of the binary, regardless of their positions between the other sections.
+    std::vector<CustomSection> customsec;
+
+    // The type indices of the imported functions, in the order of importsec.
+    // Filled by the parser.
+    std::vector<TypeIdx> imported_function_types;
+
+    // The types of the imported globals, in the order of importsec.
+    // Filled by the parser.
+    std::vector<GlobalType> imported_global_types;
+
+    // Set by the parser for the module passing the validation: the module and the code of all
+    // the functions are valid, so the execution does not check what the validation ensures.
+    // The function bodies of the lazily parsed module are validated when parsed, before
+    // the first execution.
+    bool validated = false;
+
+    // The function bodies parsed on their first use, shared by the copies of the module.
+    // Null unless the module is parsed lazily.
+    std::shared_ptr<LazyCodeSection> lazy_codesec;
+
+    // The buffers the names, the data segments and the custom sections point into,
+    // shared by the copies of the module.
+    // Empty if the module references the buffer of the caller (see parse_referencing()).
+    // The module built by hand must own its buffers: it is filled by copy_to_module()
+    // or copy_referenced_data().
+    std::vector<std::shared_ptr<const bytes>> buffers;
 };
 
 }  // namespace fizzy
@@ -21,10 +21,17 @@ struct EngineRegistryEntry
 {
     std::string_view name;
     EngineCreateFn create_fn;
+
+    /// Whether the engine restores the state from a snapshot in save_state()/restore_state().
+    bool has_snapshots = false;
 };
 
 constexpr EngineRegistryEntry engine_registry[] = {
-    {"fizzy", fizzy::test::create_fizzy_engine},
+    {"fizzy", fizzy::test::create_fizzy_engine, true},
+    {"fizzy-reg", fizzy::test::create_fizzy_register_engine, true},
+    {"fizzy-jit", fizzy::test::create_fizzy_jit_engine, true},
+    {"fizzy-tiered", fizzy::test::create_fizzy_tiered_engine, true},
+    {"fizzy-jit-guarded", fizzy::test::create_fizzy_jit_guarded_engine, true},
     {" wabt", fizzy::test::create_wabt_engine},
     {"wasm3", fizzy::test::create_wasm3_engine},
 };
@@ -86,8 +93,8 @@ struct ExecutionBenchmarkCase
     fizzy::bytes expected_memory;
 };
 
-void benchmark_execute(
-    benchmark::State& state, EngineCreateFn create_fn, const ExecutionBenchmarkCase& benchmark_case)
+void benchmark_execute(benchmark::State& state, EngineCreateFn create_fn,
+    const ExecutionBenchmarkCase& benchmark_case, bool use_snapshot)
 {
     const auto engine = create_fn();
     if (!engine->parse(*benchmark_case.wasm_binary))
@@ -112,6 +119,10 @@ void benchmark_execute(
         std::begin(initial_memory));
     engine->set_memory(initial_memory);
 
+    // Snapshots make the engine track the memory writes, so they are only used when requested.
+    if (use_snapshot)
+        engine->save_state();
+
     {  // Execute once and check results against expectations.
         const auto result = engine->execute(*func_ref, benchmark_case.func_args);
         if (result.trapped)
@@ -141,10 +152,13 @@ void benchmark_execute(
     for (auto _ : state)  // NOLINT(clang-analyzer-deadcode.DeadStores)
     {
         // Reset instance to its initial state.
-        // At this point we only reset memory, so this works only while globals
-        // and imports are not used. If this become a problem doing full
+        // Depending on the engine only the memory may be reset, so this works only while
+        // globals and imports are not used. If this become a problem doing full
         // instantiate() should be considered.
-        engine->set_memory(initial_memory);
+        if (use_snapshot)
+            engine->restore_state();
+        else
+            engine->set_memory(initial_memory);
 
         const auto result = engine->execute(*func_ref, benchmark_case.func_args);
         benchmark::DoNotOptimize(result);
@@ -249,7 +263,21 @@ void load_benchmark(const fs::path& path, const std::string& name_prefix)
                     register_benchmark(
                         std::string{entry.name} + "/execute/" + base_name + '/' + input_name,
                         [create_fn = entry.create_fn, benchmark_case](benchmark::State& state) {
-                            benchmark_execute(state, create_fn, *benchmark_case);
+                            benchmark_execute(state, create_fn, *benchmark_case, false);
+                        });
+                }
+
+                // Register the execute benchmarks resetting the state from a snapshot
+                // separately, to compare them with the above (without the write tracking).
+                for (const auto& entry : engine_registry)
+                {
+                    if (!entry.has_snapshots)
+                        continue;
+
+                    register_benchmark(std::string{entry.name} + "/execute_snapshot/" + base_name +
+                                           '/' + input_name,
+                        [create_fn = entry.create_fn, benchmark_case](benchmark::State& state) {
+                            benchmark_execute(state, create_fn, *benchmark_case, true);
                         });
                 }
 
@@ -1,6 +1,7 @@
 #include "parser.hpp"
 #include <benchmark/benchmark.h>
 #include <algorithm>
+#include <limits>
 #include <random>
 #include <vector>
 
@@ -15,14 +16,20 @@ namespace
 {
 std::mt19937_64 g_gen{std::random_device{}()};
 
+/// Generates the samples of the given number of the significant bits,
+/// or of the random number of the significant bits if 0.
 template <typename T>
-std::vector<T> generate_samples(size_t count)
+std::vector<T> generate_samples(size_t count, int bits = std::numeric_limits<T>::digits)
 {
-    std::uniform_int_distribution<T> dist;
+    constexpr auto digits = std::numeric_limits<T>::digits;
+    std::uniform_int_distribution<T> dist{0, std::numeric_limits<T>::max() >> (digits - bits)};
+    std::uniform_int_distribution<int> shift_dist{0, digits - 1};
 
     std::vector<T> samples;
     samples.reserve(count);
-    std::generate_n(std::back_inserter(samples), count, [&] { return dist(g_gen); });
+    std::generate_n(std::back_inserter(samples), count, [&] {
+        return bits != 0 ? dist(g_gen) : static_cast<T>(dist(g_gen) >> shift_dist(g_gen));
+    });
     return samples;
 }
 
@@ -37,13 +44,40 @@ fizzy::bytes generate_ascii_vec(size_t size)
     std::generate_n(std::back_inserter(result), size, [&] { return dist(g_gen); });
     return result;
 }
+
+/// Generates the module of the given number of functions of type [i32] -> [i32], each of
+/// the body of about the given size.
+fizzy::bytes generate_module(size_t num_functions, size_t body_size)
+{
+    // local.get 0, i32.const 1, i32.add, local.set 0 in a block.
+    const fizzy::bytes block{0x02, 0x40, 0x20, 0x00, 0x41, 0x01, 0x6a, 0x21, 0x00, 0x0b};
+    fizzy::bytes body{0x00};  // vec(locals)
+    while (body.size() + block.size() + 3 <= body_size)
+        body += block;
+    body += fizzy::bytes{0x20, 0x00, 0x0b};  // local.get 0, end
+    const auto code = leb128u_encode(body.size()) + body;
+
+    fizzy::bytes type_section{0x01, 0x60, 0x01, 0x7f, 0x01, 0x7f};
+    auto function_section = leb128u_encode(num_functions) + fizzy::bytes(num_functions, 0x00);
+    auto code_section = leb128u_encode(num_functions);
+    for (size_t i = 0; i < num_functions; ++i)
+        code_section += code;
+
+    fizzy::bytes module{fizzy::wasm_prefix};
+    for (const auto& [id, content] :
+        {std::pair{uint8_t{1}, &type_section}, {uint8_t{3}, &function_section},
+            {uint8_t{10}, &code_section}})
+        module += fizzy::bytes{id} + leb128u_encode(content->size()) + *content;
+    return module;
+}
 }  // namespace
 
 template <decltype(fizzy::leb128u_decode<uint64_t>) Fn>
 static void leb128u_decode_u64(benchmark::State& state)
 {
-    constexpr size_t size = 1024;
-    const auto samples = generate_samples<uint64_t>(size);
+    // Enough samples for the branch predictor not to learn the sizes of the random size samples.
+    constexpr size_t size = 65536;
+    const auto samples = generate_samples<uint64_t>(size, static_cast<int>(state.range(0)));
 
     fizzy::bytes input;
     input.reserve(size * ((sizeof(uint64_t) * 8) / 7 + 1));
@@ -66,10 +100,18 @@ static void leb128u_decode_u64(benchmark::State& state)
             state.SkipWithError("Not all input processed");
     }
 }
-BENCHMARK_TEMPLATE(leb128u_decode_u64, nop);
-BENCHMARK_TEMPLATE(leb128u_decode_u64, fizzy::leb128u_decode<uint64_t>);
-BENCHMARK_TEMPLATE(leb128u_decode_u64, leb128u_decode_u64_noinline);
-BENCHMARK_TEMPLATE(leb128u_decode_u64, decodeULEB128);
+/// The samples of the encodings of 1, 2, 4, 8 and 10 bytes, and of the random sizes.
+static void leb128_sample_bits(benchmark::internal::Benchmark* b)
+{
+    for (const auto bits : {7, 14, 28, 56, 64, 0})
+        b->Arg(bits);
+}
+BENCHMARK_TEMPLATE(leb128u_decode_u64, nop)->Apply(leb128_sample_bits);
+BENCHMARK_TEMPLATE(leb128u_decode_u64, fizzy::leb128u_decode<uint64_t>)->Apply(leb128_sample_bits);
+BENCHMARK_TEMPLATE(leb128u_decode_u64, fizzy::leb128u_decode_bytewise<uint64_t>)
+    ->Apply(leb128_sample_bits);
+BENCHMARK_TEMPLATE(leb128u_decode_u64, leb128u_decode_u64_noinline)->Apply(leb128_sample_bits);
+BENCHMARK_TEMPLATE(leb128u_decode_u64, decodeULEB128)->Apply(leb128_sample_bits);
 
 static void parse_string(benchmark::State& state)
 {
@@ -88,3 +130,21 @@ static void parse_string(benchmark::State& state)
     state.SetItemsProcessed(static_cast<int64_t>(size));
 }
 BENCHMARK(parse_string)->RangeMultiplier(2)->Range(16, 4 * 1024);
+
+static void parse_code_section(benchmark::State& state)
+{
+    const auto num_threads = static_cast<unsigned>(state.range(0));
+    // 4096 functions of 1 KiB.
+    const auto module = generate_module(4096, 1024);
+    benchmark::ClobberMemory();
+
+    for (auto _ : state)
+    {
+        (void)_;
+        benchmark::DoNotOptimize(fizzy::parse(module, fizzy::ParseMode::eager, num_threads));
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(module.size()) * state.iterations());
+}
+BENCHMARK(parse_code_section)->DenseRange(1, 4)->Arg(8)->Arg(12)->Arg(16)->UseRealTime()->Unit(
+    benchmark::kMillisecond);
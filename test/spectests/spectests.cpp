@@ -4,7 +4,9 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <sstream>
+#include <string_view>
 #include <unordered_map>
 
 namespace fs = std::filesystem;
@@ -32,8 +34,23 @@ fizzy::bytes load_wasm_file(const fs::path& json_file_path, std::string_view fil
 struct test_settings
 {
     bool skip_validation = false;
+    fizzy::Interpreter interpreter = fizzy::Interpreter::stack;
+    bool guarded_memory = false;
 };
 
+std::optional<fizzy::Interpreter> parse_interpreter(std::string_view name)
+{
+    if (name == "stack")
+        return fizzy::Interpreter::stack;
+    if (name == "registers")
+        return fizzy::Interpreter::registers;
+    if (name == "jit")
+        return fizzy::Interpreter::jit;
+    if (name == "tiered")
+        return fizzy::Interpreter::tiered;
+    return std::nullopt;
+}
+
 struct test_results
 {
     int passed = 0;
@@ -72,7 +89,14 @@ public:
                 try
                 {
                     // TODO provide dummy imports if needed
-                    instances[name] = fizzy::instantiate(fizzy::parse(wasm_binary));
+                    auto instance = fizzy::instantiate(fizzy::parse(wasm_binary));
+                    if (settings.guarded_memory)
+                        fizzy::enable_guarded_memory(instance);
+                    // Promote the functions right away, the tests call each of them only
+                    // a few times.
+                    instance.tiering_thresholds = {1, 2};
+                    fizzy::set_interpreter(instance, settings.interpreter);
+                    instances[name] = std::move(instance);
                 }
                 catch (const fizzy::parser_error& ex)
                 {
@@ -238,7 +262,7 @@ private:
         auto& instance = it_instance->second;
 
         const auto func_name = action.at("field").get<std::string>();
-        const auto func_idx = fizzy::find_exported_function(instance.module, func_name);
+        const auto func_idx = fizzy::find_exported_function(*instance.module, func_name);
         if (!func_idx.has_value())
         {
             skip("Function '" + func_name + "' not found.");
@@ -262,7 +286,14 @@ private:
             args.push_back(arg_value);
         }
 
-        return fizzy::execute(instance, *func_idx, std::move(args));
+        // The function is executed without allocating the result.
+        uint64_t result = 0;
+        const auto status = fizzy::execute(instance, *func_idx, args, {&result, 1});
+        if (status != fizzy::ExecutionStatus::success)
+            return fizzy::execution_result{true, {}};
+        if (instance.functions[*func_idx].num_outputs == 0)
+            return fizzy::execution_result{false, {}};
+        return fizzy::execution_result{false, {result}};
     }
 
     void pass()
@@ -342,8 +373,23 @@ int main(int argc, char** argv)
         {
             if (argv[i][0] == '-')
             {
-                if (argv[i] == std::string{"--skip-validation"})
+                const std::string_view arg{argv[i]};
+                constexpr std::string_view interpreter_option{"--interpreter="};
+                if (arg == "--skip-validation")
                     settings.skip_validation = true;
+                else if (arg.substr(0, interpreter_option.size()) == interpreter_option)
+                {
+                    const auto interpreter =
+                        parse_interpreter(arg.substr(interpreter_option.size()));
+                    if (!interpreter)
+                    {
+                        std::cerr << "Unknown interpreter: " << argv[i] << "\n";
+                        return -1;
+                    }
+                    settings.interpreter = *interpreter;
+                }
+                else if (arg == "--guarded-memory")
+                    settings.guarded_memory = true;
                 else
                 {
                     std::cerr << "Unknown argument: " << argv[i] << "\n";
@@ -103,6 +103,41 @@ TEST(execute_call, call_indirect)
     EXPECT_TRUE(execute(module, 5, {5}).trapped);
 }
 
+TEST(execute_call, call_indirect_equal_types)
+{
+    /* wat2wasm
+      (type $out-i32 (func (result i32)))
+      (type $out-i64 (func (result i64)))
+      (type $out-i32-copy (func (result i32)))
+
+      (table anyfunc (elem $f1 $f2))
+
+      (func $f1 (type $out-i32-copy) i32.const 7)
+      (func $f2 (type $out-i64) i64.const 4)
+
+      (func (param i32) (result i32)
+        (call_indirect (type $out-i32) (get_local 0))
+      )
+    */
+    const auto bin = from_hex(
+        "0061736d010000000112046000017f6000017e6000017f60017f017f030403020103040401700002090801"
+        "0041000b0200010a1303040041070b040042040b070020001100000b");
+
+    for (const auto interpreter : {Interpreter::stack, Interpreter::registers, Interpreter::jit})
+    {
+        auto instance = instantiate(parse(bin));
+        EXPECT_EQ(instance.type_ids, (std::vector<uint32_t>{0, 1, 0, 3}));
+        ASSERT_EQ(instance.functions.size(), 3);
+        EXPECT_EQ(instance.functions[0].type_id, 0);
+        EXPECT_EQ(instance.functions[1].type_id, 1);
+        EXPECT_EQ(instance.functions[2].type_id, 3);
+
+        set_interpreter(instance, interpreter);
+        EXPECT_RESULT(execute(instance, 2, {0}), 7);
+        EXPECT_TRUE(execute(instance, 2, {1}).trapped);
+    }
+}
+
 TEST(execute_call, call_indirect_with_argument)
 {
     /* wat2wasm
@@ -315,3 +350,63 @@ TEST(execute_call, imported_function_from_another_module)
 
     EXPECT_RESULT(execute(instance2, 1, {44, 2}), 42);
 }
+
+TEST(execute_call, recursive_calls_share_value_stack)
+{
+    /* wat2wasm
+    (func $fac (param i64) (result i64)
+      get_local 0
+      i64.eqz
+      if (result i64)
+        i64.const 1
+      else
+        get_local 0
+        get_local 0
+        i64.const 1
+        i64.sub
+        call $fac
+        i64.mul
+      end
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017e017e030201000a17011500200050047e4201052000200042017d10007e0b0b");
+
+    auto instance = instantiate(parse(wasm));
+    instance.value_stack.reserve(128);
+    const auto* const value_stack_data = instance.value_stack.data();
+
+    EXPECT_RESULT(execute(instance, 0, {20}), 2432902008176640000);
+    EXPECT_TRUE(instance.value_stack.empty());
+    EXPECT_EQ(instance.value_stack.data(), value_stack_data);
+}
+
+TEST(execute_call, imported_function_reentering_instance)
+{
+    /* wat2wasm
+    (func $twice (import "env" "twice") (param i32) (result i32))
+    (func $inc (param i32) (result i32)
+      get_local 0
+      i32.const 1
+      i32.add
+    )
+    (func $main (param i32) (result i32)
+      get_local 0
+      call $twice
+      i32.const 1
+      i32.add
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f020d0103656e76057477696365000003030200000a1302070020004101"
+        "6a0b09002000100041016a0b");
+
+    auto twice = [](Instance& instance, std::vector<uint64_t> args) -> execution_result {
+        const auto ret = execute(instance, 1, std::move(args));
+        return execute(instance, 1, ret.stack);
+    };
+
+    auto instance = instantiate(parse(wasm), {twice});
+    EXPECT_RESULT(execute(instance, 2, {39}), 42);
+    EXPECT_TRUE(instance.value_stack.empty());
+}
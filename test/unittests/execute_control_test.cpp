@@ -31,8 +31,8 @@ TEST(execute_control, nop)
 
 TEST(execute_control, block_br)
 {
-    /* wat2wasm --no-check
-    (func
+    /* wat2wasm
+    (func (result i32)
         (local i32 i32)
         (block
           i32.const 0xa
@@ -45,7 +45,7 @@ TEST(execute_control, block_br)
     )
     */
     const auto wasm = from_hex(
-        "0061736d01000000010401600000030201000a15011301027f0240410a21010c00410b21010b20010b");
+        "0061736d010000000105016000017f030201000a15011301027f0240410a21010c00410b21010b20010b");
 
     const auto [trap, ret] = execute(parse(wasm), 0, {});
     ASSERT_FALSE(trap);
@@ -71,11 +71,8 @@ TEST(execute_control, block_void_empty)
 {
     // This wasm code is invalid - block with type [] is not allowed to leave anything on the stack.
     Module module;
-    module.codesec.emplace_back(Code{0, {Instr::block, Instr::local_get, Instr::end, Instr::end},
-        from_hex("00"
-                 "00000000"
-                 "00000000"
-                 "00000000")});
+    module.codesec.emplace_back(
+        Code{0, {Instr::block, Instr::local_get, Instr::end, Instr::end}, {0, 0, 0, 0}});
 
     const auto [trap, ret] = execute(module, 0, {100});
 
@@ -100,7 +97,14 @@ TEST(execute_control, loop_void_br_if_16)
     module.codesec.emplace_back(Code{0,
         {Instr::loop, Instr::local_get, Instr::i32_const, Instr::i32_sub, Instr::local_tee,
             Instr::br_if, Instr::local_get, Instr::end, Instr::end},
-        {0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}});
+        from_hex("00000000"
+                 "01000000"
+                 "00000000"
+                 "01000000"  // br_if target: the instruction after loop
+                 "00000000"  // br_if target: the immediates after loop
+                 "00000000"  // br_if stack drop
+                 "00000000"  // br_if arity
+                 "00000000")});
 
     const auto [trap, ret] = execute(module, 0, {16});
 
@@ -0,0 +1,810 @@
+#include "execute.hpp"
+#include "parser.hpp"
+#include <gtest/gtest.h>
+#include <test/utils/hex.hpp>
+#include <stdexcept>
+#include <string>
+
+using namespace fizzy;
+
+namespace
+{
+/// The tests executed by each of the interpreters.
+class execute_interpreters : public testing::TestWithParam<Interpreter>
+{
+protected:
+    /// Instantiates the module executed by the tested interpreter. The tiered execution promotes
+    /// the functions at the second and the third call, so the tests calling the functions
+    /// of the same instance repeatedly execute all the tiers.
+    Instance instantiate_wasm(const bytes& wasm,
+        std::vector<ExternalFunction> imported_functions = {},
+        std::vector<ExternalGlobal> imported_globals = {})
+    {
+        auto instance =
+            instantiate(parse(wasm), std::move(imported_functions), {}, {}, imported_globals);
+        instance.tiering_thresholds = {1, 2};
+        set_interpreter(instance, GetParam());
+        return instance;
+    }
+
+    execution_result execute_wasm(const bytes& wasm, FuncIdx func_idx, std::vector<uint64_t> args,
+        std::vector<ExternalFunction> imported_functions = {})
+    {
+        auto instance = instantiate_wasm(wasm, std::move(imported_functions));
+        return execute(instance, func_idx, std::move(args));
+    }
+};
+
+std::string interpreter_name(const testing::TestParamInfo<Interpreter>& info)
+{
+    switch (info.param)
+    {
+    case Interpreter::stack:
+        return "stack";
+    case Interpreter::registers:
+        return "registers";
+    case Interpreter::jit:
+        return "jit";
+    case Interpreter::tiered:
+        return "tiered";
+    }
+    return "unknown";
+}
+
+uint32_t rotl32(uint32_t a, uint32_t n) noexcept
+{
+    n &= 31;
+    return n == 0 ? a : (a << n) | (a >> (32 - n));
+}
+
+uint64_t rotl64(uint64_t a, uint64_t n) noexcept
+{
+    n &= 63;
+    return n == 0 ? a : (a << n) | (a >> (64 - n));
+}
+}  // namespace
+
+INSTANTIATE_TEST_SUITE_P(interpreters, execute_interpreters,
+    testing::Values(Interpreter::stack, Interpreter::registers, Interpreter::jit,
+        Interpreter::tiered),
+    interpreter_name);
+
+TEST_P(execute_interpreters, loop)
+{
+    /* wat2wasm
+    (func (param i64) (result i64) (local i64)
+      i64.const 1
+      local.set 1
+      (block
+        (loop
+          local.get 0
+          i64.eqz
+          br_if 1
+          local.get 1
+          local.get 0
+          i64.mul
+          local.set 1
+          local.get 0
+          i64.const 1
+          i64.sub
+          local.set 0
+          br 0
+        )
+      )
+      local.get 1
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017e017e030201000a27012501017e42012101024003402000500d0120012000"
+        "7e2101200042017d21000c000b0b20010b");
+
+    for (const auto& [arg, expected] : {std::pair<uint64_t, uint64_t>{0, 1}, {1, 1}, {5, 120},
+             {20, 2432902008176640000}})
+    {
+        const auto [trap, ret] = execute_wasm(wasm, 0, {arg});
+        ASSERT_FALSE(trap);
+        ASSERT_EQ(ret.size(), 1);
+        EXPECT_EQ(ret[0], expected);
+    }
+}
+
+TEST_P(execute_interpreters, br_table)
+{
+    /* wat2wasm
+    (func (param i32) (result i32)
+      (block
+        (block
+          (block
+            local.get 0
+            br_table 0 1 2
+          )
+          i32.const 10
+          return
+        )
+        i32.const 11
+        return
+      )
+      i32.const 12
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f030201000a1c011a0002400240024020000e020001020b410a0f0b41"
+        "0b0f0b410c0b");
+
+    for (const auto& [arg, expected] : {std::pair{0, 10}, {1, 11}, {2, 12}, {7, 12}})
+    {
+        const auto [trap, ret] = execute_wasm(wasm, 0, {uint64_t(arg)});
+        ASSERT_FALSE(trap);
+        ASSERT_EQ(ret.size(), 1);
+        EXPECT_EQ(ret[0], uint64_t(expected));
+    }
+}
+
+TEST_P(execute_interpreters, br_table_with_result)
+{
+    /* wat2wasm
+    (func (param i32) (result i32)
+      (block (result i32)
+        i32.const 100
+        local.get 0
+        br_table 0 1
+      )
+      i32.const 1
+      i32.add
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f030201000a13011100027f41e40020000e0100010b41016a0b");
+
+    for (const auto& [arg, expected] : {std::pair{0, 101}, {1, 100}, {5, 100}})
+    {
+        const auto [trap, ret] = execute_wasm(wasm, 0, {uint64_t(arg)});
+        ASSERT_FALSE(trap);
+        ASSERT_EQ(ret.size(), 1);
+        EXPECT_EQ(ret[0], uint64_t(expected));
+    }
+}
+
+TEST_P(execute_interpreters, if_else_with_result)
+{
+    /* wat2wasm
+    (func (param i32) (result i32)
+      local.get 0
+      (if (result i32) (then i32.const 1) (else i32.const 2))
+      i32.const 10
+      i32.add
+    )
+    */
+    const auto wasm =
+        from_hex("0061736d0100000001060160017f017f030201000a11010f002000047f41010541020b410a6a0b");
+
+    for (const auto& [arg, expected] : {std::pair{0, 12}, {1, 11}, {2, 11}})
+    {
+        const auto [trap, ret] = execute_wasm(wasm, 0, {uint64_t(arg)});
+        ASSERT_FALSE(trap);
+        ASSERT_EQ(ret.size(), 1);
+        EXPECT_EQ(ret[0], uint64_t(expected));
+    }
+}
+
+TEST_P(execute_interpreters, local_modified_while_on_stack)
+{
+    /* wat2wasm
+    (func (param i32) (result i32) (local i32)
+      i32.const 5
+      local.set 1
+      local.get 1
+      i32.const 6
+      local.set 1
+      (block (result i32)
+        i32.const 7
+        local.get 0
+        br_if 0
+        drop
+        i32.const 8
+      )
+      i32.add
+      local.get 1
+      i32.add
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f030201000a20011e01017f41052101200141062101027f410720000d"
+        "001a41080b6a20016a0b");
+
+    for (const auto& [arg, expected] : {std::pair{0, 5 + 8 + 6}, {1, 5 + 7 + 6}})
+    {
+        const auto [trap, ret] = execute_wasm(wasm, 0, {uint64_t(arg)});
+        ASSERT_FALSE(trap);
+        ASSERT_EQ(ret.size(), 1);
+        EXPECT_EQ(ret[0], uint64_t(expected));
+    }
+}
+
+TEST_P(execute_interpreters, unreachable_code)
+{
+    /* wat2wasm
+    (func (param i32) (result i32)
+      (block (result i32)
+        local.get 0
+        br 0
+        i32.const 1
+        i32.add
+      )
+      local.get 0
+      i32.add
+    )
+    */
+    const auto wasm =
+        from_hex("0061736d0100000001060160017f017f030201000a11010f00027f20000c0041016a0b20006a0b");
+
+    const auto [trap, ret] = execute_wasm(wasm, 0, {21});
+    ASSERT_FALSE(trap);
+    ASSERT_EQ(ret.size(), 1);
+    EXPECT_EQ(ret[0], 42);
+}
+
+TEST_P(execute_interpreters, unreachable)
+{
+    /* wat2wasm
+    (func unreachable)
+    */
+    const auto wasm = from_hex("0061736d01000000010401600000030201000a05010300000b");
+
+    EXPECT_TRUE(execute_wasm(wasm, 0, {}).trapped);
+}
+
+TEST_P(execute_interpreters, division)
+{
+    /* wat2wasm
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.div_s)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.rem_s)
+    (func (param i64 i64) (result i64) local.get 0 local.get 1 i64.div_u)
+    */
+    const auto wasm = from_hex(
+        "0061736d01000000010d0260027f7f017f60027e7e017e0304030000010a19030700200020016d0b07002000"
+        "20016f0b070020002001800b");
+
+    constexpr uint64_t i32_min = 0x80000000;
+    constexpr uint64_t minus_one = 0xffffffff;
+
+    auto result = execute_wasm(wasm, 0, {7, 2});
+    ASSERT_FALSE(result.trapped);
+    EXPECT_EQ(result.stack, std::vector<uint64_t>{3});
+    EXPECT_TRUE(execute_wasm(wasm, 0, {7, 0}).trapped);
+    EXPECT_TRUE(execute_wasm(wasm, 0, {i32_min, minus_one}).trapped);
+
+    result = execute_wasm(wasm, 1, {i32_min, minus_one});
+    ASSERT_FALSE(result.trapped);
+    EXPECT_EQ(result.stack, std::vector<uint64_t>{0});
+    EXPECT_TRUE(execute_wasm(wasm, 1, {7, 0}).trapped);
+
+    result = execute_wasm(wasm, 2, {uint64_t(-1), 2});
+    ASSERT_FALSE(result.trapped);
+    EXPECT_EQ(result.stack, std::vector<uint64_t>{0x7fffffffffffffff});
+    EXPECT_TRUE(execute_wasm(wasm, 2, {1, 0}).trapped);
+}
+
+TEST_P(execute_interpreters, shifts_and_rotates)
+{
+    /* wat2wasm
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.shl)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.shr_s)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.shr_u)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.rotl)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.rotr)
+    (func (param i64 i64) (result i64) local.get 0 local.get 1 i64.shl)
+    (func (param i64 i64) (result i64) local.get 0 local.get 1 i64.shr_s)
+    (func (param i64 i64) (result i64) local.get 0 local.get 1 i64.shr_u)
+    (func (param i64 i64) (result i64) local.get 0 local.get 1 i64.rotl)
+    (func (param i64 i64) (result i64) local.get 0 local.get 1 i64.rotr)
+    (func (param i32) (result i32) local.get 0 i32.const 36 i32.shr_u)
+    (func (param i64) (result i64) local.get 0 i64.const 68 i64.rotl)
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001170460027f7f017f60027e7e017e60017f017f60017e017e030d0c0000000000010101"
+        "010102030a620c070020002001740b070020002001750b070020002001760b070020002001770b0700200020"
+        "01780b070020002001860b070020002001870b070020002001880b070020002001890b0700200020018a0b07"
+        "0020004124760b0800200042c400890b");
+    auto instance = instantiate_wasm(wasm);
+
+    // The shift counts are taken modulo the bit width.
+    for (const uint32_t a : {0x80000001u, 0x12345678u, 0xffffffffu})
+    {
+        for (const uint32_t n : {0u, 1u, 4u, 31u, 32u, 33u, 0xffffffffu})
+        {
+            const auto s = n % 32;
+            // The i32.shr_s result is sign-extended in the value stack item.
+            const uint64_t expected[] = {a << s, uint64_t(int32_t(a) >> s), a >> s,
+                rotl32(a, n), rotl32(a, 32 - s)};
+            for (FuncIdx func_idx = 0; func_idx < 5; ++func_idx)
+            {
+                const auto [trap, ret] = execute(instance, func_idx, {a, n});
+                ASSERT_FALSE(trap);
+                ASSERT_EQ(ret.size(), 1);
+                EXPECT_EQ(ret[0], expected[func_idx]) << func_idx << " " << a << " " << n;
+            }
+        }
+    }
+
+    const uint64_t values64[] = {0x8000000000000001, 0x0123456789abcdef, 0xffffffffffffffff};
+    const uint64_t counts64[] = {0, 1, 4, 63, 64, 65, 0x100000020};
+    for (const auto a : values64)
+    {
+        for (const auto n : counts64)
+        {
+            const auto s = n % 64;
+            const uint64_t expected[] = {a << s, uint64_t(int64_t(a) >> s), a >> s, rotl64(a, n),
+                rotl64(a, 64 - s)};
+            for (FuncIdx func_idx = 5; func_idx < 10; ++func_idx)
+            {
+                const auto [trap, ret] = execute(instance, func_idx, {a, n});
+                ASSERT_FALSE(trap);
+                ASSERT_EQ(ret.size(), 1);
+                EXPECT_EQ(ret[0], expected[func_idx - 5]) << func_idx << " " << a << " " << n;
+            }
+        }
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(execute(instance, 10, {0xf0000000}).stack, std::vector<uint64_t>{0x0f000000});
+        EXPECT_EQ(execute(instance, 11, {0x8000000000000001}).stack,
+            std::vector<uint64_t>{0x0000000000000018});
+    }
+}
+
+TEST_P(execute_interpreters, comparisons)
+{
+    /* wat2wasm
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.eq)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.ne)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.lt_s)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.lt_u)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.gt_s)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.gt_u)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.le_s)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.le_u)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.ge_s)
+    (func (param i32 i32) (result i32) local.get 0 local.get 1 i32.ge_u)
+    (func (param i64 i64) (result i32) local.get 0 local.get 1 i64.eq)
+    (func (param i64 i64) (result i32) local.get 0 local.get 1 i64.ne)
+    (func (param i64 i64) (result i32) local.get 0 local.get 1 i64.lt_s)
+    (func (param i64 i64) (result i32) local.get 0 local.get 1 i64.lt_u)
+    (func (param i64 i64) (result i32) local.get 0 local.get 1 i64.gt_s)
+    (func (param i64 i64) (result i32) local.get 0 local.get 1 i64.gt_u)
+    (func (param i64 i64) (result i32) local.get 0 local.get 1 i64.le_s)
+    (func (param i64 i64) (result i32) local.get 0 local.get 1 i64.le_u)
+    (func (param i64 i64) (result i32) local.get 0 local.get 1 i64.ge_s)
+    (func (param i64 i64) (result i32) local.get 0 local.get 1 i64.ge_u)
+    (func (param i32) (result i32) local.get 0 i32.eqz)
+    (func (param i64) (result i32) local.get 0 i64.eqz)
+    (func (param i32 i32) (result i32)
+      local.get 0
+      local.get 1
+      i32.lt_s
+      (if (result i32) (then i32.const 1) (else i32.const 2))
+    )
+    (func (param i32 i32) (result i32)
+      (block (result i32)
+        i32.const 1
+        local.get 0
+        local.get 1
+        i32.lt_u
+        br_if 0
+        drop
+        i32.const 2
+      )
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001170460027f7f017f60027e7e017f60017f017f60017e017f0319180000000000000000"
+        "000001010101010101010101020300000acf0118070020002001460b070020002001470b070020002001480b"
+        "070020002001490b0700200020014a0b0700200020014b0b0700200020014c0b0700200020014d0b07002000"
+        "20014e0b0700200020014f0b070020002001510b070020002001520b070020002001530b070020002001540b"
+        "070020002001550b070020002001560b070020002001570b070020002001580b070020002001590b07002000"
+        "20015a0b05002000450b05002000500b0f002000200148047f41010541020b0b1100027f410120002001490d"
+        "001a41020b0b");
+    auto instance = instantiate_wasm(wasm);
+
+    const auto execute_bool = [&instance](FuncIdx func_idx, std::vector<uint64_t> args) {
+        const auto [trap, ret] = execute(instance, func_idx, std::move(args));
+        EXPECT_FALSE(trap);
+        EXPECT_EQ(ret.size(), 1);
+        return ret.empty() ? uint64_t(-1) : ret[0];
+    };
+
+    for (const uint32_t a : {0u, 1u, 0x7fffffffu, 0x80000000u, 0xffffffffu})
+    {
+        for (const uint32_t b : {0u, 1u, 0x7fffffffu, 0x80000000u, 0xffffffffu})
+        {
+            const auto sa = int32_t(a);
+            const auto sb = int32_t(b);
+            const bool expected[] = {
+                a == b, a != b, sa < sb, a < b, sa > sb, a > b, sa <= sb, a <= b, sa >= sb, a >= b};
+            for (FuncIdx func_idx = 0; func_idx < 10; ++func_idx)
+                EXPECT_EQ(execute_bool(func_idx, {a, b}), expected[func_idx]) << func_idx;
+
+            EXPECT_EQ(execute_bool(22, {a, b}), sa < sb ? 1u : 2u);
+            EXPECT_EQ(execute_bool(23, {a, b}), a < b ? 1u : 2u);
+        }
+        EXPECT_EQ(execute_bool(20, {a}), a == 0);
+    }
+
+    const uint64_t values64[] = {
+        0, 1, 0x7fffffffffffffff, 0x8000000000000000, 0xffffffffffffffff, 0x100000000};
+    for (const auto a : values64)
+    {
+        for (const auto b : values64)
+        {
+            const auto sa = int64_t(a);
+            const auto sb = int64_t(b);
+            const bool expected[] = {
+                a == b, a != b, sa < sb, a < b, sa > sb, a > b, sa <= sb, a <= b, sa >= sb, a >= b};
+            for (FuncIdx func_idx = 10; func_idx < 20; ++func_idx)
+                EXPECT_EQ(execute_bool(func_idx, {a, b}), expected[func_idx - 10]) << func_idx;
+        }
+        EXPECT_EQ(execute_bool(21, {a}), a == 0);
+    }
+}
+
+TEST_P(execute_interpreters, select)
+{
+    /* wat2wasm
+    (func (param i32 i32 i32) (result i32) local.get 0 local.get 1 local.get 2 select)
+    (func (param i64 i64 i32) (result i64) local.get 0 local.get 1 local.get 2 select)
+    */
+    const auto wasm = from_hex(
+        "0061736d01000000010f0260037f7f7f017f60037e7e7f017e03030200010a150209002000200120021b0b09"
+        "002000200120021b0b");
+    auto instance = instantiate_wasm(wasm);
+
+    for (const uint64_t cond : {0u, 1u, 0x80000000u, 0u})
+    {
+        EXPECT_EQ(execute(instance, 0, {0xffffffff, 2, cond}).stack,
+            std::vector<uint64_t>{cond != 0 ? 0xffffffff : 2});
+        EXPECT_EQ(execute(instance, 1, {0xffffffffffffffff, 0x100000000, cond}).stack,
+            std::vector<uint64_t>{cond != 0 ? 0xffffffffffffffff : 0x100000000});
+    }
+}
+
+TEST_P(execute_interpreters, sub_word_loads)
+{
+    /* wat2wasm
+    (memory 1)
+    (func (param i32 i64) local.get 0 local.get 1 i64.store)
+    (func (param i32) (result i32) local.get 0 i32.load8_s)
+    (func (param i32) (result i32) local.get 0 i32.load8_u)
+    (func (param i32) (result i32) local.get 0 i32.load16_s)
+    (func (param i32) (result i32) local.get 0 i32.load16_u)
+    (func (param i32) (result i64) local.get 0 i64.load8_s)
+    (func (param i32) (result i64) local.get 0 i64.load8_u)
+    (func (param i32) (result i64) local.get 0 i64.load16_s)
+    (func (param i32) (result i64) local.get 0 i64.load16_u)
+    (func (param i32) (result i64) local.get 0 i64.load32_s)
+    (func (param i32) (result i64) local.get 0 i64.load32_u)
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001100360027f7e0060017f017f60017f017e030c0b000101010102020202020205030100"
+        "010a5b0b0900200020013703000b070020002c00000b070020002d00000b070020002e01000b070020002f01"
+        "000b070020003000000b070020003100000b070020003201000b070020003301000b070020003402000b0700"
+        "20003502000b");
+    auto instance = instantiate_wasm(wasm);
+
+    ASSERT_FALSE(execute(instance, 0, {8, 0x8899aabbccddeeff}).trapped);
+    ASSERT_FALSE(execute(instance, 0, {16, 0x0102030405060708}).trapped);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        // The sign-extended loads of the negative values.
+        EXPECT_EQ(execute(instance, 1, {8}).stack, std::vector<uint64_t>{0xffffffff});
+        EXPECT_EQ(execute(instance, 2, {8}).stack, std::vector<uint64_t>{0xff});
+        EXPECT_EQ(execute(instance, 3, {8}).stack, std::vector<uint64_t>{0xffffeeff});
+        EXPECT_EQ(execute(instance, 4, {8}).stack, std::vector<uint64_t>{0xeeff});
+        EXPECT_EQ(execute(instance, 5, {8}).stack, std::vector<uint64_t>{0xffffffffffffffff});
+        EXPECT_EQ(execute(instance, 6, {8}).stack, std::vector<uint64_t>{0xff});
+        EXPECT_EQ(execute(instance, 7, {8}).stack, std::vector<uint64_t>{0xffffffffffffeeff});
+        EXPECT_EQ(execute(instance, 8, {8}).stack, std::vector<uint64_t>{0xeeff});
+        EXPECT_EQ(execute(instance, 9, {8}).stack, std::vector<uint64_t>{0xffffffffccddeeff});
+        EXPECT_EQ(execute(instance, 10, {8}).stack, std::vector<uint64_t>{0xccddeeff});
+        EXPECT_EQ(execute(instance, 9, {12}).stack, std::vector<uint64_t>{0xffffffff8899aabb});
+        EXPECT_EQ(execute(instance, 4, {13}).stack, std::vector<uint64_t>{0x99aa});
+
+        // The sign-extended loads of the positive values.
+        EXPECT_EQ(execute(instance, 1, {16}).stack, std::vector<uint64_t>{0x08});
+        EXPECT_EQ(execute(instance, 3, {16}).stack, std::vector<uint64_t>{0x0708});
+        EXPECT_EQ(execute(instance, 5, {16}).stack, std::vector<uint64_t>{0x08});
+        EXPECT_EQ(execute(instance, 7, {16}).stack, std::vector<uint64_t>{0x0708});
+        EXPECT_EQ(execute(instance, 9, {16}).stack, std::vector<uint64_t>{0x05060708});
+    }
+
+    EXPECT_EQ(execute(instance, 2, {65535}).stack, std::vector<uint64_t>{0});
+    EXPECT_TRUE(execute(instance, 4, {65535}).trapped);
+    EXPECT_EQ(execute(instance, 10, {65532}).stack, std::vector<uint64_t>{0});
+    EXPECT_TRUE(execute(instance, 10, {65533}).trapped);
+    EXPECT_TRUE(execute(instance, 5, {0xffffffff}).trapped);
+}
+
+TEST_P(execute_interpreters, sub_word_stores)
+{
+    /* wat2wasm
+    (memory 1)
+    (func (param i32 i32) local.get 0 local.get 1 i32.store8)
+    (func (param i32 i32) local.get 0 local.get 1 i32.store16)
+    (func (param i32 i64) local.get 0 local.get 1 i64.store8)
+    (func (param i32 i64) local.get 0 local.get 1 i64.store16)
+    (func (param i32 i64) local.get 0 local.get 1 i64.store32)
+    (func (param i32 i64) local.get 0 local.get 1 i64.store)
+    (func (param i32) (result i64) local.get 0 i64.load)
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001100360027f7f0060027f7e0060017f017e0308070000010101010205030100010a4507"
+        "0900200020013a00000b0900200020013b01000b0900200020013c00000b0900200020013d01000b09002000"
+        "20013e02000b0900200020013703000b070020002903000b");
+    auto instance = instantiate_wasm(wasm);
+
+    // Only the stored bytes of the word filled with ones change.
+    for (int i = 0; i < 3; ++i)
+    {
+        ASSERT_FALSE(execute(instance, 5, {0, 0xffffffffffffffff}).trapped);
+        ASSERT_FALSE(execute(instance, 0, {0, 0x12345678}).trapped);
+        EXPECT_EQ(execute(instance, 6, {0}).stack, std::vector<uint64_t>{0xffffffffffffff78});
+        ASSERT_FALSE(execute(instance, 1, {2, 0xabcdef01}).trapped);
+        EXPECT_EQ(execute(instance, 6, {0}).stack, std::vector<uint64_t>{0xffffffffef01ff78});
+        ASSERT_FALSE(execute(instance, 2, {4, 0x1122334455667788}).trapped);
+        EXPECT_EQ(execute(instance, 6, {0}).stack, std::vector<uint64_t>{0xffffff88ef01ff78});
+
+        ASSERT_FALSE(execute(instance, 5, {8, 0xffffffffffffffff}).trapped);
+        ASSERT_FALSE(execute(instance, 3, {8, 0x1122334455667788}).trapped);
+        EXPECT_EQ(execute(instance, 6, {8}).stack, std::vector<uint64_t>{0xffffffffffff7788});
+        ASSERT_FALSE(execute(instance, 4, {8, 0x1122334455667788}).trapped);
+        EXPECT_EQ(execute(instance, 6, {8}).stack, std::vector<uint64_t>{0xffffffff55667788});
+    }
+
+    EXPECT_FALSE(execute(instance, 4, {65532, 1}).trapped);
+    EXPECT_FALSE(execute(instance, 0, {65535, 1}).trapped);
+    EXPECT_TRUE(execute(instance, 1, {65535, 0xffff}).trapped);
+    EXPECT_TRUE(execute(instance, 4, {65533, 0xffffffff}).trapped);
+    EXPECT_TRUE(execute(instance, 2, {0xffffffff, 1}).trapped);
+    // The trapped stores leave the memory unchanged.
+    EXPECT_EQ(execute(instance, 6, {65528}).stack, std::vector<uint64_t>{0x0100000100000000});
+}
+
+TEST_P(execute_interpreters, globals)
+{
+    /* wat2wasm
+    (global $imported (import "env" "g") (mut i32))
+    (global $a (mut i32) (i32.const 5))
+    (global $b (mut i64) (i64.const -1))
+    (global $c i32 (i32.const 7))
+    (func (param i32) (result i32)
+      global.get $a
+      local.get 0
+      i32.add
+      global.set $a
+      global.get $a
+    )
+    (func (param i64) (result i64)
+      global.get $b
+      local.get 0
+      i64.add
+      global.set $b
+      global.get $b
+    )
+    (func (result i32) global.get $c)
+    (func (param i32) (result i32)
+      global.get $imported
+      local.get 0
+      i32.add
+      global.set $imported
+      global.get $imported
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d01000000010f0360017f017f60017e017e6000017f020a0103656e760167037f0103050400010200"
+        "0610037f0141050b7e01427f0b7f0041070b0a2a040b00230120006a240123010b0b00230220007c24022302"
+        "0b040023030b0b00230020006a240023000b");
+
+    uint64_t imported = 10;
+    auto instance = instantiate_wasm(wasm, {}, {{&imported, true}});
+
+    EXPECT_EQ(execute(instance, 0, {3}).stack, std::vector<uint64_t>{8});
+    EXPECT_EQ(execute(instance, 0, {3}).stack, std::vector<uint64_t>{11});
+    // The i32 global wraps around.
+    EXPECT_EQ(execute(instance, 0, {0xffffffff}).stack, std::vector<uint64_t>{10});
+    EXPECT_EQ(execute(instance, 0, {0xfffffff6}).stack, std::vector<uint64_t>{0});
+
+    EXPECT_EQ(execute(instance, 1, {2}).stack, std::vector<uint64_t>{1});
+    EXPECT_EQ(execute(instance, 1, {0xffffffff}).stack, std::vector<uint64_t>{0x100000000});
+    EXPECT_EQ(execute(instance, 1, {0xffffffff00000000}).stack, std::vector<uint64_t>{0});
+
+    for (int i = 0; i < 3; ++i)
+        EXPECT_EQ(execute(instance, 2, {}).stack, std::vector<uint64_t>{7});
+
+    EXPECT_EQ(execute(instance, 3, {5}).stack, std::vector<uint64_t>{15});
+    EXPECT_EQ(execute(instance, 3, {5}).stack, std::vector<uint64_t>{20});
+    EXPECT_EQ(execute(instance, 3, {0xffffffec}).stack, std::vector<uint64_t>{0});
+    EXPECT_EQ(imported, 0);
+
+    EXPECT_EQ(instance.globals, (std::vector<uint64_t>{0, 0, 7}));
+}
+
+TEST_P(execute_interpreters, call_recursive)
+{
+    /* wat2wasm
+    (func $fib (param i32) (result i32)
+      local.get 0
+      i32.const 2
+      i32.lt_u
+      (if (result i32)
+        (then local.get 0)
+        (else
+          local.get 0
+          i32.const 1
+          i32.sub
+          call $fib
+          local.get 0
+          i32.const 2
+          i32.sub
+          call $fib
+          i32.add
+        )
+      )
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f030201000a1e011c002000410249047f200005200041016b10002000"
+        "41026b10006a0b0b");
+
+    const auto [trap, ret] = execute_wasm(wasm, 0, {20});
+    ASSERT_FALSE(trap);
+    ASSERT_EQ(ret.size(), 1);
+    EXPECT_EQ(ret[0], 6765);
+}
+
+TEST_P(execute_interpreters, call_imported_and_indirect)
+{
+    /* wat2wasm
+    (type $t0 (func (param i32) (result i32)))
+    (import "env" "double" (func $double (type $t0)))
+    (table 2 anyfunc)
+    (elem (i32.const 0) $double_plus_one $const)
+    (func $double_plus_one (type $t0)
+      local.get 0
+      call $double
+      i32.const 1
+      i32.add
+    )
+    (func (param i32) (result i32)
+      i32.const 5
+      local.get 0
+      call_indirect (type $t0)
+    )
+    (func $const (result i32)
+      i32.const 42
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d01000000010a0260017f017f6000017f020e0103656e7606646f75626c6500000304030000010404"
+        "017000020908010041000b0201030a1a0309002000100041016a0b0900410520001100000b0400412a0b");
+
+    const auto double_fn = [](Instance&, std::vector<uint64_t> args) -> execution_result {
+        return {false, {args[0] * 2}};
+    };
+
+    const auto [trap, ret] = execute_wasm(wasm, 2, {0}, {double_fn});
+    ASSERT_FALSE(trap);
+    ASSERT_EQ(ret.size(), 1);
+    EXPECT_EQ(ret[0], 11);
+
+    // Type mismatch.
+    EXPECT_TRUE(execute_wasm(wasm, 2, {1}, {double_fn}).trapped);
+    // Element out of table bounds.
+    EXPECT_TRUE(execute_wasm(wasm, 2, {2}, {double_fn}).trapped);
+
+    const auto trap_fn = [](Instance&, std::vector<uint64_t>) -> execution_result {
+        return {true, {}};
+    };
+    EXPECT_TRUE(execute_wasm(wasm, 2, {0}, {trap_fn}).trapped);
+}
+
+TEST_P(execute_interpreters, imported_function_exception)
+{
+    /* wat2wasm
+    (import "env" "f" (func $f))
+    (func call $f)
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001040160000002090103656e7601660000030201000a0601040010000b");
+
+    const auto throw_fn = [](Instance&, std::vector<uint64_t>) -> execution_result {
+        throw std::runtime_error{"host error"};
+    };
+
+    EXPECT_THROW(execute_wasm(wasm, 1, {}, {throw_fn}), std::runtime_error);
+}
+
+TEST_P(execute_interpreters, memory)
+{
+    /* wat2wasm
+    (memory 1)
+    (func (param i32) (result i32)
+      local.get 0
+      i32.const 0x12345678
+      i32.store
+      local.get 0
+      i32.load8_u offset=1
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f0302010005030100010a14011200200041f8acd19101360200200"
+        "02d00010b");
+
+    const auto [trap, ret] = execute_wasm(wasm, 0, {100});
+    ASSERT_FALSE(trap);
+    ASSERT_EQ(ret.size(), 1);
+    EXPECT_EQ(ret[0], 0x56);
+
+    EXPECT_TRUE(execute_wasm(wasm, 0, {65535}).trapped);
+    EXPECT_TRUE(execute_wasm(wasm, 0, {0xffffffff}).trapped);
+}
+
+TEST_P(execute_interpreters, memory_grow)
+{
+    /* wat2wasm
+    (memory 1 2)
+    (func (param i32) (result i32)
+      local.get 0
+      memory.grow
+      drop
+      i32.const 65536
+      i32.const 42
+      i32.store
+      i32.const 65536
+      i32.load
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f030201000504010101020a19011700200040001a41808004412a3602"
+        "00418080042802000b");
+
+    const auto [trap, ret] = execute_wasm(wasm, 0, {1});
+    ASSERT_FALSE(trap);
+    ASSERT_EQ(ret.size(), 1);
+    EXPECT_EQ(ret[0], 42);
+
+    EXPECT_TRUE(execute_wasm(wasm, 0, {0}).trapped);
+    // Growing over the maximum fails.
+    EXPECT_TRUE(execute_wasm(wasm, 0, {2}).trapped);
+}
+
+TEST_P(execute_interpreters, memory_grown_by_imported_function)
+{
+    /* wat2wasm
+    (import "env" "grow" (func $grow (result i32)))
+    (memory 1 2)
+    (func (result i32)
+      call $grow
+      drop
+      i32.const 65536
+      i32.load
+    )
+    (func (result i32)
+      i32.const 1
+      memory.grow
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d010000000105016000017f020c0103656e760467726f77000003030200000504010101020a15020c"
+        "0010001a418080042802000b0600410140000b");
+
+    // The imported function grows the memory by executing the function of the same instance.
+    const auto grow_fn = [](Instance& instance, std::vector<uint64_t>) {
+        return execute(instance, 2, {});
+    };
+
+    const auto [trap, ret] = execute_wasm(wasm, 1, {}, {grow_fn});
+    ASSERT_FALSE(trap);
+    ASSERT_EQ(ret.size(), 1);
+    EXPECT_EQ(ret[0], 0);
+}
@@ -1,7 +1,9 @@
 #include "execute.hpp"
+#include "host_function.hpp"
 #include "limits.hpp"
 #include "parser.hpp"
 #include <gtest/gtest.h>
+#include <stdexcept>
 #include <test/utils/asserts.hpp>
 #include <test/utils/hex.hpp>
 
@@ -266,7 +268,7 @@ TEST(execute, i32_load_imported_memory)
     module.codesec.emplace_back(
         Code{0, {Instr::local_get, Instr::i32_load, Instr::end}, {0, 0, 0, 0, 0, 0, 0, 0}});
 
-    bytes memory(PageSize, 0);
+    LinearMemory memory(PageSize);
     auto instance = instantiate(module, {}, {}, {{&memory, {1, 1}}});
     memory[0] = 42;
     const auto [trap, ret] = execute(instance, 0, {0});
@@ -563,7 +565,7 @@ TEST(execute, i32_store_imported_memory)
         Code{0, {Instr::local_get, Instr::local_get, Instr::i32_store, Instr::end},
             {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}});
 
-    bytes memory(PageSize, 0);
+    LinearMemory memory(PageSize);
     auto instance = instantiate(module, {}, {}, {{&memory, {1, 1}}});
     const auto [trap, ret] = execute(instance, 0, {42, 0});
 
@@ -965,6 +967,273 @@ TEST(execute, imported_function_traps)
     ASSERT_TRUE(trap);
 }
 
+TEST(execute, imported_function_throws)
+{
+    /* wat2wasm
+    (func (import "mod" "foo") (param i32) (result i32))
+    (func (param i32) (result i32) (local i32 i32) local.get 0 call 0)
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f020b01036d6f6403666f6f0000030201000a0a010801027f200010"
+        "000b");
+
+    auto host_foo = [](Instance&, std::vector<uint64_t>) -> execution_result {
+        throw std::runtime_error{"host failure"};
+    };
+
+    for (const auto interpreter : {Interpreter::stack, Interpreter::registers, Interpreter::jit})
+    {
+        auto instance = instantiate(parse(wasm), {host_foo});
+        set_interpreter(instance, interpreter);
+
+        // The frames of the unfinished calls are dropped from the value stack.
+        for (int i = 0; i < 2; ++i)
+        {
+            EXPECT_THROW(execute(instance, 1, {1}), std::runtime_error);
+            EXPECT_TRUE(instance.value_stack.empty());
+
+            const uint64_t args[] = {1};
+            uint64_t results[] = {0};
+            EXPECT_THROW(execute(instance, 1, {args, 1}, {results, 1}), std::runtime_error);
+            EXPECT_TRUE(instance.value_stack.empty());
+        }
+    }
+}
+
+TEST(execute, execute_with_spans)
+{
+    /* wat2wasm
+    (func (import "mod" "foo") (param i32) (result i32))
+    (func (param i32) (result i32) local.get 0 call 0 i32.const 1 i32.add)
+    (func unreachable)
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001090260017f017f600000020b01036d6f6403666f6f000003030200010a0f02090020"
+        "00100041016a0b0300000b");
+
+    auto host_foo = [](Instance&, std::vector<uint64_t> args) -> execution_result {
+        return {false, {args[0] * 2}};
+    };
+
+    for (const auto interpreter : {Interpreter::stack, Interpreter::registers, Interpreter::jit})
+    {
+        auto instance = instantiate(parse(wasm), {host_foo});
+        set_interpreter(instance, interpreter);
+
+        const uint64_t args[] = {20};
+        uint64_t results[] = {0};
+        EXPECT_EQ(execute(instance, 1, {args, 1}, {results, 1}), ExecutionStatus::success);
+        EXPECT_EQ(results[0], 41);
+        EXPECT_EQ(execute(instance, 0, {args, 1}, {results, 1}), ExecutionStatus::success);
+        EXPECT_EQ(results[0], 40);
+
+        EXPECT_EQ(execute(instance, 2, {}, {}), ExecutionStatus::trapped);
+        EXPECT_TRUE(instance.value_stack.empty());
+
+        results[0] = 0;
+        EXPECT_EQ(execute(instance, 1, {}, {results, 1}), ExecutionStatus::invalid_arguments);
+        EXPECT_EQ(execute(instance, 1, {args, 1}, {}), ExecutionStatus::invalid_arguments);
+        EXPECT_EQ(execute(instance, 3, {}, {}), ExecutionStatus::invalid_arguments);
+        EXPECT_EQ(results[0], 0);
+        EXPECT_TRUE(instance.value_stack.empty());
+    }
+}
+
+TEST(execute, imported_host_function)
+{
+    /* wat2wasm
+    (func (import "mod" "foo") (param i32) (result i32))
+    (func (param i32) (result i32) local.get 0 call 0 i32.const 1 i32.add)
+    (func unreachable)
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001090260017f017f600000020b01036d6f6403666f6f000003030200010a0f02090020"
+        "00100041016a0b0300000b");
+
+    // Doubles the argument and counts the calls, traps for the argument 0.
+    const auto host_foo = [](void* context, Instance&, const uint64_t* args, uint64_t* result) {
+        ++*static_cast<int*>(context);
+        if (args[0] == 0)
+            return ExecutionStatus::trapped;
+        *result = args[0] * 2;
+        return ExecutionStatus::success;
+    };
+
+    for (const auto interpreter : {Interpreter::stack, Interpreter::registers, Interpreter::jit})
+    {
+        int num_calls = 0;
+        auto instance = instantiate(parse(wasm), {HostFunction{host_foo, &num_calls}});
+        set_interpreter(instance, interpreter);
+        EXPECT_EQ(instance.functions[0].host_context, &num_calls);
+        EXPECT_EQ(instance.functions[0].external_function, nullptr);
+
+        EXPECT_RESULT(execute(instance, 1, {20}), 41);
+        EXPECT_RESULT(execute(instance, 0, {20}), 40);
+        EXPECT_TRUE(execute(instance, 1, {0}).trapped);
+
+        const uint64_t args[] = {10};
+        uint64_t results[] = {0};
+        EXPECT_EQ(execute(instance, 1, {args, 1}, {results, 1}), ExecutionStatus::success);
+        EXPECT_EQ(results[0], 21);
+        EXPECT_EQ(num_calls, 4);
+        EXPECT_TRUE(instance.value_stack.empty());
+    }
+}
+
+namespace
+{
+uint32_t host_sub(Instance&, uint32_t a, uint64_t b) noexcept
+{
+    return a - static_cast<uint32_t>(b);
+}
+
+int64_t host_neg(Instance&, int32_t a)
+{
+    return -int64_t{a};
+}
+
+uint64_t host_calls = 0;
+
+void host_count(Instance&)
+{
+    ++host_calls;
+}
+
+uint32_t host_double(Instance&, uint32_t a)
+{
+    return 2 * a;
+}
+
+/// Calls the function 1 of the instance recursively, the value stack grows with every level.
+uint32_t host_reenter(Instance& instance, uint32_t a)
+{
+    if (a == 0)
+        return 0;
+    return static_cast<uint32_t>(execute(instance, 1, {a - 1}).stack.at(0)) + 2;
+}
+}  // namespace
+
+TEST(execute, bind_host_function)
+{
+    Module module;
+    module.typesec.emplace_back(FuncType{{ValType::i32, ValType::i64}, {ValType::i32}});
+    module.typesec.emplace_back(FuncType{{ValType::i32}, {ValType::i64}});
+    module.typesec.emplace_back(FuncType{{}, {}});
+    module.importsec.emplace_back(Import{"mod", "sub", ExternalKind::Function, {0}});
+    module.importsec.emplace_back(Import{"mod", "neg", ExternalKind::Function, {1}});
+    module.importsec.emplace_back(Import{"mod", "count", ExternalKind::Function, {2}});
+
+    auto instance = instantiate(module, {bind_host_function<host_sub>(),
+                                            bind_host_function<host_neg>(),
+                                            bind_host_function<host_count>()});
+
+    EXPECT_RESULT(execute(instance, 0, {1, 2}), 0xffffffff);
+    EXPECT_RESULT(execute(instance, 0, {0x100000005, 2}), 3);
+    EXPECT_RESULT(execute(instance, 1, {0xfffffffe}), 2);
+    EXPECT_RESULT(execute(instance, 1, {2}), uint64_t(-2));
+
+    host_calls = 0;
+    const auto [trap, ret] = execute(instance, 2, {});
+    EXPECT_FALSE(trap);
+    EXPECT_TRUE(ret.empty());
+    EXPECT_EQ(host_calls, 1);
+}
+
+TEST(execute, bind_host_function_reentrant)
+{
+    /* wat2wasm
+    (func (import "mod" "foo") (param i32) (result i32))
+    (func (param i32) (result i32) local.get 0 call 0 i32.const 1 i32.add)
+    (func unreachable)
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001090260017f017f600000020b01036d6f6403666f6f000003030200010a0f02090020"
+        "00100041016a0b0300000b");
+
+    for (const auto interpreter : {Interpreter::stack, Interpreter::registers, Interpreter::jit})
+    {
+        auto instance = instantiate(parse(wasm), {bind_host_function<host_reenter>()});
+        set_interpreter(instance, interpreter);
+
+        // The nested executions reallocate the value stack holding the host function's frame.
+        const auto capacity = instance.value_stack.capacity();
+        EXPECT_RESULT(execute(instance, 1, {200}), 601);
+        EXPECT_GT(instance.value_stack.capacity(), capacity);
+        EXPECT_TRUE(instance.value_stack.empty());
+    }
+}
+
+TEST(execute, execute_with_spans_reserved_stack)
+{
+    /* wat2wasm
+    (func (import "mod" "foo") (param i32) (result i32))
+    (func (param i32) (result i32) local.get 0 call 0 i32.const 1 i32.add)
+    (func unreachable)
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001090260017f017f600000020b01036d6f6403666f6f000003030200010a0f02090020"
+        "00100041016a0b0300000b");
+
+    for (const auto interpreter : {Interpreter::stack, Interpreter::registers, Interpreter::jit})
+    {
+        auto instance = instantiate(parse(wasm), {bind_host_function<host_double>()});
+        set_interpreter(instance, interpreter);
+        instance.value_stack.reserve(256);
+        const auto* const stack_data = instance.value_stack.data();
+        const auto stack_capacity = instance.value_stack.capacity();
+
+        const uint64_t args[] = {20};
+        uint64_t results[] = {0};
+        for (int i = 0; i < 3; ++i)
+        {
+            EXPECT_EQ(execute(instance, 1, {args, 1}, {results, 1}), ExecutionStatus::success);
+            EXPECT_EQ(results[0], 41);
+        }
+        EXPECT_EQ(execute(instance, 2, {}, {}), ExecutionStatus::trapped);
+
+        // The frames fit the reserved value stack, so the execution does not reallocate it.
+        EXPECT_EQ(instance.value_stack.data(), stack_data);
+        EXPECT_EQ(instance.value_stack.capacity(), stack_capacity);
+    }
+}
+
+TEST(execute, operand_stack_kept_across_reallocating_calls)
+{
+    /* wat2wasm
+    (func $f (param i32) (result i32)
+      i32.const 100
+      local.get 0
+      (if (result i32)
+        (then local.get 0 i32.const 1 i32.sub call $f)
+        (else i32.const 0)
+      )
+      i32.add
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f030201000a1701150041e4002000047f200041016b10000541000b6a"
+        "0b");
+
+    // The nested calls reallocate the value stack while the operands of the validated callers
+    // are on it.
+    const auto module = parse(wasm);
+    ASSERT_TRUE(module.validated);
+    auto instance = instantiate(module);
+    EXPECT_RESULT(execute(instance, 0, {1000}), 100100);
+    EXPECT_TRUE(instance.value_stack.empty());
+
+    // The hand-built code exceeding its max_stack_height grows the value stack with the pushes.
+    Module hand_built;
+    hand_built.typesec.emplace_back(FuncType{{}, {ValType::i32}});
+    hand_built.funcsec.emplace_back(TypeIdx{0});
+    hand_built.codesec.emplace_back(Code{0,
+        {Instr::i32_const, Instr::i32_const, Instr::i32_add, Instr::end},
+        {1, 0, 0, 0, 2, 0, 0, 0}});
+    EXPECT_EQ(hand_built.codesec[0].max_stack_height, 0);
+    auto hand_built_instance = instantiate(hand_built);
+    EXPECT_RESULT(execute(hand_built_instance, 0, {}), 3);
+}
+
 TEST(execute, memory_copy_32bytes)
 {
     /* wat2wasm
@@ -1009,3 +1278,272 @@ TEST(execute, memory_copy_32bytes)
     std::copy_n(&(*instance.memory)[33], input.size(), std::back_inserter(output));
     EXPECT_EQ(output, input);
 }
+
+TEST(execute, superinstructions)
+{
+    /* wat2wasm
+    (memory 1)
+    (func (param i32 i32) (result i32) (local i32)
+      (block
+        (loop
+          local.get 0
+          i32.load
+          local.get 2
+          i32.add
+          local.set 2
+          local.get 1
+          i32.const -1
+          i32.add
+          local.tee 1
+          br_if 0
+        )
+      )
+      local.get 2
+      local.get 1
+      i32.sub
+      i32.const 7
+      i32.add
+      local.set 2
+      local.get 2
+      local.get 0
+      i32.const 3
+      i32.shl
+      i32.xor
+    )
+    */
+    const auto bin = from_hex(
+        "0061736d0100000001070160027f7f017f0302010005030100010a31012f01017f0240034020002802002002"
+        "6a21022001417f6a22010d000b0b200220016b41076a210220022000410374730b");
+
+    const auto module = parse(bin);
+    EXPECT_EQ(module.codesec[0].instructions,
+        (std::vector{Instr::block, Instr::loop, Instr::local_get_i32_load, Instr::i32_load,
+            Instr::local_get, Instr::i32_add_local_set, Instr::local_set,
+            Instr::local_get_i32_const_i32_add, Instr::i32_const, Instr::i32_add,
+            Instr::local_tee_br_if, Instr::br_if, Instr::end, Instr::end,
+            Instr::local_get_local_get, Instr::local_get, Instr::i32_sub, Instr::i32_const_i32_add,
+            Instr::i32_add, Instr::local_set_local_get, Instr::local_get,
+            Instr::local_get_i32_const, Instr::i32_const, Instr::i32_shl, Instr::i32_xor,
+            Instr::end}));
+
+    auto instance = instantiate(module);
+    const auto input = from_hex("04030201");
+    std::copy(input.begin(), input.end(), instance.memory->begin() + 4);
+
+    const auto [trap, ret] = execute(instance, 0, {4, 3});
+    ASSERT_FALSE(trap);
+    ASSERT_EQ(ret.size(), 1);
+    EXPECT_EQ(ret[0], (3 * 0x01020304 + 7) ^ (4 << 3));
+
+    EXPECT_TRUE(execute(instance, 0, {65534, 3}).trapped);
+}
+
+TEST(execute, function_profiles)
+{
+    /* wat2wasm
+    (func (param i64) (result i64) (local i64)
+      i64.const 1
+      local.set 1
+      (block
+        (loop
+          local.get 0
+          i64.eqz
+          br_if 1
+          local.get 1
+          local.get 0
+          i64.mul
+          local.set 1
+          local.get 0
+          i64.const 1
+          i64.sub
+          local.set 0
+          br 0
+        )
+      )
+      local.get 1
+    )
+    */
+    const auto bin = from_hex(
+        "0061736d0100000001060160017e017e030201000a27012501017e42012101024003402000500d0120012000"
+        "7e2101200042017d21000c000b0b20010b");
+
+    for (const auto interpreter : {Interpreter::stack, Interpreter::registers})
+    {
+        auto instance = instantiate(parse(bin));
+        set_interpreter(instance, interpreter);
+        ASSERT_EQ(instance.function_profiles.size(), 1);
+
+        EXPECT_EQ(execute(instance, 0, {5}).stack, std::vector<uint64_t>{120});
+        EXPECT_EQ(execute(instance, 0, {3}).stack, std::vector<uint64_t>{6});
+        EXPECT_EQ(instance.function_profiles[0].calls, 2);
+        EXPECT_EQ(instance.function_profiles[0].back_edges, 5 + 3);
+    }
+}
+
+TEST(execute, tiered_promotion_by_back_edges)
+{
+    // The same function as in the function_profiles test.
+    const auto bin = from_hex(
+        "0061736d0100000001060160017e017e030201000a27012501017e42012101024003402000500d0120012000"
+        "7e2101200042017d21000c000b0b20010b");
+
+    auto instance = instantiate(parse(bin));
+    set_interpreter(instance, Interpreter::tiered);
+    instance.tiering_thresholds = {10, 30};
+
+    EXPECT_EQ(execute(instance, 0, {20}).stack, std::vector<uint64_t>{2432902008176640000});
+    // The function is promoted only on its next call.
+    EXPECT_EQ(instance.function_profiles[0].tier, Interpreter::stack);
+    EXPECT_EQ(instance.tiering_stats.promoted_to_registers, 0);
+
+    EXPECT_EQ(execute(instance, 0, {5}).stack, std::vector<uint64_t>{120});
+    EXPECT_EQ(instance.function_profiles[0].tier, Interpreter::registers);
+    EXPECT_EQ(instance.tiering_stats.promoted_to_registers, 1);
+
+    EXPECT_EQ(execute(instance, 0, {5}).stack, std::vector<uint64_t>{120});
+    EXPECT_EQ(execute(instance, 0, {5}).stack, std::vector<uint64_t>{120});
+    const auto expected_tier = is_jit_available() ? Interpreter::jit : Interpreter::registers;
+    EXPECT_EQ(instance.function_profiles[0].tier, expected_tier);
+    EXPECT_EQ(instance.tiering_stats.promoted_to_jit, is_jit_available() ? 1 : 0);
+}
+
+TEST(execute, tiered_promotion_by_calls)
+{
+    /* wat2wasm
+    (func $fib (param i32) (result i32)
+      local.get 0
+      i32.const 2
+      i32.lt_u
+      (if (result i32)
+        (then local.get 0)
+        (else
+          local.get 0
+          i32.const 1
+          i32.sub
+          call $fib
+          local.get 0
+          i32.const 2
+          i32.sub
+          call $fib
+          i32.add
+        )
+      )
+    )
+    */
+    const auto bin = from_hex(
+        "0061736d0100000001060160017f017f030201000a1e011c002000410249047f200005200041016b10002000"
+        "41026b10006a0b0b");
+
+    auto instance = instantiate(parse(bin));
+    set_interpreter(instance, Interpreter::tiered);
+    instance.tiering_thresholds = {4, 100};
+
+    // The recursive calls are promoted while the outer ones still run in the lower tiers.
+    EXPECT_EQ(execute(instance, 0, {20}).stack, std::vector<uint64_t>{6765});
+    EXPECT_EQ(instance.function_profiles[0].calls, 21891);
+    EXPECT_EQ(instance.tiering_stats.promoted_to_registers, 1);
+    EXPECT_EQ(instance.tiering_stats.promoted_to_jit, is_jit_available() ? 1 : 0);
+}
+
+TEST(execute, snapshot_restore)
+{
+    /* wat2wasm
+    (memory 1 2)
+    (global (mut i32) (i32.const 7))
+    (func (param i32) (result i32)
+      global.get 0
+      i32.const 1
+      i32.add
+      global.set 0
+      local.get 0
+      global.get 0
+      i32.store
+      i32.const 1
+      memory.grow
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f030201000504010101020606017f0141070b0a160114002300410"
+        "16a240020002300360200410140000b");
+
+    for (const auto interpreter : {Interpreter::stack, Interpreter::registers, Interpreter::jit})
+    {
+        auto instance = instantiate(parse(wasm));
+        set_interpreter(instance, interpreter);
+        const auto snapshot = take_snapshot(instance);
+
+        for (const uint32_t address : {65532u, 4094u, 65532u})
+        {
+            const auto [trap, ret] = execute(instance, 0, {address});
+            ASSERT_FALSE(trap);
+            EXPECT_EQ(ret, std::vector<uint64_t>{1});
+            EXPECT_EQ(instance.globals[0], 8);
+            EXPECT_EQ(instance.memory->substr(address, 4), from_hex("08000000"));
+            EXPECT_EQ(instance.memory->size(), 2 * PageSize);
+
+            ASSERT_TRUE(restore_snapshot(instance, snapshot));
+            EXPECT_EQ(instance.globals[0], 7);
+            EXPECT_EQ(instance.memory->substr(address, 4), from_hex("00000000"));
+            EXPECT_EQ(instance.memory->size(), PageSize);
+        }
+    }
+
+    // The snapshot of the instance of another module is rejected.
+    auto instance = instantiate(parse(wasm));
+    auto other_instance = instantiate(parse(from_hex("0061736d01000000")));
+    EXPECT_FALSE(restore_snapshot(other_instance, take_snapshot(instance)));
+    EXPECT_FALSE(restore_snapshot(instance, take_snapshot(other_instance)));
+    EXPECT_EQ(instance.globals[0], 7);
+}
+
+TEST(execute, lazy_parsed_module)
+{
+    /* wat2wasm --no-check
+    (func (param i32) (result i32) local.get 0 call 1)
+    (func (param i32) (result i32) local.get 0 i32.const 1 i32.add)
+    (func (result i32) <invalid instruction 0x06>)
+    */
+    const auto wasm = from_hex(
+        "0061736d01000000010a0260017f017f6000017f0304030000010a14030600200010010b0700200041016a0b03"
+        "00060b");
+    EXPECT_THROW(parse(wasm), parser_error);
+
+    for (const auto interpreter : {Interpreter::stack, Interpreter::tiered})
+    {
+        auto instance = instantiate(parse(wasm, ParseMode::lazy));
+        set_interpreter(instance, interpreter);
+        const auto& lazy_codesec = *instance.module->lazy_codesec;
+
+        const auto [trap, ret] = execute(instance, 0, {41});
+        ASSERT_FALSE(trap);
+        EXPECT_EQ(ret, std::vector<uint64_t>{42});
+        EXPECT_TRUE(lazy_codesec.parsed[0]);
+        EXPECT_TRUE(lazy_codesec.parsed[1]);
+        EXPECT_FALSE(lazy_codesec.parsed[2]);
+
+        EXPECT_THROW(execute(instance, 2, {}), parser_error);
+    }
+
+    /* wat2wasm --no-check
+    (func (param i32) (result i32) (local i32 i32) local.get 0 call 1)
+    (func (param i32) (result i32) <invalid instruction 0x06>)
+    */
+    const auto wasm_invalid_callee = from_hex(
+        "0061736d0100000001060160017f017f03030200000a0e020801027f200010010b0300060b");
+    for (const auto interpreter : {Interpreter::stack, Interpreter::tiered})
+    {
+        auto instance = instantiate(parse(wasm_invalid_callee, ParseMode::lazy));
+        set_interpreter(instance, interpreter);
+
+        // The frame of the caller is dropped from the value stack.
+        EXPECT_THROW(execute(instance, 0, {1}), parser_error);
+        EXPECT_TRUE(instance.value_stack.empty());
+    }
+
+    // The register code is translated from all the bodies.
+    for (const auto interpreter : {Interpreter::registers, Interpreter::jit})
+    {
+        auto instance = instantiate(parse(wasm, ParseMode::lazy));
+        EXPECT_THROW(set_interpreter(instance, interpreter), parser_error);
+    }
+}
@@ -1,8 +1,11 @@
 #include "execute.hpp"
+#include "host_function.hpp"
 #include "limits.hpp"
+#include "parser.hpp"
 #include <gtest/gtest.h>
 #include <test/utils/asserts.hpp>
 #include <test/utils/hex.hpp>
+#include <thread>
 
 using namespace fizzy;
 
@@ -46,6 +49,41 @@ TEST(instantiate, imported_functions_multiple)
     EXPECT_EQ(instance.imported_function_types[1], TypeIdx{1});
 }
 
+TEST(instantiate, function_descriptors)
+{
+    Module module;
+    module.typesec.emplace_back(FuncType{{ValType::i32}, {ValType::i32}});
+    module.typesec.emplace_back(FuncType{{ValType::i64, ValType::i32}, {}});
+    module.typesec.emplace_back(FuncType{{ValType::i32}, {ValType::i32}});
+    module.importsec.emplace_back(Import{"mod", "foo", ExternalKind::Function, {1}});
+    module.funcsec.emplace_back(TypeIdx{2});
+    module.funcsec.emplace_back(TypeIdx{1});
+    module.codesec.resize(2);
+
+    auto host_foo = [](Instance&, std::vector<uint64_t>) -> execution_result { return {}; };
+    const auto instance = instantiate(module, {host_foo});
+
+    ASSERT_EQ(instance.functions.size(), 3);
+    EXPECT_EQ(instance.functions[0].type_idx, 1);
+    EXPECT_EQ(instance.functions[0].type_id, 1);
+    EXPECT_EQ(instance.functions[0].num_inputs, 2);
+    EXPECT_EQ(instance.functions[0].num_outputs, 0);
+    EXPECT_NE(instance.functions[0].host_function, nullptr);
+    EXPECT_EQ(instance.functions[0].external_function, &instance.imported_functions[0]);
+
+    EXPECT_EQ(instance.functions[1].type_idx, 2);
+    EXPECT_EQ(instance.functions[1].type_id, 0);
+    EXPECT_EQ(instance.functions[1].num_inputs, 1);
+    EXPECT_EQ(instance.functions[1].num_outputs, 1);
+    EXPECT_EQ(instance.functions[1].code_idx, 0);
+    EXPECT_EQ(instance.functions[1].host_function, nullptr);
+
+    EXPECT_EQ(instance.functions[2].type_idx, 1);
+    EXPECT_EQ(instance.functions[2].type_id, 1);
+    EXPECT_EQ(instance.functions[2].code_idx, 1);
+    EXPECT_EQ(instance.functions[2].host_function, nullptr);
+}
+
 TEST(instantiate, imported_functions_not_enough)
 {
     Module module;
@@ -56,6 +94,69 @@ TEST(instantiate, imported_functions_not_enough)
         "Module requires 1 imported functions, 0 provided");
 }
 
+TEST(instantiate, try_instantiate)
+{
+    Module module;
+    module.typesec.emplace_back(FuncType{{ValType::i32}, {ValType::i32}});
+    module.importsec.emplace_back(Import{"mod", "foo", ExternalKind::Function, {0}});
+
+    Error error;
+    EXPECT_FALSE(try_instantiate(module, error).has_value());
+    EXPECT_EQ(error.code, ErrorCode::imported_function_count_mismatch);
+    EXPECT_EQ(error.value, 1);
+    EXPECT_EQ(error.value2, 0);
+    EXPECT_EQ(error_message(error), "Module requires 1 imported functions, 0 provided");
+    EXPECT_THROW_MESSAGE(instantiate(module), std::runtime_error,
+        "Module requires 1 imported functions, 0 provided");
+
+    const auto host_foo = [](Instance&, std::vector<uint64_t>) -> execution_result {
+        return {false, {}};
+    };
+    const auto instance = try_instantiate(module, error, {host_foo});
+    EXPECT_FALSE(error);
+    EXPECT_TRUE(instance.has_value());
+
+    // The exception of the host function called by the start function.
+    module.typesec.emplace_back(FuncType{});
+    module.importsec.emplace_back(Import{"mod", "start", ExternalKind::Function, {1}});
+    module.startfunc = 1;
+    const auto host_throwing = [](Instance&, std::vector<uint64_t>) -> execution_result {
+        throw std::runtime_error{"host failure"};
+    };
+    EXPECT_FALSE(try_instantiate(module, error, {host_foo, host_throwing}).has_value());
+    EXPECT_EQ(error.code, ErrorCode::unexpected_exception);
+}
+
+namespace
+{
+uint32_t host_add(Instance&, uint32_t a, uint32_t b)
+{
+    return a + b;
+}
+}  // namespace
+
+TEST(instantiate, imported_host_function_type_mismatch)
+{
+    Module module;
+    module.typesec.emplace_back(FuncType{{ValType::i32, ValType::i32}, {ValType::i32}});
+    module.typesec.emplace_back(FuncType{{ValType::i32, ValType::i64}, {ValType::i32}});
+    module.typesec.emplace_back(FuncType{{ValType::i32, ValType::i32}, {}});
+    module.importsec.emplace_back(Import{"mod", "foo1", ExternalKind::Function, {0}});
+    module.importsec.emplace_back(Import{"mod", "foo2", ExternalKind::Function, {0}});
+
+    const std::vector<ExternalFunction> imports = {
+        bind_host_function<host_add>(), bind_host_function<host_add>()};
+    EXPECT_NO_THROW(instantiate(module, imports));
+
+    module.importsec[1].desc.function_type_index = 1;
+    EXPECT_THROW_MESSAGE(instantiate(module, imports), instantiate_error,
+        "Function 1 type doesn't match module's imported function type");
+
+    module.importsec[1].desc.function_type_index = 2;
+    EXPECT_THROW_MESSAGE(instantiate(module, imports), instantiate_error,
+        "Function 1 type doesn't match module's imported function type");
+}
+
 TEST(instantiate, imported_table)
 {
     Module module;
@@ -149,7 +250,7 @@ TEST(instantiate, imported_memory)
     imp.desc.memory = Memory{{1, 3}};
     module.importsec.emplace_back(imp);
 
-    bytes memory(PageSize, 0);
+    LinearMemory memory(PageSize);
     auto instance = instantiate(module, {}, {}, {{&memory, {1, 3}}});
 
     ASSERT_TRUE(instance.memory);
@@ -165,7 +266,7 @@ TEST(instantiate, imported_memory_unlimited)
     imp.desc.memory = Memory{{1, std::nullopt}};
     module.importsec.emplace_back(imp);
 
-    bytes memory(PageSize, 0);
+    LinearMemory memory(PageSize);
     auto instance = instantiate(module, {}, {}, {{&memory, {1, std::nullopt}}});
 
     ASSERT_TRUE(instance.memory);
@@ -181,7 +282,7 @@ TEST(instantiate, imported_memory_stricter_limits)
     imp.desc.memory = Memory{{1, 3}};
     module.importsec.emplace_back(imp);
 
-    bytes memory(PageSize * 2, 0);
+    LinearMemory memory(PageSize * 2);
     auto instance = instantiate(module, {}, {}, {{&memory, {2, 2}}});
 
     ASSERT_TRUE(instance.memory);
@@ -197,7 +298,7 @@ TEST(instantiate, imported_memory_invalid)
     imp.desc.memory = Memory{{1, 3}};
     module.importsec.emplace_back(imp);
 
-    bytes memory(PageSize, 0);
+    LinearMemory memory(PageSize);
 
     // Providing more than 1 memory
     EXPECT_THROW_MESSAGE(instantiate(module, {}, {}, {{&memory, {1, 3}}, {&memory, {1, 1}}}),
@@ -214,7 +315,7 @@ TEST(instantiate, imported_memory_invalid)
         "Module defines an imported memory but none was provided.");
 
     // Provided min too low
-    bytes memory_empty;
+    LinearMemory memory_empty;
     EXPECT_THROW_MESSAGE(instantiate(module, {}, {}, {{&memory_empty, {0, 3}}}), instantiate_error,
         "Provided import's min is below import's min defined in module.");
 
@@ -235,7 +336,7 @@ TEST(instantiate, imported_memory_invalid)
         "Provided imported memory doesn't fit provided limits");
 
     // Allocated more than max
-    bytes memory_big(PageSize * 4, 0);
+    LinearMemory memory_big(PageSize * 4);
     EXPECT_THROW_MESSAGE(instantiate(module, {}, {}, {{&memory_big, {1, 3}}}), instantiate_error,
         "Provided imported memory doesn't fit provided limits");
 
@@ -502,9 +603,11 @@ TEST(instantiate, data_section)
     Module module;
     module.memorysec.emplace_back(Memory{{1, 1}});
     // Memory contents: 0, 0xaa, 0xff, 0, ...
-    module.datasec.emplace_back(Data{{ConstantExpression::Kind::Constant, {1}}, {0xaa, 0xff}});
+    module.datasec.emplace_back(
+        Data{{ConstantExpression::Kind::Constant, {1}}, copy_to_module(module, "aaff"_bytes)});
     // Memory contents: 0, 0xaa, 0x55, 0x55, 0, ...
-    module.datasec.emplace_back(Data{{ConstantExpression::Kind::Constant, {2}}, {0x55, 0x55}});
+    module.datasec.emplace_back(
+        Data{{ConstantExpression::Kind::Constant, {2}}, copy_to_module(module, "5555"_bytes)});
 
     auto instance = instantiate(module);
 
@@ -517,7 +620,8 @@ TEST(instantiate, data_section_offset_from_global)
     module.memorysec.emplace_back(Memory{{1, 1}});
     module.globalsec.emplace_back(Global{false, {ConstantExpression::Kind::Constant, {42}}});
     // Memory contents: 0, 0xaa, 0xff, 0, ...
-    module.datasec.emplace_back(Data{{ConstantExpression::Kind::GlobalGet, {0}}, {0xaa, 0xff}});
+    module.datasec.emplace_back(
+        Data{{ConstantExpression::Kind::GlobalGet, {0}}, copy_to_module(module, "aaff"_bytes)});
 
     auto instance = instantiate(module);
 
@@ -530,7 +634,8 @@ TEST(instantiate, data_section_offset_from_imported_global)
     module.importsec.emplace_back(Import{"mod", "g1", ExternalKind::Global, {false}});
     module.memorysec.emplace_back(Memory{{1, 1}});
     // Memory contents: 0, 0xaa, 0xff, 0, ...
-    module.datasec.emplace_back(Data{{ConstantExpression::Kind::GlobalGet, {0}}, {0xaa, 0xff}});
+    module.datasec.emplace_back(
+        Data{{ConstantExpression::Kind::GlobalGet, {0}}, copy_to_module(module, "aaff"_bytes)});
 
     uint64_t global_value = 42;
     ExternalGlobal g{&global_value, false};
@@ -546,7 +651,8 @@ TEST(instantiate, data_section_offset_from_mutable_global)
     module.memorysec.emplace_back(Memory{{1, 1}});
     module.globalsec.emplace_back(Global{true, {ConstantExpression::Kind::Constant, {42}}});
     // Memory contents: 0, 0xaa, 0xff, 0, ...
-    module.datasec.emplace_back(Data{{ConstantExpression::Kind::GlobalGet, {0}}, {0xaa, 0xff}});
+    module.datasec.emplace_back(
+        Data{{ConstantExpression::Kind::GlobalGet, {0}}, copy_to_module(module, "aaff"_bytes)});
 
     EXPECT_THROW_MESSAGE(instantiate(module), instantiate_error,
         "Constant expression can use global_get only for const globals.");
@@ -557,7 +663,8 @@ TEST(instantiate, data_section_offset_too_large)
     Module module;
     module.memorysec.emplace_back(Memory{{0, 1}});
     // Memory contents: 0, 0xaa, 0xff, 0, ...
-    module.datasec.emplace_back(Data{{ConstantExpression::Kind::Constant, {1}}, {0xaa, 0xff}});
+    module.datasec.emplace_back(
+        Data{{ConstantExpression::Kind::Constant, {1}}, copy_to_module(module, "aaff"_bytes)});
 
     EXPECT_THROW_MESSAGE(
         instantiate(module), instantiate_error, "Data segment is out of memory bounds");
@@ -570,16 +677,46 @@ TEST(instantiate, data_section_fills_imported_memory)
     imp.desc.memory = Memory{{1, 1}};
     module.importsec.emplace_back(imp);
     // Memory contents: 0, 0xaa, 0xff, 0, ...
-    module.datasec.emplace_back(Data{{ConstantExpression::Kind::Constant, {1}}, {0xaa, 0xff}});
+    module.datasec.emplace_back(
+        Data{{ConstantExpression::Kind::Constant, {1}}, copy_to_module(module, "aaff"_bytes)});
     // Memory contents: 0, 0xaa, 0x55, 0x55, 0, ...
-    module.datasec.emplace_back(Data{{ConstantExpression::Kind::Constant, {2}}, {0x55, 0x55}});
+    module.datasec.emplace_back(
+        Data{{ConstantExpression::Kind::Constant, {2}}, copy_to_module(module, "5555"_bytes)});
 
-    bytes memory(PageSize, 0);
+    LinearMemory memory(PageSize);
     auto instance = instantiate(module, {}, {}, {{&memory, {1, 1}}});
 
     EXPECT_EQ(memory.substr(0, 6), from_hex("00aa55550000"));
 }
 
+TEST(instantiate, data_section_referencing_input)
+{
+    /* wat2wasm
+    (memory 1)
+    (data (i32.const 1) "\aa\ff")
+    */
+    const auto wasm = from_hex("0061736d0100000005030100010b08010041010b02aaff");
+
+    auto instance = instantiate(parse_referencing(wasm));
+
+    EXPECT_EQ(instance.memory->substr(0, 4), "00aaff00"_bytes);
+}
+
+TEST(instantiate, module_built_by_hand_owns_names)
+{
+    // The module taken by instantiate() gets the copy of the buffers it does not own.
+    auto name = std::string{"memory"};
+    Module module;
+    module.memorysec.emplace_back(Memory{{1, 1}});
+    module.exportsec.emplace_back(Export{name, ExternalKind::Memory, 0});
+
+    auto instance = instantiate(module);
+    name.assign(name.size(), 'x');
+
+    EXPECT_TRUE(references_owned_data(*instance.module));
+    EXPECT_EQ(instance.module->exportsec[0].name, "memory");
+}
+
 TEST(instantiate, globals_single)
 {
     Module module;
@@ -660,6 +797,60 @@ TEST(instantiate, globals_initialized_from_imported)
         "Global can be initialized by another const global only if it's imported.");
 }
 
+TEST(instantiate, shared_module)
+{
+    /* wat2wasm
+    (memory 1)
+    (data (i32.const 0) "\2a")
+    (func (result i32) i32.const 0 i32.load8_u)
+    */
+    const auto wasm = from_hex(
+        "0061736d010000000105016000017f0302010005030100010a0901070041002d00000b0b07010041000b012a");
+    const auto module = std::make_shared<const Module>(parse(wasm));
+
+    auto instance1 = instantiate(module);
+    auto instance2 = instantiate(module);
+    EXPECT_EQ(instance1.module, module);
+    EXPECT_EQ(instance2.module, module);
+    EXPECT_EQ(module.use_count(), 3);
+
+    // The instances share the module, but not the memory.
+    (*instance1.memory)[0] = 1;
+    EXPECT_EQ(execute(instance1, 0, {}).stack, std::vector<uint64_t>{1});
+    EXPECT_EQ(execute(instance2, 0, {}).stack, std::vector<uint64_t>{42});
+}
+
+TEST(instantiate, shared_module_concurrently)
+{
+    /* wat2wasm
+    (memory 1)
+    (data (i32.const 0) "\2a")
+    (func (result i32) i32.const 0 i32.load8_u)
+    */
+    const auto wasm = from_hex(
+        "0061736d010000000105016000017f0302010005030100010a0901070041002d00000b0b07010041000b012a");
+    const auto module = std::make_shared<const Module>(parse(wasm));
+
+    std::vector<std::thread> threads;
+    std::vector<uint64_t> results(8);
+    for (auto& result : results)
+    {
+        threads.emplace_back([&module, &result] {
+            for (int i = 0; i < 10; ++i)
+            {
+                auto instance = instantiate(module);
+                result += execute(instance, 0, {}).stack.at(0);
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    for (const auto result : results)
+        EXPECT_EQ(result, 420);
+    EXPECT_EQ(module.use_count(), 1);
+}
+
 TEST(execute, start_unreachable)
 {
     Module module;
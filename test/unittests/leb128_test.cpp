@@ -2,6 +2,7 @@
 #include <gtest/gtest.h>
 #include <test/utils/asserts.hpp>
 #include <test/utils/hex.hpp>
+#include <random>
 
 using namespace fizzy;
 
@@ -20,6 +21,36 @@ inline auto leb128s_decode(bytes_view input)
 {
     return fizzy::leb128s_decode<T>(input.begin(), input.end());
 }
+
+/// Checks the decoding of the input gives the same result or error as the bytewise decoding.
+template <typename T>
+void expect_decode_as_bytewise(bytes_view input)
+{
+    const auto decode = [](const uint8_t* pos, const uint8_t* end) {
+        if constexpr (std::numeric_limits<T>::is_signed)
+            return fizzy::leb128s_decode<T>(pos, end);
+        else
+            return fizzy::leb128u_decode<T>(pos, end);
+    };
+    const auto decode_bytewise = [](const uint8_t* pos, const uint8_t* end) {
+        if constexpr (std::numeric_limits<T>::is_signed)
+            return leb128s_decode_bytewise<T>(pos, end);
+        else
+            return leb128u_decode_bytewise<T>(pos, end);
+    };
+
+    try
+    {
+        const auto expected = decode_bytewise(input.begin(), input.end());
+        const auto res = decode(input.begin(), input.end());
+        EXPECT_EQ(res.first, expected.first) << hex(input);
+        EXPECT_EQ(res.second, expected.second) << hex(input);
+    }
+    catch (const parser_error& e)
+    {
+        EXPECT_THROW_MESSAGE(decode(input.begin(), input.end()), parser_error, e.what());
+    }
+}
 }  // namespace
 
 TEST(leb128, decode_u64)
@@ -300,4 +331,48 @@ TEST(leb128, decode_s_out_of_buffer)
     EXPECT_THROW_MESSAGE(leb128s_decode<int16_t>(input.data(), input.data()), parser_error, m);
     EXPECT_THROW_MESSAGE(leb128s_decode<int16_t>(input.data(), input.data() + 1), parser_error, m);
     EXPECT_THROW_MESSAGE(leb128s_decode<int16_t>(input), parser_error, m);
-}
\ No newline at end of file
+}
+TEST(leb128, decode_word)
+{
+    // The input of at least 8 bytes is decoded from the single load,
+    // if the encoding is not longer.
+    const auto input = "e58ea68080800080"_bytes;
+    EXPECT_EQ(leb128_decode_word(input.data(), input.data() + input.size()),
+        (std::pair<uint64_t, int>{624485, 7}));
+    EXPECT_EQ(leb128_decode_word(input.data(), input.data() + input.size() - 1),
+        (std::pair<uint64_t, int>{0, 0}));
+
+    const auto max_size = "ffffffffffffff7f"_bytes;
+    EXPECT_EQ(leb128_decode_word(max_size.data(), max_size.data() + max_size.size()),
+        (std::pair<uint64_t, int>{0x00ffffffffffffff, 8}));
+
+    const auto too_long = "8080808080808080"_bytes + "00"_bytes;
+    EXPECT_EQ(leb128_decode_word(too_long.data(), too_long.data() + too_long.size()),
+        (std::pair<uint64_t, int>{0, 0}));
+}
+
+TEST(leb128, decode_as_bytewise)
+{
+    // The encodings of all sizes, including the too long ones, followed by the random bytes,
+    // so the input is decoded with and without leb128_decode_word().
+    std::mt19937_64 gen{0};
+    for (int i = 0; i < 4000; ++i)
+    {
+        const auto size = gen() % 12;
+        const auto padding = gen() % 10;
+        bytes input;
+        for (size_t j = 0; j < size + padding; ++j)
+            input.push_back(static_cast<uint8_t>(gen() | (j + 1 < size ? 0x80 : 0)));
+        if (size != 0)
+            input[size - 1] &= 0x7f;
+
+        expect_decode_as_bytewise<uint8_t>(input);
+        expect_decode_as_bytewise<uint16_t>(input);
+        expect_decode_as_bytewise<uint32_t>(input);
+        expect_decode_as_bytewise<uint64_t>(input);
+        expect_decode_as_bytewise<int8_t>(input);
+        expect_decode_as_bytewise<int16_t>(input);
+        expect_decode_as_bytewise<int32_t>(input);
+        expect_decode_as_bytewise<int64_t>(input);
+    }
+}
@@ -0,0 +1,374 @@
+#include "execute.hpp"
+#include "linear_memory.hpp"
+#include "parser.hpp"
+#include <gtest/gtest.h>
+#include <test/utils/hex.hpp>
+
+using namespace fizzy;
+
+namespace
+{
+constexpr Interpreter all_interpreters[] = {
+    Interpreter::stack, Interpreter::registers, Interpreter::jit, Interpreter::tiered};
+}  // namespace
+
+TEST(linear_memory, heap)
+{
+    LinearMemory memory(PageSize);
+    EXPECT_FALSE(memory.is_reserved());
+    EXPECT_FALSE(memory.is_guarded());
+    EXPECT_EQ(memory.region(), nullptr);
+    ASSERT_EQ(memory.size(), PageSize);
+    EXPECT_EQ(memory[PageSize - 1], 0);
+
+    memory[PageSize - 1] = 0xfe;
+    EXPECT_TRUE(memory.grow(2 * PageSize));
+    ASSERT_EQ(memory.size(), 2 * PageSize);
+    EXPECT_EQ(memory[PageSize - 1], 0xfe);
+    EXPECT_EQ(memory[PageSize], 0);
+
+    EXPECT_TRUE(memory.assign(from_hex("0102")));
+    EXPECT_EQ(memory.substr(0), from_hex("0102"));
+
+    const auto moved = std::move(memory);
+    EXPECT_EQ(moved.substr(0), from_hex("0102"));
+    EXPECT_TRUE(memory.empty());
+}
+
+#if FIZZY_RESERVED_MEMORY
+TEST(linear_memory, reserved)
+{
+    auto memory = LinearMemory::create_reserved(PageSize, 3 * PageSize);
+    ASSERT_TRUE(memory.has_value());
+    EXPECT_TRUE(memory->is_reserved());
+    EXPECT_FALSE(memory->is_guarded());
+    EXPECT_EQ(memory->region(), memory->data());
+    ASSERT_EQ(memory->size(), PageSize);
+    EXPECT_EQ((*memory)[PageSize - 1], 0);
+
+    // The memory grows in place.
+    const auto* const data = memory->data();
+    (*memory)[0] = 0xfe;
+    EXPECT_TRUE(memory->grow(2 * PageSize + 1));
+    EXPECT_EQ(memory->data(), data);
+    ASSERT_EQ(memory->size(), 2 * PageSize + 1);
+    EXPECT_EQ((*memory)[0], 0xfe);
+    EXPECT_EQ((*memory)[2 * PageSize], 0);
+
+    EXPECT_TRUE(memory->grow(3 * PageSize));
+    EXPECT_FALSE(memory->grow(3 * PageSize + 1));
+    EXPECT_EQ(memory->size(), 3 * PageSize);
+
+    // The memory shrinking into the middle of the page is zero-filled when it grows again.
+    (*memory)[3] = 0xfe;
+    (*memory)[2 * PageSize] = 0xfe;
+    EXPECT_TRUE(memory->assign(from_hex("010203")));
+    EXPECT_EQ(memory->substr(0), from_hex("010203"));
+    EXPECT_TRUE(memory->grow(3 * PageSize));
+    EXPECT_EQ(memory->substr(0, 4), from_hex("01020300"));
+    EXPECT_EQ((*memory)[2 * PageSize], 0);
+
+    EXPECT_FALSE(LinearMemory::create_reserved(0, 0).has_value());
+    EXPECT_FALSE(LinearMemory::create_reserved(2 * PageSize, PageSize).has_value());
+}
+
+TEST(linear_memory, instance_memory_reserved)
+{
+    /* wat2wasm
+    (memory 1 2)
+    */
+    const auto wasm = from_hex("0061736d01000000050401010102");
+    const auto instance = instantiate(parse(wasm));
+    ASSERT_NE(instance.memory, nullptr);
+    EXPECT_TRUE(instance.memory->is_reserved());
+    EXPECT_FALSE(instance.memory->is_guarded());
+    EXPECT_EQ(instance.memory->size(), PageSize);
+}
+#endif
+
+#if FIZZY_GUARDED_MEMORY
+TEST(linear_memory, guarded)
+{
+    auto memory = LinearMemory::create_guarded(PageSize);
+    ASSERT_TRUE(memory.has_value());
+    EXPECT_TRUE(memory->is_reserved());
+    EXPECT_TRUE(memory->is_guarded());
+    EXPECT_EQ(memory->region(), memory->data());
+    ASSERT_EQ(memory->size(), PageSize);
+    EXPECT_EQ((*memory)[PageSize - 1], 0);
+
+    (*memory)[0] = 0xfe;
+    EXPECT_TRUE(memory->grow(3 * PageSize));
+    ASSERT_EQ(memory->size(), 3 * PageSize);
+    EXPECT_EQ((*memory)[0], 0xfe);
+    EXPECT_EQ((*memory)[3 * PageSize - 1], 0);
+
+    // The guarded memory size must be a multiple of the page size and not exceed 4GiB.
+    EXPECT_FALSE(memory->grow(3 * PageSize + 1));
+    EXPECT_FALSE(memory->grow((size_t{1} << 32) + PageSize));
+    EXPECT_EQ(memory->size(), 3 * PageSize);
+
+    // The released pages are zero-filled when the memory grows again.
+    (*memory)[PageSize] = 0xfe;
+    EXPECT_TRUE(memory->assign(bytes(PageSize, 0x01)));
+    EXPECT_TRUE(memory->grow(2 * PageSize));
+    EXPECT_EQ((*memory)[PageSize - 1], 0x01);
+    EXPECT_EQ((*memory)[PageSize], 0);
+}
+#endif
+
+TEST(linear_memory, snapshot)
+{
+    std::vector<LinearMemory> memories;
+    memories.emplace_back(PageSize);
+    if (auto reserved = LinearMemory::create_reserved(PageSize, 2 * PageSize))
+        memories.emplace_back(std::move(*reserved));
+    if (auto guarded = LinearMemory::create_guarded(PageSize))
+        memories.emplace_back(std::move(*guarded));
+
+    for (auto& memory : memories)
+    {
+        memory[1] = 0xfe;
+        const auto snapshot = memory.snapshot();
+        EXPECT_EQ(snapshot.size(), PageSize);
+
+        for (int i = 0; i < 2; ++i)
+        {
+            // The writes not done by the wasm code must be marked.
+            memory[1] = 0x01;
+            memory[PageSize - 1] = 0x01;
+            memory.mark_dirty(1, 1);
+            memory.mark_dirty(PageSize - 1, 1);
+            ASSERT_TRUE(memory.grow(2 * PageSize));
+            memory[PageSize] = 0x01;
+
+            ASSERT_TRUE(memory.restore(snapshot));
+            ASSERT_EQ(memory.size(), PageSize);
+            EXPECT_EQ(memory[1], 0xfe);
+            EXPECT_EQ(memory[PageSize - 1], 0);
+
+            // The memory grown again is zero-filled.
+            ASSERT_TRUE(memory.grow(2 * PageSize));
+            EXPECT_EQ(memory[PageSize], 0);
+            ASSERT_TRUE(memory.restore(snapshot));
+        }
+
+        // The unmarked write is not restored.
+        memory[2] = 0x01;
+        ASSERT_TRUE(memory.restore(snapshot));
+        EXPECT_EQ(memory[2], 0x01);
+
+        // The memory shrunk and grown back is restored.
+        ASSERT_TRUE(memory.assign({}));
+        ASSERT_TRUE(memory.grow(PageSize));
+        ASSERT_TRUE(memory.restore(snapshot));
+        EXPECT_EQ(memory[1], 0xfe);
+        EXPECT_EQ(memory[2], 0);
+    }
+
+    // The snapshot can be restored to other memory.
+    auto other = LinearMemory::create_reserved(0, PageSize);
+    if (other)
+    {
+        ASSERT_TRUE(other->restore(memories.back().snapshot()));
+        ASSERT_EQ(other->size(), PageSize);
+        EXPECT_EQ((*other)[1], 0xfe);
+    }
+    LinearMemory heap_memory;
+    ASSERT_TRUE(heap_memory.restore(memories.back().snapshot()));
+    ASSERT_EQ(heap_memory.size(), PageSize);
+    EXPECT_EQ(heap_memory[1], 0xfe);
+}
+
+TEST(linear_memory, guarded_memory_access)
+{
+    /* wat2wasm
+    (memory 1)
+    (func (param i32) (result i32)
+      local.get 0
+      i32.const 0x12345678
+      i32.store
+      local.get 0
+      i32.load8_u offset=1
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f0302010005030100010a14011200200041f8acd19101360200200"
+        "02d00010b");
+
+    for (const auto interpreter : all_interpreters)
+    {
+        auto instance = instantiate(parse(wasm));
+        (*instance.memory)[7] = 0xfe;
+        if (!enable_guarded_memory(instance))
+            return;  // Not available on this platform.
+        set_interpreter(instance, interpreter);
+        ASSERT_TRUE(instance.memory->is_guarded());
+        EXPECT_EQ((*instance.memory)[7], 0xfe);
+
+        const auto [trap, ret] = execute(instance, 0, {100});
+        ASSERT_FALSE(trap);
+        ASSERT_EQ(ret.size(), 1);
+        EXPECT_EQ(ret[0], 0x56);
+
+        EXPECT_FALSE(execute(instance, 0, {65532}).trapped);
+        EXPECT_TRUE(execute(instance, 0, {65533}).trapped);
+        EXPECT_TRUE(execute(instance, 0, {0xffffffff}).trapped);
+
+        // The instance is usable after the trap.
+        EXPECT_EQ(execute(instance, 0, {0}).stack, std::vector<uint64_t>{0x56});
+    }
+}
+
+TEST(linear_memory, guarded_memory_grow)
+{
+    /* wat2wasm
+    (memory 1 2)
+    (func (param i32) (result i32)
+      local.get 0
+      memory.grow
+      drop
+      i32.const 65536
+      i32.const 42
+      i32.store
+      i32.const 65536
+      i32.load
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f030201000504010101020a19011700200040001a41808004412a3602"
+        "00418080042802000b");
+
+    for (const auto interpreter : all_interpreters)
+    {
+        auto instance = instantiate(parse(wasm));
+        if (!enable_guarded_memory(instance))
+            return;  // Not available on this platform.
+        set_interpreter(instance, interpreter);
+
+        EXPECT_TRUE(execute(instance, 0, {0}).trapped);
+        // Growing over the maximum fails.
+        EXPECT_TRUE(execute(instance, 0, {2}).trapped);
+
+        const auto [trap, ret] = execute(instance, 0, {1});
+        ASSERT_FALSE(trap);
+        ASSERT_EQ(ret.size(), 1);
+        EXPECT_EQ(ret[0], 42);
+        EXPECT_EQ(instance.memory->size(), 2 * PageSize);
+    }
+}
+
+TEST(linear_memory, guarded_memory_trap_in_imported_function)
+{
+    /* wat2wasm
+    (import "env" "f" (func $f (result i32)))
+    (memory 1 2)
+    (func (param i32) (result i32)
+      local.get 0
+      i32.load
+    )
+    (func (result i32)
+      call $f
+      i32.const 0
+      i32.load
+      i32.add
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d01000000010a026000017f60017f017f02090103656e760166000003030201000504010101020a14"
+        "02070020002802000b0a00100041002802006a0b");
+
+    // The trap of the nested execution does not affect the calling function.
+    const auto trapping_fn = [](Instance& instance, std::vector<uint64_t>) -> execution_result {
+        return {false, {execute(instance, 1, {65536}).trapped ? 1u : 0u}};
+    };
+
+    for (const auto interpreter : all_interpreters)
+    {
+        auto instance = instantiate(parse(wasm), {trapping_fn});
+        if (!enable_guarded_memory(instance))
+            return;  // Not available on this platform.
+        set_interpreter(instance, interpreter);
+
+        const auto [trap, ret] = execute(instance, 2, {});
+        ASSERT_FALSE(trap);
+        ASSERT_EQ(ret.size(), 1);
+        EXPECT_EQ(ret[0], 1);
+    }
+}
+
+TEST(linear_memory, guarded_memory_trap_in_nested_call)
+{
+    /* wat2wasm
+    (memory 1)
+    (func $load (param i32) (result i32)
+      local.get 0
+      i32.load
+    )
+    (func $nested (param i32 i32) (result i32)
+      local.get 0
+      i32.eqz
+      (if (result i32)
+        (then local.get 1 call $load)
+        (else
+          local.get 0
+          i32.const 1
+          i32.sub
+          local.get 1
+          call $nested
+          i32.const 1
+          i32.add
+        )
+      )
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d01000000010c0260017f017f60027f7f017f030302000105030100010a2302070020002802000b19"
+        "00200045047f2001100005200041016b2001100141016a0b0b");
+
+    for (const auto interpreter : all_interpreters)
+    {
+        auto instance = instantiate(parse(wasm));
+        if (!enable_guarded_memory(instance))
+            return;  // Not available on this platform.
+        set_interpreter(instance, interpreter);
+
+        EXPECT_EQ(execute(instance, 1, {10, 0}).stack, std::vector<uint64_t>{10});
+
+        // The fault in the innermost call returns to execute(), which drops the frames
+        // of all the calls.
+        EXPECT_TRUE(execute(instance, 1, {10, 65533}).trapped);
+        EXPECT_TRUE(instance.value_stack.empty());
+
+        const uint64_t trapping_args[] = {10, 65533};
+        uint64_t result = 0;
+        EXPECT_EQ(execute(instance, 1, {trapping_args, 2}, {&result, 1}), ExecutionStatus::trapped);
+        EXPECT_TRUE(instance.value_stack.empty());
+
+        const uint64_t args[] = {10, 0};
+        EXPECT_EQ(execute(instance, 1, {args, 2}, {&result, 1}), ExecutionStatus::success);
+        EXPECT_EQ(result, 10);
+    }
+}
+
+TEST(linear_memory, enable_guarded_memory_unavailable)
+{
+    /* wat2wasm
+    (func)
+    */
+    const auto wasm_no_memory = from_hex("0061736d01000000010401600000030201000a040102000b");
+    auto instance = instantiate(parse(wasm_no_memory));
+    EXPECT_FALSE(enable_guarded_memory(instance));
+
+    /* wat2wasm
+    (import "env" "m" (memory 1))
+    (func)
+    */
+    const auto wasm_imported_memory = from_hex(
+        "0061736d01000000010401600000020a0103656e76016d020001030201000a040102000b");
+    LinearMemory memory(PageSize);
+    instance = instantiate(parse(wasm_imported_memory), {}, {}, {{&memory, {1, std::nullopt}}});
+    EXPECT_FALSE(enable_guarded_memory(instance));
+    EXPECT_FALSE(memory.is_guarded());
+    EXPECT_EQ(instance.memory.get(), &memory);
+}
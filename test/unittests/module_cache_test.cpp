@@ -0,0 +1,267 @@
+#include "execute.hpp"
+#include "module_cache.hpp"
+#include "parser.hpp"
+#include <gtest/gtest.h>
+#include <test/utils/hex.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+using namespace fizzy;
+
+namespace
+{
+/* wat2wasm
+(type $t0 (func (param i32) (result i32)))
+(import "env" "f" (func $f (type $t0)))
+(import "env" "g" (global i32))
+(table 2 funcref)
+(memory 1 2)
+(global $g1 (mut i32) (i32.const 5))
+(export "f" (func 1))
+(export "m" (memory 0))
+(start 2)
+(elem (i32.const 0) 1)
+(data (i32.const 0) "\2a")
+(func (type $t0)
+  local.get 0
+  (block (result i32) i32.const 1 br 0)
+  i32.add
+  global.get $g1
+  i32.add
+  call $f
+)
+(func i32.const 7 global.set $g1)
+*/
+const auto wasm = from_hex(
+    "0061736d0100000001090260017f017f60000002120203656e760166000003656e760167037f000303020001040401"
+    "7000020504010101020606017f0141050b07090201660001016d02000801020907010041000b01010a1a02110020"
+    "00027f41010c000b6a23016a10000b0600410724010b0b07010041000b012a");
+
+uint64_t execute_module(Module module)
+{
+    const auto double_fn = [](Instance&, std::vector<uint64_t> args) -> execution_result {
+        return {false, {args[0] * 2}};
+    };
+    uint64_t g0 = 0;
+    auto instance = instantiate(std::move(module), {double_fn}, {}, {}, {ExternalGlobal{&g0}});
+    const auto result = execute(instance, 1, {10});
+    EXPECT_FALSE(result.trapped);
+    EXPECT_EQ(result.stack.size(), 1);
+    return result.stack.empty() ? 0 : result.stack[0];
+}
+
+/// The 64-bit FNV-1a hash of the serialized module, stored in the cache file.
+bytes module_hash(bytes_view serialized)
+{
+    uint64_t h = 0xcbf29ce484222325;
+    for (const auto byte : serialized)
+        h = (h ^ byte) * 0x100000001b3;
+    return {reinterpret_cast<const uint8_t*>(&h), sizeof(h)};
+}
+
+bytes read_file(const std::filesystem::path& path)
+{
+    std::ifstream file{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+void write_file(const std::filesystem::path& path, bytes_view content)
+{
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char*>(content.data()),
+        static_cast<std::streamsize>(content.size()));
+}
+
+/// The cache directory removed at the end of the test.
+class TempDirectory
+{
+    std::filesystem::path m_path;
+
+public:
+    TempDirectory()
+      : m_path{std::filesystem::temp_directory_path() /
+               ("fizzy-module-cache-" + std::to_string(std::random_device{}()))}
+    {
+        std::filesystem::remove_all(m_path);
+        std::filesystem::create_directory(m_path);
+    }
+
+    ~TempDirectory() { std::filesystem::remove_all(m_path); }
+
+    const std::filesystem::path& path() const noexcept { return m_path; }
+};
+}  // namespace
+
+TEST(module_cache, serialize_roundtrip)
+{
+    const auto module = parse(wasm);
+    const auto serialized = serialize_module(module);
+    const auto loaded = deserialize_module(serialized);
+
+    ASSERT_EQ(loaded.typesec.size(), 2);
+    EXPECT_EQ(loaded.typesec[0].inputs, std::vector{ValType::i32});
+    EXPECT_EQ(loaded.typesec[0].outputs, std::vector{ValType::i32});
+    EXPECT_TRUE(loaded.typesec[1].inputs.empty());
+    EXPECT_TRUE(loaded.typesec[1].outputs.empty());
+    ASSERT_EQ(loaded.importsec.size(), 2);
+    EXPECT_EQ(loaded.importsec[0].module, "env");
+    EXPECT_EQ(loaded.importsec[0].name, "f");
+    EXPECT_EQ(loaded.importsec[0].kind, ExternalKind::Function);
+    EXPECT_EQ(loaded.importsec[0].desc.function_type_index, 0);
+    EXPECT_EQ(loaded.importsec[1].name, "g");
+    EXPECT_EQ(loaded.importsec[1].kind, ExternalKind::Global);
+    EXPECT_FALSE(loaded.importsec[1].desc.global.is_mutable);
+    EXPECT_EQ(loaded.funcsec, (std::vector<TypeIdx>{0, 1}));
+    ASSERT_EQ(loaded.tablesec.size(), 1);
+    EXPECT_EQ(loaded.tablesec[0].limits.min, 2);
+    EXPECT_FALSE(loaded.tablesec[0].limits.max.has_value());
+    ASSERT_EQ(loaded.memorysec.size(), 1);
+    EXPECT_EQ(loaded.memorysec[0].limits.min, 1);
+    EXPECT_EQ(loaded.memorysec[0].limits.max, 2);
+    ASSERT_EQ(loaded.globalsec.size(), 1);
+    EXPECT_TRUE(loaded.globalsec[0].is_mutable);
+    EXPECT_EQ(loaded.globalsec[0].expression.kind, ConstantExpression::Kind::Constant);
+    EXPECT_EQ(loaded.globalsec[0].expression.value.constant, 5);
+    ASSERT_EQ(loaded.exportsec.size(), 2);
+    EXPECT_EQ(loaded.exportsec[1].name, "m");
+    EXPECT_EQ(loaded.exportsec[1].kind, ExternalKind::Memory);
+    EXPECT_EQ(loaded.startfunc, 2);
+    ASSERT_EQ(loaded.elementsec.size(), 1);
+    EXPECT_EQ(loaded.elementsec[0].init, std::vector<FuncIdx>{1});
+    ASSERT_EQ(loaded.codesec.size(), module.codesec.size());
+    for (size_t i = 0; i < module.codesec.size(); ++i)
+    {
+        EXPECT_EQ(loaded.codesec[i].local_count, module.codesec[i].local_count);
+        EXPECT_EQ(loaded.codesec[i].max_stack_height, module.codesec[i].max_stack_height);
+        EXPECT_EQ(loaded.codesec[i].instructions, module.codesec[i].instructions);
+        EXPECT_EQ(loaded.codesec[i].immediates, module.codesec[i].immediates);
+    }
+    ASSERT_EQ(loaded.datasec.size(), 1);
+    EXPECT_EQ(loaded.datasec[0].init, bytes{0x2a});
+    EXPECT_EQ(loaded.imported_function_types, std::vector<TypeIdx>{0});
+    ASSERT_EQ(loaded.imported_global_types.size(), 1);
+    EXPECT_FALSE(loaded.imported_global_types[0].is_mutable);
+    EXPECT_EQ(loaded.imported_global_types[0].value_type, ValType::i32);
+    EXPECT_FALSE(loaded.validated);
+
+    EXPECT_EQ(serialize_module(loaded), serialized);
+    EXPECT_EQ(execute_module(std::move(loaded)), 36);
+}
+
+TEST(module_cache, deserialize_invalid)
+{
+    const auto serialized = serialize_module(parse(wasm));
+
+    EXPECT_THROW(deserialize_module({}), parser_error);
+    EXPECT_THROW(deserialize_module(wasm), parser_error);
+
+    auto other_version = serialized;
+    other_version[4] ^= 0xff;
+    EXPECT_THROW(deserialize_module(other_version), parser_error);
+
+    for (size_t size = 0; size < serialized.size(); ++size)
+        EXPECT_THROW(deserialize_module(bytes_view{serialized}.substr(0, size)), parser_error);
+
+    EXPECT_THROW(deserialize_module(serialized + bytes{0}), parser_error);
+}
+
+TEST(module_cache, deserialize_invalid_values)
+{
+    const auto expect_error = [](const Module& module, ErrorCode code, int64_t value) {
+        try
+        {
+            deserialize_module(serialize_module(module));
+            ADD_FAILURE() << "parser_error expected";
+        }
+        catch (const parser_error& e)
+        {
+            EXPECT_EQ(e.error().code, code);
+            EXPECT_EQ(e.error().value, value);
+        }
+    };
+
+    Module invalid_valtype;
+    invalid_valtype.typesec.push_back({{ValType::i32, static_cast<ValType>(0x7d)}, {}});
+    expect_error(invalid_valtype, ErrorCode::invalid_serialized_value, 0x7d);
+
+    Module invalid_export_kind;
+    invalid_export_kind.exportsec.push_back({"f", static_cast<ExternalKind>(4), 0});
+    expect_error(invalid_export_kind, ErrorCode::invalid_serialized_value, 4);
+
+    Module invalid_expression_kind;
+    invalid_expression_kind.globalsec.push_back({});
+    invalid_expression_kind.globalsec[0].value_type = ValType::i32;
+    invalid_expression_kind.globalsec[0].expression.kind =
+        static_cast<ConstantExpression::Kind>(2);
+    expect_error(invalid_expression_kind, ErrorCode::invalid_serialized_value, 2);
+
+    Module valid_code;
+    valid_code.codesec.emplace_back();
+    valid_code.codesec[0].instructions = {Instr::local_get_local_get, Instr::i32_wrap_i64,
+        Instr::i64_extend_i32_u, Instr::end};
+    EXPECT_EQ(deserialize_module(serialize_module(valid_code)).codesec[0].instructions,
+        valid_code.codesec[0].instructions);
+
+    for (const auto instr : {Instr::f32_add, Instr::f64_load, static_cast<Instr>(0x06),
+             static_cast<Instr>(0xc0), static_cast<Instr>(0xe8)})
+    {
+        Module invalid_code;
+        invalid_code.codesec.emplace_back();
+        invalid_code.codesec[0].instructions = {Instr::nop, instr, Instr::end};
+        expect_error(invalid_code, ErrorCode::invalid_serialized_instruction,
+            static_cast<uint8_t>(instr));
+    }
+
+    // The invalid bool.
+    auto serialized = serialize_module(parse(wasm));
+    ASSERT_EQ(serialized.back(), uint8_t{0x7f});  // The type of the imported global.
+    serialized[serialized.size() - 2] = 2;          // Its mutability.
+    EXPECT_THROW(deserialize_module(serialized), parser_error);
+}
+
+TEST(module_cache, parse_cached)
+{
+    const TempDirectory dir;
+    const auto path = module_cache_path(wasm, dir.path().string());
+    EXPECT_EQ(std::filesystem::path{path}.parent_path(), dir.path());
+    EXPECT_NE(module_cache_path(bytes{wasm} + bytes{0}, dir.path().string()), path);
+    ASSERT_FALSE(std::filesystem::exists(path));
+
+    // Miss: the module is parsed and stored.
+    EXPECT_EQ(execute_module(parse_cached(wasm, dir.path().string())), 36);
+    ASSERT_TRUE(std::filesystem::exists(path));
+    const auto cached = read_file(path);
+    EXPECT_EQ(std::distance(std::filesystem::directory_iterator{dir.path()},
+                  std::filesystem::directory_iterator{}),
+        1);
+
+    // Hit: the module is loaded from the file. The file holding a different module for the same
+    // binary proves the binary is not parsed: without the start function the global stays 5.
+    auto patched = parse(wasm);
+    patched.startfunc.reset();
+    const auto serialized_patched = serialize_module(patched);
+    const auto wasm_prefix = cached.substr(0, sizeof(uint64_t) + wasm.size());
+    write_file(path, wasm_prefix + module_hash(serialized_patched) + serialized_patched);
+    EXPECT_EQ(execute_module(parse_cached(wasm, dir.path().string())), 32);
+
+    // The file holding the module not matching its hash is replaced.
+    const auto cached_hash = cached.substr(wasm_prefix.size(), sizeof(uint64_t));
+    write_file(path, wasm_prefix + cached_hash + serialized_patched);
+    EXPECT_EQ(execute_module(parse_cached(wasm, dir.path().string())), 36);
+    EXPECT_EQ(read_file(path), cached);
+
+    // The damaged file is replaced.
+    write_file(path, bytes_view{cached}.substr(0, cached.size() - 1));
+    EXPECT_EQ(execute_module(parse_cached(wasm, dir.path().string())), 36);
+    EXPECT_EQ(read_file(path), cached);
+
+    // The invalid binary is not cached.
+    EXPECT_THROW(parse_cached(from_hex("0061736d01000000ff"), dir.path().string()), parser_error);
+    EXPECT_FALSE(std::filesystem::exists(module_cache_path(from_hex("0061736d01000000ff"),
+        dir.path().string())));
+
+    // The cache not accessible is ignored.
+    EXPECT_EQ(execute_module(parse_cached(wasm, (dir.path() / "missing").string())), 36);
+}
@@ -7,9 +7,21 @@ using namespace fizzy;
 
 namespace
 {
-inline auto parse_expr(const bytes& input)
+/// Returns the module with the single function of the given type, a table and a memory.
+Module make_module(FuncType func_type = {})
 {
-    return fizzy::parse_expr(input.data(), input.data() + input.size());
+    Module module;
+    module.typesec.emplace_back(std::move(func_type));
+    module.funcsec.emplace_back(TypeIdx{0});
+    module.tablesec.emplace_back(Table{{0, std::nullopt}});
+    module.memorysec.emplace_back(Memory{{0, std::nullopt}});
+    return module;
+}
+
+inline auto parse_expr(const bytes& input, const std::vector<Locals>& locals = {},
+    const Module& module = make_module())
+{
+    return fizzy::parse_expr(input.data(), input.data() + input.size(), 0, locals, module);
 }
 }  // namespace
 
@@ -20,16 +32,52 @@ TEST(parser, instr_loop)
     EXPECT_EQ(code1.instructions, (std::vector{Instr::loop, Instr::end, Instr::end}));
     EXPECT_EQ(code1.immediates.size(), 0);
 
+    const auto loop_i32 = "037f41000b1a0b"_bytes;
+    const auto [code2, pos2] = parse_expr(loop_i32);
+    EXPECT_EQ(code2.instructions,
+        (std::vector{Instr::loop, Instr::i32_const, Instr::end, Instr::drop, Instr::end}));
+    EXPECT_EQ(code2.immediates.size(), 4);
+
     const auto loop_i32_empty = "037f0b0b"_bytes;
-    const auto [code2, pos2] = parse_expr(loop_i32_empty);
-    EXPECT_EQ(code2.instructions, (std::vector{Instr::loop, Instr::end, Instr::end}));
-    EXPECT_EQ(code2.immediates.size(), 0);
+    EXPECT_THROW_MESSAGE(parse_expr(loop_i32_empty), parser_error, "stack underflow");
 
     const auto loop_f32_empty = "037d0b0b"_bytes;
     EXPECT_THROW_MESSAGE(
         parse_expr(loop_f32_empty), parser_error, "unsupported valtype (floating point)");
 }
 
+TEST(parser, fuse_instructions)
+{
+    // local.get 0
+    // i32.const 1
+    // i32.add
+    // local.set 0
+    // local.get 0
+    // local.get 0
+    // local.get 0
+    // i32.const 2
+    // i32.sub
+    // drop
+    // drop
+    // i32.const 3
+    // i32.add
+    const auto [code, pos] = parse_expr("200041016a21002000200020004102"
+                                        "6b1a1a41036a0b"_bytes,
+        {{1, ValType::i32}}, make_module({{}, {ValType::i32}}));
+    auto fused = code;
+    fuse_instructions(fused);
+    EXPECT_EQ(fused.instructions,
+        (std::vector{Instr::local_get_i32_const_i32_add, Instr::i32_const, Instr::i32_add,
+            Instr::local_set_local_get, Instr::local_get, Instr::local_get_local_get,
+            Instr::local_get, Instr::i32_const, Instr::i32_sub, Instr::drop, Instr::drop,
+            Instr::i32_const_i32_add, Instr::i32_add, Instr::end}));
+    EXPECT_EQ(fused.immediates, code.immediates);
+    EXPECT_EQ(fused.max_stack_height, code.max_stack_height);
+
+    for (size_t i = 0; i < code.instructions.size(); ++i)
+        EXPECT_EQ(unfused_instruction(fused.instructions[i]), code.instructions[i]);
+}
+
 TEST(parser, instr_loop_input_buffer_overflow)
 {
     // The function end opcode 0b is missing causing reading out of input buffer.
@@ -46,18 +94,16 @@ TEST(parser, instr_block)
     const auto [code1, pos1] = parse_expr(empty);
     EXPECT_EQ(code1.instructions,
         (std::vector{Instr::nop, Instr::nop, Instr::block, Instr::end, Instr::end}));
-    EXPECT_EQ(code1.immediates,
-        "00"
-        "04000000"
-        "09000000"_bytes);
+    EXPECT_TRUE(code1.immediates.empty());
 
-    const auto block_i64 = "027e0b0b"_bytes;
+    const auto block_i64 = "027e42000b1a0b"_bytes;
     const auto [code2, pos2] = parse_expr(block_i64);
-    EXPECT_EQ(code2.instructions, (std::vector{Instr::block, Instr::end, Instr::end}));
-    EXPECT_EQ(code2.immediates,
-        "01"
-        "02000000"
-        "09000000"_bytes);
+    EXPECT_EQ(code2.instructions,
+        (std::vector{Instr::block, Instr::i64_const, Instr::end, Instr::drop, Instr::end}));
+    EXPECT_EQ(code2.immediates.size(), 8);
+
+    const auto block_i64_empty = "027e0b0b"_bytes;
+    EXPECT_THROW_MESSAGE(parse_expr(block_i64_empty), parser_error, "stack underflow");
 
     const auto block_f64_empty = "027c0b0b"_bytes;
     EXPECT_THROW_MESSAGE(
@@ -85,22 +131,109 @@ TEST(parser, block_br)
     // end
 
     const auto code_bin = "010240410a21010c00410b21010b20010b"_bytes;
-    const auto [code, pos] = parse_expr(code_bin);
+    const auto [code, pos] =
+        parse_expr(code_bin, {{2, ValType::i32}}, make_module({{}, {ValType::i32}}));
     EXPECT_EQ(code.instructions,
         (std::vector{Instr::nop, Instr::block, Instr::i32_const, Instr::local_set, Instr::br,
             Instr::i32_const, Instr::local_set, Instr::end, Instr::local_get, Instr::end}));
     EXPECT_EQ(code.immediates,
-        "00"
-        "08000000"
-        "1d000000"
         "0a000000"
         "01000000"
-        "00000000"
+        "08000000"  // br target: the instruction after the block's end
+        "20000000"  // br target: the immediates of the instruction after the block's end
+        "00000000"  // br stack drop
+        "00000000"  // br arity
         "0b000000"
         "01000000"
         "01000000"_bytes);
 }
 
+TEST(parser, block_br_stack_drop)
+{
+    // block (result i32)
+    //   i32.const 1
+    //   i32.const 2
+    //   i32.const 3
+    //   br 0
+    // end
+    // drop
+    // end
+
+    const auto code_bin = "027f4101410241030c000b1a0b"_bytes;
+    const auto [code, pos] = parse_expr(code_bin);
+    EXPECT_EQ(code.instructions,
+        (std::vector{Instr::block, Instr::i32_const, Instr::i32_const, Instr::i32_const, Instr::br,
+            Instr::end, Instr::drop, Instr::end}));
+    EXPECT_EQ(code.immediates,
+        "01000000"
+        "02000000"
+        "03000000"
+        "06000000"  // br target: the instruction after the block's end
+        "1c000000"  // br target: the immediates of the instruction after the block's end
+        "02000000"  // br stack drop
+        "01000000"_bytes);  // br arity
+}
+
+TEST(parser, if_else_jump_targets)
+{
+    // i32.const 0
+    // if
+    //   nop
+    // else
+    //   nop
+    // end
+    // end
+
+    const auto code_bin = "410004400105010b0b"_bytes;
+    const auto [code, pos] = parse_expr(code_bin);
+    EXPECT_EQ(code.instructions, (std::vector{Instr::i32_const, Instr::if_, Instr::nop,
+                                     Instr::else_, Instr::nop, Instr::end, Instr::end}));
+    EXPECT_EQ(code.immediates,
+        "00000000"
+        "04000000"  // if false target: the instruction after else
+        "14000000"  // if false target: the immediates after else
+        "06000000"  // else target: the instruction after end
+        "14000000"_bytes);  // else target: the immediates after end
+}
+
+TEST(parser, max_stack_height)
+{
+    const auto [code1, pos1] = parse_expr("0b"_bytes);
+    EXPECT_EQ(code1.max_stack_height, 0);
+
+    // i32.const 1
+    // i32.const 2
+    // i32.add
+    // drop
+    // end
+    const auto [code2, pos2] = parse_expr("410141026a1a0b"_bytes);
+    EXPECT_EQ(code2.max_stack_height, 2);
+
+    // block (result i32)
+    //   i32.const 1
+    //   i32.const 2
+    //   i32.const 3
+    //   br 0
+    // end
+    // drop
+    // end
+    const auto [code3, pos3] = parse_expr("027f4101410241030c000b1a0b"_bytes);
+    EXPECT_EQ(code3.max_stack_height, 3);
+
+    // The operand stack in unreachable code is polymorphic.
+    // unreachable
+    // i32.add
+    // drop
+    // end
+    const auto [code4, pos4] = parse_expr("006a1a0b"_bytes);
+    EXPECT_EQ(code4.max_stack_height, 1);
+}
+
+TEST(parser, br_invalid_label_index)
+{
+    EXPECT_THROW_MESSAGE(parse_expr("0c010b"_bytes), parser_error, "invalid label index 1");
+}
+
 TEST(parser, instr_br_table)
 {
     /*
@@ -128,7 +261,8 @@ TEST(parser, instr_br_table)
         "000f0b41e4000f0b41e5000f0b41e6000f0b41e7000f0b41e8000b000c04"
         "6e616d6502050100010000"_bytes;
 
-    const auto [code, pos] = parse_expr(code_bin);
+    const auto [code, pos] =
+        parse_expr(code_bin, {{1, ValType::i32}}, make_module({{}, {ValType::i32}}));
 
     EXPECT_EQ(code.instructions,
         (std::vector{Instr::block, Instr::block, Instr::block, Instr::block, Instr::block,
@@ -137,15 +271,30 @@ TEST(parser, instr_br_table)
             Instr::end, Instr::i32_const, Instr::return_, Instr::end, Instr::i32_const,
             Instr::return_, Instr::end, Instr::i32_const, Instr::end}));
 
-    // 5 blocks + 1 local_get before br_table
-    const auto br_table_imm_offset = 5 * (1 + 2 * 4) + 4;
+    // local_get before br_table
+    const auto br_table_imm_offset = 4;
     const auto expected_br_imm =
-        "04000000"
-        "03000000"
-        "02000000"
-        "01000000"
+        "04000000"  // the number of labels without the default one
+        "13000000"  // label 3: the instruction after the 2nd block's end
+        "68000000"
+        "00000000"
+        "00000000"
+        "10000000"  // label 2: the instruction after the 3rd block's end
+        "64000000"
         "00000000"
-        "04000000"_bytes;
+        "00000000"
+        "0d000000"  // label 1: the instruction after the 4th block's end
+        "60000000"
+        "00000000"
+        "00000000"
+        "0a000000"  // label 0: the instruction after the 5th block's end
+        "5c000000"
+        "00000000"
+        "00000000"
+        "16000000"  // default label 4: the instruction after the 1st block's end
+        "6c000000"
+        "00000000"
+        "00000000"_bytes;
     EXPECT_EQ(code.immediates.substr(br_table_imm_offset, expected_br_imm.size()), expected_br_imm);
 }
 
@@ -161,15 +310,19 @@ TEST(parser, instr_br_table_empty_vector)
 
     const auto code_bin = "024020000e000041e3000f0b41e4000b000c046e616d6502050100010000"_bytes;
 
-    const auto [code, pos] = parse_expr(code_bin);
+    const auto [code, pos] =
+        parse_expr(code_bin, {{1, ValType::i32}}, make_module({{}, {ValType::i32}}));
 
     EXPECT_EQ(code.instructions,
         (std::vector{Instr::block, Instr::local_get, Instr::br_table, Instr::i32_const,
             Instr::return_, Instr::end, Instr::i32_const, Instr::end}));
 
-    // blocks + local_get before br_table
-    const auto br_table_imm_offset = 1 + 2 * 4 + 4;
+    // local_get before br_table
+    const auto br_table_imm_offset = 4;
     const auto expected_br_imm =
+        "00000000"  // the number of labels without the default one
+        "06000000"  // default label 0: the instruction after the block's end
+        "1c000000"
         "00000000"
         "00000000"_bytes;
     EXPECT_EQ(code.immediates.substr(br_table_imm_offset, expected_br_imm.size()), expected_br_imm);
@@ -189,11 +342,11 @@ TEST(parser, unexpected_else)
 
 TEST(parser, call_indirect_table_index)
 {
-    const auto code1_bin = "1122000b"_bytes;
+    const auto code1_bin = "41001100000b"_bytes;
     const auto [code, pos] = parse_expr(code1_bin);
-    EXPECT_EQ(code.instructions, (std::vector{Instr::call_indirect, Instr::end}));
+    EXPECT_EQ(code.instructions, (std::vector{Instr::i32_const, Instr::call_indirect, Instr::end}));
 
-    const auto code2_bin = "1122010b"_bytes;
+    const auto code2_bin = "41001100010b"_bytes;
     EXPECT_THROW_MESSAGE(
         parse_expr(code2_bin), parser_error, "invalid tableidx encountered with call_indirect");
 }
@@ -252,3 +405,120 @@ TEST(parser, memory_grow_out_of_bounds)
         EXPECT_THROW_MESSAGE(parse_expr(code), parser_error, "Unexpected EOF");
     }
 }
+
+TEST(parser, validate_operand_types)
+{
+    // i64.const 0
+    // i32.const 0
+    // i32.add
+    EXPECT_THROW_MESSAGE(parse_expr("420041006a1a0b"_bytes), parser_error, "type mismatch");
+
+    // i32.add
+    EXPECT_THROW_MESSAGE(parse_expr("6a1a0b"_bytes), parser_error, "stack underflow");
+
+    // i32.const 0
+    EXPECT_THROW_MESSAGE(parse_expr("41000b"_bytes), parser_error, "too many results");
+
+    // i64.const 0 (in the function returning i32)
+    EXPECT_THROW_MESSAGE(parse_expr("42000b"_bytes, {}, make_module({{}, {ValType::i32}})),
+        parser_error, "type mismatch");
+
+    // i32.const 1
+    // i64.const 2
+    // i32.const 0
+    // select
+    EXPECT_THROW_MESSAGE(
+        parse_expr("4101420241001b1a0b"_bytes), parser_error, "type mismatch");
+
+    // i32.const 0
+    // if (result i32)
+    //   i32.const 1
+    // end
+    EXPECT_THROW_MESSAGE(parse_expr("4100047f41010b1a0b"_bytes), parser_error,
+        "missing result in if without else");
+
+    // block (result i32)
+    //   block
+    //     i32.const 0
+    //     i32.const 0
+    //     br_table 0 1
+    //   end
+    //   i32.const 0
+    // end
+    EXPECT_THROW_MESSAGE(parse_expr("027f0240410041000e0100010b41000b1a0b"_bytes), parser_error,
+        "br_table labels have inconsistent types");
+
+    // The br_if operand remains on the stack if not branching.
+    // block (result i64)
+    //   i64.const 1
+    //   i32.const 0
+    //   br_if 0
+    // end
+    // drop
+    const auto [code, pos] = parse_expr("027e420141000d000b1a0b"_bytes);
+    EXPECT_EQ(code.max_stack_height, 2);
+}
+
+TEST(parser, validate_locals)
+{
+    // local.get 0
+    EXPECT_THROW_MESSAGE(parse_expr("20001a0b"_bytes), parser_error, "invalid local index 0");
+
+    // The parameters are followed by the locals.
+    // local.get 0
+    // i64.eqz
+    // local.get 2
+    // i32.add
+    // local.set 1
+    const auto module = make_module({{ValType::i64, ValType::i32}, {}});
+    const auto locals = std::vector<Locals>{{0, ValType::i64}, {1, ValType::i32}};
+    parse_expr("20005020026a21010b"_bytes, locals, module);
+    EXPECT_THROW_MESSAGE(
+        parse_expr("20005020026a21000b"_bytes, locals, module), parser_error, "type mismatch");
+    EXPECT_THROW_MESSAGE(parse_expr("20005020026a21030b"_bytes, locals, module), parser_error,
+        "invalid local index 3");
+}
+
+TEST(parser, validate_globals)
+{
+    auto module = make_module();
+    module.imported_global_types.push_back({false, ValType::i64});
+    module.globalsec.push_back({true, {}, ValType::i32});
+
+    // global.get 0
+    // i64.eqz
+    // global.set 1
+    parse_expr("23005024010b"_bytes, {}, module);
+
+    EXPECT_THROW_MESSAGE(parse_expr("23005024000b"_bytes, {}, module), parser_error,
+        "trying to mutate immutable global 0");
+    EXPECT_THROW_MESSAGE(parse_expr("23025024010b"_bytes, {}, module), parser_error,
+        "invalid global index 2");
+}
+
+TEST(parser, validate_memory_and_table)
+{
+    Module module;
+    module.typesec.emplace_back();
+    module.funcsec.emplace_back(TypeIdx{0});
+
+    // i32.const 0
+    // i32.load
+    // drop
+    EXPECT_THROW_MESSAGE(parse_expr("41002802001a0b"_bytes, {}, module),
+        parser_error, "memory instructions require imported or defined memory");
+    // memory.size
+    EXPECT_THROW_MESSAGE(parse_expr("3f001a0b"_bytes, {}, module), parser_error,
+        "memory instructions require imported or defined memory");
+    // i32.const 0
+    // call_indirect 0
+    EXPECT_THROW_MESSAGE(parse_expr("41001100000b"_bytes, {}, module), parser_error,
+        "call_indirect instruction without defined table");
+
+    // i32.const 0
+    // i32.load align=8
+    // drop
+    EXPECT_THROW_MESSAGE(parse_expr("41002803001a0b"_bytes), parser_error,
+        "alignment cannot exceed operand size");
+    parse_expr("41002902001a0b"_bytes);
+}
@@ -1,8 +1,10 @@
+#include "module_cache.hpp"
 #include "parser.hpp"
 #include <gtest/gtest.h>
 #include <test/utils/asserts.hpp>
 #include <test/utils/hex.hpp>
 #include <array>
+#include <thread>
 
 using namespace fizzy;
 
@@ -37,6 +39,27 @@ bytes make_invalid_size_section(uint8_t id, size_t size, const bytes& content)
     assert(size < 0x80);
     return bytes{id, static_cast<uint8_t>(size)} + content;
 }
+
+/// Returns the wasm prefix followed by the type and function sections declaring
+/// the given number of functions of type [] -> [] to be matched by the code section.
+bytes make_void_functions_prefix(uint8_t num_functions)
+{
+    const auto func_section = bytes{num_functions} + bytes(num_functions, 0x00);
+    return bytes{wasm_prefix} + make_section(1, make_vec({functype_void_to_void})) +
+           make_section(3, func_section);
+}
+
+/// Returns the code section of the given number of empty function bodies.
+bytes make_empty_code_section(uint8_t num_functions)
+{
+    auto section_contents = bytes{num_functions};
+    for (uint8_t i = 0; i < num_functions; ++i)
+        section_contents += "02000b"_bytes;
+    return make_section(10, section_contents);
+}
+
+/// The import of the immutable i32 global.
+const auto global_import = bytes{0x01, 'm', 0x01, 'g', 0x03, 0x7f, 0x00};
 }  // namespace
 
 TEST(parser, valtype)
@@ -123,6 +146,141 @@ TEST(parser, module_with_wrong_prefix)
         parse("006173d602000000"_bytes), parser_error, "invalid wasm module prefix");
 }
 
+TEST(parser, try_parse)
+{
+    Error error;
+    const auto module =
+        try_parse(bytes{wasm_prefix} + "010401600000030201000a040102000b"_bytes, error);
+    EXPECT_FALSE(error);
+    ASSERT_TRUE(module.has_value());
+    EXPECT_EQ(module->funcsec.size(), 1);
+
+    EXPECT_FALSE(try_parse("006173d6"_bytes, error).has_value());
+    EXPECT_EQ(error.code, ErrorCode::invalid_prefix);
+    EXPECT_EQ(error.offset, 0);
+    EXPECT_EQ(error_message(error), "invalid wasm module prefix");
+
+    // The section size missing.
+    EXPECT_FALSE(try_parse(bytes{wasm_prefix} + "01"_bytes, error).has_value());
+    EXPECT_EQ(error.code, ErrorCode::unexpected_eof);
+    EXPECT_EQ(error.offset, 9);
+
+    // The invalid parameter type 0x7b.
+    EXPECT_FALSE(try_parse(bytes{wasm_prefix} + "01050160017b00"_bytes, error).has_value());
+    EXPECT_EQ(error.code, ErrorCode::invalid_valtype);
+    EXPECT_EQ(error.offset, 13);
+    EXPECT_EQ(error.value, 0x7b);
+    EXPECT_EQ(error_message(error), "invalid valtype 123");
+
+    // The i64.eqz instruction at the offset 25 taking the i32 operand.
+    const auto body_invalid_type = "010401600000030201000a070105004100500b"_bytes;
+    EXPECT_FALSE(try_parse(bytes{wasm_prefix} + body_invalid_type, error).has_value());
+    EXPECT_EQ(error.code, ErrorCode::type_mismatch);
+    EXPECT_EQ(error.offset, 25);
+    EXPECT_FALSE(try_parse(bytes{wasm_prefix} + body_invalid_type, error, ParseMode::eager, 4));
+    EXPECT_EQ(error.code, ErrorCode::type_mismatch);
+    EXPECT_EQ(error.offset, 25);
+
+    // The errors found by the validation of the whole module are at the end of the input.
+    EXPECT_FALSE(try_parse(bytes{wasm_prefix} + "080105"_bytes, error).has_value());
+    EXPECT_EQ(error.code, ErrorCode::invalid_start_function_index);
+    EXPECT_EQ(error.offset, 11);
+
+    // The name of the invalid export points into the input.
+    const auto wasm_invalid_export =
+        bytes{wasm_prefix} + make_section(7, make_vec({bytes{0x01, 'm', 0x02, 0x00}}));
+    EXPECT_FALSE(try_parse(wasm_invalid_export, error).has_value());
+    EXPECT_EQ(error.code, ErrorCode::invalid_export_index);
+    EXPECT_EQ(error.offset, wasm_invalid_export.size());
+    EXPECT_EQ(error_message(error), "invalid index of export m");
+
+    // The exception carries the same error.
+    try
+    {
+        parse(bytes{wasm_prefix} + "01050160017b00"_bytes);
+        ADD_FAILURE();
+    }
+    catch (const parser_error& e)
+    {
+        EXPECT_EQ(e.error().code, ErrorCode::invalid_valtype);
+        EXPECT_EQ(e.error().value, 0x7b);
+        EXPECT_STREQ(e.what(), "invalid valtype 123");
+    }
+    EXPECT_THROW_MESSAGE(parse(wasm_invalid_export), std::runtime_error,
+        "invalid index of export m");
+}
+
+TEST(parser, try_parse_status_errors)
+{
+    // The errors reported by the status inside try_parse() are the same as thrown by parse().
+    const auto header = bytes{wasm_prefix} + "010401600000030201000a"_bytes;
+    const std::tuple<bytes, ErrorCode, size_t> cases[] = {
+        {"0061736d02000000"_bytes, ErrorCode::invalid_prefix, 0},
+        {bytes{wasm_prefix} + "0c00"_bytes, ErrorCode::unknown_section, 10},
+        {bytes{wasm_prefix} + "01ffffffffff0f"_bytes, ErrorCode::invalid_leb128, 14},
+        {bytes{wasm_prefix} + "01050160000000"_bytes, ErrorCode::invalid_section_size, 14},
+        {header + "05"_bytes, ErrorCode::unexpected_eof, 20},
+        {header + "050103ff"_bytes, ErrorCode::unexpected_eof, 20},
+        {header + "03018080"_bytes, ErrorCode::unexpected_eof, 23},
+        {header + "05010300ff0b"_bytes, ErrorCode::invalid_instruction, 23},
+        {header + "050103008b0b"_bytes, ErrorCode::floating_point_instruction, 23},
+        {header + "060104000b0000"_bytes, ErrorCode::malformed_function_size, 24},
+    };
+    for (const auto& [wasm, code, offset] : cases)
+    {
+        for (const auto num_threads : {1u, 4u})
+        {
+            Error error;
+            EXPECT_FALSE(try_parse(wasm, error, ParseMode::eager, num_threads).has_value());
+            EXPECT_EQ(error.code, code);
+            EXPECT_EQ(error.offset, offset);
+
+            try
+            {
+                parse(wasm, ParseMode::eager, num_threads);
+                ADD_FAILURE();
+            }
+            catch (const parser_error& e)
+            {
+                EXPECT_EQ(e.error().code, code);
+                EXPECT_EQ(e.position(), wasm.data() + offset);
+                EXPECT_EQ(e.what(), error_message(error));
+            }
+        }
+    }
+}
+
+TEST(parser, error_message_threads)
+{
+    // The message is built once, while what() is called by many threads.
+    const auto error = std::make_exception_ptr(parser_error{ErrorCode::invalid_valtype, 0x7b});
+    std::vector<std::thread> threads;
+    std::vector<std::string> messages(4);
+    for (auto& message : messages)
+    {
+        threads.emplace_back([&error, &message] {
+            try
+            {
+                std::rethrow_exception(error);
+            }
+            catch (const parser_error& e)
+            {
+                message = e.what();
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    for (const auto& message : messages)
+        EXPECT_EQ(message, "invalid valtype 123");
+
+    // The copy has the same message.
+    const parser_error original{ErrorCode::invalid_valtype, 0x7b};
+    const auto copy = original;
+    EXPECT_STREQ(copy.what(), "invalid valtype 123");
+    EXPECT_STREQ(original.what(), "invalid valtype 123");
+}
+
 TEST(parser, section_vec_size_out_of_bounds)
 {
     const auto malformed_vec_size = "81"_bytes;
@@ -141,6 +299,9 @@ TEST(parser, custom_section_empty)
     EXPECT_EQ(module.typesec.size(), 0);
     EXPECT_EQ(module.funcsec.size(), 0);
     EXPECT_EQ(module.codesec.size(), 0);
+    ASSERT_EQ(module.customsec.size(), 1);
+    EXPECT_EQ(module.customsec[0].name, "");
+    EXPECT_EQ(module.customsec[0].content, bytes{});
 }
 
 TEST(parser, custom_section_nonempty_name_only)
@@ -151,6 +312,9 @@ TEST(parser, custom_section_nonempty_name_only)
     EXPECT_EQ(module.typesec.size(), 0);
     EXPECT_EQ(module.funcsec.size(), 0);
     EXPECT_EQ(module.codesec.size(), 0);
+    ASSERT_EQ(module.customsec.size(), 1);
+    EXPECT_EQ(module.customsec[0].name, "abc");
+    EXPECT_EQ(module.customsec[0].content, bytes{});
 }
 
 TEST(parser, custom_section_nonempty)
@@ -162,6 +326,9 @@ TEST(parser, custom_section_nonempty)
     EXPECT_EQ(module.typesec.size(), 0);
     EXPECT_EQ(module.funcsec.size(), 0);
     EXPECT_EQ(module.codesec.size(), 0);
+    ASSERT_EQ(module.customsec.size(), 1);
+    EXPECT_EQ(module.customsec[0].name, "abc");
+    EXPECT_EQ(module.customsec[0].content, "0000112233445566778899000099"_bytes);
 }
 
 TEST(parser, custom_section_size_out_of_bounds)
@@ -299,31 +466,37 @@ TEST(parser, import_section_empty)
 
 TEST(parser, import_single_function)
 {
-    const auto section_contents = bytes{0x01, 0x03, 'm', 'o', 'd', 0x03, 'f', 'o', 'o', 0x00, 0x42};
-    const auto bin = bytes{wasm_prefix} + make_section(2, section_contents);
+    const auto section_contents = bytes{0x01, 0x03, 'm', 'o', 'd', 0x03, 'f', 'o', 'o', 0x00, 0x01};
+    const auto bin = bytes{wasm_prefix} +
+                     make_section(1, make_vec({functype_void_to_void, functype_i32_to_void})) +
+                     make_section(2, section_contents);
 
     const auto module = parse(bin);
     ASSERT_EQ(module.importsec.size(), 1);
     EXPECT_EQ(module.importsec[0].module, "mod");
     EXPECT_EQ(module.importsec[0].name, "foo");
     EXPECT_EQ(module.importsec[0].kind, ExternalKind::Function);
-    EXPECT_EQ(module.importsec[0].desc.function_type_index, 0x42);
+    EXPECT_EQ(module.importsec[0].desc.function_type_index, 1);
+
+    const auto bin_invalid_type = bytes{wasm_prefix} + make_section(2, section_contents);
+    EXPECT_THROW_MESSAGE(parse(bin_invalid_type), parser_error, "invalid function type index 1");
 }
 
 TEST(parser, import_multiple)
 {
-    const auto section_contents = make_vec({bytes{0x02, 'm', '1', 0x03, 'a', 'b', 'c', 0x00, 0x42},
+    const auto section_contents = make_vec({bytes{0x02, 'm', '1', 0x03, 'a', 'b', 'c', 0x00, 0x00},
         bytes{0x02, 'm', '2', 0x03, 'f', 'o', 'o', 0x02, 0x00, 0x7f},
-        bytes{0x02, 'm', '3', 0x03, 'b', 'a', 'r', 0x03, 0x7f, 0x00},
+        bytes{0x02, 'm', '3', 0x03, 'b', 'a', 'r', 0x03, 0x7e, 0x00},
         bytes{0x02, 'm', '4', 0x03, 't', 'a', 'b', 0x01, 0x70, 0x01, 0x01, 0x42}});
-    const auto bin = bytes{wasm_prefix} + make_section(2, section_contents);
+    const auto bin = bytes{wasm_prefix} + make_section(1, make_vec({functype_void_to_void})) +
+                     make_section(2, section_contents);
 
     const auto module = parse(bin);
     ASSERT_EQ(module.importsec.size(), 4);
     EXPECT_EQ(module.importsec[0].module, "m1");
     EXPECT_EQ(module.importsec[0].name, "abc");
     EXPECT_EQ(module.importsec[0].kind, ExternalKind::Function);
-    EXPECT_EQ(module.importsec[0].desc.function_type_index, 0x42);
+    EXPECT_EQ(module.importsec[0].desc.function_type_index, 0);
     EXPECT_EQ(module.importsec[1].module, "m2");
     EXPECT_EQ(module.importsec[1].name, "foo");
     EXPECT_EQ(module.importsec[1].kind, ExternalKind::Memory);
@@ -332,7 +505,8 @@ TEST(parser, import_multiple)
     EXPECT_EQ(module.importsec[2].module, "m3");
     EXPECT_EQ(module.importsec[2].name, "bar");
     EXPECT_EQ(module.importsec[2].kind, ExternalKind::Global);
-    EXPECT_FALSE(module.importsec[2].desc.global_mutable);
+    EXPECT_FALSE(module.importsec[2].desc.global.is_mutable);
+    EXPECT_EQ(module.importsec[2].desc.global.value_type, ValType::i64);
     EXPECT_EQ(module.importsec[3].module, "m4");
     EXPECT_EQ(module.importsec[3].name, "tab");
     EXPECT_EQ(module.importsec[3].kind, ExternalKind::Table);
@@ -409,22 +583,35 @@ TEST(parser, function_section_empty)
 TEST(parser, function_section_with_single_function)
 {
     const auto section_contents = "0100"_bytes;
-    const auto bin = bytes{wasm_prefix} + make_section(3, section_contents);
+    const auto bin = bytes{wasm_prefix} + make_section(1, make_vec({functype_void_to_void})) +
+                     make_section(3, section_contents) + make_empty_code_section(1);
     const auto module = parse(bin);
     ASSERT_EQ(module.funcsec.size(), 1);
     EXPECT_EQ(module.funcsec[0], 0);
+
+    const auto bin_no_type = bytes{wasm_prefix} + make_section(3, section_contents);
+    EXPECT_THROW_MESSAGE(parse(bin_no_type), parser_error, "invalid function type index 0");
+
+    const auto bin_no_code =
+        bytes{wasm_prefix} + make_section(1, make_vec({functype_void_to_void})) +
+        make_section(3, section_contents);
+    EXPECT_THROW_MESSAGE(parse(bin_no_code), parser_error,
+        "malformed code section: the number of bodies differs from functions");
 }
 
 TEST(parser, function_section_with_multiple_functions)
 {
-    const auto section_contents = "04000142ff01"_bytes;
-    const auto bin = bytes{wasm_prefix} + make_section(3, section_contents);
+    // The last index has the non-minimal encoding.
+    const auto section_contents = "040001018000"_bytes;
+    const auto bin = bytes{wasm_prefix} +
+                     make_section(1, make_vec({functype_void_to_void, functype_i32_to_void})) +
+                     make_section(3, section_contents) + make_empty_code_section(4);
     const auto module = parse(bin);
     ASSERT_EQ(module.funcsec.size(), 4);
     EXPECT_EQ(module.funcsec[0], 0);
     EXPECT_EQ(module.funcsec[1], 1);
-    EXPECT_EQ(module.funcsec[2], 0x42);
-    EXPECT_EQ(module.funcsec[3], 0xff);
+    EXPECT_EQ(module.funcsec[2], 1);
+    EXPECT_EQ(module.funcsec[3], 0);
 }
 
 TEST(parser, function_section_end_out_of_bounds)
@@ -567,7 +754,9 @@ TEST(parser, global_single_mutable_const_inited)
 TEST(parser, global_single_const_global_inited)
 {
     const auto section_contents = bytes{0x01, 0x7f, 0x00, uint8_t(Instr::global_get), 0x01, 0x0b};
-    const auto bin = bytes{wasm_prefix} + make_section(6, section_contents);
+    const auto import_section = make_vec({global_import, global_import});
+    const auto bin =
+        bytes{wasm_prefix} + make_section(2, import_section) + make_section(6, section_contents);
 
     const auto module = parse(bin);
     ASSERT_EQ(module.globalsec.size(), 1);
@@ -579,14 +768,34 @@ TEST(parser, global_single_const_global_inited)
 TEST(parser, global_single_multi_instructions_inited)
 {
     const auto section_contents = bytes{
-        0x01, 0x7f, 0x01, uint8_t(Instr::i32_const), 0x10, uint8_t(Instr::i64_const), 0x7f, 0x0b};
+        0x01, 0x7f, 0x01, uint8_t(Instr::i32_const), 0x10, uint8_t(Instr::i32_const), 0x7f, 0x0b};
     const auto bin = bytes{wasm_prefix} + make_section(6, section_contents);
 
-    const auto module = parse(bin);
-    ASSERT_EQ(module.globalsec.size(), 1);
-    EXPECT_TRUE(module.globalsec[0].is_mutable);
-    EXPECT_EQ(module.globalsec[0].expression.kind, ConstantExpression::Kind::Constant);
-    EXPECT_EQ(module.globalsec[0].expression.value.constant, uint64_t(-1));
+    EXPECT_THROW_MESSAGE(
+        parse(bin), parser_error, "constant expression has more than one instruction");
+}
+
+TEST(parser, global_initializer_type_mismatch)
+{
+    // (global i64 (i32.const 0))
+    const auto wasm1 = bytes{wasm_prefix} + make_section(6, make_vec({"7e0041000b"_bytes}));
+    EXPECT_THROW_MESSAGE(parse(wasm1), parser_error, "constant expression type mismatch");
+
+    // (global i64 (global.get 0)) with the imported i32 global.
+    const auto wasm2 = bytes{wasm_prefix} + make_section(2, make_vec({global_import})) +
+                       make_section(6, make_vec({"7e0023000b"_bytes}));
+    EXPECT_THROW_MESSAGE(parse(wasm2), parser_error, "constant expression type mismatch");
+
+    // (global i32 (global.get 0)) with the imported mutable global.
+    const auto mutable_global_import = bytes{0x01, 'm', 0x01, 'g', 0x03, 0x7f, 0x01};
+    const auto wasm3 = bytes{wasm_prefix} + make_section(2, make_vec({mutable_global_import})) +
+                       make_section(6, make_vec({"7f0023000b"_bytes}));
+    EXPECT_THROW_MESSAGE(parse(wasm3), parser_error,
+        "constant expression can use global.get only for const globals");
+
+    // (global i32 (global.get 0)) without the imported globals.
+    const auto wasm4 = bytes{wasm_prefix} + make_section(6, make_vec({"7f0023000b"_bytes}));
+    EXPECT_THROW_MESSAGE(parse(wasm4), parser_error, "invalid global index in constant expression");
 }
 
 TEST(parser, global_multi_const_inited)
@@ -646,8 +855,8 @@ TEST(parser, global_constant_expression_out_of_bounds)
     const auto wasm3 = bytes{wasm_prefix} + make_section(6, make_vec({"7f004181"_bytes}));
     EXPECT_THROW_MESSAGE(parse(wasm3), parser_error, "Unexpected EOF");
 
-    // i32, immutable, i64_const, 0x808081, EOF.
-    const auto wasm4 = bytes{wasm_prefix} + make_section(6, make_vec({"7f0042808081"_bytes}));
+    // i64, immutable, i64_const, 0x808081, EOF.
+    const auto wasm4 = bytes{wasm_prefix} + make_section(6, make_vec({"7e0042808081"_bytes}));
     EXPECT_THROW_MESSAGE(parse(wasm4), parser_error, "Unexpected EOF");
 }
 
@@ -660,37 +869,62 @@ TEST(parser, export_section_empty)
 
 TEST(parser, export_single_function)
 {
-    const auto section_contents = make_vec({bytes{0x03, 'a', 'b', 'c', 0x00, 0x42}});
-    const auto bin = bytes{wasm_prefix} + make_section(7, section_contents);
+    const auto section_contents = make_vec({bytes{0x03, 'a', 'b', 'c', 0x00, 0x01}});
+    const auto bin = make_void_functions_prefix(2) + make_section(7, section_contents) +
+                     make_empty_code_section(2);
 
     const auto module = parse(bin);
     ASSERT_EQ(module.exportsec.size(), 1);
     EXPECT_EQ(module.exportsec[0].name, "abc");
     EXPECT_EQ(module.exportsec[0].kind, ExternalKind::Function);
-    EXPECT_EQ(module.exportsec[0].index, 0x42);
+    EXPECT_EQ(module.exportsec[0].index, 1);
+
+    const auto bin_invalid_index = make_void_functions_prefix(1) +
+                                   make_section(7, section_contents) + make_empty_code_section(1);
+    EXPECT_THROW_MESSAGE(parse(bin_invalid_index), parser_error, "invalid index of export abc");
 }
 
 TEST(parser, export_multiple)
 {
     const auto section_contents =
-        make_vec({bytes{0x03, 'a', 'b', 'c', 0x00, 0x42}, bytes{0x03, 'f', 'o', 'o', 0x01, 0x43},
-            bytes{0x03, 'b', 'a', 'r', 0x02, 0x44}, bytes{0x03, 'x', 'y', 'z', 0x03, 0x45}});
-    const auto bin = bytes{wasm_prefix} + make_section(7, section_contents);
+        make_vec({bytes{0x03, 'a', 'b', 'c', 0x00, 0x00}, bytes{0x03, 'f', 'o', 'o', 0x01, 0x00},
+            bytes{0x03, 'b', 'a', 'r', 0x02, 0x00}, bytes{0x03, 'x', 'y', 'z', 0x03, 0x01}});
+    const auto bin = make_void_functions_prefix(1) + make_section(4, make_vec({"700000"_bytes})) +
+                     make_section(5, make_vec({"0000"_bytes})) +
+                     make_section(6, make_vec({"7f0041000b"_bytes, "7e0042000b"_bytes})) +
+                     make_section(7, section_contents) + make_empty_code_section(1);
 
     const auto module = parse(bin);
     ASSERT_EQ(module.exportsec.size(), 4);
     EXPECT_EQ(module.exportsec[0].name, "abc");
     EXPECT_EQ(module.exportsec[0].kind, ExternalKind::Function);
-    EXPECT_EQ(module.exportsec[0].index, 0x42);
+    EXPECT_EQ(module.exportsec[0].index, 0);
     EXPECT_EQ(module.exportsec[1].name, "foo");
     EXPECT_EQ(module.exportsec[1].kind, ExternalKind::Table);
-    EXPECT_EQ(module.exportsec[1].index, 0x43);
+    EXPECT_EQ(module.exportsec[1].index, 0);
     EXPECT_EQ(module.exportsec[2].name, "bar");
     EXPECT_EQ(module.exportsec[2].kind, ExternalKind::Memory);
-    EXPECT_EQ(module.exportsec[2].index, 0x44);
+    EXPECT_EQ(module.exportsec[2].index, 0);
     EXPECT_EQ(module.exportsec[3].name, "xyz");
     EXPECT_EQ(module.exportsec[3].kind, ExternalKind::Global);
-    EXPECT_EQ(module.exportsec[3].index, 0x45);
+    EXPECT_EQ(module.exportsec[3].index, 1);
+}
+
+TEST(parser, export_invalid)
+{
+    // The memory and the global are not defined.
+    const auto wasm1 =
+        bytes{wasm_prefix} + make_section(7, make_vec({bytes{0x01, 'm', 0x02, 0x00}}));
+    EXPECT_THROW_MESSAGE(parse(wasm1), parser_error, "invalid index of export m");
+    const auto wasm2 = bytes{wasm_prefix} + make_section(2, make_vec({global_import})) +
+                       make_section(7, make_vec({bytes{0x01, 'g', 0x03, 0x01}}));
+    EXPECT_THROW_MESSAGE(parse(wasm2), parser_error, "invalid index of export g");
+
+    const auto wasm3 = make_void_functions_prefix(1) +
+                       make_section(7, make_vec({bytes{0x01, 'f', 0x00, 0x00},
+                                           bytes{0x01, 'f', 0x00, 0x00}})) +
+                       make_empty_code_section(1);
+    EXPECT_THROW_MESSAGE(parse(wasm3), parser_error, "duplicate export name");
 }
 
 TEST(parser, export_invalid_kind)
@@ -716,22 +950,29 @@ TEST(parser, export_name_out_of_bounds)
 
 TEST(parser, start)
 {
-    const auto func_section = make_vec({"00"_bytes, "00"_bytes});
     const auto start_section = "01"_bytes;
-    const auto bin =
-        bytes{wasm_prefix} + make_section(3, func_section) + make_section(8, start_section);
+    const auto bin = make_void_functions_prefix(2) + make_section(8, start_section) +
+                     make_empty_code_section(2);
 
     const auto module = parse(bin);
     EXPECT_TRUE(module.startfunc);
     EXPECT_EQ(*module.startfunc, 1);
 }
 
+TEST(parser, start_invalid_type)
+{
+    const auto bin = bytes{wasm_prefix} + make_section(1, make_vec({functype_i32_to_void})) +
+                     make_section(3, make_vec({"00"_bytes})) + make_section(8, "00"_bytes) +
+                     make_empty_code_section(1);
+
+    EXPECT_THROW_MESSAGE(parse(bin), parser_error, "invalid start function type");
+}
+
 TEST(parser, start_invalid_index)
 {
-    const auto func_section = make_vec({"00"_bytes, "00"_bytes});
     const auto start_section = "02"_bytes;
-    const auto bin =
-        bytes{wasm_prefix} + make_section(3, func_section) + make_section(8, start_section);
+    const auto bin = make_void_functions_prefix(2) + make_section(8, start_section) +
+                     make_empty_code_section(2);
 
     EXPECT_THROW_MESSAGE(parse(bin), parser_error, "invalid start function index");
 }
@@ -747,11 +988,12 @@ TEST(parser, start_missing_funcsec)
 TEST(parser, start_module_with_imports)
 {
     const auto import_section =
-        make_vec({bytes{0x03, 'm', 'o', 'd', 0x03, 'f', 'o', 'o', 0x00, 0x42}});
+        make_vec({bytes{0x03, 'm', 'o', 'd', 0x03, 'f', 'o', 'o', 0x00, 0x00}});
     const auto func_section = make_vec({"00"_bytes, "00"_bytes});
     const auto start_section = "02"_bytes;
-    const auto bin = bytes{wasm_prefix} + make_section(2, import_section) +
-                     make_section(3, func_section) + make_section(8, start_section);
+    const auto bin = bytes{wasm_prefix} + make_section(1, make_vec({functype_void_to_void})) +
+                     make_section(2, import_section) + make_section(3, func_section) +
+                     make_section(8, start_section) + make_empty_code_section(2);
 
     const auto module = parse(bin);
     EXPECT_TRUE(module.startfunc);
@@ -761,11 +1003,12 @@ TEST(parser, start_module_with_imports)
 TEST(parser, start_module_with_imports_invalid_index)
 {
     const auto import_section =
-        make_vec({bytes{0x03, 'm', 'o', 'd', 0x03, 'f', 'o', 'o', 0x00, 0x42}});
+        make_vec({bytes{0x03, 'm', 'o', 'd', 0x03, 'f', 'o', 'o', 0x00, 0x00}});
     const auto func_section = make_vec({"00"_bytes, "00"_bytes});
     const auto start_section = "03"_bytes;
-    const auto bin = bytes{wasm_prefix} + make_section(2, import_section) +
-                     make_section(3, func_section) + make_section(8, start_section);
+    const auto bin = bytes{wasm_prefix} + make_section(1, make_vec({functype_void_to_void})) +
+                     make_section(2, import_section) + make_section(3, func_section) +
+                     make_section(8, start_section) + make_empty_code_section(2);
 
     EXPECT_THROW_MESSAGE(parse(bin), parser_error, "invalid start function index");
 }
@@ -786,29 +1029,41 @@ TEST(parser, element_section_empty)
 TEST(parser, element_section)
 {
     const auto table_contents = bytes{0x01, 0x70, 0x00, 0x7f};
-    const auto element_contents = make_vec({bytes{0x00, 0x41, 0x01, 0x0b, 0x02, 0x7f, 0x7f},
-        bytes{0x00, 0x41, 0x02, 0x0b, 0x02, 0x55, 0x55},
-        bytes{0x00, 0x23, 0x00, 0x0b, 0x02, 0x24, 0x24}});
-    const auto bin =
-        bytes{wasm_prefix} + make_section(4, table_contents) + make_section(9, element_contents);
+    const auto element_contents = make_vec({bytes{0x00, 0x41, 0x01, 0x0b, 0x02, 0x02, 0x02},
+        bytes{0x00, 0x41, 0x02, 0x0b, 0x02, 0x01, 0x01},
+        bytes{0x00, 0x23, 0x00, 0x0b, 0x02, 0x00, 0x00}});
+    const auto bin = bytes{wasm_prefix} + make_section(1, make_vec({functype_void_to_void})) +
+                     make_section(2, make_vec({global_import})) +
+                     make_section(3, make_vec({"00"_bytes, "00"_bytes, "00"_bytes})) +
+                     make_section(4, table_contents) + make_section(9, element_contents) +
+                     make_empty_code_section(3);
 
     const auto module = parse(bin);
     ASSERT_EQ(module.elementsec.size(), 3);
     EXPECT_EQ(module.elementsec[0].offset.kind, ConstantExpression::Kind::Constant);
     EXPECT_EQ(module.elementsec[0].offset.value.constant, 1);
     ASSERT_EQ(module.elementsec[0].init.size(), 2);
-    EXPECT_EQ(module.elementsec[0].init[0], 0x7f);
-    EXPECT_EQ(module.elementsec[0].init[1], 0x7f);
+    EXPECT_EQ(module.elementsec[0].init[0], 2);
+    EXPECT_EQ(module.elementsec[0].init[1], 2);
     EXPECT_EQ(module.elementsec[1].offset.kind, ConstantExpression::Kind::Constant);
     EXPECT_EQ(module.elementsec[1].offset.value.constant, 2);
     ASSERT_EQ(module.elementsec[1].init.size(), 2);
-    EXPECT_EQ(module.elementsec[1].init[0], 0x55);
-    EXPECT_EQ(module.elementsec[1].init[1], 0x55);
+    EXPECT_EQ(module.elementsec[1].init[0], 1);
+    EXPECT_EQ(module.elementsec[1].init[1], 1);
     EXPECT_EQ(module.elementsec[2].offset.kind, ConstantExpression::Kind::GlobalGet);
     EXPECT_EQ(module.elementsec[2].offset.value.global_index, 0);
     ASSERT_EQ(module.elementsec[2].init.size(), 2);
-    EXPECT_EQ(module.elementsec[2].init[0], 0x24);
-    EXPECT_EQ(module.elementsec[2].init[1], 0x24);
+    EXPECT_EQ(module.elementsec[2].init[0], 0);
+    EXPECT_EQ(module.elementsec[2].init[1], 0);
+}
+
+TEST(parser, element_section_invalid_function_index)
+{
+    const auto bin = make_void_functions_prefix(1) + make_section(4, make_vec({"700000"_bytes})) +
+                     make_section(9, make_vec({"0041000b0101"_bytes})) +
+                     make_empty_code_section(1);
+
+    EXPECT_THROW_MESSAGE(parse(bin), parser_error, "invalid function index in element section");
 }
 
 TEST(parser, element_section_tableidx_nonzero)
@@ -822,7 +1077,7 @@ TEST(parser, element_section_tableidx_nonzero)
 TEST(parser, element_section_no_table_section)
 {
     const auto wasm =
-        bytes{wasm_prefix} + make_section(9, make_vec({"000b"_bytes + make_vec({"00"_bytes})}));
+        bytes{wasm_prefix} + make_section(9, make_vec({"0041000b"_bytes + make_vec({"00"_bytes})}));
     EXPECT_THROW_MESSAGE(
         parse(wasm), parser_error, "element section encountered without a table section");
 }
@@ -838,7 +1093,7 @@ TEST(parser, code_locals)
 {
     const auto wasm_locals = "81017f"_bytes;  // 0x81 x i32.
     const auto wasm =
-        bytes{wasm_prefix} +
+        make_void_functions_prefix(1) +
         make_section(10, make_vec({add_size_prefix(make_vec({wasm_locals}) + "0b"_bytes)}));
 
     const auto module = parse(wasm);
@@ -853,7 +1108,7 @@ TEST(parser, code_locals_2)
     const auto wasm_locals3 = "037e"_bytes;  // 3 x i64.
     const auto wasm_locals4 = "047e"_bytes;  // 4 x i64.
     const auto wasm =
-        bytes{wasm_prefix} +
+        make_void_functions_prefix(1) +
         make_section(10,
             make_vec({add_size_prefix(
                 make_vec({wasm_locals1, wasm_locals2, wasm_locals3, wasm_locals4}) + "0b"_bytes)}));
@@ -867,7 +1122,7 @@ TEST(parser, code_locals_invalid_type)
 {
     const auto wasm_locals = "017b"_bytes;  // 1 x <invalid_type>.
     const auto wasm =
-        bytes{wasm_prefix} +
+        make_void_functions_prefix(1) +
         make_section(10, make_vec({add_size_prefix(make_vec({wasm_locals}) + "0b"_bytes)}));
 
     EXPECT_THROW_MESSAGE(parse(wasm), parser_error, "invalid valtype 123");
@@ -882,8 +1137,8 @@ TEST(parser, code_locals_too_many)
              make_vec({large_num + "7f"_bytes, large_num + "7f"_bytes})   // large i32 + large i32
          })
     {
-        const auto wasm =
-            bytes{wasm_prefix} + make_section(10, make_vec({add_size_prefix(locals + "0b"_bytes)}));
+        const auto wasm = make_void_functions_prefix(1) +
+                          make_section(10, make_vec({add_size_prefix(locals + "0b"_bytes)}));
 
         EXPECT_THROW_MESSAGE(parse(wasm), parser_error, "too many local variables");
     }
@@ -894,7 +1149,7 @@ TEST(parser, code_with_empty_expr_2_locals)
     // Func with 2x i32 locals, only 0x0b "end" instruction.
     const auto func_2_locals_bin = "01027f0b"_bytes;
     const auto code_bin = add_size_prefix(func_2_locals_bin);
-    const auto wasm_bin = bytes{wasm_prefix} + make_section(10, make_vec({code_bin}));
+    const auto wasm_bin = make_void_functions_prefix(1) + make_section(10, make_vec({code_bin}));
 
     const auto module = parse(wasm_bin);
     ASSERT_EQ(module.codesec.size(), 1);
@@ -910,7 +1165,7 @@ TEST(parser, code_with_empty_expr_5_locals)
     // Func with 1x i64 + 4x i32 locals , only 0x0b "end" instruction.
     const auto func_5_locals_bin = "02017f047e0b"_bytes;
     const auto code_bin = add_size_prefix(func_5_locals_bin);
-    const auto wasm_bin = bytes{wasm_prefix} + make_section(10, make_vec({code_bin}));
+    const auto wasm_bin = make_void_functions_prefix(1) + make_section(10, make_vec({code_bin}));
 
     const auto module = parse(wasm_bin);
     ASSERT_EQ(module.codesec.size(), 1);
@@ -926,10 +1181,10 @@ TEST(parser, code_section_with_2_trivial_codes)
     const auto func_nolocals_bin = "000b"_bytes;
     const auto code_bin = add_size_prefix(func_nolocals_bin);
     const auto section_contents = make_vec({code_bin, code_bin});
-    const auto bin = bytes{wasm_prefix} + make_section(10, section_contents);
+    const auto bin = make_void_functions_prefix(2) + make_section(10, section_contents);
 
     const auto module = parse(bin);
-    EXPECT_EQ(module.typesec.size(), 0);
+    EXPECT_EQ(module.typesec.size(), 1);
     ASSERT_EQ(module.codesec.size(), 2);
     EXPECT_EQ(module.codesec[0].local_count, 0);
     ASSERT_EQ(module.codesec[0].instructions.size(), 1);
@@ -942,51 +1197,57 @@ TEST(parser, code_section_with_2_trivial_codes)
 TEST(parser, code_section_with_basic_instructions)
 {
     const auto func_bin =
-        "00"  // vec(locals)
-        "2001210222036a01000b"_bytes;
+        "01047f"  // vec(locals): 4 x i32.
+        "2001220245220321010100"
+        "0b"_bytes;
     const auto code_bin = add_size_prefix(func_bin);
     const auto section_contents = make_vec({code_bin});
-    const auto bin = bytes{wasm_prefix} + make_section(10, section_contents);
+    const auto bin = make_void_functions_prefix(1) + make_section(10, section_contents);
 
     const auto module = parse(bin);
-    EXPECT_EQ(module.typesec.size(), 0);
+    EXPECT_EQ(module.typesec.size(), 1);
     ASSERT_EQ(module.codesec.size(), 1);
-    EXPECT_EQ(module.codesec[0].local_count, 0);
-    ASSERT_EQ(module.codesec[0].instructions.size(), 7);
+    EXPECT_EQ(module.codesec[0].local_count, 4);
+    ASSERT_EQ(module.codesec[0].instructions.size(), 8);
     EXPECT_EQ(module.codesec[0].instructions[0], Instr::local_get);
-    EXPECT_EQ(module.codesec[0].instructions[1], Instr::local_set);
-    EXPECT_EQ(module.codesec[0].instructions[2], Instr::local_tee);
-    EXPECT_EQ(module.codesec[0].instructions[3], Instr::i32_add);
-    EXPECT_EQ(module.codesec[0].instructions[4], Instr::nop);
-    EXPECT_EQ(module.codesec[0].instructions[5], Instr::unreachable);
-    EXPECT_EQ(module.codesec[0].instructions[6], Instr::end);
-    ASSERT_EQ(module.codesec[0].immediates.size(), 3 * 4);
-    EXPECT_EQ(module.codesec[0].immediates, "010000000200000003000000"_bytes);
+    EXPECT_EQ(module.codesec[0].instructions[1], Instr::local_tee);
+    EXPECT_EQ(module.codesec[0].instructions[2], Instr::i32_eqz);
+    EXPECT_EQ(module.codesec[0].instructions[3], Instr::local_tee);
+    EXPECT_EQ(module.codesec[0].instructions[4], Instr::local_set);
+    EXPECT_EQ(module.codesec[0].instructions[5], Instr::nop);
+    EXPECT_EQ(module.codesec[0].instructions[6], Instr::unreachable);
+    EXPECT_EQ(module.codesec[0].instructions[7], Instr::end);
+    ASSERT_EQ(module.codesec[0].immediates.size(), 4 * 4);
+    EXPECT_EQ(module.codesec[0].immediates, "01000000020000000300000001000000"_bytes);
 }
 
 TEST(parser, code_section_with_memory_size)
 {
     const auto func_bin =
         "00"  // vec(locals)
-        "3f000b"_bytes;
+        "3f001a0b"_bytes;
     const auto code_bin = add_size_prefix(func_bin);
     const auto section_contents = make_vec({code_bin});
-    const auto bin = bytes{wasm_prefix} + make_section(10, section_contents);
+    const auto memory_section = make_section(5, make_vec({"0000"_bytes}));
+    const auto bin =
+        make_void_functions_prefix(1) + memory_section + make_section(10, section_contents);
 
     const auto module = parse(bin);
     ASSERT_EQ(module.codesec.size(), 1);
     EXPECT_EQ(module.codesec[0].local_count, 0);
-    ASSERT_EQ(module.codesec[0].instructions.size(), 2);
+    ASSERT_EQ(module.codesec[0].instructions.size(), 3);
     EXPECT_EQ(module.codesec[0].instructions[0], Instr::memory_size);
-    EXPECT_EQ(module.codesec[0].instructions[1], Instr::end);
+    EXPECT_EQ(module.codesec[0].instructions[1], Instr::drop);
+    EXPECT_EQ(module.codesec[0].instructions[2], Instr::end);
     EXPECT_TRUE(module.codesec[0].immediates.empty());
 
     const auto func_bin_invalid =
         "00"  // vec(locals)
-        "3f010b"_bytes;
+        "3f011a0b"_bytes;
     const auto code_bin_invalid = add_size_prefix(func_bin_invalid);
     const auto section_contents_invalid = make_vec({code_bin_invalid});
-    const auto bin_invalid = bytes{wasm_prefix} + make_section(10, section_contents_invalid);
+    const auto bin_invalid = make_void_functions_prefix(1) + memory_section +
+                             make_section(10, section_contents_invalid);
 
     EXPECT_THROW_MESSAGE(parse(bin_invalid), parser_error, "invalid memory index encountered");
 }
@@ -998,7 +1259,9 @@ TEST(parser, code_section_with_memory_grow)
         "410040001a0b"_bytes;
     const auto code_bin = add_size_prefix(func_bin);
     const auto section_contents = make_vec({code_bin});
-    const auto bin = bytes{wasm_prefix} + make_section(10, section_contents);
+    const auto memory_section = make_section(5, make_vec({"0000"_bytes}));
+    const auto bin =
+        make_void_functions_prefix(1) + memory_section + make_section(10, section_contents);
 
     const auto module = parse(bin);
     ASSERT_EQ(module.codesec.size(), 1);
@@ -1015,7 +1278,8 @@ TEST(parser, code_section_with_memory_grow)
         "410040011a0b"_bytes;
     const auto code_bin_invalid = add_size_prefix(func_bin_invalid);
     const auto section_contents_invalid = make_vec({code_bin_invalid});
-    const auto bin_invalid = bytes{wasm_prefix} + make_section(10, section_contents_invalid);
+    const auto bin_invalid = make_void_functions_prefix(1) + memory_section +
+                             make_section(10, section_contents_invalid);
 
     EXPECT_THROW_MESSAGE(parse(bin_invalid), parser_error, "invalid memory index encountered");
 }
@@ -1034,7 +1298,7 @@ TEST(parser, code_section_unsupported_fp_instructions)
                               + bytes{instr};
         const auto code_bin = add_size_prefix(func_bin);
         const auto section_contents = make_vec({code_bin});
-        const auto bin = bytes{wasm_prefix} + make_section(10, section_contents);
+        const auto bin = make_void_functions_prefix(1) + make_section(10, section_contents);
 
         const auto expected_msg =
             std::string{"unsupported floating point instruction "} + std::to_string(instr);
@@ -1057,7 +1321,7 @@ TEST(parser, code_section_invalid_instructions)
                               + bytes{instr};
         const auto code_bin = add_size_prefix(func_bin);
         const auto section_contents = make_vec({code_bin});
-        const auto bin = bytes{wasm_prefix} + make_section(10, section_contents);
+        const auto bin = make_void_functions_prefix(1) + make_section(10, section_contents);
 
         const auto expected_msg = std::string{"invalid instruction "} + std::to_string(instr);
         EXPECT_THROW_MESSAGE(parse(bin), parser_error, expected_msg.c_str());
@@ -1072,7 +1336,7 @@ TEST(parser, code_section_size_too_small)
         "0101010b"_bytes;
     const auto code_bin = "04"_bytes + func_bin;
     const auto section_contents = make_vec({code_bin});
-    const auto bin = bytes{wasm_prefix} + make_section(10, section_contents);
+    const auto bin = make_void_functions_prefix(1) + make_section(10, section_contents);
 
     EXPECT_THROW_MESSAGE(parse(bin), parser_error, "malformed size field for function");
 }
@@ -1085,11 +1349,190 @@ TEST(parser, code_section_size_too_large)
         "0101010b"_bytes;
     const auto code_bin = "06"_bytes + func_bin;
     const auto section_contents = make_vec({code_bin});
-    const auto bin = bytes{wasm_prefix} + make_section(10, section_contents);
+    const auto bin = make_void_functions_prefix(1) + make_section(10, section_contents);
 
     EXPECT_THROW_MESSAGE(parse(bin), parser_error, "malformed size field for function");
 }
 
+TEST(parser, code_section_lazy)
+{
+    const auto code1_bin = add_size_prefix(
+        "01047f"  // vec(locals): 4 x i32.
+        "20012202452203210101000b"_bytes);
+    const auto code2_bin = add_size_prefix(
+        "01017f"  // vec(locals): 1 x i32.
+        "3f0021000b"_bytes);
+    const auto bin = make_void_functions_prefix(2) + make_section(5, make_vec({"0000"_bytes})) +
+                     make_section(10, make_vec({code1_bin, code2_bin}));
+
+    const auto eager = parse(bin);
+    EXPECT_EQ(eager.lazy_codesec, nullptr);
+    const auto module = parse(bin, ParseMode::lazy);
+    EXPECT_TRUE(module.codesec.empty());
+    ASSERT_NE(module.lazy_codesec, nullptr);
+    ASSERT_EQ(get_code_count(module), 2);
+    EXPECT_FALSE(module.lazy_codesec->parsed[0]);
+    EXPECT_FALSE(module.lazy_codesec->parsed[1]);
+
+    // Only the used body is parsed, and only once.
+    const auto& code = get_code(module, 1);
+    EXPECT_FALSE(module.lazy_codesec->parsed[0]);
+    EXPECT_TRUE(module.lazy_codesec->parsed[1]);
+    EXPECT_EQ(&get_code(module, 1), &code);
+
+    // The copies of the module share the parsed bodies.
+    const auto copy = module;
+    EXPECT_EQ(&get_code(copy, 1), &code);
+
+    for (size_t code_idx = 0; code_idx < 2; ++code_idx)
+    {
+        const auto& expected = eager.codesec[code_idx];
+        const auto& actual = get_code(module, code_idx);
+        EXPECT_EQ(actual.local_count, expected.local_count);
+        EXPECT_EQ(actual.instructions, expected.instructions);
+        EXPECT_EQ(actual.immediates, expected.immediates);
+        EXPECT_EQ(actual.max_stack_height, expected.max_stack_height);
+    }
+}
+
+TEST(parser, code_section_lazy_invalid_body)
+{
+    const auto invalid_code_bin = add_size_prefix(
+        "00"  // vec(locals)
+        "060b"_bytes);
+    const auto code_bin = add_size_prefix(
+        "00"  // vec(locals)
+        "0b"_bytes);
+    const auto bin =
+        make_void_functions_prefix(2) + make_section(10, make_vec({invalid_code_bin, code_bin}));
+
+    EXPECT_THROW_MESSAGE(parse(bin), parser_error, "invalid instruction 6");
+
+    // The invalid body is reported on every use.
+    const auto module = parse(bin, ParseMode::lazy);
+    EXPECT_THROW_MESSAGE(get_code(module, 0), parser_error, "invalid instruction 6");
+    EXPECT_THROW_MESSAGE(get_code(module, 0), parser_error, "invalid instruction 6");
+    EXPECT_FALSE(module.lazy_codesec->parsed[0]);
+    EXPECT_EQ(get_code(module, 1).instructions, std::vector{Instr::end});
+
+    // The body size not matching the body is reported when the body is parsed.
+    // The first body is "00010101 0b", but its size is 3 and the split puts "010b" in the second.
+    const auto size_too_small_bin = make_void_functions_prefix(2) +
+                                    make_section(10, make_vec({"03000101"_bytes, "010b"_bytes}));
+    const auto size_too_small = parse(size_too_small_bin, ParseMode::lazy);
+    EXPECT_THROW_MESSAGE(
+        get_code(size_too_small, 0), parser_error, "malformed size field for function");
+
+    // The body not fitting the section is reported by the parser.
+    const auto out_of_bounds_bin =
+        make_void_functions_prefix(1) + make_section(10, make_vec({"06000101010b"_bytes}));
+    EXPECT_THROW_MESSAGE(
+        parse(out_of_bounds_bin, ParseMode::lazy), parser_error, "Unexpected EOF");
+}
+
+TEST(parser, code_section_lazy_concurrently)
+{
+    constexpr uint8_t num_functions = 8;
+    const auto code_bin = add_size_prefix(
+        "00"  // vec(locals)
+        "0240410141026a1a0b0b"_bytes);
+    auto section_contents = bytes{num_functions};
+    for (size_t i = 0; i < num_functions; ++i)
+        section_contents += code_bin;
+    const auto bin = make_void_functions_prefix(num_functions) + make_section(10, section_contents);
+    const auto module = parse(bin, ParseMode::lazy);
+
+    std::vector<std::thread> threads;
+    std::vector<std::vector<const Code*>> codes(8);
+    for (auto& thread_codes : codes)
+    {
+        threads.emplace_back([&module, &thread_codes] {
+            for (size_t code_idx = 0; code_idx < num_functions; ++code_idx)
+                thread_codes.push_back(&get_code(module, code_idx));
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    const auto eager = parse(bin);
+    for (const auto& thread_codes : codes)
+    {
+        for (size_t code_idx = 0; code_idx < num_functions; ++code_idx)
+        {
+            EXPECT_EQ(thread_codes[code_idx], codes[0][code_idx]);
+            EXPECT_EQ(thread_codes[code_idx]->instructions, eager.codesec[code_idx].instructions);
+            EXPECT_EQ(thread_codes[code_idx]->immediates, eager.codesec[code_idx].immediates);
+        }
+    }
+}
+
+TEST(parser, code_section_parallel)
+{
+    const auto code1_bin = add_size_prefix(
+        "00"  // vec(locals)
+        "0240410141026a1a0b0b"_bytes);
+    const auto code2_bin = add_size_prefix(
+        "01017f"  // vec(locals): 1 x i32.
+        "20001a0b"_bytes);
+    auto section_contents = "0a"_bytes;
+    for (int i = 0; i < 5; ++i)
+        section_contents += code1_bin + code2_bin;
+    const auto bin = make_void_functions_prefix(10) + make_section(10, section_contents);
+
+    const auto expected = parse(bin);
+    for (const auto num_threads : {0u, 2u, 4u, 16u})
+    {
+        const auto module = parse(bin, ParseMode::eager, num_threads);
+        ASSERT_EQ(module.codesec.size(), expected.codesec.size());
+        for (size_t code_idx = 0; code_idx < module.codesec.size(); ++code_idx)
+        {
+            const auto& code = module.codesec[code_idx];
+            EXPECT_EQ(code.local_count, expected.codesec[code_idx].local_count);
+            EXPECT_EQ(code.instructions, expected.codesec[code_idx].instructions);
+            EXPECT_EQ(code.immediates, expected.codesec[code_idx].immediates);
+            EXPECT_EQ(code.max_stack_height, expected.codesec[code_idx].max_stack_height);
+        }
+    }
+}
+
+TEST(parser, code_section_parallel_errors)
+{
+    const auto code_bin = "0400010b0b"_bytes;         // vec(locals) nop end end
+    const auto invalid_bin = "0300060b"_bytes;        // vec(locals) <invalid instruction 6> end
+    const auto fp_bin = "0400430b0b"_bytes;           // vec(locals) f32.const end end
+    const auto too_small_bin = "03000101010b"_bytes;  // The real size is 5.
+    const auto too_large_bin = "0600010b0b"_bytes;    // The real size is 4, exceeds the input.
+    const auto malformed_size_bin = "80"_bytes;
+
+    const std::vector<std::vector<bytes>> sections = {
+        {code_bin, invalid_bin, code_bin, fp_bin},
+        {code_bin, code_bin, fp_bin, invalid_bin},
+        {code_bin, too_small_bin, code_bin, invalid_bin},
+        {code_bin, code_bin, code_bin, too_large_bin},
+        {code_bin, code_bin, code_bin, malformed_size_bin},
+        {code_bin, code_bin, code_bin},
+    };
+    for (const auto& codes : sections)
+    {
+        auto section_contents = bytes{static_cast<uint8_t>(4)};
+        for (const auto& code : codes)
+            section_contents += code;
+        const auto bin = make_void_functions_prefix(4) + make_section(10, section_contents);
+
+        std::string expected_msg;
+        try
+        {
+            parse(bin);
+        }
+        catch (const parser_error& error)
+        {
+            expected_msg = error.what();
+        }
+        ASSERT_FALSE(expected_msg.empty());
+        EXPECT_THROW_MESSAGE(parse(bin, ParseMode::eager, 4), parser_error, expected_msg.c_str());
+    }
+}
+
 TEST(parser, data_section_empty)
 {
     const auto bin = bytes{wasm_prefix} + make_section(11, make_vec({}));
@@ -1101,7 +1544,8 @@ TEST(parser, data_section)
 {
     const auto section_contents =
         make_vec({"0041010b02aaff"_bytes, "0041020b025555"_bytes, "0023000b022424"_bytes});
-    const auto bin = bytes{wasm_prefix} + make_section(11, section_contents);
+    const auto bin = bytes{wasm_prefix} + make_section(2, make_vec({global_import})) +
+                     make_section(5, make_vec({"0000"_bytes})) + make_section(11, section_contents);
 
     const auto module = parse(bin);
     ASSERT_EQ(module.datasec.size(), 3);
@@ -1114,6 +1558,11 @@ TEST(parser, data_section)
     EXPECT_EQ(module.datasec[2].offset.kind, ConstantExpression::Kind::GlobalGet);
     EXPECT_EQ(module.datasec[2].offset.value.global_index, 0);
     EXPECT_EQ(module.datasec[2].init, "2424"_bytes);
+
+    const auto bin_no_memory = bytes{wasm_prefix} + make_section(2, make_vec({global_import})) +
+                               make_section(11, section_contents);
+    EXPECT_THROW_MESSAGE(
+        parse(bin_no_memory), parser_error, "data section encountered without a memory section");
 }
 
 TEST(parser, data_section_memidx_nonzero)
@@ -1151,6 +1600,97 @@ TEST(parser, interleaved_custom_section)
     EXPECT_EQ(module.typesec.size(), 1);
     EXPECT_EQ(module.funcsec.size(), 1);
     EXPECT_EQ(module.codesec.size(), 1);
+    ASSERT_EQ(module.customsec.size(), 3);
+    EXPECT_EQ(module.customsec[0].name, "\xaa");
+    EXPECT_EQ(module.customsec[1].name, "\xbb");
+    EXPECT_EQ(module.customsec[2].name, "\xcc");
+}
+
+TEST(parser, referencing_input)
+{
+    /* wat2wasm
+    (import "mod" "f" (func))
+    (memory 1)
+    (export "m" (memory 0))
+    (data (i32.const 0) "\2a\2b")
+    */
+    // With the custom section "abc" with content "ff" added.
+    const auto wasm = from_hex(
+        "0061736d010000000005036162637f010401600000020901036d6f64016600000503010001070501"
+        "016d02000b08010041000b022a2b");
+    const auto contains = [](bytes_view buffer, auto view) {
+        const auto* const data = reinterpret_cast<const uint8_t*>(view.data());
+        return data >= buffer.data() && data + view.size() <= buffer.data() + buffer.size();
+    };
+
+    const auto referencing = parse_referencing(wasm);
+    EXPECT_TRUE(referencing.buffers.empty());
+    ASSERT_EQ(referencing.importsec.size(), 1);
+    EXPECT_EQ(referencing.importsec[0].module, "mod");
+    EXPECT_TRUE(contains(wasm, referencing.importsec[0].module));
+    EXPECT_EQ(referencing.importsec[0].name, "f");
+    EXPECT_TRUE(contains(wasm, referencing.importsec[0].name));
+    ASSERT_EQ(referencing.exportsec.size(), 1);
+    EXPECT_EQ(referencing.exportsec[0].name, "m");
+    EXPECT_TRUE(contains(wasm, referencing.exportsec[0].name));
+    ASSERT_EQ(referencing.datasec.size(), 1);
+    EXPECT_EQ(referencing.datasec[0].init, "2a2b"_bytes);
+    EXPECT_TRUE(contains(wasm, referencing.datasec[0].init));
+    ASSERT_EQ(referencing.customsec.size(), 1);
+    EXPECT_EQ(referencing.customsec[0].name, "abc");
+    EXPECT_TRUE(contains(wasm, referencing.customsec[0].name));
+    EXPECT_EQ(referencing.customsec[0].content, "7f"_bytes);
+    EXPECT_TRUE(contains(wasm, referencing.customsec[0].content));
+
+    // The module owns the copies and outlives the input.
+    const auto module = parse(bytes{wasm});
+    ASSERT_EQ(module.buffers.size(), 1);
+    const auto& buffer = *module.buffers[0];
+    EXPECT_EQ(buffer, "6d6f6466"_bytes + "6d"_bytes + "2a2b"_bytes + "6162637f"_bytes);
+    EXPECT_EQ(module.importsec[0].module, "mod");
+    EXPECT_TRUE(contains(buffer, module.importsec[0].module));
+    EXPECT_EQ(module.importsec[0].name, "f");
+    EXPECT_TRUE(contains(buffer, module.importsec[0].name));
+    EXPECT_EQ(module.exportsec[0].name, "m");
+    EXPECT_TRUE(contains(buffer, module.exportsec[0].name));
+    EXPECT_EQ(module.datasec[0].init, "2a2b"_bytes);
+    EXPECT_TRUE(contains(buffer, module.datasec[0].init));
+    EXPECT_EQ(module.customsec[0].name, "abc");
+    EXPECT_TRUE(contains(buffer, module.customsec[0].name));
+    EXPECT_EQ(module.customsec[0].content, "7f"_bytes);
+    EXPECT_TRUE(contains(buffer, module.customsec[0].content));
+
+    // The copy of the module shares the buffer.
+    const auto copy = module;
+    EXPECT_EQ(copy.buffers, module.buffers);
+    EXPECT_EQ(copy.datasec[0].init.data(), module.datasec[0].init.data());
+}
+
+TEST(parser, copy_to_module)
+{
+    Module module;
+    EXPECT_TRUE(references_owned_data(module));
+
+    module.exportsec.push_back(
+        {copy_to_module(module, std::string{"f"}), ExternalKind::Function, 0});
+    module.datasec.push_back({{}, copy_to_module(module, bytes{0xaa, 0xff})});
+    module.customsec.push_back({copy_to_module(module, "abc"), {}});
+    ASSERT_EQ(module.buffers.size(), 3);
+    EXPECT_EQ(module.exportsec[0].name, "f");
+    EXPECT_EQ(module.datasec[0].init, "aaff"_bytes);
+    EXPECT_EQ(module.customsec[0].name, "abc");
+    EXPECT_TRUE(references_owned_data(module));
+
+    const auto content = "7f"_bytes;
+    module.customsec[0].content = content;
+    EXPECT_FALSE(references_owned_data(module));
+    copy_referenced_data(module);
+    EXPECT_EQ(module.buffers.size(), 1);
+    EXPECT_EQ(module.customsec[0].content, "7f"_bytes);
+    EXPECT_TRUE(references_owned_data(module));
+
+    const auto referencing = parse_referencing(from_hex("0061736d010000000005036162637f"));
+    EXPECT_FALSE(references_owned_data(referencing));
 }
 
 TEST(parser, milestone1)
@@ -1182,8 +1722,9 @@ TEST(parser, milestone1)
     const auto& c = m.codesec[0];
     EXPECT_EQ(c.local_count, 1);
     EXPECT_EQ(c.instructions,
-        (std::vector{Instr::local_get, Instr::local_get, Instr::i32_add, Instr::local_get,
-            Instr::i32_add, Instr::local_tee, Instr::local_get, Instr::i32_add, Instr::end}));
+        (std::vector{Instr::local_get_local_get, Instr::local_get, Instr::i32_add,
+            Instr::local_get, Instr::i32_add, Instr::local_tee, Instr::local_get, Instr::i32_add,
+            Instr::end}));
     EXPECT_EQ(c.immediates,
         "00000000"
         "01000000"
@@ -1191,3 +1732,106 @@ TEST(parser, milestone1)
         "02000000"
         "00000000"_bytes);
 }
+
+TEST(parser, streaming)
+{
+    /* wat2wasm
+    (type $t0 (func (param i32) (result i32)))
+    (import "env" "f" (func $f (type $t0)))
+    (import "env" "g" (global i32))
+    (table 2 funcref)
+    (memory 1 2)
+    (global $g1 (mut i32) (i32.const 5))
+    (export "f" (func 1))
+    (export "m" (memory 0))
+    (start 2)
+    (elem (i32.const 0) 1)
+    (data (i32.const 0) "\2a")
+    (func (type $t0)
+      local.get 0
+      (block (result i32) i32.const 1 br 0)
+      i32.add
+      global.get $g1
+      i32.add
+      call $f
+    )
+    (func i32.const 7 global.set $g1)
+    */
+    // With the custom section "abc" added.
+    const auto wasm = from_hex(
+        "0061736d0100000000070361626378797a01090260017f017f60000002120203656e760166000003656e7601"
+        "67037f0003030200010404017000020504010101020606017f0141050b07090201660001016d020008010209"
+        "07010041000b01010a1a0211002000027f41010c000b6a23016a10000b0600410724010b0b07010041000b01"
+        "2a");
+    // The modules are compared by their serialized form.
+    const auto expected = serialize_module(parse(wasm));
+
+    for (const auto mode : {ParseMode::eager, ParseMode::lazy})
+    {
+        for (const size_t chunk_size : {size_t{1}, size_t{2}, size_t{7}, wasm.size()})
+        {
+            StreamingParser parser{mode};
+            for (size_t pos = 0; pos < wasm.size(); pos += chunk_size)
+                parser.push(bytes_view{wasm}.substr(pos, chunk_size));
+            const auto module = parser.finish();
+            EXPECT_EQ(module.lazy_codesec != nullptr, mode == ParseMode::lazy);
+            EXPECT_EQ(serialize_module(module), expected);
+        }
+    }
+}
+
+TEST(parser, streaming_errors)
+{
+    {
+        StreamingParser parser;
+        parser.push("0061"_bytes);
+        EXPECT_THROW_MESSAGE(parser.push("72"_bytes), parser_error, "invalid wasm module prefix");
+    }
+    {
+        StreamingParser parser;
+        parser.push("0061"_bytes);
+        EXPECT_THROW_MESSAGE(parser.finish(), parser_error, "invalid wasm module prefix");
+    }
+    {
+        StreamingParser parser;
+        parser.push(bytes{wasm_prefix} + "0105"_bytes);
+        EXPECT_THROW_MESSAGE(parser.finish(), parser_error, "Unexpected EOF");
+    }
+    {
+        StreamingParser parser;
+        parser.push(bytes{wasm_prefix});
+        EXPECT_THROW_MESSAGE(
+            parser.push("0c00"_bytes), parser_error, "unknown section encountered 12");
+    }
+
+    // The invalid body is reported as soon as it is received, before the following bodies.
+    const auto code_bin = add_size_prefix("000b"_bytes);
+    const auto invalid_code_bin = add_size_prefix("00060b"_bytes);
+    const auto bin = make_void_functions_prefix(3) +
+                     make_section(10, make_vec({code_bin, invalid_code_bin, code_bin}));
+    EXPECT_THROW_MESSAGE(parse(bin), parser_error, "invalid instruction 6");
+    {
+        StreamingParser parser;
+        const auto invalid_code_end = bin.size() - code_bin.size();
+        parser.push(bin.substr(0, invalid_code_end - 1));
+        EXPECT_THROW_MESSAGE(parser.push(bin.substr(invalid_code_end - 1, 1)), parser_error,
+            "invalid instruction 6");
+    }
+
+    // The code section size not matching the bodies.
+    const auto too_small_bin = make_void_functions_prefix(1) +
+                               make_section(10, make_vec({code_bin})).substr(0, 1) + "03"_bytes +
+                               make_vec({code_bin}) + "00"_bytes;
+    {
+        StreamingParser parser;
+        EXPECT_THROW_MESSAGE(parser.push(too_small_bin), parser_error, "Unexpected EOF");
+    }
+    const auto too_large_bin = make_void_functions_prefix(1) +
+                               make_section(10, make_vec({code_bin})).substr(0, 1) + "05"_bytes +
+                               make_vec({code_bin}) + "00"_bytes;
+    {
+        StreamingParser parser;
+        EXPECT_THROW_MESSAGE(parser.push(too_large_bin), parser_error,
+            "incorrect section 10 size, difference: -1");
+    }
+}
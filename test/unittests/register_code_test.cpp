@@ -0,0 +1,72 @@
+#include "execute.hpp"
+#include "parser.hpp"
+#include "register_code.hpp"
+#include <gtest/gtest.h>
+#include <test/utils/hex.hpp>
+
+using namespace fizzy;
+
+TEST(register_code, locals_used_directly)
+{
+    /* wat2wasm
+    (func (param i32 i32) (result i32) (local i32)
+      local.get 0
+      local.get 1
+      i32.add
+      local.set 2
+      local.get 2
+    )
+    */
+    const auto wasm =
+        from_hex("0061736d0100000001070160027f7f017f030201000a0f010d01017f200020016a210220020b");
+    const auto module = parse(wasm);
+
+    const auto code = translate_to_register_code(module, 0);
+    ASSERT_EQ(code.instructions.size(), 2);
+    EXPECT_EQ(code.instructions[0].opcode, Instr::i32_add);
+    EXPECT_EQ(code.instructions[0].dst, 2);
+    EXPECT_EQ(code.instructions[0].a, 0);
+    EXPECT_EQ(code.instructions[0].b, 1);
+    EXPECT_EQ(code.instructions[1].opcode, Instr::return_);
+    EXPECT_EQ(code.instructions[1].a, 2);
+    EXPECT_EQ(code.instructions[1].c, 1);
+    EXPECT_TRUE(code.constants.empty());
+    EXPECT_EQ(code.constants_base, 3);
+    EXPECT_EQ(code.num_registers, 5);
+}
+
+TEST(register_code, constants)
+{
+    /* wat2wasm
+    (func (param i64) (result i64) (local i64)
+      i64.const 1
+      local.set 1
+      (block
+        (loop
+          local.get 0
+          i64.eqz
+          br_if 1
+          local.get 1
+          local.get 0
+          i64.mul
+          local.set 1
+          local.get 0
+          i64.const 1
+          i64.sub
+          local.set 0
+          br 0
+        )
+      )
+      local.get 1
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017e017e030201000a27012501017e42012101024003402000500d0120012000"
+        "7e2101200042017d21000c000b0b20010b");
+    const auto module = parse(wasm);
+
+    const auto code = translate_to_register_code(module, 0);
+    EXPECT_EQ(code.constants, std::vector<uint64_t>{1});
+    EXPECT_EQ(code.constants_base, 2);
+    EXPECT_EQ(code.instructions.size(), 7);
+}
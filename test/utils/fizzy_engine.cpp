@@ -8,27 +8,57 @@ namespace fizzy::test
 {
 class FizzyEngine : public WasmEngine
 {
+    std::shared_ptr<const Module> m_module;
     Instance m_instance;
+    Interpreter m_interpreter;
+    bool m_guarded_memory;
+    InstanceSnapshot m_snapshot;
 
 public:
+    explicit FizzyEngine(Interpreter interpreter, bool guarded_memory = false) noexcept
+      : m_interpreter{interpreter}, m_guarded_memory{guarded_memory}
+    {}
+
     bool parse(bytes_view input) final;
     std::optional<FuncRef> find_function(std::string_view name) const final;
     bool instantiate() final;
     bytes_view get_memory() const final;
     void set_memory(bytes_view memory) final;
+    void save_state() final;
+    void restore_state() final;
     Result execute(FuncRef func_ref, const std::vector<uint64_t>& args) final;
 };
 
 std::unique_ptr<WasmEngine> create_fizzy_engine()
 {
-    return std::make_unique<FizzyEngine>();
+    return std::make_unique<FizzyEngine>(Interpreter::stack);
+}
+
+std::unique_ptr<WasmEngine> create_fizzy_register_engine()
+{
+    return std::make_unique<FizzyEngine>(Interpreter::registers);
+}
+
+std::unique_ptr<WasmEngine> create_fizzy_jit_engine()
+{
+    return std::make_unique<FizzyEngine>(Interpreter::jit);
+}
+
+std::unique_ptr<WasmEngine> create_fizzy_tiered_engine()
+{
+    return std::make_unique<FizzyEngine>(Interpreter::tiered);
+}
+
+std::unique_ptr<WasmEngine> create_fizzy_jit_guarded_engine()
+{
+    return std::make_unique<FizzyEngine>(Interpreter::jit, true);
 }
 
 bool FizzyEngine::parse(bytes_view input)
 {
     try
     {
-        m_instance.module = fizzy::parse(input);
+        m_module = std::make_shared<const Module>(fizzy::parse(input));
     }
     catch (const fizzy::parser_error&)
     {
@@ -41,7 +71,10 @@ bool FizzyEngine::instantiate()
 {
     try
     {
-        m_instance = fizzy::instantiate(std::move(m_instance.module));
+        m_instance = fizzy::instantiate(m_module);
+        if (m_guarded_memory)
+            enable_guarded_memory(m_instance);
+        set_interpreter(m_instance, m_interpreter);
     }
     catch (const fizzy::instantiate_error&)
     {
@@ -64,20 +97,35 @@ void FizzyEngine::set_memory(bytes_view memory)
         return;
 
     assert(m_instance.memory != nullptr);
-    *m_instance.memory = memory;
+    [[maybe_unused]] const auto assigned = m_instance.memory->assign(memory);
+    assert(assigned);
+}
+
+void FizzyEngine::save_state()
+{
+    m_snapshot = take_snapshot(m_instance);
+}
+
+void FizzyEngine::restore_state()
+{
+    [[maybe_unused]] const auto restored = restore_snapshot(m_instance, m_snapshot);
+    assert(restored);
 }
 
 std::optional<WasmEngine::FuncRef> FizzyEngine::find_function(std::string_view name) const
 {
-    return fizzy::find_exported_function(m_instance.module, name);
+    return fizzy::find_exported_function(*m_module, name);
 }
 
 WasmEngine::Result FizzyEngine::execute(
     WasmEngine::FuncRef func_ref, const std::vector<uint64_t>& args)
 {
-    const auto [trapped, result_stack] =
-        fizzy::execute(m_instance, static_cast<uint32_t>(func_ref), args);
-    assert(result_stack.size() <= 1);
-    return {trapped, !result_stack.empty() ? result_stack.back() : std::optional<uint64_t>{}};
+    const auto func_idx = static_cast<uint32_t>(func_ref);
+    uint64_t result = 0;
+    const auto status = fizzy::execute(m_instance, func_idx, args, {&result, 1});
+    if (status != ExecutionStatus::success)
+        return {true, std::nullopt};
+    const bool has_result = m_instance.functions[func_idx].num_outputs != 0;
+    return {false, has_result ? result : std::optional<uint64_t>{}};
 }
 }  // namespace fizzy::test
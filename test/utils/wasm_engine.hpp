@@ -49,12 +49,28 @@ public:
     /// Requires instantiate().
     virtual void set_memory(bytes_view memory) = 0;
 
+    /// Captures the state of the internal instance to be restored by restore_state().
+    /// The default implementation captures the memory only.
+    /// Requires instantiate().
+    virtual void save_state() { m_saved_memory = bytes{get_memory()}; }
+
+    /// Restores the state of the internal instance captured by save_state().
+    /// Requires save_state().
+    virtual void restore_state() { set_memory(m_saved_memory); }
+
     /// Executes the function of the given index.
     /// Requires instantiate().
     virtual Result execute(FuncRef func_ref, const std::vector<uint64_t>& args) = 0;
+
+private:
+    bytes m_saved_memory;
 };
 
 std::unique_ptr<WasmEngine> create_fizzy_engine();
+std::unique_ptr<WasmEngine> create_fizzy_register_engine();
+std::unique_ptr<WasmEngine> create_fizzy_jit_engine();
+std::unique_ptr<WasmEngine> create_fizzy_tiered_engine();
+std::unique_ptr<WasmEngine> create_fizzy_jit_guarded_engine();
 std::unique_ptr<WasmEngine> create_wabt_engine();
 std::unique_ptr<WasmEngine> create_wasm3_engine();
 }  // namespace fizzy::test